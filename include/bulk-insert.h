@@ -0,0 +1,24 @@
+#ifndef BULK_INSERT_H
+#define BULK_INSERT_H
+
+#include <quickjs.h>
+#include <cutils.h>
+
+/**
+ * \defgroup bulk-insert bulk-insert: Batched INSERT statements for the SQL drivers
+ * @{
+ */
+#define BULK_INSERT_MAX_BYTES (1 << 20)
+
+typedef struct {
+  /* returns -1 on an exception */
+  int (*print_value)(JSContext*, JSValueConst conn, DynBuf*, JSValueConst value);
+  void (*print_identifier)(JSContext*, JSValueConst conn, DynBuf*, JSValueConst name);
+} BulkInsertDriver;
+
+JSValue js_bulkinsert(JSContext*, JSValueConst conn, int argc, JSValueConst argv[], const BulkInsertDriver*, size_t max_bytes, size_t limit);
+
+/**
+ * @}
+ */
+#endif /* defined(BULK_INSERT_H) */
@@ -0,0 +1,43 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <quickjs.h>
+#include <cutils.h>
+
+/**
+ * \defgroup columns columns: Conversion of query results
+ * @{
+ */
+typedef enum {
+  COLUMN_STRING = 0,
+  COLUMN_FLOAT64,
+  COLUMN_INT32,
+  COLUMN_BIGINT64,
+} ColumnType;
+
+/*
+ * Numeric columns collect their values in 'data', string columns their bytes,
+ * with the start of each row in 'offsets' (one more entry than rows). Bit i of
+ * 'nulls' is set when row i is NULL or could not be converted.
+ */
+typedef struct {
+  ColumnType type;
+  uint32_t rows;
+  BOOL has_nulls;
+  DynBuf data, offsets, nulls;
+} Column;
+
+void column_init(JSContext*, Column*, ColumnType);
+void column_free(Column*);
+int column_append(Column*, const char* buf, size_t len);
+JSValue column_value(JSContext*, Column*);
+int column_type_parse(const char*);
+int column_type_option(JSContext*, JSValueConst types, uint32_t index, const char* name);
+JSValue column_parse_number(JSContext*, const char*);
+BOOL column_parse_time(const char*, double* ms);
+JSValue column_parse_date(JSContext*, const char*);
+
+/**
+ * @}
+ */
+#endif /* defined(COLUMNS_H) */
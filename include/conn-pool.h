@@ -0,0 +1,28 @@
+#ifndef CONN_POOL_H
+#define CONN_POOL_H
+
+#include <quickjs.h>
+#include <cutils.h>
+#include "defines.h"
+
+/**
+ * \defgroup conn-pool conn-pool: Connection pool shared by the SQL drivers
+ * @{
+ */
+typedef struct {
+  JSClassID* class_id;
+  /* TRUE when an idle connection can be handed out again */
+  BOOL (*alive)(JSContext*, JSValueConst conn);
+} ConnPoolDriver;
+
+extern VISIBLE JSClassID js_connpool_class_id;
+extern VISIBLE JSValue connpool_proto;
+
+int js_connpool_init(JSContext*);
+JSValue js_connpool_new(JSContext*, JSValueConst new_target, int argc, JSValueConst argv[], const ConnPoolDriver*);
+BOOL connpool_socket_idle(int fd);
+
+/**
+ * @}
+ */
+#endif /* defined(CONN_POOL_H) */
@@ -0,0 +1,56 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * \defgroup http-parser http-parser: Incremental HTTP/1.x parser
+ * @{
+ */
+#define HTTP_MAX_HEADERS 100
+
+enum http_type {
+  HTTP_REQUEST = 0,
+  HTTP_RESPONSE = 1,
+};
+
+enum http_result {
+  HTTP_ERROR = -1,
+  HTTP_INCOMPLETE = -2,
+};
+
+/* all positions are byte offsets into the parsed buffer */
+typedef struct {
+  uint32_t name, name_len, value, value_len;
+} HttpHeader;
+
+typedef struct {
+  size_t bytes_left;
+  unsigned hex_count, state;
+  int consume_trailer;
+} HttpChunked;
+
+typedef struct http_parser {
+  enum http_type type;
+  size_t last_len;
+  uint32_t method, method_len, path, path_len;
+  uint32_t reason, reason_len;
+  int minor_version, status;
+  uint32_t num_headers;
+  HttpHeader headers[HTTP_MAX_HEADERS];
+  int64_t content_length;
+  int chunked, keep_alive;
+  HttpChunked chunk;
+} HttpParser;
+
+void http_parser_init(HttpParser*, enum http_type);
+int http_parse(HttpParser*, const uint8_t* buf, size_t len);
+ssize_t http_decode_chunked(HttpChunked*, uint8_t* buf, size_t* len);
+int http_header_find(const HttpParser*, const uint8_t* buf, const char* name, size_t name_len);
+
+/**
+ * @}
+ */
+#endif /* defined(HTTP_PARSER_H) */
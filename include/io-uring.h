@@ -0,0 +1,58 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#ifdef USE_IO_URING
+#include <quickjs.h>
+#include <list.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \defgroup io-uring io-uring: io_uring completion backend
+ * @{
+ */
+typedef struct io_ring {
+  int fd, eventfd;
+  unsigned sq_entries, cq_entries;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *sq_flags;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_size, cq_size, sqes_size;
+  unsigned sqe_tail, pending;
+  unsigned flushing : 1, armed : 1;
+} IORing;
+
+/* flags bit of a callback whose ring has been torn down: release opaque, do not call into JS */
+#define IO_RING_RELEASED (1u << 31)
+
+typedef void IORingCallback(JSContext*, int32_t res, uint32_t flags, void* opaque);
+
+int io_ring_init(IORing*, unsigned entries);
+void io_ring_free(IORing*);
+struct io_uring_sqe* io_ring_sqe(IORing*);
+int io_ring_submit(IORing*);
+struct io_uring_cqe* io_ring_peek(IORing*);
+void io_ring_seen(IORing*);
+int io_ring_overflow(IORing*);
+
+IORing* io_ring_get(JSContext*);
+struct io_uring_sqe* io_ring_prepare(JSContext*, IORingCallback*, void* opaque);
+
+static inline void
+io_ring_prep_rw(struct io_uring_sqe* sqe, int op, int fd, const void* addr, unsigned len, uint64_t off) {
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)addr;
+  sqe->len = len;
+  sqe->off = off;
+}
+
+/**
+ * @}
+ */
+#endif /* defined(USE_IO_URING) */
+
+#endif /* defined(IO_URING_H) */
@@ -0,0 +1,28 @@
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include <quickjs.h>
+#include <cutils.h>
+
+/**
+ * \defgroup query-stats query-stats: Per-query latency and row-count instrumentation for the SQL drivers
+ * @{
+ */
+#define QUERYSTATS_MAX_QUERIES 1000
+#define QUERYSTATS_SLOW_THRESHOLD 100
+
+typedef struct query_stats QueryStats;
+
+QueryStats* querystats_new(JSContext*, JSValueConst options);
+void querystats_free(JSRuntime*, QueryStats*);
+void querystats_begin(JSContext*, QueryStats*, const char* sql, size_t len);
+void querystats_sent(QueryStats*);
+void querystats_end(JSContext*, QueryStats*, int64_t rows, size_t received, BOOL error);
+void querystats_defer(QueryStats*, const void* key);
+void querystats_rows(QueryStats*, const void* key, uint64_t rows);
+JSValue querystats_snapshot(JSContext*, QueryStats*, BOOL reset);
+
+/**
+ * @}
+ */
+#endif /* defined(QUERY_STATS_H) */
@@ -49,6 +49,10 @@ ssize_t queue_peek(Queue*, void* x, size_t n);
 ssize_t queue_skip(Queue*, size_t n);
 Chunk* queue_next(Queue*);
 void queue_clear(Queue*);
+#ifndef _WIN32
+ssize_t queue_writev(Queue*, int fd, size_t max_chunks);
+ssize_t queue_readv(Queue*, int fd, size_t size);
+#endif
 
 static inline size_t
 queue_size(Queue* q) {
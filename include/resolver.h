@@ -0,0 +1,32 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#ifndef _WIN32
+#include <quickjs.h>
+#include <netdb.h>
+
+/**
+ * \defgroup resolver resolver: getaddrinfo() thread pool with cache
+ * @{
+ */
+#define RESOLVER_TTL 30000
+#define RESOLVER_NEGATIVE_TTL 5000
+
+/* result is only valid during the call */
+typedef void ResolverCallback(JSContext*, int error, const struct addrinfo* result, void* opaque);
+
+typedef struct {
+  /* getaddrinfo() calls, answers from the cache, lookups added to one in flight */
+  uint64_t queries, hits, coalesced;
+  uint32_t entries, pending;
+} ResolverStats;
+
+int resolver_lookup(JSContext*, const char* host, int family, ResolverCallback*, void* opaque);
+void resolver_stats(ResolverStats*);
+
+/**
+ * @}
+ */
+#endif /* !defined(_WIN32) */
+
+#endif /* defined(RESOLVER_H) */
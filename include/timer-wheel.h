@@ -0,0 +1,40 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <quickjs.h>
+#include <list.h>
+#include <stdint.h>
+
+/**
+ * \defgroup timer-wheel timer-wheel: Hierarchical timer wheel
+ * @{
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct timer_entry Timer;
+typedef void TimerFunc(JSContext*, Timer*);
+typedef void TimerReleaseFunc(JSRuntime*, Timer*);
+
+struct timer_entry {
+  struct list_head link;
+  uint64_t expires;
+  TimerFunc* func;
+  TimerReleaseFunc* release; /* called for timers still pending at runtime teardown */
+};
+
+void timer_init(Timer*, TimerFunc*);
+void timer_start(JSContext*, Timer*, uint32_t ms);
+void timer_stop(JSContext*, Timer*);
+uint64_t timer_now(void);
+
+static inline BOOL
+timer_pending(const Timer* t) {
+  return t->link.next != NULL;
+}
+
+/**
+ * @}
+ */
+#endif /* defined(TIMER_WHEEL_H) */
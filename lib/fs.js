@@ -359,6 +359,11 @@ export function mkdirSync(path, mode = 0o777) {
 
 export async function read(fd, buf, offset, length) {
   let ret;
+
+  /* io_uring fails O_NONBLOCK descriptors that are not ready with EAGAIN, these wait below */
+  if(typeof fd == 'number' && misc.readAsync && (ret = misc.readAsync(fd, buf, offset, length)))
+    if((ret = numerr(await ret)) != -1 || errno != EAGAIN) return ret;
+
   do {
     await waitRead(fd);
     errno = 0;
@@ -431,6 +436,10 @@ export function unlinkSync(path) {
 
 export async function write(fd, buf, offset, length) {
   let ret;
+
+  if(typeof fd == 'number' && misc.writeAsync && (ret = misc.writeAsync(fd, buf, offset, length)))
+    if((ret = numerr(await ret)) != -1 || errno != EWOULDBLOCK) return ret;
+
   do {
     await waitWrite(fd);
     errno = 0;
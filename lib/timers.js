@@ -1,28 +1,15 @@
-import { setTimeout, clearTimeout } from 'os';
-export { setTimeout, clearTimeout } from 'os';
+import { setTimer, clearTimer } from 'misc';
 
-const intervalId = (() => {
-    const u32 = new Uint32Array(1);
-    return () => u32[0]++;
-  })(),
-  intervalMap = {};
-
-export function setInterval(fn, t) {
-  let ret = intervalId();
-
-  function start() {
-    intervalMap[ret] = setTimeout(() => {
-      start();
-      fn();
-    }, t);
-  }
-
-  start();
+export function setTimeout(fn, t, ...args) {
+  return setTimer(args.length ? () => fn(...args) : fn, t);
+}
 
-  return ret;
+export function setInterval(fn, t, ...args) {
+  return setTimer(args.length ? () => fn(...args) : fn, t, true);
 }
 
-export function clearInterval(id) {
-  clearTimeout(intervalMap[id]);
-  delete intervalMap[id];
+export function clearTimeout(timer) {
+  if(timer) clearTimer(timer);
 }
+
+export const clearInterval = clearTimeout;
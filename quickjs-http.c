@@ -0,0 +1,368 @@
+#include "defines.h"
+#include "http-parser.h"
+#include "utils.h"
+#include "buffer-utils.h"
+
+/**
+ * \defgroup quickjs-http quickjs-http: HTTP/1.x parser
+ * @{
+ */
+VISIBLE JSClassID js_httpparser_class_id = 0;
+VISIBLE JSValue httpparser_proto, httpparser_ctor;
+
+typedef struct {
+  HttpParser parser;
+  JSValue buffer;
+  int64_t trailing;
+} JSHttpParser;
+
+enum {
+  HTTPPARSER_PARSE,
+  HTTPPARSER_HEADER,
+  HTTPPARSER_DECODE_CHUNKED,
+  HTTPPARSER_RESET,
+};
+
+enum {
+  HTTPPARSER_METHOD,
+  HTTPPARSER_PATH,
+  HTTPPARSER_REASON,
+  HTTPPARSER_STATUS,
+  HTTPPARSER_MINOR_VERSION,
+  HTTPPARSER_HEADERS,
+  HTTPPARSER_HEADER_COUNT,
+  HTTPPARSER_CONTENT_LENGTH,
+  HTTPPARSER_CHUNKED,
+  HTTPPARSER_KEEP_ALIVE,
+  HTTPPARSER_TRAILING,
+};
+
+static inline JSHttpParser*
+js_httpparser_data2(JSContext* ctx, JSValueConst value) {
+  return JS_GetOpaque2(ctx, value, js_httpparser_class_id);
+}
+
+/* creates a string from a span of the last parsed buffer */
+static JSValue
+js_httpparser_span(JSContext* ctx, JSHttpParser* hp, uint32_t offset, uint32_t length) {
+  InputBuffer input = js_input_buffer(ctx, hp->buffer);
+  JSValue ret = JS_UNDEFINED;
+
+  if(input.data && (size_t)offset + length <= input.size)
+    ret = JS_NewStringLen(ctx, (const char*)input.data + offset, length);
+
+  input_buffer_free(&input, ctx);
+  return ret;
+}
+
+static JSValue
+js_httpparser_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  JSValue proto, obj = JS_UNDEFINED;
+  JSHttpParser* hp;
+  int32_t type = HTTP_REQUEST;
+
+  if(argc > 0)
+    JS_ToInt32(ctx, &type, argv[0]);
+
+  if(!(hp = js_malloc(ctx, sizeof(JSHttpParser))))
+    return JS_ThrowOutOfMemory(ctx);
+
+  http_parser_init(&hp->parser, type == HTTP_RESPONSE ? HTTP_RESPONSE : HTTP_REQUEST);
+  hp->buffer = JS_UNDEFINED;
+  hp->trailing = -1;
+
+  /* using new_target to get the prototype is necessary when the class is extended. */
+  proto = JS_GetPropertyStr(ctx, new_target, "prototype");
+  if(JS_IsException(proto))
+    goto fail;
+
+  obj = JS_NewObjectProtoClass(ctx, proto, js_httpparser_class_id);
+  JS_FreeValue(ctx, proto);
+
+  if(JS_IsException(obj))
+    goto fail;
+
+  JS_SetOpaque(obj, hp);
+
+  return obj;
+
+fail:
+  js_free(ctx, hp);
+  JS_FreeValue(ctx, obj);
+  return JS_EXCEPTION;
+}
+
+static JSValue
+js_httpparser_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  JSHttpParser* hp;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(hp = js_httpparser_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  switch(magic) {
+    /* parse(buf, length?): length of the head, HttpParser.INCOMPLETE or HttpParser.ERROR */
+    case HTTPPARSER_PARSE: {
+      InputBuffer input = js_input_buffer(ctx, argv[0]);
+      int64_t length;
+
+      if(!input.data) {
+        input_buffer_free(&input, ctx);
+        return JS_ThrowTypeError(ctx, "argument 1 must be an ArrayBuffer");
+      }
+
+      length = input.size;
+
+      if(argc > 1 && !js_is_null_or_undefined(argv[1])) {
+        JS_ToInt64(ctx, &length, argv[1]);
+        length = MAX_NUM(MIN_NUM(length, (int64_t)input.size), 0);
+      }
+
+      ret = JS_NewInt32(ctx, http_parse(&hp->parser, input.data, length));
+
+      JS_FreeValue(ctx, hp->buffer);
+      hp->buffer = JS_DupValue(ctx, argv[0]);
+
+      input_buffer_free(&input, ctx);
+      break;
+    }
+
+    /* header(name | index): value string or undefined */
+    case HTTPPARSER_HEADER: {
+      int32_t index = -1;
+
+      if(JS_IsNumber(argv[0])) {
+        JS_ToInt32(ctx, &index, argv[0]);
+      } else {
+        InputBuffer input = js_input_buffer(ctx, hp->buffer);
+        size_t len;
+        const char* name;
+
+        if(!(name = JS_ToCStringLen(ctx, &len, argv[0]))) {
+          input_buffer_free(&input, ctx);
+          return JS_EXCEPTION;
+        }
+
+        if(input.data)
+          index = http_header_find(&hp->parser, input.data, name, len);
+
+        JS_FreeCString(ctx, name);
+        input_buffer_free(&input, ctx);
+      }
+
+      if(index >= 0 && (uint32_t)index < hp->parser.num_headers)
+        ret = js_httpparser_span(ctx, hp, hp->parser.headers[index].value, hp->parser.headers[index].value_len);
+
+      break;
+    }
+
+    /*
+     * decodeChunked(buf, offset?, length?): decodes in place and returns the
+     * number of body bytes now at buf[offset], or HttpParser.ERROR. Once the
+     * body is complete, parser.trailing is the number of bytes after it.
+     */
+    case HTTPPARSER_DECODE_CHUNKED: {
+      InputBuffer input = js_input_buffer(ctx, argv[0]);
+      OffsetLength off = OFFSET_INIT();
+      size_t len;
+      ssize_t r;
+
+      if(!input.data) {
+        input_buffer_free(&input, ctx);
+        return JS_ThrowTypeError(ctx, "argument 1 must be an ArrayBuffer");
+      }
+
+      js_offset_length(ctx, input.size, argc - 1, argv + 1, &off);
+      len = offset_size(&off, input.size);
+
+      r = http_decode_chunked(&hp->parser.chunk, input.data + off.offset, &len);
+      hp->trailing = r >= 0 ? r : -1;
+
+      ret = JS_NewInt64(ctx, r == HTTP_ERROR ? HTTP_ERROR : (int64_t)len);
+      input_buffer_free(&input, ctx);
+      break;
+    }
+
+    case HTTPPARSER_RESET: {
+      http_parser_init(&hp->parser, hp->parser.type);
+      JS_FreeValue(ctx, hp->buffer);
+      hp->buffer = JS_UNDEFINED;
+      hp->trailing = -1;
+      break;
+    }
+  }
+
+  return ret;
+}
+
+static JSValue
+js_httpparser_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  JSHttpParser* hp;
+  HttpParser* p;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(hp = js_httpparser_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  p = &hp->parser;
+
+  switch(magic) {
+    case HTTPPARSER_METHOD: {
+      if(p->type == HTTP_REQUEST && p->method_len)
+        ret = js_httpparser_span(ctx, hp, p->method, p->method_len);
+      break;
+    }
+
+    case HTTPPARSER_PATH: {
+      if(p->type == HTTP_REQUEST && p->path_len)
+        ret = js_httpparser_span(ctx, hp, p->path, p->path_len);
+      break;
+    }
+
+    case HTTPPARSER_REASON: {
+      if(p->type == HTTP_RESPONSE && p->status)
+        ret = js_httpparser_span(ctx, hp, p->reason, p->reason_len);
+      break;
+    }
+
+    case HTTPPARSER_STATUS: {
+      ret = JS_NewInt32(ctx, p->status);
+      break;
+    }
+
+    case HTTPPARSER_MINOR_VERSION: {
+      ret = JS_NewInt32(ctx, p->minor_version);
+      break;
+    }
+
+    /* Uint32Array of [name, nameLength, value, valueLength] per header, a view on the parser */
+    case HTTPPARSER_HEADERS: {
+      JSValue buf = js_arraybuffer_fromvalue(ctx, p->headers, p->num_headers * sizeof(HttpHeader), this_val);
+
+      ret = js_typedarray_new(ctx, 32, FALSE, FALSE, buf);
+      JS_FreeValue(ctx, buf);
+      break;
+    }
+
+    case HTTPPARSER_HEADER_COUNT: {
+      ret = JS_NewUint32(ctx, p->num_headers);
+      break;
+    }
+
+    case HTTPPARSER_CONTENT_LENGTH: {
+      ret = JS_NewInt64(ctx, p->content_length);
+      break;
+    }
+
+    case HTTPPARSER_CHUNKED: {
+      ret = JS_NewBool(ctx, p->chunked);
+      break;
+    }
+
+    case HTTPPARSER_KEEP_ALIVE: {
+      ret = JS_NewBool(ctx, p->keep_alive);
+      break;
+    }
+
+    case HTTPPARSER_TRAILING: {
+      ret = JS_NewInt64(ctx, hp->trailing);
+      break;
+    }
+  }
+
+  return ret;
+}
+
+static void
+js_httpparser_finalizer(JSRuntime* rt, JSValue val) {
+  JSHttpParser* hp;
+
+  if((hp = JS_GetOpaque(val, js_httpparser_class_id))) {
+    JS_FreeValueRT(rt, hp->buffer);
+    js_free_rt(rt, hp);
+  }
+}
+
+static void
+js_httpparser_mark(JSRuntime* rt, JSValueConst val, JS_MarkFunc* mark_func) {
+  JSHttpParser* hp;
+
+  if((hp = JS_GetOpaque(val, js_httpparser_class_id)))
+    JS_MarkValue(rt, hp->buffer, mark_func);
+}
+
+static JSClassDef js_httpparser_class = {
+    .class_name = "HttpParser",
+    .finalizer = js_httpparser_finalizer,
+    .gc_mark = js_httpparser_mark,
+};
+
+static const JSCFunctionListEntry js_httpparser_funcs[] = {
+    JS_CFUNC_MAGIC_DEF("parse", 1, js_httpparser_method, HTTPPARSER_PARSE),
+    JS_CFUNC_MAGIC_DEF("header", 1, js_httpparser_method, HTTPPARSER_HEADER),
+    JS_CFUNC_MAGIC_DEF("decodeChunked", 1, js_httpparser_method, HTTPPARSER_DECODE_CHUNKED),
+    JS_CFUNC_MAGIC_DEF("reset", 0, js_httpparser_method, HTTPPARSER_RESET),
+    JS_CGETSET_MAGIC_DEF("method", js_httpparser_get, 0, HTTPPARSER_METHOD),
+    JS_CGETSET_MAGIC_DEF("path", js_httpparser_get, 0, HTTPPARSER_PATH),
+    JS_CGETSET_MAGIC_DEF("reason", js_httpparser_get, 0, HTTPPARSER_REASON),
+    JS_CGETSET_MAGIC_DEF("status", js_httpparser_get, 0, HTTPPARSER_STATUS),
+    JS_CGETSET_MAGIC_DEF("minorVersion", js_httpparser_get, 0, HTTPPARSER_MINOR_VERSION),
+    JS_CGETSET_MAGIC_DEF("headers", js_httpparser_get, 0, HTTPPARSER_HEADERS),
+    JS_CGETSET_MAGIC_DEF("headerCount", js_httpparser_get, 0, HTTPPARSER_HEADER_COUNT),
+    JS_CGETSET_MAGIC_DEF("contentLength", js_httpparser_get, 0, HTTPPARSER_CONTENT_LENGTH),
+    JS_CGETSET_MAGIC_DEF("chunked", js_httpparser_get, 0, HTTPPARSER_CHUNKED),
+    JS_CGETSET_MAGIC_DEF("keepAlive", js_httpparser_get, 0, HTTPPARSER_KEEP_ALIVE),
+    JS_CGETSET_MAGIC_DEF("trailing", js_httpparser_get, 0, HTTPPARSER_TRAILING),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "HttpParser", JS_PROP_CONFIGURABLE),
+};
+
+static const JSCFunctionListEntry js_httpparser_static[] = {
+    JS_PROP_INT32_DEF("REQUEST", HTTP_REQUEST, 0),
+    JS_PROP_INT32_DEF("RESPONSE", HTTP_RESPONSE, 0),
+    JS_PROP_INT32_DEF("ERROR", HTTP_ERROR, 0),
+    JS_PROP_INT32_DEF("INCOMPLETE", HTTP_INCOMPLETE, 0),
+};
+
+int
+js_http_init(JSContext* ctx, JSModuleDef* m) {
+
+  if(js_httpparser_class_id == 0) {
+    JS_NewClassID(&js_httpparser_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_httpparser_class_id, &js_httpparser_class);
+
+    httpparser_ctor = JS_NewCFunction2(ctx, js_httpparser_constructor, "HttpParser", 1, JS_CFUNC_constructor, 0);
+    httpparser_proto = JS_NewObject(ctx);
+
+    JS_SetPropertyFunctionList(ctx, httpparser_proto, js_httpparser_funcs, countof(js_httpparser_funcs));
+    JS_SetPropertyFunctionList(ctx, httpparser_ctor, js_httpparser_static, countof(js_httpparser_static));
+
+    JS_SetClassProto(ctx, js_httpparser_class_id, httpparser_proto);
+    JS_SetConstructor(ctx, httpparser_ctor, httpparser_proto);
+  }
+
+  if(m)
+    JS_SetModuleExport(ctx, m, "HttpParser", httpparser_ctor);
+
+  return 0;
+}
+
+#ifdef JS_HTTP_MODULE
+#define JS_INIT_MODULE js_init_module
+#else
+#define JS_INIT_MODULE js_init_module_http
+#endif
+
+VISIBLE JSModuleDef*
+JS_INIT_MODULE(JSContext* ctx, const char* module_name) {
+  JSModuleDef* m;
+
+  if((m = JS_NewCModule(ctx, module_name, js_http_init))) {
+    JS_AddModuleExport(ctx, m, "HttpParser");
+  }
+
+  return m;
+}
+
+/**
+ * @}
+ */
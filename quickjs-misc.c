@@ -54,6 +54,8 @@
 #include <sys/inotify.h>
 #endif
 #include "buffer-utils.h"
+#include "io-uring.h"
+#include "timer-wheel.h"
 #ifdef HAVE_TERMIOS_H
 #include <termios.h>
 #include <sys/ioctl.h>
@@ -1462,7 +1464,7 @@ js_misc_consolemode(JSContext* ctx, JSValueConst this_val, int argc, JSValueCons
       JS_ToUint32(ctx, &mode, argv[1]);
 
       if(!SetConsoleMode(h, mode))
-        ret = JS_Throw(ctx, js_syscallerror_new(ctx, "SetConsoleMode", GetLastError()));
+        ret = js_syscallerror_throw_errno(ctx, "SetConsoleMode", GetLastError());
 
       break;
     }
@@ -1470,7 +1472,7 @@ js_misc_consolemode(JSContext* ctx, JSValueConst this_val, int argc, JSValueCons
     case GET_CONSOLE_MODE: {
       DWORD mode = 0;
       if(!GetConsoleMode(h, &mode))
-        ret = JS_Throw(ctx, js_syscallerror_new(ctx, "GetConsoleMode", GetLastError()));
+        ret = js_syscallerror_throw_errno(ctx, "GetConsoleMode", GetLastError());
       else
         ret = JS_NewUint32(ctx, mode);
 
@@ -2737,6 +2739,87 @@ js_misc_watch(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv
 }
 #endif
 
+#ifdef USE_IO_URING
+typedef struct {
+  JSValue resolve;
+  InputBuffer buf;
+  OffsetLength off;
+} MiscIOOp;
+
+static void
+misc_io_complete(JSContext* ctx, int32_t res, uint32_t flags, void* opaque) {
+  MiscIOOp* op = opaque;
+  JSValue value = JS_NewInt32(ctx, res);
+
+  if(!(flags & IO_RING_RELEASED))
+    JS_FreeValue(ctx, JS_Call(ctx, op->resolve, JS_UNDEFINED, 1, &value));
+
+  JS_FreeValue(ctx, op->resolve);
+  input_buffer_free(&op->buf, ctx);
+  js_free(ctx, op);
+}
+
+/**
+ * readAsync(fd, buf, offset, length, position) / writeAsync(...)
+ *
+ * Returns a Promise resolving to the byte count or a negative errno, or
+ * undefined when io_uring is unavailable and the caller has to fall back.
+ * O_NONBLOCK descriptors which are not ready resolve to -EAGAIN, the caller
+ * waits for readiness and retries then.
+ */
+static JSValue
+js_misc_io(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  struct io_uring_sqe* sqe;
+  MiscIOOp* op;
+  JSValue promise, resolving_funcs[2];
+  int32_t fd = -1;
+  int64_t pos = -1;
+
+  if(!io_ring_get(ctx))
+    return JS_UNDEFINED;
+
+  JS_ToInt32(ctx, &fd, argv[0]);
+
+  if(argc >= 5 && !js_is_null_or_undefined(argv[4]))
+    JS_ToInt64(ctx, &pos, argv[4]);
+
+  if(!(op = js_mallocz(ctx, sizeof(MiscIOOp))))
+    return JS_EXCEPTION;
+
+  op->buf = magic ? js_input_chars(ctx, argv[1]) : js_input_buffer(ctx, argv[1]);
+
+  if(JS_IsException(op->buf.value)) {
+    js_free(ctx, op);
+    return JS_EXCEPTION;
+  }
+
+  op->off = OFFSET_INIT();
+  js_offset_length(ctx, op->buf.size, argc - 2, argv + 2, &op->off);
+
+  promise = JS_NewPromiseCapability(ctx, resolving_funcs);
+  if(JS_IsException(promise)) {
+    input_buffer_free(&op->buf, ctx);
+    js_free(ctx, op);
+    return promise;
+  }
+
+  op->resolve = resolving_funcs[0];
+  JS_FreeValue(ctx, resolving_funcs[1]);
+
+  if(!(sqe = io_ring_prepare(ctx, misc_io_complete, op))) {
+    JS_FreeValue(ctx, promise);
+    JS_FreeValue(ctx, op->resolve);
+    input_buffer_free(&op->buf, ctx);
+    js_free(ctx, op);
+    return JS_UNDEFINED;
+  }
+
+  io_ring_prep_rw(sqe, magic ? IORING_OP_WRITE : IORING_OP_READ, fd, op->buf.data + op->off.offset, offset_size(&op->off, op->buf.size), (uint64_t)pos);
+
+  return promise;
+}
+#endif
+
 #ifdef HAVE_DAEMON
 static JSValue
 js_misc_daemon(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
@@ -2852,6 +2935,135 @@ js_misc_atexit(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst arg
   return JS_UNDEFINED;
 }
 
+/**
+ * Timer objects scheduled on the shared timer wheel.
+ *
+ * While armed, the wheel owns a reference to the Timer object, so an unused
+ * Timer stays alive until it has fired or has been cleared.
+ */
+typedef struct {
+  Timer timer;
+  uint32_t interval;
+  JSValue func;
+  JSObject* obj;
+} JSTimer;
+
+static JSClassID js_timer_class_id;
+
+static void
+js_misc_timer_free(JSRuntime* rt, Timer* t) {
+  JSTimer* jt = list_entry(t, JSTimer, timer);
+  JSObject* obj;
+
+  if((obj = jt->obj)) {
+    jt->obj = 0;
+    JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_OBJECT, obj));
+  }
+}
+
+static void
+js_misc_timer_release(JSContext* ctx, JSTimer* jt) {
+  js_misc_timer_free(JS_GetRuntime(ctx), &jt->timer);
+}
+
+static void
+js_misc_timer_fire(JSContext* ctx, Timer* t) {
+  JSTimer* jt = list_entry(t, JSTimer, timer);
+  JSValue obj = JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, jt->obj)), ret;
+
+  if(jt->interval)
+    timer_start(ctx, t, jt->interval);
+  else
+    js_misc_timer_release(ctx, jt);
+
+  ret = JS_Call(ctx, jt->func, JS_UNDEFINED, 0, 0);
+
+  if(JS_IsException(ret))
+    js_std_dump_error(ctx);
+
+  JS_FreeValue(ctx, ret);
+  JS_FreeValue(ctx, obj);
+}
+
+/**
+ * setTimer(fn, ms, repeat = false) returns a Timer, clearTimer(timer) cancels it
+ */
+static JSValue
+js_misc_settimer(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  JSTimer* jt;
+  JSValue obj;
+  int64_t delay = 0;
+  uint32_t ms;
+
+  if(argc < 1 || !JS_IsFunction(ctx, argv[0]))
+    return JS_ThrowTypeError(ctx, "argument 1 must be function");
+
+  /* like setTimeout(), negative delays fire right away */
+  if(argc >= 2 && !js_is_null_or_undefined(argv[1]))
+    JS_ToInt64(ctx, &delay, argv[1]);
+
+  ms = MIN_NUM(MAX_NUM(delay, 0), UINT32_MAX);
+
+  if(!(jt = js_mallocz(ctx, sizeof(JSTimer))))
+    return JS_EXCEPTION;
+
+  obj = JS_NewObjectClass(ctx, js_timer_class_id);
+
+  if(JS_IsException(obj)) {
+    js_free(ctx, jt);
+    return obj;
+  }
+
+  timer_init(&jt->timer, js_misc_timer_fire);
+  jt->timer.release = js_misc_timer_free;
+  jt->func = JS_DupValue(ctx, argv[0]);
+  jt->interval = argc >= 3 && JS_ToBool(ctx, argv[2]) ? MAX_NUM(ms, 1) : 0;
+  jt->obj = JS_VALUE_GET_OBJ(JS_DupValue(ctx, obj));
+
+  JS_SetOpaque(obj, jt);
+  timer_start(ctx, &jt->timer, ms);
+
+  return obj;
+}
+
+static JSValue
+js_misc_cleartimer(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  JSTimer* jt;
+
+  /* like clearTimeout(), anything but a Timer is ignored */
+  if(!(jt = JS_GetOpaque(argv[0], js_timer_class_id)))
+    return JS_UNDEFINED;
+
+  timer_stop(ctx, &jt->timer);
+  js_misc_timer_release(ctx, jt);
+
+  return JS_UNDEFINED;
+}
+
+static void
+js_timer_finalizer(JSRuntime* rt, JSValue val) {
+  JSTimer* jt;
+
+  if((jt = JS_GetOpaque(val, js_timer_class_id))) {
+    JS_FreeValueRT(rt, jt->func);
+    js_free_rt(rt, jt);
+  }
+}
+
+static void
+js_timer_mark(JSRuntime* rt, JSValueConst val, JS_MarkFunc* mark_func) {
+  JSTimer* jt;
+
+  if((jt = JS_GetOpaque(val, js_timer_class_id)))
+    JS_MarkValue(rt, jt->func, mark_func);
+}
+
+static JSClassDef js_timer_class = {
+    .class_name = "Timer",
+    .finalizer = js_timer_finalizer,
+    .gc_mark = js_timer_mark,
+};
+
 #ifdef HAVE_LINK
 static JSValue
 js_misc_link(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
@@ -3137,6 +3349,12 @@ static const JSCFunctionListEntry js_misc_funcs[] = {
 #endif
 #ifdef HAVE_INOTIFY_INIT1
     JS_CFUNC_DEF("watch", 1, js_misc_watch),
+#endif
+    JS_CFUNC_DEF("setTimer", 2, js_misc_settimer),
+    JS_CFUNC_DEF("clearTimer", 1, js_misc_cleartimer),
+#ifdef USE_IO_URING
+    JS_CFUNC_MAGIC_DEF("readAsync", 4, js_misc_io, 0),
+    JS_CFUNC_MAGIC_DEF("writeAsync", 4, js_misc_io, 1),
 #endif
 #ifdef HAVE_DAEMON
     JS_CFUNC_DEF("daemon", 2, js_misc_daemon),
@@ -3462,6 +3680,12 @@ js_misc_init(JSContext* ctx, JSModuleDef* m) {
   vector_init(&js_misc_atexit_functions, ctx);
   atexit(&js_misc_atexit_handler);
 
+  if(js_timer_class_id == 0)
+    JS_NewClassID(&js_timer_class_id);
+
+  if(!JS_IsRegisteredClass(JS_GetRuntime(ctx), js_timer_class_id))
+    JS_NewClass(JS_GetRuntime(ctx), js_timer_class_id, &js_timer_class);
+
   if(m) {
     JS_SetModuleExportList(ctx, m, js_misc_funcs, countof(js_misc_funcs));
     // JS_SetModuleExport(ctx, m, "Location", location_ctor);
@@ -5,6 +5,10 @@
 #include "char-utils.h"
 #include "js-utils.h"
 #include "async-closure.h"
+#include "columns.h"
+#include "conn-pool.h"
+#include "bulk-insert.h"
+#include "query-stats.h"
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -17,9 +21,12 @@
  * @{
  */
 
-VISIBLE JSClassID js_connectparams_class_id = 0, js_mysqlerror_class_id = 0, js_mysql_class_id = 0, js_mysqlresult_class_id = 0;
+VISIBLE JSClassID js_connectparams_class_id = 0, js_mysqlerror_class_id = 0, js_mysql_class_id = 0, js_mysqlresult_class_id = 0,
+                   js_mysqlstmt_class_id = 0;
 VISIBLE JSValue mysqlerror_proto = {{0}, JS_TAG_UNDEFINED}, mysqlerror_ctor = {{0}, JS_TAG_UNDEFINED}, mysql_proto = {{0}, JS_TAG_UNDEFINED},
-                mysql_ctor = {{0}, JS_TAG_UNDEFINED}, mysqlresult_proto = {{0}, JS_TAG_UNDEFINED}, mysqlresult_ctor = {{0}, JS_TAG_UNDEFINED};
+                mysql_ctor = {{0}, JS_TAG_UNDEFINED}, mysqlresult_proto = {{0}, JS_TAG_UNDEFINED}, mysqlresult_ctor = {{0}, JS_TAG_UNDEFINED},
+                mysqlstmt_proto = {{0}, JS_TAG_UNDEFINED}, mysqlstmt_ctor = {{0}, JS_TAG_UNDEFINED},
+                mysqlpool_proto = {{0}, JS_TAG_UNDEFINED}, mysqlpool_ctor = {{0}, JS_TAG_UNDEFINED};
 
 static JSValue js_mysqlresult_wrap(JSContext* ctx, MYSQL_RES* res);
 
@@ -56,13 +63,11 @@ static BOOL field_is_date(MYSQL_FIELD const* field);
 static BOOL field_is_string(MYSQL_FIELD const* field);
 static BOOL field_is_blob(MYSQL_FIELD const* field);
 static JSValue string_to_value(JSContext* ctx, const char* func_name, const char* s);
-static JSValue string_to_object(JSContext* ctx, const char* ctor_name, const char* s);
 
 #define string_to_number(ctx, s) string_to_value(ctx, "Number", s);
 #define string_to_bigdecimal(ctx, s) string_to_value(ctx, "BigDecimal", s);
 #define string_to_bigint(ctx, s) string_to_value(ctx, "BigInt", s);
 #define string_to_bigfloat(ctx, s) string_to_value(ctx, "BigFloat", s);
-#define string_to_date(ctx, s) string_to_object(ctx, "Date", s);
 
 static JSValue js_mysqlerror_new(JSContext* ctx, const char* msg);
 
@@ -76,8 +81,12 @@ to_mysql_wait(AsyncEvent e) {
   return ((e & WANT_WRITE) ? MYSQL_WAIT_WRITE : 0) | ((e & WANT_READ) ? MYSQL_WAIT_READ : 0);
 }
 
-static void
-js_mysql_print_value(JSContext* ctx, DynBuf* out, JSValueConst value) {
+/**
+ * Strings are escaped for the connection's character set when 'my' is given.
+ * Returns -1 when an object could not be converted to JSON.
+ */
+static int
+js_mysql_print_value(JSContext* ctx, MYSQL* my, DynBuf* out, JSValueConst value) {
 
   if(JS_IsNull(value) || JS_IsUndefined(value) || js_is_nan(value)) {
     dbuf_putstr(out, "NULL");
@@ -92,9 +101,10 @@ js_mysql_print_value(JSContext* ctx, DynBuf* out, JSValueConst value) {
 
     dbuf_putc(out, '\'');
     dst = (char*)dbuf_reserve(out, len * 2 + 1);
-    len = mysql_escape_string(dst, src, len);
+    len = my ? mysql_real_escape_string(my, dst, src, len) : mysql_escape_string(dst, src, len);
     out->size += len;
     dbuf_putc(out, '\'');
+    JS_FreeCString(ctx, src);
 
   } else if(js_is_date(ctx, value)) {
     size_t len;
@@ -141,30 +151,34 @@ js_mysql_print_value(JSContext* ctx, DynBuf* out, JSValueConst value) {
     dbuf_put(out, src, len);
     JS_FreeCString(ctx, src);
 
-  } else {
-
+  } else if(js_is_arraybuffer(ctx, value) || js_is_sharedarraybuffer(ctx, value) || js_is_typedarray(ctx, value)) {
+    static const uint8_t hexdigits[] = "0123456789ABCDEF";
     InputBuffer input = js_input_buffer(ctx, value);
 
-    if(input.size) {
-      static const uint8_t hexdigits[] = "0123456789ABCDEF";
-      dbuf_putstr(out, "0x");
-      for(size_t i = 0; i < input.size; i++) {
-        const uint8_t hex[2] = {
-            hexdigits[(input.data[i] & 0xf0) >> 4],
-            hexdigits[(input.data[i] & 0x0f)],
-        };
-        dbuf_put(out, hex, 2);
-      }
-      input_buffer_free(&input, ctx);
+    /* X'' is also valid for an empty buffer, unlike 0x */
+    dbuf_putstr(out, "X'");
+    for(size_t i = 0; i < input.size; i++) {
+      const uint8_t hex[2] = {
+          hexdigits[(input.data[i] & 0xf0) >> 4],
+          hexdigits[(input.data[i] & 0x0f)],
+      };
+      dbuf_put(out, hex, 2);
+    }
+    dbuf_putc(out, '\'');
+    input_buffer_free(&input, ctx);
 
-    } else {
-      size_t len;
-      const char* str = JS_ToCStringLen(ctx, &len, value);
+  } else {
+    /* other objects are stored as JSON, escaped like any other string */
+    JSValue str = JS_JSONStringify(ctx, value, JS_NULL, JS_NULL);
 
-      dbuf_put(out, (const uint8_t*)str, len);
-      JS_FreeCString(ctx, str);
-    }
+    if(JS_IsException(str))
+      return -1;
+
+    js_mysql_print_value(ctx, my, out, str);
+    JS_FreeValue(ctx, str);
   }
+
+  return 0;
 }
 
 static void
@@ -187,7 +201,7 @@ js_mysql_print_insert(JSContext* ctx, DynBuf* out) {
 }
 
 static void
-js_mysql_print_values(JSContext* ctx, DynBuf* out, JSValueConst values) {
+js_mysql_print_values(JSContext* ctx, MYSQL* my, DynBuf* out, JSValueConst values) {
   JSValue item, iter = js_iterator_new(ctx, values);
 
   if(!JS_IsUndefined(iter)) {
@@ -200,7 +214,7 @@ js_mysql_print_values(JSContext* ctx, DynBuf* out, JSValueConst values) {
         break;
       if(i > 0)
         dbuf_putstr(out, ", ");
-      js_mysql_print_value(ctx, out, item);
+      js_mysql_print_value(ctx, my, out, item);
       JS_FreeValue(ctx, item);
     }
     dbuf_putc(out, ')');
@@ -224,7 +238,7 @@ js_mysql_print_values(JSContext* ctx, DynBuf* out, JSValueConst values) {
       if(i > 0)
         dbuf_putstr(out, ", ");
       item = JS_GetProperty(ctx, values, tmp_tab[i].atom);
-      js_mysql_print_value(ctx, out, item);
+      js_mysql_print_value(ctx, my, out, item);
       JS_FreeValue(ctx, item);
     }
     dbuf_putc(out, ')');
@@ -832,7 +846,7 @@ js_mysql_value_string(JSContext* ctx, JSValueConst this_val, int argc, JSValueCo
   for(int i = 0; i < argc; i++) {
     if(i > 0)
       dbuf_putstr(&buf, ", ");
-    js_mysql_print_value(ctx, &buf, argv[i]);
+    js_mysql_print_value(ctx, js_mysql_data(this_val), &buf, argv[i]);
   }
 
   ret = JS_NewStringLen(ctx, (const char*)buf.buf, buf.size);
@@ -851,7 +865,7 @@ js_mysql_values_string(JSContext* ctx, JSValueConst this_val, int argc, JSValueC
     if(i > 0)
       dbuf_putstr(&buf, ", ");
 
-    js_mysql_print_values(ctx, &buf, argv[i]);
+    js_mysql_print_values(ctx, js_mysql_data(this_val), &buf, argv[i]);
   }
 
   ret = JS_NewStringLen(ctx, (const char*)buf.buf, buf.size);
@@ -877,7 +891,7 @@ js_mysql_insert_query(JSContext* ctx, JSValueConst this_val, int argc, JSValueCo
     if(i > 1)
       dbuf_putstr(&buf, ", ");
 
-    js_mysql_print_values(ctx, &buf, argv[i]);
+    js_mysql_print_values(ctx, js_mysql_data(this_val), &buf, argv[i]);
   }
 
   dbuf_putstr(&buf, ";");
@@ -887,6 +901,122 @@ js_mysql_insert_query(JSContext* ctx, JSValueConst this_val, int argc, JSValueCo
   return ret;
 }
 
+static int
+mysql_bulk_value(JSContext* ctx, JSValueConst conn, DynBuf* out, JSValueConst value) {
+  return js_mysql_print_value(ctx, js_mysql_data(conn), out, value);
+}
+
+static void
+mysql_bulk_identifier(JSContext* ctx, JSValueConst conn, DynBuf* out, JSValueConst name) {
+  const char* str;
+  size_t i, len;
+
+  if(!(str = JS_ToCStringLen(ctx, &len, name)))
+    return;
+
+  dbuf_putc(out, '`');
+
+  for(i = 0; i < len; i++) {
+    if(str[i] == '`')
+      dbuf_putc(out, '`');
+
+    dbuf_putc(out, str[i]);
+  }
+
+  dbuf_putc(out, '`');
+  JS_FreeCString(ctx, str);
+}
+
+static const BulkInsertDriver mysql_bulk_driver = {
+    mysql_bulk_value,
+    mysql_bulk_identifier,
+};
+
+/**
+ * bulkInsert(table, columns, rows, { maxBytes }): statements are kept below
+ * the client's max_allowed_packet
+ */
+static JSValue
+js_mysql_bulk_insert(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  MYSQL* my;
+  unsigned long packet = 0;
+
+  if(!(my = js_mysql_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  mysql_get_option(my, MYSQL_OPT_MAX_ALLOWED_PACKET, &packet);
+
+  return js_bulkinsert(ctx, this_val, argc, argv, &mysql_bulk_driver, BULK_INSERT_MAX_BYTES, packet);
+}
+
+/* the slot is registered once, as a user data key can't be unset */
+static QueryStats**
+mysql_querystats_slot(MYSQL* my) {
+  void* ptr = 0;
+
+  mysql_get_optionv(my, MARIADB_OPT_USERDATA, (void*)"QueryStats**", (void*)&ptr);
+  return ptr;
+}
+
+/* NULL unless instrument() has been called */
+static QueryStats*
+mysql_querystats(MYSQL* my) {
+  QueryStats** slot = mysql_querystats_slot(my);
+
+  return slot ? *slot : 0;
+}
+
+/**
+ * instrument({ slowQuery, slowThreshold, maxQueries }) starts recording
+ * query() and MySQLStatement execute() calls, instrument(false) stops
+ */
+static JSValue
+js_mysql_instrument(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  MYSQL* my;
+  QueryStats **slot, *qs = 0;
+
+  if(!(my = js_mysql_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(!(argc > 0 && JS_IsBool(argv[0]) && !JS_ToBool(ctx, argv[0])))
+    if(!(qs = querystats_new(ctx, argc > 0 ? argv[0] : JS_UNDEFINED)))
+      return JS_EXCEPTION;
+
+  if(!(slot = mysql_querystats_slot(my))) {
+    if(!(slot = js_mallocz(ctx, sizeof(QueryStats*)))) {
+      if(qs)
+        querystats_free(JS_GetRuntime(ctx), qs);
+
+      return JS_EXCEPTION;
+    }
+
+    mysql_optionsv(my, MARIADB_OPT_USERDATA, (void*)"QueryStats**", (void*)slot);
+  }
+
+  if(*slot)
+    querystats_free(JS_GetRuntime(ctx), *slot);
+
+  *slot = qs;
+  return JS_UNDEFINED;
+}
+
+/**
+ * stats(reset = false) returns the query statistics, null when not instrumented
+ */
+static JSValue
+js_mysql_stats(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  MYSQL* my;
+  QueryStats* qs;
+
+  if(!(my = js_mysql_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(!(qs = mysql_querystats(my)))
+    return JS_NULL;
+
+  return querystats_snapshot(ctx, qs, argc > 0 && JS_ToBool(ctx, argv[0]));
+}
+
 static JSValue
 js_mysql_escape_string(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
   JSValue ret = JS_UNDEFINED;
@@ -1047,27 +1177,53 @@ js_mysql_connect(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst a
   return asyncclosure_promise(ac);
 }
 
+static void
+js_mysql_query_done(JSContext* ctx, AsyncClosure* ac, int err) {
+  MYSQL_RES* res = err ? 0 : mysql_use_result(ac->opaque);
+  QueryStats* qs;
+
+  if((qs = mysql_querystats(ac->opaque))) {
+    BOOL error = err || (!res && mysql_field_count(ac->opaque));
+
+    /* rows of a result set are counted once it has been read */
+    if(res)
+      querystats_defer(qs, res);
+
+    querystats_end(ctx, qs, res || error ? -1 : (int64_t)mysql_affected_rows(ac->opaque), 0, error);
+  }
+
+  if(err) {
+    JSValue error = js_mysqlerror_new(ctx, mysql_error(ac->opaque));
+    asyncclosure_error(ac, error);
+    JS_FreeValue(ctx, error);
+  } else if(res) {
+    JS_SetOpaque(ac->result, res);
+    asyncclosure_resolve(ac);
+  } else if(mysql_field_count(ac->opaque) == 0) {
+    /* INSERT, UPDATE, ...: no result set */
+    asyncclosure_yield(ac, JS_NULL);
+  } else {
+    JSValue error = js_mysqlerror_new(ctx, mysql_error(ac->opaque));
+    asyncclosure_error(ac, error);
+    JS_FreeValue(ctx, error);
+  }
+}
+
 static JSValue
 js_mysql_query_continue(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, void* ptr) {
   AsyncClosure* ac = ptr;
+  QueryStats* qs;
   int err = 0, state, as;
 
   state = mysql_real_query_cont(&err, ac->opaque, to_mysql_wait(ac->state));
   as = to_asyncevent(state);
   asyncclosure_change_event(ac, as);
 
-  if(state == 0) {
-    MYSQL_RES* res;
+  if(!(state & MYSQL_WAIT_WRITE) && (qs = mysql_querystats(ac->opaque)))
+    querystats_sent(qs);
 
-    if(err) {
-      JSValue error = js_mysqlerror_new(ctx, mysql_error(ac->opaque));
-      asyncclosure_error(ac, error);
-      JS_FreeValue(ctx, error);
-    } else if((res = mysql_use_result(ac->opaque))) {
-      JS_SetOpaque(ac->result, res);
-      asyncclosure_resolve(ac);
-    }
-  }
+  if(state == 0)
+    js_mysql_query_done(ctx, ac, err);
 
   return JS_UNDEFINED;
 }
@@ -1075,16 +1231,25 @@ js_mysql_query_continue(JSContext* ctx, JSValueConst this_val, int argc, JSValue
 static JSValue
 js_mysql_query(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
   AsyncClosure* ac;
+  JSValue ret;
   const char* query = 0;
   size_t i;
   MYSQL* my;
+  QueryStats* qs;
   int state, err = 0, as, fd;
 
   if(!(my = js_mysql_data2(ctx, this_val)))
     return JS_EXCEPTION;
 
   query = JS_ToCStringLen(ctx, &i, argv[0]);
+
+  if((qs = query ? mysql_querystats(my) : 0))
+    querystats_begin(ctx, qs, query, i);
+
   state = mysql_real_query_start(&err, my, query, i);
+
+  if(qs && !(state & MYSQL_WAIT_WRITE))
+    querystats_sent(qs);
   fd = js_mysql_fd(ctx, this_val);
   as = to_asyncevent(state);
   ac = asyncclosure_new(ctx, fd, as, JS_NewObjectProtoClass(ctx, mysqlresult_proto, js_mysqlresult_class_id), &js_mysql_query_continue);
@@ -1094,8 +1259,15 @@ js_mysql_query(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst arg
 #endif
 
   asyncclosure_opaque(ac, my, NULL);
+  JS_FreeCString(ctx, query);
 
-  return asyncclosure_promise(ac);
+  ret = asyncclosure_promise(ac);
+
+  /* completed without waiting */
+  if(state == 0)
+    js_mysql_query_done(ctx, ac, err);
+
+  return ret;
 }
 
 static JSValue
@@ -1133,10 +1305,21 @@ js_mysql_finalizer(JSRuntime* rt, JSValue val) {
   MYSQL* my;
 
   if((my = JS_GetOpaque(val, js_mysql_class_id))) {
+    QueryStats** slot;
+
+    if((slot = mysql_querystats_slot(my))) {
+      if(*slot)
+        querystats_free(rt, *slot);
+
+      js_free_rt(rt, slot);
+    }
+
     mysql_close(my);
   }
 }
 
+static JSValue js_mysql_prepare(JSContext*, JSValueConst, int, JSValueConst[]);
+
 static JSClassDef js_mysql_class = {
     .class_name = "MySQL",
     .finalizer = js_mysql_finalizer,
@@ -1171,6 +1354,10 @@ static const JSCFunctionListEntry js_mysql_funcs[] = {
     JS_CGETSET_MAGIC_DEF("pending", js_mysql_get, 0, PROP_PENDING),
     JS_CFUNC_DEF("connect", 1, js_mysql_connect),
     JS_CFUNC_DEF("query", 1, js_mysql_query),
+    JS_CFUNC_DEF("prepare", 1, js_mysql_prepare),
+    JS_CFUNC_DEF("bulkInsert", 3, js_mysql_bulk_insert),
+    JS_CFUNC_DEF("instrument", 0, js_mysql_instrument),
+    JS_CFUNC_DEF("stats", 0, js_mysql_stats),
     JS_CFUNC_DEF("close", 0, js_mysql_close),
     JS_ALIAS_DEF("execute", "query"),
     JS_CFUNC_MAGIC_DEF("escapeString", 1, js_mysql_methods, METHOD_ESCAPE_STRING),
@@ -1335,14 +1522,11 @@ result_value(JSContext* ctx, MYSQL_FIELD const* field, char* buf, size_t len, Re
 
   if(!(rtype & RESULT_STRING)) {
     if(field_is_number(field))
-      return string_to_number(ctx, buf);
+      return column_parse_number(ctx, buf);
     if(field_is_decimal(field))
       return string_to_bigdecimal(ctx, buf);
-    if(field_is_date(field)) {
-      if(field->length == 19 && buf[10] == ' ')
-        buf[10] = 'T';
-      return string_to_date(ctx, buf);
-    }
+    if(field_is_date(field))
+      return column_parse_date(ctx, buf);
   }
 
   if(field_is_blob(field)) {
@@ -1374,23 +1558,78 @@ result_array(JSContext* ctx, MYSQL_RES* res, MYSQL_ROW row, ResultFlags rtype) {
   return ret;
 }
 
-static JSValue
-result_object(JSContext* ctx, MYSQL_RES* res, MYSQL_ROW row, ResultFlags rtype) {
-  JSValue ret = JS_NewObject(ctx);
+/* property names of object rows, for the result which was last turned into objects */
+static thread_local struct {
+  JSRuntime* rt;
+  MYSQL_RES* res;
+  JSAtom* atoms;
+  uint32_t num_atoms;
+  BOOL tblnam;
+} result_shape;
+
+static void
+result_shape_clear(void) {
+  for(uint32_t i = 0; i < result_shape.num_atoms; i++)
+    if(result_shape.atoms[i] != JS_ATOM_NULL)
+      JS_FreeAtomRT(result_shape.rt, result_shape.atoms[i]);
+
+  if(result_shape.atoms)
+    js_free_rt(result_shape.rt, result_shape.atoms);
+
+  memset(&result_shape, 0, sizeof(result_shape));
+}
+
+static JSAtom*
+result_atoms(JSContext* ctx, MYSQL_RES* res, ResultFlags rtype) {
   uint32_t i, num_fields = mysql_num_fields(res);
   MYSQL_FIELD* fields = mysql_fetch_fields(res);
-  FieldNameFunc* fn = (rtype & RESULT_TBLNAM) ? field_id : field_namefunc(fields, num_fields);
-  unsigned long* field_lengths = mysql_fetch_lengths(res);
+  BOOL tblnam = !!(rtype & RESULT_TBLNAM);
+  FieldNameFunc* fn;
+
+  if(result_shape.res == res && result_shape.rt == JS_GetRuntime(ctx) && result_shape.num_atoms == num_fields && result_shape.tblnam == tblnam)
+    return result_shape.atoms;
+
+  result_shape_clear();
+
+  if(!(result_shape.atoms = js_mallocz(ctx, sizeof(JSAtom) * (num_fields + 1))))
+    return 0;
+
+  result_shape.rt = JS_GetRuntime(ctx);
+  result_shape.res = res;
+  result_shape.num_atoms = num_fields;
+  result_shape.tblnam = tblnam;
+  fn = tblnam ? field_id : field_namefunc(fields, num_fields);
 
   for(i = 0; i < num_fields; i++) {
     char* id;
 
     if((id = fn(ctx, &fields[i]))) {
-      JS_SetPropertyStr(ctx, ret, id, result_value(ctx, &fields[i], row[i], field_lengths[i], rtype));
+      result_shape.atoms[i] = JS_NewAtom(ctx, id);
       js_free(ctx, id);
     }
   }
 
+  return result_shape.atoms;
+}
+
+/* rows get their properties in the same order, so they share one shape */
+static JSValue
+result_object(JSContext* ctx, MYSQL_RES* res, MYSQL_ROW row, ResultFlags rtype) {
+  JSValue ret;
+  uint32_t i, num_fields = mysql_num_fields(res);
+  MYSQL_FIELD* fields = mysql_fetch_fields(res);
+  unsigned long* field_lengths = mysql_fetch_lengths(res);
+  JSAtom* atoms;
+
+  if(!(atoms = result_atoms(ctx, res, rtype)))
+    return JS_EXCEPTION;
+
+  ret = JS_NewObject(ctx);
+
+  for(i = 0; i < num_fields; i++)
+    if(atoms[i] != JS_ATOM_NULL)
+      JS_DefinePropertyValue(ctx, ret, atoms[i], result_value(ctx, &fields[i], row[i], field_lengths[i], rtype), JS_PROP_C_W_E);
+
   return ret;
 }
 
@@ -1458,10 +1697,14 @@ static void
 result_iterator_value(ResultIterator* ri, MYSQL_ROW row, AsyncClosure* ac) {
   JSValue result = JS_UNDEFINED;
   JSContext* ctx = ac->ctx;
+  QueryStats* qs;
 
-  if(row)
+  if(row) {
     if(mysql_num_fields(ri->res) == ri->field_count)
       result = result_row(ctx, ri->res, row, ri->flags);
+  } else if((qs = mysql_querystats(ri->conn))) {
+    querystats_rows(qs, ri->res, mysql_num_rows(ri->res));
+  }
 
   if(ri->flags & RESULT_ITERAT) {
     JSValue tmp = js_iterator_result(ctx, result, JS_IsUndefined(result));
@@ -1541,6 +1784,11 @@ js_mysqlresult_next_continue(JSContext* ctx, JSValueConst this_val, int argc, JS
 
     } else {
       JSValue error = js_mysqlerror_new(ctx, mysql_error(ri->conn));
+      QueryStats* qs;
+
+      if((qs = mysql_querystats(ri->conn)))
+        querystats_rows(qs, res, mysql_num_rows(res));
+
       asyncclosure_error(ac, error);
       JS_FreeValue(ctx, error);
     }
@@ -1692,6 +1940,186 @@ enum {
   METHOD_ASYNC_ITERATOR,
 };
 
+typedef struct {
+  MYSQL* conn;
+  MYSQL_RES* res;
+  uint32_t num_fields;
+  Column* columns;
+  char** names;
+} ResultColumns;
+
+static void
+result_columns_free(JSRuntime* rt, void* ptr) {
+  ResultColumns* rc = ptr;
+
+  for(uint32_t i = 0; i < rc->num_fields; i++) {
+    column_free(&rc->columns[i]);
+
+    if(rc->names[i])
+      js_free_rt(rt, rc->names[i]);
+  }
+
+  js_free_rt(rt, rc->columns);
+  js_free_rt(rt, rc->names);
+  js_free_rt(rt, rc);
+}
+
+static ColumnType
+result_column_type(MYSQL_FIELD const* field) {
+  switch(field->type) {
+    case MYSQL_TYPE_TINY:
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_INT24: return COLUMN_INT32;
+    case MYSQL_TYPE_LONG: return (field->flags & UNSIGNED_FLAG) ? COLUMN_BIGINT64 : COLUMN_INT32;
+    case MYSQL_TYPE_LONGLONG: return COLUMN_BIGINT64;
+    case MYSQL_TYPE_FLOAT:
+    case MYSQL_TYPE_DOUBLE:
+    case MYSQL_TYPE_DECIMAL:
+    case MYSQL_TYPE_NEWDECIMAL: return COLUMN_FLOAT64;
+    default: return COLUMN_STRING;
+  }
+}
+
+static ResultColumns*
+result_columns_new(JSContext* ctx, MYSQL* my, MYSQL_RES* res, JSValueConst types) {
+  ResultColumns* rc;
+  MYSQL_FIELD* fields = mysql_fetch_fields(res);
+  uint32_t i, num_fields = mysql_num_fields(res);
+  FieldNameFunc* fn = field_namefunc(fields, num_fields);
+
+  if(!(rc = js_mallocz(ctx, sizeof(ResultColumns))))
+    return 0;
+
+  rc->conn = my;
+  rc->res = res;
+
+  if(!(rc->columns = js_mallocz(ctx, sizeof(Column) * (num_fields + 1))) || !(rc->names = js_mallocz(ctx, sizeof(char*) * (num_fields + 1))))
+    goto fail;
+
+  for(i = 0; i < num_fields; i++) {
+    int type;
+
+    if(!(rc->names[i] = fn(ctx, &fields[i])))
+      goto fail;
+
+    if((type = column_type_option(ctx, types, i, rc->names[i])) == -2)
+      goto fail;
+
+    column_init(ctx, &rc->columns[i], type == -1 ? result_column_type(&fields[i]) : type);
+    rc->num_fields = i + 1;
+  }
+
+  return rc;
+
+fail:
+  /* names[num_fields] is the one which could not be set up */
+  if(rc->names && rc->names[rc->num_fields])
+    js_free(ctx, rc->names[rc->num_fields]);
+
+  result_columns_free(JS_GetRuntime(ctx), rc);
+  return 0;
+}
+
+static int
+result_columns_append(ResultColumns* rc, MYSQL_ROW row) {
+  unsigned long* lengths = mysql_fetch_lengths(rc->res);
+
+  for(uint32_t i = 0; i < rc->num_fields; i++)
+    if(column_append(&rc->columns[i], row[i], lengths[i]))
+      return -1;
+
+  return 0;
+}
+
+/* takes the rows which are available without waiting, then waits for more or settles */
+static void
+result_columns_step(AsyncClosure* ac, int state, MYSQL_ROW row) {
+  ResultColumns* rc = ac->opaque;
+  JSContext* ctx = ac->ctx;
+
+  while(state == 0) {
+    if(!row) {
+      if(mysql_errno(rc->conn)) {
+        JSValue error = js_mysqlerror_new(ctx, mysql_error(rc->conn));
+        asyncclosure_error(ac, error);
+        JS_FreeValue(ctx, error);
+      } else {
+        JSValue ret = JS_NewObject(ctx);
+        QueryStats* qs;
+
+        if((qs = mysql_querystats(rc->conn)))
+          querystats_rows(qs, rc->res, mysql_num_rows(rc->res));
+
+        for(uint32_t i = 0; i < rc->num_fields; i++)
+          JS_SetPropertyStr(ctx, ret, rc->names[i], column_value(ctx, &rc->columns[i]));
+
+        asyncclosure_yield(ac, ret);
+        JS_FreeValue(ctx, ret);
+      }
+
+      return;
+    }
+
+    if(result_columns_append(rc, row)) {
+      JSValue error = js_mysqlerror_new(ctx, "out of memory");
+      asyncclosure_error(ac, error);
+      JS_FreeValue(ctx, error);
+      return;
+    }
+
+    state = mysql_fetch_row_start(&row, rc->res);
+  }
+
+  asyncclosure_change_event(ac, to_asyncevent(state));
+}
+
+static JSValue
+js_mysqlresult_tocolumns_continue(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, void* ptr) {
+  AsyncClosure* ac = ptr;
+  ResultColumns* rc = ac->opaque;
+  MYSQL_ROW row;
+  int state;
+
+  state = mysql_fetch_row_cont(&row, rc->res, to_mysql_wait(ac->state));
+  result_columns_step(ac, state, row);
+
+  return JS_UNDEFINED;
+}
+
+static JSValue
+js_mysqlresult_tocolumns(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  MYSQL_RES* res;
+  MYSQL* my;
+  MYSQL_ROW row;
+  ResultColumns* rc;
+  AsyncClosure* ac;
+  JSValue types = JS_UNDEFINED, ret;
+  int state;
+
+  if(!(res = js_mysqlresult_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  my = js_mysqlresult_handle(ctx, this_val);
+
+  if(argc > 0 && JS_IsObject(argv[0]))
+    types = JS_GetPropertyStr(ctx, argv[0], "types");
+
+  rc = result_columns_new(ctx, my, res, types);
+  JS_FreeValue(ctx, types);
+
+  if(!rc)
+    return JS_EXCEPTION;
+
+  ac = asyncclosure_new(ctx, js_mysqlresult_fd(ctx, this_val), WANT_NONE, JS_NULL, &js_mysqlresult_tocolumns_continue);
+  asyncclosure_opaque(ac, rc, result_columns_free);
+  ret = asyncclosure_promise(ac);
+
+  state = mysql_fetch_row_start(&row, res);
+  result_columns_step(ac, state, row);
+
+  return ret;
+}
+
 static JSValue
 js_mysqlresult_iterator(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
   JSValue ret = JS_UNDEFINED;
@@ -1739,6 +2167,9 @@ js_mysqlresult_finalizer(JSRuntime* rt, JSValue val) {
   MYSQL_RES* res;
 
   if((res = JS_GetOpaque(val, js_mysqlresult_class_id))) {
+    if(result_shape.res == res)
+      result_shape_clear();
+
     mysql_free_result(res);
   }
 }
@@ -1758,27 +2189,733 @@ static const JSCFunctionListEntry js_mysqlresult_funcs[] = {
     JS_CFUNC_MAGIC_DEF("fetchField", 1, js_mysqlresult_functions, METHOD_FETCH_FIELD),
     JS_CFUNC_MAGIC_DEF("fetchFields", 0, js_mysqlresult_functions, METHOD_FETCH_FIELDS),
     JS_CFUNC_MAGIC_DEF("fetchRow", 0, js_mysqlresult_next, 0),
+    JS_CFUNC_DEF("toColumns", 0, js_mysqlresult_tocolumns),
     JS_CFUNC_MAGIC_DEF("[Symbol.iterator]", 0, js_mysqlresult_iterator, METHOD_ITERATOR),
     JS_CFUNC_MAGIC_DEF("[Symbol.asyncIterator]", 0, js_mysqlresult_iterator, METHOD_ASYNC_ITERATOR),
     JS_PROP_STRING_DEF("[Symbol.toStringTag]", "MySQLResult", JS_PROP_CONFIGURABLE),
 };
 
-static char*
-field_id(JSContext* ctx, MYSQL_FIELD const* field) {
-  DynBuf buf;
+/* a prepared statement, its result set is fetched with the binary protocol */
+struct MySQLStatement {
+  int ref_count;
+  MYSQL_STMT* stmt;
+  JSValue handle;
+  char* sql;
+  uint32_t param_count, field_count;
+  MYSQL_RES* meta;
+  JSAtom* atoms;
+  /* close() while calls are in flight only takes effect when the last one has finished */
+  uint32_t pending;
+  BOOL closed;
+};
 
-  dbuf_init2(&buf, 0, 0);
-  dbuf_put(&buf, (const uint8_t*)field->table, field->table_length);
-  dbuf_putstr(&buf, ".");
-  dbuf_put(&buf, (const uint8_t*)field->name, field->name_length);
-  dbuf_0(&buf);
+typedef struct MySQLStatement MYSQLStatement;
 
-  return (char*)buf.buf;
-}
+typedef struct {
+  union {
+    int64_t i;
+    double d;
+    MYSQL_TIME t;
+  } u;
+  InputBuffer buf;
+  unsigned long length;
+  my_bool is_null, error;
+} StatementValue;
 
-static char*
-field_name(JSContext* ctx, MYSQL_FIELD const* field) {
-  return js_strndup(ctx, field->name, field->name_length);
+enum {
+  STMT_PREPARE = 0,
+  STMT_EXECUTE,
+  STMT_STORE,
+};
+
+typedef struct {
+  JSContext* ctx;
+  MYSQLStatement* st;
+  int stage;
+  ResultFlags flags;
+  uint32_t num_params;
+  MYSQL_BIND* binds;
+  StatementValue* values;
+  BOOL started;
+} StatementCall;
+
+static MYSQLStatement*
+mysqlstmt_dup(MYSQLStatement* st) {
+  ++st->ref_count;
+  return st;
+}
+
+/* COM_STMT_CLOSE has no reply, so this does not wait */
+static void
+mysqlstmt_close(MYSQLStatement* st) {
+  if(st->meta) {
+    mysql_free_result(st->meta);
+    st->meta = 0;
+  }
+
+  if(st->stmt) {
+    mysql_stmt_close(st->stmt);
+    st->stmt = 0;
+  }
+}
+
+static void
+mysqlstmt_free(JSRuntime* rt, MYSQLStatement* st) {
+  if(--st->ref_count == 0) {
+    mysqlstmt_close(st);
+
+    if(st->atoms) {
+      for(uint32_t i = 0; i < st->field_count; i++)
+        if(st->atoms[i] != JS_ATOM_NULL)
+          JS_FreeAtomRT(rt, st->atoms[i]);
+
+      js_free_rt(rt, st->atoms);
+    }
+
+    JS_FreeValueRT(rt, st->handle);
+    js_free_rt(rt, st->sql);
+    js_free_rt(rt, st);
+  }
+}
+
+static void
+stmtcall_free(JSRuntime* rt, void* ptr) {
+  StatementCall* call = ptr;
+
+  for(uint32_t i = 0; i < call->num_params; i++)
+    input_buffer_free(&call->values[i].buf, call->ctx);
+
+  js_free_rt(rt, call->binds);
+  js_free_rt(rt, call->values);
+
+  if(call->started && --call->st->pending == 0 && call->st->closed)
+    mysqlstmt_close(call->st);
+
+  mysqlstmt_free(rt, call->st);
+  js_free_rt(rt, call);
+}
+
+static StatementCall*
+stmtcall_new(JSContext* ctx, MYSQLStatement* st, int stage) {
+  StatementCall* call;
+
+  if(!(call = js_mallocz(ctx, sizeof(StatementCall))))
+    return 0;
+
+  call->ctx = ctx;
+  call->st = mysqlstmt_dup(st);
+  call->stage = stage;
+  return call;
+}
+
+/* binds a JS value as a statement parameter, its data lives in 'value' until the call is freed */
+static int
+stmtcall_bind(JSContext* ctx, MYSQL_BIND* bind, StatementValue* value, JSValueConst arg) {
+  value->buf.value = JS_UNDEFINED;
+
+  if(JS_IsNull(arg) || JS_IsUndefined(arg)) {
+    bind->buffer_type = MYSQL_TYPE_NULL;
+  } else if(JS_IsBool(arg)) {
+    value->u.i = JS_ToBool(ctx, arg);
+    bind->buffer_type = MYSQL_TYPE_LONGLONG;
+    bind->buffer = &value->u.i;
+  } else if(JS_IsBigInt(ctx, arg)) {
+    if(JS_ToBigInt64(ctx, &value->u.i, arg))
+      return -1;
+
+    bind->buffer_type = MYSQL_TYPE_LONGLONG;
+    bind->buffer = &value->u.i;
+  } else if(JS_IsNumber(arg)) {
+    double d;
+
+    JS_ToFloat64(ctx, &d, arg);
+
+    if(JS_VALUE_GET_TAG(arg) == JS_TAG_INT || (d == trunc(d) && fabs(d) < 9007199254740992.0)) {
+      value->u.i = d;
+      bind->buffer_type = MYSQL_TYPE_LONGLONG;
+      bind->buffer = &value->u.i;
+    } else {
+      value->u.d = d;
+      bind->buffer_type = MYSQL_TYPE_DOUBLE;
+      bind->buffer = &value->u.d;
+    }
+  } else if(js_is_date(ctx, arg)) {
+    /* UTC, like the text protocol path (see js_mysql_print_value) */
+    int64_t ms = js_date_gettime(ctx, arg);
+    time_t t = ms >= 0 ? ms / 1000 : (ms - 999) / 1000;
+    struct tm tm;
+
+    gmtime_r(&t, &tm);
+
+    value->u.t = (MYSQL_TIME){0};
+    value->u.t.year = tm.tm_year + 1900;
+    value->u.t.month = tm.tm_mon + 1;
+    value->u.t.day = tm.tm_mday;
+    value->u.t.hour = tm.tm_hour;
+    value->u.t.minute = tm.tm_min;
+    value->u.t.second = tm.tm_sec;
+    value->u.t.second_part = (ms - (int64_t)t * 1000) * 1000;
+    bind->buffer_type = MYSQL_TYPE_DATETIME;
+    bind->buffer = &value->u.t;
+  } else {
+    BOOL binary = js_is_arraybuffer(ctx, arg) || js_is_typedarray(ctx, arg);
+
+    if(binary) {
+      value->buf = js_input_buffer(ctx, arg);
+    } else {
+      JSValue str;
+
+      if(JS_IsException((str = JS_ToString(ctx, arg))))
+        return -1;
+
+      value->buf = js_input_chars(ctx, str);
+      JS_FreeValue(ctx, str);
+    }
+
+    if(JS_IsException(value->buf.value))
+      return -1;
+
+    value->length = input_buffer_length(&value->buf);
+    bind->buffer_type = binary ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING;
+    bind->buffer = input_buffer_data(&value->buf);
+    bind->buffer_length = value->length;
+    bind->length = &value->length;
+  }
+
+  return 0;
+}
+
+static JSValue
+stmt_value(JSContext* ctx, MYSQL_FIELD const* field, MYSQL_BIND* bind, StatementValue* value, ResultFlags rtype) {
+  if(value->is_null)
+    return result_value(ctx, field, 0, 0, rtype);
+
+  switch(bind->buffer_type) {
+    case MYSQL_TYPE_LONGLONG: {
+      if(field_is_boolean(field))
+        return JS_NewBool(ctx, value->u.i != 0);
+
+      if(bind->is_unsigned && (uint64_t)value->u.i > 9007199254740991ull)
+        return JS_NewBigUint64(ctx, value->u.i);
+
+      if(value->u.i > 9007199254740991ll || value->u.i < -9007199254740991ll)
+        return JS_NewBigInt64(ctx, value->u.i);
+
+      return JS_NewInt64(ctx, value->u.i);
+    }
+
+    case MYSQL_TYPE_DOUBLE: {
+      return JS_NewFloat64(ctx, value->u.d);
+    }
+
+    case MYSQL_TYPE_DATETIME: {
+      MYSQL_TIME* t = &value->u.t;
+      char buf[32];
+
+      if(field->type == MYSQL_TYPE_DATE || field->type == MYSQL_TYPE_NEWDATE)
+        snprintf(buf, sizeof(buf), "%04u-%02u-%02u", t->year, t->month, t->day);
+      else
+        snprintf(buf, sizeof(buf), "%04u-%02u-%02u %02u:%02u:%02u.%06lu", t->year, t->month, t->day, t->hour, t->minute, t->second, t->second_part);
+
+      return column_parse_date(ctx, buf);
+    }
+
+    default: {
+      char* data = bind->buffer;
+      size_t len = value->length < bind->buffer_length ? value->length : bind->buffer_length - 1;
+
+      data[len] = '\0';
+      return result_value(ctx, field, data, len, rtype);
+    }
+  }
+}
+
+/* fetches the stored result set, decoding each column from its binary form */
+static JSValue
+stmtcall_rows(JSContext* ctx, StatementCall* call) {
+  MYSQLStatement* st = call->st;
+  MYSQL_FIELD* fields = mysql_fetch_fields(st->meta);
+  uint32_t i, n, num_fields = mysql_num_fields(st->meta);
+  MYSQL_BIND* binds;
+  StatementValue* values;
+  JSValue ret = JS_EXCEPTION;
+  int r;
+
+  binds = js_mallocz(ctx, sizeof(MYSQL_BIND) * (num_fields + 1));
+  values = js_mallocz(ctx, sizeof(StatementValue) * (num_fields + 1));
+
+  if(!binds || !values)
+    goto fail;
+
+  for(i = 0; i < num_fields; i++) {
+    MYSQL_FIELD const* field = &fields[i];
+    MYSQL_BIND* bind = &binds[i];
+
+    bind->is_null = &values[i].is_null;
+    bind->error = &values[i].error;
+    bind->length = &values[i].length;
+
+    if(!(call->flags & RESULT_STRING) && (field_is_integer(field) || field->type == MYSQL_TYPE_LONGLONG || field->type == MYSQL_TYPE_YEAR)) {
+      bind->buffer_type = MYSQL_TYPE_LONGLONG;
+      bind->buffer = &values[i].u.i;
+      bind->is_unsigned = !!(field->flags & UNSIGNED_FLAG);
+    } else if(!(call->flags & RESULT_STRING) && field_is_float(field)) {
+      bind->buffer_type = MYSQL_TYPE_DOUBLE;
+      bind->buffer = &values[i].u.d;
+    } else if(!(call->flags & RESULT_STRING) && field_is_date(field) && field->type != MYSQL_TYPE_TIME) {
+      bind->buffer_type = MYSQL_TYPE_DATETIME;
+      bind->buffer = &values[i].u.t;
+    } else {
+      /* max_length is known since STMT_ATTR_UPDATE_MAX_LENGTH was set before storing */
+      bind->buffer_type = field_is_blob(field) ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING;
+      bind->buffer_length = (field->max_length > 64 ? field->max_length : 64) + 1;
+
+      if(!(bind->buffer = js_malloc(ctx, bind->buffer_length)))
+        goto fail;
+    }
+  }
+
+  if(mysql_stmt_bind_result(st->stmt, binds)) {
+    JS_Throw(ctx, js_mysqlerror_new(ctx, mysql_stmt_error(st->stmt)));
+    goto fail;
+  }
+
+  if((call->flags & RESULT_OBJECT) && !st->atoms) {
+    FieldNameFunc* fn = (call->flags & RESULT_TBLNAM) ? field_id : field_namefunc(fields, num_fields);
+
+    if(!(st->atoms = js_mallocz(ctx, sizeof(JSAtom) * (num_fields + 1))))
+      goto fail;
+
+    for(i = 0; i < num_fields; i++) {
+      char* id;
+
+      if((id = fn(ctx, &fields[i]))) {
+        st->atoms[i] = JS_NewAtom(ctx, id);
+        js_free(ctx, id);
+      }
+    }
+  }
+
+  ret = JS_NewArray(ctx);
+
+  for(n = 0; (r = mysql_stmt_fetch(st->stmt)) == 0 || r == MYSQL_DATA_TRUNCATED; n++) {
+    JSValue row = (call->flags & RESULT_OBJECT) ? JS_NewObject(ctx) : JS_NewArray(ctx);
+
+    for(i = 0; i < num_fields; i++) {
+      JSValue value = stmt_value(ctx, &fields[i], &binds[i], &values[i], call->flags);
+
+      if(call->flags & RESULT_OBJECT) {
+        if(st->atoms[i] != JS_ATOM_NULL)
+          JS_DefinePropertyValue(ctx, row, st->atoms[i], value, JS_PROP_C_W_E);
+        else
+          JS_FreeValue(ctx, value);
+      } else {
+        JS_SetPropertyUint32(ctx, row, i, value);
+      }
+    }
+
+    JS_SetPropertyUint32(ctx, ret, n, row);
+  }
+
+  if(r == 1) {
+    JS_FreeValue(ctx, ret);
+    ret = JS_Throw(ctx, js_mysqlerror_new(ctx, mysql_stmt_error(st->stmt)));
+  }
+
+fail:
+  mysql_stmt_free_result(st->stmt);
+
+  if(binds)
+    for(i = 0; i < num_fields; i++)
+      if(binds[i].buffer_length)
+        js_free(ctx, binds[i].buffer);
+
+  js_free(ctx, binds);
+  js_free(ctx, values);
+
+  return ret;
+}
+
+static JSValue js_mysqlstmt_wrap(JSContext* ctx, MYSQLStatement* st);
+
+/* execute() is recorded like query(), preparing a statement is not */
+static QueryStats*
+stmtcall_querystats(StatementCall* call) {
+  MYSQL* my;
+
+  if(call->stage == STMT_PREPARE || !(my = js_mysql_data(call->st->handle)))
+    return 0;
+
+  return mysql_querystats(my);
+}
+
+/* continues with the next stage as long as the calls complete without waiting */
+static void
+stmtcall_step(AsyncClosure* ac, int state, int err) {
+  StatementCall* call = ac->opaque;
+  MYSQLStatement* st = call->st;
+  JSContext* ctx = ac->ctx;
+  QueryStats* qs = stmtcall_querystats(call);
+  JSValue ret;
+
+  for(;;) {
+    if(state) {
+      asyncclosure_change_event(ac, to_asyncevent(state));
+      return;
+    }
+
+    if(err) {
+      JSValue error = js_mysqlerror_new(ctx, mysql_stmt_error(st->stmt));
+
+      if(qs)
+        querystats_end(ctx, qs, -1, 0, TRUE);
+
+      asyncclosure_error(ac, error);
+      JS_FreeValue(ctx, error);
+      return;
+    }
+
+    switch(call->stage) {
+      case STMT_PREPARE: {
+        st->param_count = mysql_stmt_param_count(st->stmt);
+        st->field_count = mysql_stmt_field_count(st->stmt);
+        st->meta = mysql_stmt_result_metadata(st->stmt);
+
+        ret = js_mysqlstmt_wrap(ctx, mysqlstmt_dup(st));
+        break;
+      }
+
+      case STMT_EXECUTE: {
+        if(st->meta) {
+          my_bool update = 1;
+
+          mysql_stmt_attr_set(st->stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update);
+          call->stage = STMT_STORE;
+          state = mysql_stmt_store_result_start(&err, st->stmt);
+          continue;
+        }
+
+        if(qs)
+          querystats_end(ctx, qs, mysql_stmt_affected_rows(st->stmt), 0, FALSE);
+
+        ret = JS_NewObject(ctx);
+        JS_SetPropertyStr(ctx, ret, "affectedRows", JS_NewInt64(ctx, mysql_stmt_affected_rows(st->stmt)));
+        JS_SetPropertyStr(ctx, ret, "insertId", JS_NewInt64(ctx, mysql_stmt_insert_id(st->stmt)));
+        break;
+      }
+
+      case STMT_STORE: {
+        if(qs)
+          querystats_end(ctx, qs, mysql_stmt_num_rows(st->stmt), 0, FALSE);
+
+        ret = stmtcall_rows(ctx, call);
+        break;
+      }
+    }
+
+    break;
+  }
+
+  if(JS_IsException(ret)) {
+    JSValue error = JS_GetException(ctx);
+    asyncclosure_error(ac, error);
+    JS_FreeValue(ctx, error);
+  } else {
+    asyncclosure_yield(ac, ret);
+    JS_FreeValue(ctx, ret);
+  }
+}
+
+static JSValue
+js_mysqlstmt_continue(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, void* ptr) {
+  AsyncClosure* ac = ptr;
+  StatementCall* call = ac->opaque;
+  MYSQL_STMT* stmt = call->st->stmt;
+  QueryStats* qs;
+  int state = 0, err = 0, wait = to_mysql_wait(ac->state);
+
+  if(!stmt) {
+    JSValue error = js_mysqlerror_new(ctx, "statement closed");
+    asyncclosure_error(ac, error);
+    JS_FreeValue(ctx, error);
+    return JS_UNDEFINED;
+  }
+
+  switch(call->stage) {
+    case STMT_PREPARE: state = mysql_stmt_prepare_cont(&err, stmt, wait); break;
+    case STMT_EXECUTE: state = mysql_stmt_execute_cont(&err, stmt, wait); break;
+    case STMT_STORE: state = mysql_stmt_store_result_cont(&err, stmt, wait); break;
+  }
+
+  if(call->stage == STMT_EXECUTE && !(state & MYSQL_WAIT_WRITE) && (qs = stmtcall_querystats(call)))
+    querystats_sent(qs);
+
+  stmtcall_step(ac, state, err);
+  return JS_UNDEFINED;
+}
+
+static JSValue
+js_mysql_prepare(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  MYSQL* my;
+  MYSQLStatement* st;
+  StatementCall* call;
+  AsyncClosure* ac;
+  const char* sql;
+  size_t len;
+  int state, err = 0;
+  JSValue ret;
+
+  if(!(my = js_mysql_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(!(sql = JS_ToCStringLen(ctx, &len, argv[0])))
+    return JS_EXCEPTION;
+
+  if(!(st = js_mallocz(ctx, sizeof(MYSQLStatement)))) {
+    JS_FreeCString(ctx, sql);
+    return JS_EXCEPTION;
+  }
+
+  st->ref_count = 1;
+  st->handle = JS_DupValue(ctx, this_val);
+  st->sql = js_strndup(ctx, sql, len);
+
+  if(!(st->stmt = mysql_stmt_init(my)) || !(call = stmtcall_new(ctx, st, STMT_PREPARE))) {
+    ret = st->stmt ? JS_EXCEPTION : JS_Throw(ctx, js_mysqlerror_new(ctx, mysql_error(my)));
+    mysqlstmt_free(JS_GetRuntime(ctx), st);
+    JS_FreeCString(ctx, sql);
+    return ret;
+  }
+
+  ac = asyncclosure_new(ctx, js_mysql_fd(ctx, this_val), WANT_NONE, JS_NULL, &js_mysqlstmt_continue);
+  asyncclosure_opaque(ac, call, stmtcall_free);
+  ret = asyncclosure_promise(ac);
+
+  call->started = TRUE;
+  st->pending++;
+
+  state = mysql_stmt_prepare_start(&err, st->stmt, sql, len);
+  JS_FreeCString(ctx, sql);
+  mysqlstmt_free(JS_GetRuntime(ctx), st);
+
+  stmtcall_step(ac, state, err);
+  return ret;
+}
+
+static MYSQLStatement*
+js_mysqlstmt_data2(JSContext* ctx, JSValueConst value) {
+  return JS_GetOpaque2(ctx, value, js_mysqlstmt_class_id);
+}
+
+static JSValue
+js_mysqlstmt_wrap(JSContext* ctx, MYSQLStatement* st) {
+  JSValue obj = JS_NewObjectProtoClass(ctx, mysqlstmt_proto, js_mysqlstmt_class_id);
+
+  if(JS_IsException(obj)) {
+    mysqlstmt_free(JS_GetRuntime(ctx), st);
+    return obj;
+  }
+
+  JS_SetOpaque(obj, st);
+  return obj;
+}
+
+static JSValue
+js_mysqlstmt_execute(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  MYSQLStatement* st;
+  StatementCall* call;
+  AsyncClosure* ac;
+  QueryStats* qs;
+  JSValue ret, args = JS_UNDEFINED;
+  uint32_t i;
+  int state, err = 0;
+
+  if(!(st = js_mysqlstmt_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(!st->stmt || st->closed || !js_mysql_data(st->handle))
+    return JS_Throw(ctx, js_mysqlerror_new(ctx, "statement closed"));
+
+  /* execute([a, b]) or execute(a, b) */
+  if(argc == 1 && JS_IsArray(ctx, argv[0])) {
+    args = JS_DupValue(ctx, argv[0]);
+    argc = js_array_length(ctx, args);
+  }
+
+  if((uint32_t)argc != st->param_count) {
+    JS_FreeValue(ctx, args);
+    return JS_ThrowRangeError(ctx, "statement has %" PRIu32 " parameters, got %d", st->param_count, argc);
+  }
+
+  if(!(call = stmtcall_new(ctx, st, STMT_EXECUTE))) {
+    JS_FreeValue(ctx, args);
+    return JS_EXCEPTION;
+  }
+
+  call->flags = js_get_propertystr_int32(ctx, st->handle, "resultType");
+
+  if(argc) {
+    call->binds = js_mallocz(ctx, sizeof(MYSQL_BIND) * argc);
+    call->values = js_mallocz(ctx, sizeof(StatementValue) * argc);
+
+    if(!call->binds || !call->values)
+      goto fail;
+
+    for(i = 0; i < (uint32_t)argc; i++) {
+      JSValue arg = JS_IsUndefined(args) ? JS_DupValue(ctx, argv[i]) : JS_GetPropertyUint32(ctx, args, i);
+      int r = stmtcall_bind(ctx, &call->binds[i], &call->values[i], arg);
+
+      JS_FreeValue(ctx, arg);
+      call->num_params = i + 1;
+
+      if(r)
+        goto fail;
+    }
+
+    if(mysql_stmt_bind_param(st->stmt, call->binds)) {
+      JS_Throw(ctx, js_mysqlerror_new(ctx, mysql_stmt_error(st->stmt)));
+      goto fail;
+    }
+  }
+
+  JS_FreeValue(ctx, args);
+
+  ac = asyncclosure_new(ctx, js_mysql_fd(ctx, st->handle), WANT_NONE, JS_NULL, &js_mysqlstmt_continue);
+  asyncclosure_opaque(ac, call, stmtcall_free);
+  ret = asyncclosure_promise(ac);
+
+  call->started = TRUE;
+  st->pending++;
+
+  if((qs = stmtcall_querystats(call)))
+    querystats_begin(ctx, qs, st->sql, strlen(st->sql));
+
+  state = mysql_stmt_execute_start(&err, st->stmt);
+
+  if(qs && !(state & MYSQL_WAIT_WRITE))
+    querystats_sent(qs);
+
+  stmtcall_step(ac, state, err);
+
+  return ret;
+
+fail:
+  JS_FreeValue(ctx, args);
+  stmtcall_free(JS_GetRuntime(ctx), call);
+  return JS_EXCEPTION;
+}
+
+static JSValue
+js_mysqlstmt_close(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  MYSQLStatement* st;
+
+  if(!(st = js_mysqlstmt_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  st->closed = TRUE;
+
+  /* an execute() in flight still needs the handle, stmtcall_free() closes it then */
+  if(st->pending == 0)
+    mysqlstmt_close(st);
+
+  return JS_UNDEFINED;
+}
+
+enum {
+  STMT_SQL = 0,
+  STMT_PARAM_COUNT,
+  STMT_FIELD_COUNT,
+};
+
+static JSValue
+js_mysqlstmt_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  MYSQLStatement* st;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(st = js_mysqlstmt_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  switch(magic) {
+    case STMT_SQL: ret = JS_NewString(ctx, st->sql ? st->sql : ""); break;
+    case STMT_PARAM_COUNT: ret = JS_NewUint32(ctx, st->param_count); break;
+    case STMT_FIELD_COUNT: ret = JS_NewUint32(ctx, st->field_count); break;
+  }
+
+  return ret;
+}
+
+static JSValue
+js_mysqlstmt_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  return JS_ThrowTypeError(ctx, "MySQLStatement is created by MySQL.prototype.prepare()");
+}
+
+static void
+js_mysqlstmt_finalizer(JSRuntime* rt, JSValue val) {
+  MYSQLStatement* st;
+
+  if((st = JS_GetOpaque(val, js_mysqlstmt_class_id)))
+    mysqlstmt_free(rt, st);
+}
+
+static JSClassDef js_mysqlstmt_class = {
+    .class_name = "MySQLStatement",
+    .finalizer = js_mysqlstmt_finalizer,
+};
+
+static const JSCFunctionListEntry js_mysqlstmt_funcs[] = {
+    JS_CFUNC_DEF("execute", 0, js_mysqlstmt_execute),
+    JS_CFUNC_DEF("close", 0, js_mysqlstmt_close),
+    JS_CGETSET_MAGIC_DEF("sql", js_mysqlstmt_get, 0, STMT_SQL),
+    JS_CGETSET_MAGIC_FLAGS_DEF("paramCount", js_mysqlstmt_get, 0, STMT_PARAM_COUNT, JS_PROP_ENUMERABLE),
+    JS_CGETSET_MAGIC_FLAGS_DEF("fieldCount", js_mysqlstmt_get, 0, STMT_FIELD_COUNT, JS_PROP_ENUMERABLE),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "MySQLStatement", JS_PROP_CONFIGURABLE),
+};
+
+/* idle, nothing in flight, and the server has not closed the socket */
+static BOOL
+mysqlpool_alive(JSContext* ctx, JSValueConst conn) {
+  MYSQL* my;
+  int fd;
+
+  if(!(my = js_mysql_data(conn)))
+    return FALSE;
+
+  if((fd = mysql_get_socket(my)) < 0 || asyncclosure_lookup(fd))
+    return FALSE;
+
+  return connpool_socket_idle(fd);
+}
+
+static const ConnPoolDriver mysqlpool_driver = {
+    &js_mysql_class_id,
+    mysqlpool_alive,
+};
+
+static JSValue
+js_mysqlpool_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  return js_connpool_new(ctx, new_target, argc, argv, &mysqlpool_driver);
+}
+
+static const JSCFunctionListEntry js_mysqlpool_funcs[] = {
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "MySQLPool", JS_PROP_CONFIGURABLE),
+};
+
+static char*
+field_id(JSContext* ctx, MYSQL_FIELD const* field) {
+  DynBuf buf;
+
+  dbuf_init2(&buf, 0, 0);
+  dbuf_put(&buf, (const uint8_t*)field->table, field->table_length);
+  dbuf_putstr(&buf, ".");
+  dbuf_put(&buf, (const uint8_t*)field->name, field->name_length);
+  dbuf_0(&buf);
+
+  return (char*)buf.buf;
+}
+
+static char*
+field_name(JSContext* ctx, MYSQL_FIELD const* field) {
+  return js_strndup(ctx, field->name, field->name_length);
 }
 
 static FieldNameFunc*
@@ -2016,14 +3153,6 @@ string_to_value(JSContext* ctx, const char* func_name, const char* s) {
   return ret;
 }
 
-static JSValue
-string_to_object(JSContext* ctx, const char* ctor_name, const char* s) {
-  JSValue ret, arg = JS_NewString(ctx, s);
-  ret = js_global_new(ctx, ctor_name, 1, &arg);
-  JS_FreeValue(ctx, arg);
-  return ret;
-}
-
 int
 js_mysql_init(JSContext* ctx, JSModuleDef* m) {
   if(js_mysql_class_id == 0) {
@@ -2063,12 +3192,31 @@ js_mysql_init(JSContext* ctx, JSModuleDef* m) {
 
     JS_SetPropertyFunctionList(ctx, mysqlresult_proto, js_mysqlresult_funcs, countof(js_mysqlresult_funcs));
     JS_SetClassProto(ctx, js_mysqlresult_class_id, mysqlresult_proto);
+
+    JS_NewClassID(&js_mysqlstmt_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_mysqlstmt_class_id, &js_mysqlstmt_class);
+
+    mysqlstmt_ctor = JS_NewCFunction2(ctx, js_mysqlstmt_constructor, "MySQLStatement", 1, JS_CFUNC_constructor, 0);
+    mysqlstmt_proto = JS_NewObject(ctx);
+
+    JS_SetPropertyFunctionList(ctx, mysqlstmt_proto, js_mysqlstmt_funcs, countof(js_mysqlstmt_funcs));
+    JS_SetClassProto(ctx, js_mysqlstmt_class_id, mysqlstmt_proto);
+
+    js_connpool_init(ctx);
+
+    mysqlpool_ctor = JS_NewCFunction2(ctx, js_mysqlpool_constructor, "MySQLPool", 2, JS_CFUNC_constructor, 0);
+    mysqlpool_proto = JS_NewObjectProto(ctx, connpool_proto);
+
+    JS_SetPropertyFunctionList(ctx, mysqlpool_proto, js_mysqlpool_funcs, countof(js_mysqlpool_funcs));
+    JS_SetConstructor(ctx, mysqlpool_ctor, mysqlpool_proto);
   }
 
   if(m) {
     JS_SetModuleExport(ctx, m, "MySQL", mysql_ctor);
     JS_SetModuleExport(ctx, m, "MySQLError", mysqlerror_ctor);
     JS_SetModuleExport(ctx, m, "MySQLResult", mysqlresult_ctor);
+    JS_SetModuleExport(ctx, m, "MySQLStatement", mysqlstmt_ctor);
+    JS_SetModuleExport(ctx, m, "MySQLPool", mysqlpool_ctor);
   }
 
   return 0;
@@ -2088,6 +3236,8 @@ JS_INIT_MODULE(JSContext* ctx, const char* module_name) {
     JS_AddModuleExport(ctx, m, "MySQL");
     JS_AddModuleExport(ctx, m, "MySQLError");
     JS_AddModuleExport(ctx, m, "MySQLResult");
+    JS_AddModuleExport(ctx, m, "MySQLStatement");
+    JS_AddModuleExport(ctx, m, "MySQLPool");
   }
 
   return m;
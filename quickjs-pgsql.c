@@ -1,5 +1,10 @@
 #include "defines.h"
 #include "quickjs-pgsql.h"
+#include "quickjs-stream.h"
+#include "columns.h"
+#include "conn-pool.h"
+#include "bulk-insert.h"
+#include "query-stats.h"
 #include "utils.h"
 #include "buffer-utils.h"
 #include "char-utils.h"
@@ -10,26 +15,32 @@
  * @{
  */
 
-VISIBLE JSClassID js_pgsqlerror_class_id = 0, js_pgconn_class_id = 0, js_pgresult_class_id = 0;
+VISIBLE JSClassID js_pgsqlerror_class_id = 0, js_pgconn_class_id = 0, js_pgresult_class_id = 0, js_pgstmt_class_id = 0, js_pgpipeline_class_id = 0;
 VISIBLE JSValue pgsqlerror_proto = {{0}, JS_TAG_UNDEFINED}, pgsqlerror_ctor = {{0}, JS_TAG_UNDEFINED}, pgsql_proto = {{0}, JS_TAG_UNDEFINED},
-                pgsql_ctor = {{0}, JS_TAG_UNDEFINED}, pgresult_proto = {{0}, JS_TAG_UNDEFINED}, pgresult_ctor = {{0}, JS_TAG_UNDEFINED};
+                pgsql_ctor = {{0}, JS_TAG_UNDEFINED}, pgresult_proto = {{0}, JS_TAG_UNDEFINED}, pgresult_ctor = {{0}, JS_TAG_UNDEFINED},
+                pgstmt_proto = {{0}, JS_TAG_UNDEFINED}, pgstmt_ctor = {{0}, JS_TAG_UNDEFINED}, pgpipeline_proto = {{0}, JS_TAG_UNDEFINED},
+                pgpool_proto = {{0}, JS_TAG_UNDEFINED}, pgpool_ctor = {{0}, JS_TAG_UNDEFINED};
 
 static JSValue js_pgresult_wrap(JSContext* ctx, PGresult* res);
-static JSValue string_to_value(JSContext* ctx, const char* func_name, const char* s);
-static JSValue string_to_object(JSContext* ctx, const char* ctor_name, const char* s);
 static void result_free(JSRuntime* rt, void* opaque, void* ptr);
 
-#define string_to_number(ctx, s) string_to_value(ctx, "Number", s);
-#define string_to_date(ctx, s) string_to_object(ctx, "Date", s);
-
 struct PGConnection;
 struct PGResult;
+struct PGStatement;
+struct PGPipeline;
+
+#define STATEMENT_BUCKETS 64
+#define STATEMENT_CACHE_SIZE 256
 
 struct PGResult {
   int ref_count;
   PGresult* result;
   struct PGConnection* conn;
   uint32_t row_index;
+  /* property names of object rows, created on first use */
+  JSAtom* atoms;
+  uint32_t num_atoms;
+  BOOL atoms_tblnam;
 };
 
 struct PGResultIterator {
@@ -43,6 +54,53 @@ struct PGConnection {
   PGconn* conn;
   BOOL nonblocking;
   struct PGResult* result;
+  /* prepared statements, least recently used first */
+  struct list_head statements, stale;
+  struct list_head buckets[STATEMENT_BUCKETS];
+  uint32_t num_statements, max_statements, statement_id;
+  /* not owned, set while in pipeline mode */
+  struct PGPipeline* pipeline;
+  /* set by instrument() */
+  QueryStats* stats;
+};
+
+struct PGStatement {
+  int ref_count;
+  /* in conn->statements, or conn->stale once evicted */
+  struct list_head link, bucket;
+  /* not owned, cleared when the statement leaves the cache */
+  struct PGConnection* conn;
+  char *name, *sql;
+  uint32_t hash;
+  BOOL prepared : 1, named : 1;
+};
+
+enum PipelineCommand {
+  PIPELINE_QUERY = 0,
+  PIPELINE_PREPARE,
+  PIPELINE_SYNC,
+};
+
+/* one per command sent, results arrive in the same order */
+struct PGPipelineWaiter {
+  struct list_head link;
+  enum PipelineCommand type;
+  struct PGStatement* stmt;
+  JSValue resolve, reject, result, error;
+};
+
+struct PGPipeline {
+  JSValue conn;
+  struct PGConnection* pq;
+  struct list_head waiters;
+  BOOL reading : 1, writing : 1, closed : 1;
+};
+
+struct PGParams {
+  int num_params;
+  const char** values;
+  int *lengths, *formats;
+  InputBuffer* buffers;
 };
 
 struct PGConnectParameters {
@@ -54,6 +112,10 @@ typedef struct PGConnection PGSQLConnection;
 typedef struct PGResult PGSQLResult;
 typedef struct PGResultIterator PGSQLResultIterator;
 typedef struct PGConnectParameters PGSQLConnectParameters;
+typedef struct PGStatement PGSQLStatement;
+typedef struct PGParams PGSQLParams;
+typedef struct PGPipeline PGSQLPipeline;
+typedef struct PGPipelineWaiter PGSQLPipelineWaiter;
 
 typedef char* FieldNameFunc(JSContext*, PGSQLResult*, int field);
 typedef JSValue RowValueFunc(JSContext*, PGSQLResult*, int, int);
@@ -80,13 +142,19 @@ enum ResultFlags {
 
 static PGSQLResult* pgresult_dup(PGSQLResult* ptr);
 static void pgresult_free(JSRuntime* rt, void* ptr, void* mem);
+static void pgresult_atoms_free(JSRuntime* rt, PGSQLResult* opaque);
 static JSValue pgresult_row(PGSQLResult* opaque, uint32_t row, RowValueFunc*, JSContext* ctx);
+static PGSQLResult* pgresult_new(JSContext* ctx);
+static JSValue result_row(JSContext* ctx, PGSQLResult* opaque, int row, int rtype);
 static int64_t pgresult_cmdtuples(PGSQLResult* opaque);
 static void pgresult_set_conn(PGSQLResult* opaque, PGSQLConnection* conn, JSContext* ctx);
 
 static JSValue js_pgresult_new(JSContext* ctx, JSValueConst proto, PGresult* res);
 static JSValue js_pgsqlerror_new(JSContext* ctx, const char* msg);
 
+static void pgstmt_free(PGSQLStatement* st, JSRuntime* rt);
+static void pgconn_statements_clear(PGSQLConnection* pq, JSRuntime* rt);
+
 static void
 connectparams_parse(JSContext* ctx, PGSQLConnectParameters* c, const char* params) {
   char* err;
@@ -213,6 +281,8 @@ js_pgconn_print_value(JSContext* ctx, PGSQLConnection* pq, DynBuf* out, JSValueC
       dbuf_putc(out, '\'');
     }
 
+    JS_FreeCString(ctx, src);
+
   } else if(js_is_date(ctx, value)) {
     size_t len;
     char* str;
@@ -254,6 +324,7 @@ js_pgconn_print_value(JSContext* ctx, PGSQLConnection* pq, DynBuf* out, JSValueC
     const char* src = JS_ToCStringLen(ctx, &len, val);
     dbuf_put(out, (const uint8_t*)src, len);
     // js_pgconn_print_value(ctx, pq, out, val);
+    JS_FreeCString(ctx, src);
     JS_FreeValue(ctx, val);
 
   } else if(js_is_arraybuffer(ctx, value)) {
@@ -403,6 +474,14 @@ pgconn_new(JSContext* ctx) {
 
   *pq = (PGSQLConnection){1, NULL, FALSE, NULL};
 
+  init_list_head(&pq->statements);
+  init_list_head(&pq->stale);
+
+  for(int i = 0; i < STATEMENT_BUCKETS; i++)
+    init_list_head(&pq->buckets[i]);
+
+  pq->max_statements = STATEMENT_CACHE_SIZE;
+
   return pq;
 }
 
@@ -419,6 +498,11 @@ pgconn_free(PGSQLConnection* pq, JSRuntime* rt) {
       pgresult_free(rt, pq->result, 0);
       pq->result = 0;
     }
+    pgconn_statements_clear(pq, rt);
+    if(pq->stats) {
+      querystats_free(rt, pq->stats);
+      pq->stats = 0;
+    }
     if(pq->conn) {
       PQfinish(pq->conn);
       pq->conn = 0;
@@ -434,7 +518,17 @@ pgconn_nonblock(PGSQLConnection* pq) {
 
 static const char*
 pgconn_error(PGSQLConnection* pq) {
-  return pgconn_error(pq);
+  return PQerrorMessage(pq->conn);
+}
+
+/* other commands would take the results of the pipeline's commands */
+static BOOL
+pgconn_pipelined(JSContext* ctx, PGSQLConnection* pq) {
+  if(!pq->pipeline)
+    return FALSE;
+
+  JS_Throw(ctx, js_pgsqlerror_new(ctx, "connection is in pipeline mode"));
+  return TRUE;
 }
 
 static void
@@ -465,6 +559,277 @@ pgconn_get_result(PGSQLConnection* pq, JSContext* ctx) {
   return JS_NULL;
 }
 
+static uint32_t
+pgstmt_hash(const char* sql) {
+  uint32_t h = 2166136261u;
+
+  while(*sql)
+    h = (h ^ (uint8_t)*sql++) * 16777619u;
+
+  return h;
+}
+
+static PGSQLStatement*
+pgstmt_new(JSContext* ctx, const char* name, const char* sql) {
+  PGSQLStatement* st;
+
+  if(!(st = js_mallocz(ctx, sizeof(PGSQLStatement))))
+    return 0;
+
+  st->ref_count = 1;
+  st->name = js_strdup(ctx, name);
+  st->sql = js_strdup(ctx, sql);
+  st->hash = pgstmt_hash(sql);
+  init_list_head(&st->link);
+  init_list_head(&st->bucket);
+
+  return st;
+}
+
+static PGSQLStatement*
+pgstmt_dup(PGSQLStatement* st) {
+  ++st->ref_count;
+  return st;
+}
+
+static void
+pgstmt_free(PGSQLStatement* st, JSRuntime* rt) {
+  if(--st->ref_count == 0) {
+    js_free_rt(rt, st->name);
+    js_free_rt(rt, st->sql);
+    js_free_rt(rt, st);
+  }
+}
+
+static PGSQLStatement*
+pgconn_statement_touch(PGSQLConnection* pq, PGSQLStatement* st) {
+  list_del(&st->link);
+  list_add_tail(&st->link, &pq->statements);
+  return st;
+}
+
+/* prepared statement with this SQL text, moved to the end of the LRU list */
+static PGSQLStatement*
+pgconn_statement_find(PGSQLConnection* pq, const char* sql) {
+  uint32_t hash = pgstmt_hash(sql);
+  struct list_head* el;
+
+  list_for_each(el, &pq->buckets[hash % STATEMENT_BUCKETS]) {
+    PGSQLStatement* st = list_entry(el, PGSQLStatement, bucket);
+
+    if(st->hash == hash && !strcmp(st->sql, sql))
+      return pgconn_statement_touch(pq, st);
+  }
+
+  return 0;
+}
+
+/* server-side statements are deallocated later, see pgconn_statements_deallocate() */
+static void
+pgconn_statement_remove(PGSQLConnection* pq, PGSQLStatement* st, JSRuntime* rt) {
+  list_del(&st->link);
+  list_del(&st->bucket);
+  init_list_head(&st->bucket);
+  st->conn = 0;
+  pq->num_statements--;
+
+  if(st->prepared && pq->conn) {
+    st->prepared = FALSE;
+    list_add_tail(&st->link, &pq->stale);
+  } else {
+    init_list_head(&st->link);
+    pgstmt_free(st, rt);
+  }
+}
+
+/* evicts unnamed statements until the cache fits max_statements */
+static void
+pgconn_statements_trim(PGSQLConnection* pq, JSRuntime* rt) {
+  struct list_head *el, *next;
+
+  list_for_each_safe(el, next, &pq->statements) {
+    PGSQLStatement* st = list_entry(el, PGSQLStatement, link);
+
+    if(pq->num_statements <= pq->max_statements)
+      break;
+
+    if(!st->named)
+      pgconn_statement_remove(pq, st, rt);
+  }
+}
+
+static void
+pgconn_statement_add(PGSQLConnection* pq, PGSQLStatement* st, JSRuntime* rt) {
+  st->conn = pq;
+  list_add_tail(&st->link, &pq->statements);
+  list_add_tail(&st->bucket, &pq->buckets[st->hash % STATEMENT_BUCKETS]);
+  pq->num_statements++;
+
+  pgconn_statements_trim(pq, rt);
+}
+
+/*
+ * Moves the evicted statements into a single DEALLOCATE command in buf, which
+ * is always initialized. Returns FALSE if there is nothing to send or if no
+ * command can be sent right now. This only happens before preparing a new
+ * statement, so a cache sized for the working set never gets here.
+ */
+static BOOL
+pgconn_statements_deallocate(PGSQLConnection* pq, JSContext* ctx, DynBuf* buf) {
+  PGTransactionStatusType status;
+
+  js_dbuf_init(ctx, buf);
+
+  if(list_empty(&pq->stale) || !pq->conn)
+    return FALSE;
+
+  status = PQtransactionStatus(pq->conn);
+
+  if(status != PQTRANS_IDLE && status != PQTRANS_INTRANS)
+    return FALSE;
+
+#ifdef LIBPQ_HAS_PIPELINING
+  if(PQpipelineStatus(pq->conn) != PQ_PIPELINE_OFF)
+    return FALSE;
+#endif
+
+  while(!list_empty(&pq->stale)) {
+    PGSQLStatement* st = list_entry(pq->stale.next, PGSQLStatement, link);
+    char* id;
+
+    if((id = PQescapeIdentifier(pq->conn, st->name, strlen(st->name)))) {
+      dbuf_putstr(buf, "DEALLOCATE ");
+      dbuf_putstr(buf, id);
+      dbuf_putstr(buf, ";");
+      PQfreemem(id);
+    }
+
+    list_del(&st->link);
+    init_list_head(&st->link);
+    pgstmt_free(st, JS_GetRuntime(ctx));
+  }
+
+  dbuf_0(buf);
+  return buf->size > 0;
+}
+
+/* blocking connections deallocate with a round-trip of their own */
+static void
+pgconn_statements_flush(PGSQLConnection* pq, JSContext* ctx) {
+  DynBuf buf;
+
+  if(pgconn_statements_deallocate(pq, ctx, &buf))
+    PQclear(PQexec(pq->conn, (const char*)buf.buf));
+
+  dbuf_free(&buf);
+}
+
+/* statements die with the session, nothing is sent to the server */
+static void
+pgconn_statements_clear(PGSQLConnection* pq, JSRuntime* rt) {
+  while(!list_empty(&pq->statements)) {
+    PGSQLStatement* st = list_entry(pq->statements.next, PGSQLStatement, link);
+
+    st->prepared = FALSE;
+    pgconn_statement_remove(pq, st, rt);
+  }
+
+  while(!list_empty(&pq->stale)) {
+    PGSQLStatement* st = list_entry(pq->stale.next, PGSQLStatement, link);
+
+    list_del(&st->link);
+    init_list_head(&st->link);
+    pgstmt_free(st, rt);
+  }
+}
+
+/*
+ * values are sent as text, ArrayBuffers and typed arrays as binary (bytea).
+ * Call pgparams_free() even when this fails.
+ */
+static int
+pgparams_init(JSContext* ctx, PGSQLParams* p, JSValueConst array) {
+  int64_t i, len = js_is_null_or_undefined(array) ? 0 : js_array_length(ctx, array);
+
+  memset(p, 0, sizeof(PGSQLParams));
+
+  if(len < 0) {
+    JS_ThrowTypeError(ctx, "parameters must be an array");
+    return -1;
+  }
+
+  if(len > 65535) {
+    JS_ThrowRangeError(ctx, "too many parameters (%" PRId64 ")", len);
+    return -1;
+  }
+
+  if(len == 0)
+    return 0;
+
+  if(!(p->values = js_mallocz(ctx, len * sizeof(char*))) || !(p->lengths = js_mallocz(ctx, len * sizeof(int))) ||
+     !(p->formats = js_mallocz(ctx, len * sizeof(int))) || !(p->buffers = js_mallocz(ctx, len * sizeof(InputBuffer))))
+    return -1;
+
+  p->num_params = len;
+
+  for(i = 0; i < len; i++) {
+    JSValue str = JS_UNDEFINED, item = JS_GetPropertyUint32(ctx, array, i);
+    InputBuffer* in = &p->buffers[i];
+
+    in->value = JS_UNDEFINED;
+
+    if(js_is_null_or_undefined(item)) {
+      p->values[i] = 0;
+    } else if(JS_IsBool(item)) {
+      p->values[i] = JS_ToBool(ctx, item) ? "t" : "f";
+      p->lengths[i] = 1;
+    } else if(js_is_arraybuffer(ctx, item) || js_is_typedarray(ctx, item)) {
+      *in = js_input_buffer(ctx, item);
+      p->values[i] = (const char*)input_buffer_data(in);
+      p->lengths[i] = input_buffer_length(in);
+      p->formats[i] = 1;
+    } else {
+      if(JS_IsString(item))
+        str = JS_DupValue(ctx, item);
+      else if(js_is_date(ctx, item))
+        str = js_invoke(ctx, item, "toISOString", 0, 0);
+      else if(JS_IsObject(item))
+        str = JS_JSONStringify(ctx, item, JS_NULL, JS_NULL);
+      else
+        str = JS_ToString(ctx, item);
+
+      if(JS_IsException(str)) {
+        in->value = JS_EXCEPTION;
+      } else {
+        *in = js_input_chars(ctx, str);
+        JS_FreeValue(ctx, str);
+        p->values[i] = (const char*)in->data;
+        p->lengths[i] = in->size;
+      }
+    }
+
+    JS_FreeValue(ctx, item);
+
+    if(JS_IsException(in->value)) {
+      p->num_params = i;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void
+pgparams_free(JSContext* ctx, PGSQLParams* p) {
+  for(int i = 0; i < p->num_params; i++)
+    input_buffer_free(&p->buffers[i], ctx);
+
+  js_free(ctx, p->values);
+  js_free(ctx, p->lengths);
+  js_free(ctx, p->formats);
+  js_free(ctx, p->buffers);
+}
+
 static char*
 pgconn_lookup_oid(PGSQLConnection* pq, Oid oid, JSContext* ctx) {
   PGresult* res;
@@ -589,6 +954,7 @@ enum {
   PROP_DB,
   PROP_PORT,
   PROP_CONNINFO,
+  PROP_STATEMENT_CACHE_SIZE,
 
   PROP_CLIENT_INFO,
   PROP_CLIENT_VERSION,
@@ -712,6 +1078,11 @@ js_pgconn_get(JSContext* ctx, JSValueConst this_val, int magic) {
 
       break;
     }
+
+    case PROP_STATEMENT_CACHE_SIZE: {
+      ret = JS_NewUint32(ctx, pq->max_statements);
+      break;
+    }
   }
 
   return ret;
@@ -747,6 +1118,17 @@ js_pgconn_set(JSContext* ctx, JSValueConst this_val, JSValueConst value, int mag
       }
       break;
     }
+
+    case PROP_STATEMENT_CACHE_SIZE: {
+      uint32_t size;
+
+      if(JS_ToUint32(ctx, &size, value))
+        return JS_EXCEPTION;
+
+      pq->max_statements = size;
+      pgconn_statements_trim(pq, JS_GetRuntime(ctx));
+      break;
+    }
   }
 
   return JS_UNDEFINED;
@@ -844,6 +1226,93 @@ js_pgconn_insert_query(JSContext* ctx, JSValueConst this_val, int argc, JSValueC
   return ret;
 }
 
+static int
+pgconn_bulk_value(JSContext* ctx, JSValueConst conn, DynBuf* out, JSValueConst value) {
+  js_pgconn_print_value(ctx, JS_GetOpaque(conn, js_pgconn_class_id), out, value);
+  return 0;
+}
+
+static void
+pgconn_bulk_identifier(JSContext* ctx, JSValueConst conn, DynBuf* out, JSValueConst name) {
+  js_pgconn_print_field(ctx, JS_GetOpaque(conn, js_pgconn_class_id), out, name);
+}
+
+static const BulkInsertDriver pgconn_bulk_driver = {
+    pgconn_bulk_value,
+    pgconn_bulk_identifier,
+};
+
+/**
+ * bulkInsert(table, columns, rows, { maxBytes })
+ */
+static JSValue
+js_pgconn_bulk_insert(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  PGSQLConnection* pq;
+
+  if(!(pq = js_pgconn_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(!pq->conn)
+    return JS_ThrowInternalError(ctx, "not connected");
+
+  return js_bulkinsert(ctx, this_val, argc, argv, &pgconn_bulk_driver, BULK_INSERT_MAX_BYTES, 0);
+}
+
+/* records the query begun last, before 'res' is handed to a PGresult object */
+static void
+pgconn_querystats_end(JSContext* ctx, PGSQLConnection* pq, PGresult* res) {
+  ExecStatusType status = res ? PQresultStatus(res) : PGRES_FATAL_ERROR;
+  int64_t rows = 0;
+
+  if(status == PGRES_TUPLES_OK || status == PGRES_SINGLE_TUPLE)
+    rows = PQntuples(res);
+  else if(res && *PQcmdTuples(res))
+    rows = atoll(PQcmdTuples(res));
+
+  querystats_end(ctx, pq->stats, rows, res ? PQresultMemorySize(res) : 0, status == PGRES_BAD_RESPONSE || status == PGRES_FATAL_ERROR);
+}
+
+/**
+ * instrument({ slowQuery, slowThreshold, maxQueries }) starts recording
+ * query(), prepare(), execute(), stream() and copyFrom()/copyTo() calls,
+ * instrument(false) stops. Commands of a pipeline() are not recorded, the
+ * stats time one command at a time.
+ */
+static JSValue
+js_pgconn_instrument(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  PGSQLConnection* pq;
+  QueryStats* qs = 0;
+
+  if(!(pq = js_pgconn_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(!(argc > 0 && JS_IsBool(argv[0]) && !JS_ToBool(ctx, argv[0])))
+    if(!(qs = querystats_new(ctx, argc > 0 ? argv[0] : JS_UNDEFINED)))
+      return JS_EXCEPTION;
+
+  if(pq->stats)
+    querystats_free(JS_GetRuntime(ctx), pq->stats);
+
+  pq->stats = qs;
+  return JS_UNDEFINED;
+}
+
+/**
+ * stats(reset = false) returns the query statistics, null when not instrumented
+ */
+static JSValue
+js_pgconn_stats(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  PGSQLConnection* pq;
+
+  if(!(pq = js_pgconn_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(!pq->stats)
+    return JS_NULL;
+
+  return querystats_snapshot(ctx, pq->stats, argc > 0 && JS_ToBool(ctx, argv[0]));
+}
+
 static JSValue
 js_pgconn_escape_string(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
   JSValue ret = JS_UNDEFINED;
@@ -1084,17 +1553,31 @@ js_pgconn_query_cont(JSContext* ctx, JSValueConst this_val, int argc, JSValueCon
     return JS_EXCEPTION;
 
   fd = PQsocket(pq->conn);
+
+  /* there is something to read, so the query has been sent */
+  if(pq->stats)
+    querystats_sent(pq->stats);
+
   ret = PQconsumeInput(pq->conn);
 
   if(ret == 0) {
     JSValue err = js_pgsqlerror_new(ctx, pgconn_error(pq));
+
+    if(pq->stats)
+      pgconn_querystats_end(ctx, pq, 0);
+
     JS_Call(ctx, data[3], JS_UNDEFINED, 1, &err);
     JS_FreeValue(ctx, err);
   } else {
 
     if(!PQisBusy(pq->conn)) {
       PGresult* res = PQgetResult(pq->conn);
-      JSValue res_val = pgconn_result(pq, res, ctx);
+      JSValue res_val;
+
+      if(pq->stats)
+        pgconn_querystats_end(ctx, pq, res);
+
+      res_val = pgconn_result(pq, res, ctx);
 
       js_iohandler_set(ctx, data[1], fd, JS_NULL);
 
@@ -1116,11 +1599,17 @@ js_pgconn_query_start(JSContext* ctx, JSValueConst this_val, int argc, JSValueCo
   const char* query = 0;
   PGSQLConnection* pq;
   int ret = 0, fd;
+  size_t len;
 
   if(!(pq = js_pgconn_data2(ctx, this_val)))
     return JS_EXCEPTION;
 
-  query = JS_ToCString(ctx, argv[0]);
+  if(!(query = JS_ToCStringLen(ctx, &len, argv[0])))
+    return JS_EXCEPTION;
+
+  if(pq->stats)
+    querystats_begin(ctx, pq->stats, query, len);
+
   ret = PQsendQuery(pq->conn, query);
   fd = PQsocket(pq->conn);
 
@@ -1128,10 +1617,19 @@ js_pgconn_query_start(JSContext* ctx, JSValueConst this_val, int argc, JSValueCo
   printf("%s ret=%d query='%s'\n", __func__, ret, query);
 #endif
 
+  JS_FreeCString(ctx, query);
+
+  if(pq->stats && ret && PQflush(pq->conn) == 0)
+    querystats_sent(pq->stats);
+
   promise = JS_NewPromiseCapability(ctx, &data[2]);
 
   if(ret == 0) {
     JSValue err = js_pgsqlerror_new(ctx, pgconn_error(pq));
+
+    if(pq->stats)
+      pgconn_querystats_end(ctx, pq, 0);
+
     JS_Call(ctx, data[3], JS_UNDEFINED, 1, &err);
     JS_FreeValue(ctx, err);
   } else {
@@ -1167,13 +1665,26 @@ js_pgconn_query(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
   if(!(pq = js_pgconn_data2(ctx, this_val)))
     return JS_EXCEPTION;
 
+  if(pgconn_pipelined(ctx, pq))
+    return JS_EXCEPTION;
+
   if(!pgconn_nonblock(pq)) {
     PGresult* res = 0;
     const char* query = 0;
     JSValue ret = JS_UNDEFINED;
+    size_t len;
+
+    if(!(query = JS_ToCStringLen(ctx, &len, argv[0])))
+      return JS_EXCEPTION;
+
+    if(pq->stats)
+      querystats_begin(ctx, pq->stats, query, len);
 
-    query = JS_ToCString(ctx, argv[0]);
     res = PQexec(pq->conn, query);
+    JS_FreeCString(ctx, query);
+
+    if(pq->stats)
+      pgconn_querystats_end(ctx, pq, res);
 
     ret = res ? pgconn_result(pq, res, ctx) : JS_NULL;
 
@@ -1186,40 +1697,1799 @@ js_pgconn_query(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
   return js_pgconn_query_start(ctx, this_val, argc, argv);
 }
 
+enum {
+  STMT_PREPARE = 0,
+  STMT_EXECUTE,
+  STMT_PREPARE_EXECUTE,
+  /* flag: evicted statements are being deallocated before the command is sent */
+  STMT_DEALLOCATE = 0x10,
+};
+
 static JSValue
-js_pgconn_close(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
-  JSValue ret = JS_UNDEFINED;
-  PGSQLConnection* pq;
+js_pgstmt_wrap(JSContext* ctx, PGSQLStatement* st) {
+  JSValue obj = JS_NewObjectProtoClass(ctx, pgstmt_proto, js_pgstmt_class_id);
 
-  if(!(pq = js_pgconn_data2(ctx, this_val)))
-    return JS_EXCEPTION;
+  if(!JS_IsException(obj))
+    JS_SetOpaque(obj, pgstmt_dup(st));
 
-  PQfinish(pq->conn);
-  pq->conn = 0;
+  return obj;
+}
 
-  return ret;
+/* returns a reference to the cached statement for sql, adding a new (unprepared) one on a miss */
+static PGSQLStatement*
+pgconn_statement(JSContext* ctx, PGSQLConnection* pq, const char* name, const char* sql) {
+  PGSQLStatement* st;
+  char buf[32];
+
+  if((st = pgconn_statement_find(pq, sql)) && (!name || !strcmp(st->name, name)))
+    return pgstmt_dup(st);
+
+  if(!name) {
+    snprintf(buf, sizeof(buf), "qjs_%" PRIu32, pq->statement_id++);
+    name = buf;
+  }
+
+  if(!(st = pgstmt_new(ctx, name, sql)))
+    return 0;
+
+  st->named = name != buf;
+  pgconn_statement_add(pq, st, JS_GetRuntime(ctx));
+
+  return pgstmt_dup(st);
 }
 
-static void
-js_pgconn_finalizer(JSRuntime* rt, JSValue val) {
-  PGSQLConnection* pq;
+static int
+pgconn_prepare_sync(JSContext* ctx, PGSQLConnection* pq, PGSQLStatement* st) {
+  PGresult* res;
 
-  if((pq = JS_GetOpaque(val, js_pgconn_class_id)))
-    pgconn_free(pq, rt);
+  if(st->prepared)
+    return 0;
+
+  pgconn_statements_flush(pq, ctx);
+
+  if(pq->stats)
+    querystats_begin(ctx, pq->stats, st->sql, strlen(st->sql));
+
+  res = PQprepare(pq->conn, st->name, st->sql, 0, 0);
+
+  if(pq->stats)
+    pgconn_querystats_end(ctx, pq, res);
+
+  if(PQresultStatus(res) != PGRES_COMMAND_OK) {
+    JS_Throw(ctx, js_pgsqlerror_new(ctx, res ? PQresultErrorMessage(res) : pgconn_error(pq)));
+    PQclear(res);
+
+    if(st->conn == pq)
+      pgconn_statement_remove(pq, st, JS_GetRuntime(ctx));
+
+    return -1;
+  }
+
+  PQclear(res);
+  st->prepared = TRUE;
+  return 0;
 }
 
-static JSClassDef js_pgconn_class = {
-    .class_name = "PGconn",
-    .finalizer = js_pgconn_finalizer,
-};
+/* returns 1 when sent, 0 on a libpq error and -1 on a JS exception */
+static int
+pgconn_send_statement(JSContext* ctx, PGSQLConnection* pq, PGSQLStatement* st, JSValueConst params, int magic) {
+  PGSQLParams p;
+  int ret = -1;
 
-static const JSCFunctionListEntry js_pgconn_funcs[] = {
-    JS_CGETSET_MAGIC_DEF("cmdTuples", js_pgconn_get, 0, PROP_CMD_TUPLES),
-    JS_CGETSET_MAGIC_DEF("affectedRows", js_pgconn_get, 0, PROP_CMD_TUPLES),
+  if(magic != STMT_EXECUTE)
+    return PQsendPrepare(pq->conn, st->name, st->sql, 0, 0);
 
-    JS_CGETSET_MAGIC_DEF("nonblocking", js_pgconn_get, js_pgconn_set, PROP_NONBLOCKING),
-    JS_CGETSET_MAGIC_DEF("fd", js_pgconn_get, 0, PROP_FD),
-    JS_CGETSET_MAGIC_DEF("errorMessage", js_pgconn_get, 0, PROP_ERROR_MESSAGE),
+  if(!pgparams_init(ctx, &p, params))
+    ret = PQsendQueryPrepared(pq->conn, st->name, p.num_params, p.values, p.lengths, p.formats, 0);
+
+  pgparams_free(ctx, &p);
+  return ret;
+}
+
+static void js_pgconn_statement_send(JSContext* ctx, PGSQLConnection* pq, int magic, JSValue data[]);
+
+static void
+js_pgconn_statement_done(JSContext* ctx, PGSQLConnection* pq, int magic, JSValue data[]) {
+  PGSQLStatement* st = JS_GetOpaque(data[4], js_pgstmt_class_id);
+
+  js_iohandler_set(ctx, data[1], PQsocket(pq->conn), JS_NULL);
+
+  if(magic == STMT_EXECUTE) {
+    /* like query(), failed statements resolve with their result */
+    value_yield(ctx, data[2], data[6]);
+    return;
+  }
+
+  if(!JS_IsUndefined(data[7])) {
+    if(st->conn == pq)
+      pgconn_statement_remove(pq, st, JS_GetRuntime(ctx));
+
+    value_yield(ctx, data[3], data[7]);
+    return;
+  }
+
+  /* evicted while it was being prepared, so nobody else will deallocate it */
+  if(st->conn != pq) {
+    if(pq->conn)
+      list_add_tail(&pgstmt_dup(st)->link, &pq->stale);
+  } else {
+    st->prepared = TRUE;
+  }
+
+  if(magic == STMT_PREPARE)
+    value_yield(ctx, data[2], data[4]);
+  else
+    js_pgconn_statement_send(ctx, pq, STMT_EXECUTE, data);
+}
+
+static JSValue
+js_pgconn_statement_cont(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  PGSQLConnection* pq;
+  PGresult* res;
+
+  if(!(pq = js_pgconn_data2(ctx, data[0])))
+    return JS_EXCEPTION;
+
+  if(pq->stats && !(magic & STMT_DEALLOCATE))
+    querystats_sent(pq->stats);
+
+  if(!PQconsumeInput(pq->conn)) {
+    if(pq->stats && !(magic & STMT_DEALLOCATE))
+      pgconn_querystats_end(ctx, pq, 0);
+
+    js_iohandler_set(ctx, data[1], PQsocket(pq->conn), JS_NULL);
+    value_yield_free(ctx, data[3], js_pgsqlerror_new(ctx, pgconn_error(pq)));
+    return JS_UNDEFINED;
+  }
+
+  /* the command is complete when PQgetResult() returns NULL */
+  while(!PQisBusy(pq->conn)) {
+    if(!(res = PQgetResult(pq->conn))) {
+      if(magic & STMT_DEALLOCATE)
+        js_pgconn_statement_send(ctx, pq, magic & ~STMT_DEALLOCATE, data);
+      else
+        js_pgconn_statement_done(ctx, pq, magic, data);
+      break;
+    }
+
+    /* a failed DEALLOCATE only leaves a statement behind on the server */
+    if(magic & STMT_DEALLOCATE) {
+      PQclear(res);
+      continue;
+    }
+
+    if(PQresultStatus(res) == PGRES_FATAL_ERROR && JS_IsUndefined(data[7]))
+      data[7] = js_pgsqlerror_new(ctx, PQresultErrorMessage(res));
+
+    if(pq->stats)
+      pgconn_querystats_end(ctx, pq, res);
+
+    if(magic == STMT_EXECUTE) {
+      JS_FreeValue(ctx, data[6]);
+      data[6] = pgconn_result(pq, res, ctx);
+    } else {
+      PQclear(res);
+    }
+  }
+
+#ifdef DEBUG_OUTPUT
+  printf("%s fd=%i pq=%p magic=%d error='%s'\n", __func__, PQsocket(pq->conn), pq, magic, pgconn_error(pq));
+#endif
+
+  return JS_UNDEFINED;
+}
+
+static void
+js_pgconn_statement_send(JSContext* ctx, PGSQLConnection* pq, int magic, JSValue data[]) {
+  PGSQLStatement* st = JS_GetOpaque(data[4], js_pgstmt_class_id);
+  DynBuf buf;
+  int ret;
+
+  js_dbuf_init(ctx, &buf);
+
+  /* evicted statements are deallocated ahead of the next prepare, without blocking */
+  if(magic != STMT_EXECUTE && pgconn_statements_deallocate(pq, ctx, &buf)) {
+    ret = PQsendQuery(pq->conn, (const char*)buf.buf);
+    magic |= STMT_DEALLOCATE;
+  } else {
+    if(pq->stats)
+      querystats_begin(ctx, pq->stats, st->sql, strlen(st->sql));
+
+    ret = pgconn_send_statement(ctx, pq, st, data[5], magic);
+
+    if(pq->stats && ret <= 0)
+      pgconn_querystats_end(ctx, pq, 0);
+    else if(pq->stats && PQflush(pq->conn) == 0)
+      querystats_sent(pq->stats);
+  }
+
+  dbuf_free(&buf);
+
+  switch(ret) {
+    case -1: {
+      value_yield_free(ctx, data[3], JS_GetException(ctx));
+      break;
+    }
+
+    case 0: {
+      value_yield_free(ctx, data[3], js_pgsqlerror_new(ctx, pgconn_error(pq)));
+      break;
+    }
+
+    default: {
+      JSValue handler = JS_NewCFunctionData(ctx, js_pgconn_statement_cont, 0, magic, 8, data);
+
+      if(!js_iohandler_set(ctx, data[1], PQsocket(pq->conn), handler))
+        JS_Call(ctx, data[3], JS_UNDEFINED, 0, 0);
+
+      break;
+    }
+  }
+}
+
+/* data: [this, setReadHandler, resolve, reject, statement, params, result, error] */
+static JSValue
+js_pgconn_statement_start(JSContext* ctx, JSValueConst this_val, PGSQLStatement* st, JSValueConst params, int magic) {
+  PGSQLConnection* pq = js_pgconn_data2(ctx, this_val);
+  JSValue promise, data[8];
+
+  promise = JS_NewPromiseCapability(ctx, &data[2]);
+
+  data[0] = JS_DupValue(ctx, this_val);
+  data[1] = js_iohandler_fn(ctx, FALSE);
+  data[4] = js_pgstmt_wrap(ctx, st);
+  data[5] = JS_DupValue(ctx, params);
+  data[6] = JS_NULL;
+  data[7] = JS_UNDEFINED;
+
+  if(magic == STMT_PREPARE && st->prepared)
+    value_yield(ctx, data[2], data[4]);
+  else
+    js_pgconn_statement_send(ctx, pq, magic, data);
+
+  for(size_t i = 0; i < countof(data); i++)
+    JS_FreeValue(ctx, data[i]);
+
+  return promise;
+}
+
+static JSValue
+js_pgconn_prepare(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  PGSQLConnection* pq;
+  PGSQLStatement* st;
+  const char *name = 0, *sql;
+  JSValue ret;
+
+  if(!(pq = js_pgconn_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(pgconn_pipelined(ctx, pq))
+    return JS_EXCEPTION;
+
+  if(argc > 1 && !js_is_null_or_undefined(argv[0]) && !(name = JS_ToCString(ctx, argv[0])))
+    return JS_EXCEPTION;
+
+  if(!(sql = JS_ToCString(ctx, argv[argc > 1 ? 1 : 0]))) {
+    if(name)
+      JS_FreeCString(ctx, name);
+    return JS_EXCEPTION;
+  }
+
+  st = pgconn_statement(ctx, pq, name, sql);
+
+  if(name)
+    JS_FreeCString(ctx, name);
+  JS_FreeCString(ctx, sql);
+
+  if(!st)
+    return JS_EXCEPTION;
+
+  if(!pgconn_nonblock(pq))
+    ret = pgconn_prepare_sync(ctx, pq, st) ? JS_EXCEPTION : js_pgstmt_wrap(ctx, st);
+  else
+    ret = js_pgconn_statement_start(ctx, this_val, st, JS_UNDEFINED, STMT_PREPARE);
+
+  pgstmt_free(st, JS_GetRuntime(ctx));
+  return ret;
+}
+
+static JSValue
+js_pgconn_execute(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  PGSQLConnection* pq;
+  PGSQLStatement *st, *arg;
+  JSValue ret = JS_EXCEPTION;
+
+  if(!(pq = js_pgconn_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(pgconn_pipelined(ctx, pq))
+    return JS_EXCEPTION;
+
+  /* plain query without parameters, execute() used to be an alias of query() */
+  if(argc < 2 && JS_IsString(argv[0]))
+    return js_pgconn_query(ctx, this_val, argc, argv);
+
+  if((arg = JS_GetOpaque(argv[0], js_pgstmt_class_id))) {
+    /* evicted or from another connection: prepare again */
+    st = arg->conn == pq ? pgstmt_dup(pgconn_statement_touch(pq, arg)) : pgconn_statement(ctx, pq, arg->named ? arg->name : 0, arg->sql);
+  } else {
+    const char* sql;
+
+    if(!(sql = JS_ToCString(ctx, argv[0])))
+      return JS_EXCEPTION;
+
+    st = pgconn_statement(ctx, pq, 0, sql);
+    JS_FreeCString(ctx, sql);
+  }
+
+  if(!st)
+    return JS_EXCEPTION;
+
+  if(!pgconn_nonblock(pq)) {
+    PGSQLParams p;
+
+    if(!pgconn_prepare_sync(ctx, pq, st)) {
+      if(!pgparams_init(ctx, &p, argc > 1 ? argv[1] : JS_UNDEFINED)) {
+        PGresult* res;
+
+        if(pq->stats)
+          querystats_begin(ctx, pq->stats, st->sql, strlen(st->sql));
+
+        res = PQexecPrepared(pq->conn, st->name, p.num_params, p.values, p.lengths, p.formats, 0);
+
+        if(pq->stats)
+          pgconn_querystats_end(ctx, pq, res);
+
+        ret = res ? pgconn_result(pq, res, ctx) : JS_NULL;
+      }
+
+      pgparams_free(ctx, &p);
+    }
+  } else {
+    ret = js_pgconn_statement_start(ctx, this_val, st, argc > 1 ? argv[1] : JS_UNDEFINED, st->prepared ? STMT_EXECUTE : STMT_PREPARE_EXECUTE);
+  }
+
+  pgstmt_free(st, JS_GetRuntime(ctx));
+  return ret;
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+static void
+pipeline_waiter_free(JSContext* ctx, PGSQLPipelineWaiter* w) {
+  list_del(&w->link);
+
+  if(w->stmt)
+    pgstmt_free(w->stmt, JS_GetRuntime(ctx));
+
+  JS_FreeValue(ctx, w->resolve);
+  JS_FreeValue(ctx, w->reject);
+  JS_FreeValue(ctx, w->result);
+  JS_FreeValue(ctx, w->error);
+  js_free(ctx, w);
+}
+
+static PGSQLPipelineWaiter*
+pipeline_waiter_push(JSContext* ctx, PGSQLPipeline* pl, enum PipelineCommand type, JSValue* promise) {
+  PGSQLPipelineWaiter* w;
+  JSValue funcs[2] = {JS_UNDEFINED, JS_UNDEFINED};
+
+  if(!(w = js_mallocz(ctx, sizeof(PGSQLPipelineWaiter))))
+    return 0;
+
+  if(promise)
+    *promise = JS_NewPromiseCapability(ctx, funcs);
+
+  w->type = type;
+  w->resolve = funcs[0];
+  w->reject = funcs[1];
+  w->result = JS_NULL;
+  w->error = JS_UNDEFINED;
+  list_add_tail(&w->link, &pl->waiters);
+
+  return w;
+}
+
+static JSValue js_pgpipeline_io(JSContext*, JSValueConst, int, JSValueConst[], int, JSValue[]);
+
+/* the read handler is armed while results are outstanding, the write handler while libpq has unsent data */
+static void
+pipeline_arm(JSContext* ctx, PGSQLPipeline* pl, JSValueConst obj) {
+  BOOL reading = !list_empty(&pl->waiters), writing = FALSE;
+  int fd = PQsocket(pl->pq->conn);
+
+  if(pl->pq->conn && reading)
+    writing = PQflush(pl->pq->conn) == 1;
+
+  if(reading != pl->reading) {
+    JSValue fn = js_iohandler_fn(ctx, FALSE);
+
+    if(js_iohandler_set(ctx, fn, fd, reading ? JS_NewCFunctionData(ctx, js_pgpipeline_io, 0, FALSE, 1, (JSValue*)&obj) : JS_NULL))
+      pl->reading = reading;
+
+    JS_FreeValue(ctx, fn);
+  }
+
+  if(writing != pl->writing) {
+    JSValue fn = js_iohandler_fn(ctx, TRUE);
+
+    if(js_iohandler_set(ctx, fn, fd, writing ? JS_NewCFunctionData(ctx, js_pgpipeline_io, 0, TRUE, 1, (JSValue*)&obj) : JS_NULL))
+      pl->writing = writing;
+
+    JS_FreeValue(ctx, fn);
+  }
+}
+
+static void
+pipeline_close(JSContext* ctx, PGSQLPipeline* pl) {
+  if(pl->closed)
+    return;
+
+  pl->closed = TRUE;
+
+  if(pl->pq->conn)
+    PQexitPipelineMode(pl->pq->conn);
+
+  if(pl->pq->pipeline == pl)
+    pl->pq->pipeline = 0;
+}
+
+static void
+pipeline_settle(JSContext* ctx, PGSQLPipeline* pl, PGSQLPipelineWaiter* w) {
+  BOOL failed = !JS_IsUndefined(w->error);
+
+  switch(w->type) {
+    case PIPELINE_PREPARE: {
+      if(failed && w->stmt->conn == pl->pq) {
+        w->stmt->prepared = FALSE;
+        pgconn_statement_remove(pl->pq, w->stmt, JS_GetRuntime(ctx));
+      }
+      break;
+    }
+
+    case PIPELINE_SYNC: {
+      pipeline_close(ctx, pl);
+      break;
+    }
+
+    case PIPELINE_QUERY: break;
+  }
+
+  if(!JS_IsUndefined(w->resolve))
+    value_yield(ctx, failed ? w->reject : w->resolve, failed ? w->error : w->result);
+
+  pipeline_waiter_free(ctx, w);
+}
+
+/* fails every outstanding command, used when the connection is lost */
+static void
+pipeline_abort(JSContext* ctx, PGSQLPipeline* pl, const char* msg) {
+  while(!list_empty(&pl->waiters)) {
+    PGSQLPipelineWaiter* w = list_entry(pl->waiters.next, PGSQLPipelineWaiter, link);
+
+    if(JS_IsUndefined(w->error))
+      w->error = js_pgsqlerror_new(ctx, msg);
+
+    pipeline_settle(ctx, pl, w);
+  }
+
+  pipeline_close(ctx, pl);
+}
+
+/* hands each result to the command at the head of the queue */
+static void
+pipeline_process(JSContext* ctx, PGSQLPipeline* pl) {
+  PGconn* conn = pl->pq->conn;
+
+  while(!list_empty(&pl->waiters) && !PQisBusy(conn)) {
+    PGSQLPipelineWaiter* w = list_entry(pl->waiters.next, PGSQLPipelineWaiter, link);
+    PGresult* res = PQgetResult(conn);
+
+    if(w->type == PIPELINE_SYNC) {
+      /* there is no NULL after PGRES_PIPELINE_SYNC */
+      if(!res)
+        break;
+
+      PQclear(res);
+      pipeline_settle(ctx, pl, w);
+      continue;
+    }
+
+    if(!res) {
+      pipeline_settle(ctx, pl, w);
+      continue;
+    }
+
+    switch(PQresultStatus(res)) {
+      case PGRES_PIPELINE_ABORTED:
+      case PGRES_FATAL_ERROR: {
+        if(JS_IsUndefined(w->error))
+          w->error = js_pgsqlerror_new(ctx, PQresultStatus(res) == PGRES_FATAL_ERROR ? PQresultErrorMessage(res) : "pipeline aborted by an earlier error");
+
+        PQclear(res);
+        break;
+      }
+
+      default: {
+        if(w->type == PIPELINE_QUERY) {
+          JS_FreeValue(ctx, w->result);
+          w->result = pgconn_result(pl->pq, res, ctx);
+        } else {
+          PQclear(res);
+        }
+        break;
+      }
+    }
+  }
+}
+
+static JSValue
+js_pgpipeline_io(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  PGSQLPipeline* pl;
+
+  if(!(pl = JS_GetOpaque2(ctx, data[0], js_pgpipeline_class_id)))
+    return JS_EXCEPTION;
+
+  if(!magic) {
+    if(!PQconsumeInput(pl->pq->conn))
+      pipeline_abort(ctx, pl, pgconn_error(pl->pq));
+    else
+      pipeline_process(ctx, pl);
+  }
+
+  pipeline_arm(ctx, pl, data[0]);
+
+  return JS_UNDEFINED;
+}
+
+static PGSQLPipeline*
+js_pgpipeline_data2(JSContext* ctx, JSValueConst value) {
+  PGSQLPipeline* pl;
+
+  if(!(pl = JS_GetOpaque2(ctx, value, js_pgpipeline_class_id)))
+    return 0;
+
+  if(pl->closed || !pl->pq->conn) {
+    JS_ThrowInternalError(ctx, "pipeline has ended");
+    return 0;
+  }
+
+  return pl;
+}
+
+/* a command has been sent but can not be tracked, its results would go to the commands after it */
+static JSValue
+pipeline_fail(JSContext* ctx, PGSQLPipeline* pl, JSValue error) {
+  pipeline_abort(ctx, pl, "pipeline aborted");
+  return JS_Throw(ctx, error);
+}
+
+enum {
+  PIPELINE_METHOD_QUERY,
+  PIPELINE_METHOD_EXECUTE,
+};
+
+static JSValue
+js_pgpipeline_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  PGSQLPipeline* pl;
+  PGSQLStatement *st = 0, *arg;
+  PGSQLParams p;
+  PGSQLPipelineWaiter* w;
+  PGconn* conn;
+  JSValue promise = JS_UNDEFINED;
+  int ret = 0;
+
+  if(!(pl = js_pgpipeline_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  conn = pl->pq->conn;
+
+  if(magic == PIPELINE_METHOD_EXECUTE) {
+    if((arg = JS_GetOpaque(argv[0], js_pgstmt_class_id))) {
+      st = arg->conn == pl->pq ? pgstmt_dup(pgconn_statement_touch(pl->pq, arg)) : pgconn_statement(ctx, pl->pq, arg->named ? arg->name : 0, arg->sql);
+    } else {
+      const char* sql;
+
+      if(!(sql = JS_ToCString(ctx, argv[0])))
+        return JS_EXCEPTION;
+
+      st = pgconn_statement(ctx, pl->pq, 0, sql);
+      JS_FreeCString(ctx, sql);
+    }
+
+    if(!st)
+      return JS_EXCEPTION;
+
+    /* the statement counts as prepared from here on, later commands in the pipeline can use it */
+    if(!st->prepared) {
+      if(!PQsendPrepare(conn, st->name, st->sql, 0, 0)) {
+        pgstmt_free(st, JS_GetRuntime(ctx));
+        return JS_Throw(ctx, js_pgsqlerror_new(ctx, pgconn_error(pl->pq)));
+      }
+
+      if(!(w = pipeline_waiter_push(ctx, pl, PIPELINE_PREPARE, 0))) {
+        pgstmt_free(st, JS_GetRuntime(ctx));
+        promise = pipeline_fail(ctx, pl, JS_GetException(ctx));
+        pipeline_arm(ctx, pl, this_val);
+        return promise;
+      }
+
+      w->stmt = pgstmt_dup(st);
+      st->prepared = TRUE;
+    }
+  }
+
+  if(!pgparams_init(ctx, &p, argc > 1 ? argv[1] : JS_UNDEFINED)) {
+    if(st) {
+      ret = PQsendQueryPrepared(conn, st->name, p.num_params, p.values, p.lengths, p.formats, 0);
+    } else {
+      const char* sql;
+
+      if((sql = JS_ToCString(ctx, argv[0]))) {
+        ret = PQsendQueryParams(conn, sql, p.num_params, 0, p.values, p.lengths, p.formats, 0);
+        JS_FreeCString(ctx, sql);
+      }
+    }
+
+    if(!ret)
+      promise = JS_Throw(ctx, js_pgsqlerror_new(ctx, pgconn_error(pl->pq)));
+    else if(!PQsendFlushRequest(conn))
+      promise = pipeline_fail(ctx, pl, js_pgsqlerror_new(ctx, pgconn_error(pl->pq)));
+    else if(!pipeline_waiter_push(ctx, pl, PIPELINE_QUERY, &promise))
+      promise = pipeline_fail(ctx, pl, JS_GetException(ctx));
+  } else {
+    promise = JS_EXCEPTION;
+  }
+
+  pgparams_free(ctx, &p);
+
+  if(st)
+    pgstmt_free(st, JS_GetRuntime(ctx));
+
+  pipeline_arm(ctx, pl, this_val);
+
+  return promise;
+}
+
+/* settles the callback's promise: magic 0 = fulfilled, 1 = rejected. data: [pipeline, resolve, reject] */
+static JSValue
+js_pgpipeline_done(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  PGSQLPipeline* pl;
+  PGSQLPipelineWaiter* w;
+  JSValue value = argc > 0 ? argv[0] : JS_UNDEFINED;
+
+  if(!(pl = JS_GetOpaque2(ctx, data[0], js_pgpipeline_class_id)))
+    return JS_EXCEPTION;
+
+  if(pl->closed || !pl->pq->conn) {
+    value_yield(ctx, data[magic ? 2 : 1], value);
+    return JS_UNDEFINED;
+  }
+
+  if(!(w = pipeline_waiter_push(ctx, pl, PIPELINE_SYNC, 0)))
+    return JS_EXCEPTION;
+
+  w->resolve = JS_DupValue(ctx, data[1]);
+  w->reject = JS_DupValue(ctx, data[2]);
+
+  if(magic)
+    w->error = JS_DupValue(ctx, value);
+  else
+    w->result = JS_DupValue(ctx, value);
+
+  if(!PQpipelineSync(pl->pq->conn))
+    pipeline_abort(ctx, pl, pgconn_error(pl->pq));
+  else
+    pipeline_arm(ctx, pl, data[0]);
+
+  return JS_UNDEFINED;
+}
+
+static JSValue
+js_pgconn_pipeline(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  PGSQLConnection* pq;
+  PGSQLPipeline* pl;
+  JSValue obj, ret, tmp, promise, data[3], funcs[2];
+
+  if(!(pq = js_pgconn_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(!JS_IsFunction(ctx, argv[0]))
+    return JS_ThrowTypeError(ctx, "argument 1 must be a function");
+
+  if(!pq->conn || !pgconn_nonblock(pq))
+    return JS_ThrowInternalError(ctx, "pipeline() needs a nonblocking connection");
+
+  if(pq->pipeline || !PQenterPipelineMode(pq->conn))
+    return JS_Throw(ctx, js_pgsqlerror_new(ctx, pq->pipeline ? "already in pipeline mode" : pgconn_error(pq)));
+
+  if(!(pl = js_mallocz(ctx, sizeof(PGSQLPipeline)))) {
+    PQexitPipelineMode(pq->conn);
+    return JS_EXCEPTION;
+  }
+
+  pl->conn = JS_DupValue(ctx, this_val);
+  pl->pq = pq;
+  init_list_head(&pl->waiters);
+  pq->pipeline = pl;
+
+  obj = JS_NewObjectProtoClass(ctx, pgpipeline_proto, js_pgpipeline_class_id);
+  JS_SetOpaque(obj, pl);
+
+  promise = JS_NewPromiseCapability(ctx, &data[1]);
+  data[0] = obj;
+
+  ret = JS_Call(ctx, argv[0], JS_UNDEFINED, 1, &obj);
+
+  if(JS_IsException(ret)) {
+    JSValue error = JS_GetException(ctx);
+
+    ret = js_promise_reject(ctx, error);
+    JS_FreeValue(ctx, error);
+  } else {
+    tmp = ret;
+    ret = js_promise_resolve(ctx, tmp);
+    JS_FreeValue(ctx, tmp);
+  }
+
+  funcs[0] = JS_NewCFunctionData(ctx, js_pgpipeline_done, 1, 0, countof(data), data);
+  funcs[1] = JS_NewCFunctionData(ctx, js_pgpipeline_done, 1, 1, countof(data), data);
+
+  tmp = js_invoke(ctx, ret, "then", 2, funcs);
+
+  JS_FreeValue(ctx, tmp);
+  JS_FreeValue(ctx, ret);
+  JS_FreeValue(ctx, funcs[0]);
+  JS_FreeValue(ctx, funcs[1]);
+
+  for(size_t i = 0; i < countof(data); i++)
+    JS_FreeValue(ctx, data[i]);
+
+  return promise;
+}
+
+static void
+js_pgpipeline_finalizer(JSRuntime* rt, JSValue val) {
+  PGSQLPipeline* pl;
+
+  if((pl = JS_GetOpaque(val, js_pgpipeline_class_id))) {
+    /* handlers keep the object alive while commands are outstanding */
+    if(pl->pq->pipeline == pl)
+      pl->pq->pipeline = 0;
+
+    JS_FreeValueRT(rt, pl->conn);
+    js_free_rt(rt, pl);
+  }
+}
+
+static JSClassDef js_pgpipeline_class = {
+    .class_name = "PGpipeline",
+    .finalizer = js_pgpipeline_finalizer,
+};
+
+static const JSCFunctionListEntry js_pgpipeline_funcs[] = {
+    JS_CFUNC_MAGIC_DEF("query", 1, js_pgpipeline_method, PIPELINE_METHOD_QUERY),
+    JS_CFUNC_MAGIC_DEF("execute", 2, js_pgpipeline_method, PIPELINE_METHOD_EXECUTE),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "PGpipeline", JS_PROP_CONFIGURABLE),
+};
+#endif /* defined(LIBPQ_HAS_PIPELINING) */
+
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+/* cancel request in progress, driven by PQcancelPoll() from the I/O handlers */
+struct PGCancel {
+  int ref_count;
+  JSContext* ctx;
+  PGcancelConn* conn;
+  int fd;
+  BOOL writing;
+};
+
+typedef struct PGCancel PGSQLCancel;
+
+static PGSQLCancel*
+pgcancel_dup(PGSQLCancel* c) {
+  ++c->ref_count;
+  return c;
+}
+
+static void
+pgcancel_free(void* ptr) {
+  PGSQLCancel* c = ptr;
+
+  if(--c->ref_count == 0) {
+    if(c->conn)
+      PQcancelFinish(c->conn);
+
+    js_free(c->ctx, c);
+  }
+}
+
+static JSValue js_pgcancel_ready(JSContext*, JSValueConst, int, JSValueConst[], int, void*);
+
+static void
+pgcancel_poll(PGSQLCancel* c) {
+  JSContext* ctx = c->ctx;
+  PostgresPollingStatusType status = PQcancelPoll(c->conn);
+  JSValue fn;
+
+  if(c->fd != -1) {
+    fn = js_iohandler_fn(ctx, c->writing);
+    js_iohandler_set(ctx, fn, c->fd, JS_NULL);
+    JS_FreeValue(ctx, fn);
+    c->fd = -1;
+  }
+
+  /* once it has succeeded or failed, the last reference is dropped and the request freed */
+  if(status == PGRES_POLLING_READING || status == PGRES_POLLING_WRITING) {
+    c->writing = status == PGRES_POLLING_WRITING;
+    fn = js_iohandler_fn(ctx, c->writing);
+
+    if(js_iohandler_set(ctx, fn, PQcancelSocket(c->conn), js_function_cclosure(ctx, js_pgcancel_ready, 0, 0, pgcancel_dup(c), pgcancel_free)))
+      c->fd = PQcancelSocket(c->conn);
+
+    JS_FreeValue(ctx, fn);
+  }
+}
+
+static JSValue
+js_pgcancel_ready(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, void* ptr) {
+  pgcancel_poll(ptr);
+  return JS_UNDEFINED;
+}
+#endif
+
+/**
+ * Asks the server to cancel the command in progress, without waiting for the
+ * outcome: the results of the command tell whether it has been cancelled.
+ * With libpq 17 the request is sent without blocking. Before that, PQcancel()
+ * blocks until the cancel request has been delivered, which takes a separate
+ * connection to the server.
+ */
+static void
+pgconn_cancel(JSContext* ctx, PGSQLConnection* pq) {
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+  PGSQLCancel* c;
+
+  if(!(c = js_mallocz(ctx, sizeof(PGSQLCancel))))
+    return;
+
+  c->ref_count = 1;
+  c->ctx = ctx;
+  c->fd = -1;
+
+  if((c->conn = PQcancelCreate(pq->conn)) && PQcancelStart(c->conn))
+    pgcancel_poll(c);
+
+  pgcancel_free(c);
+#else
+  PGcancel* cancel;
+  char errbuf[256];
+
+  if((cancel = PQgetCancel(pq->conn))) {
+    PQcancel(cancel, errbuf, sizeof(errbuf));
+    PQfreeCancel(cancel);
+  }
+#endif
+}
+
+enum {
+  ROWS_NEXT = 0,
+  ROWS_RETURN,
+  ROWS_ITERATOR,
+  ROWS_READABLE,
+};
+
+/*
+ * Result of pq.stream(): rows are fetched in single-row mode (or chunked rows
+ * mode, where libpq has it) and only as far as next() asks for them, so the
+ * server is held back by the socket instead of the client buffering it all.
+ */
+struct PGRowStream {
+  int ref_count;
+  JSContext* ctx;
+  JSValue conn;
+  PGSQLConnection* pq;
+  /* rows received but not yet yielded, reused for each chunk so the row shape is kept */
+  PGSQLResult* chunk;
+  JSValue funcs[2];
+  JSValue error;
+  uint32_t batch;
+  int rtype;
+  /* rows received so far, for the query stats */
+  uint64_t count;
+  BOOL done : 1, cancelled : 1, reading : 1, recorded : 1;
+};
+
+typedef struct PGRowStream PGSQLRowStream;
+
+static JSValue js_pgrows_method(JSContext*, JSValueConst, int, JSValueConst[], int, void*);
+
+static PGSQLRowStream*
+pgrows_dup(PGSQLRowStream* rows) {
+  ++rows->ref_count;
+  return rows;
+}
+
+static void
+pgrows_free(void* ptr) {
+  PGSQLRowStream* rows = ptr;
+
+  if(--rows->ref_count == 0) {
+    JSContext* ctx = rows->ctx;
+
+    if(rows->chunk)
+      pgresult_free(JS_GetRuntime(ctx), rows->chunk, 0);
+
+    JS_FreeValue(ctx, rows->funcs[0]);
+    JS_FreeValue(ctx, rows->funcs[1]);
+    JS_FreeValue(ctx, rows->error);
+    JS_FreeValue(ctx, rows->conn);
+    js_free(ctx, rows);
+  }
+}
+
+static void
+pgrows_wait(PGSQLRowStream* rows, BOOL on) {
+  JSContext* ctx = rows->ctx;
+  JSValue fn;
+
+  if(on == rows->reading)
+    return;
+
+  fn = js_iohandler_fn(ctx, FALSE);
+
+  if(js_iohandler_set(ctx, fn, PQsocket(rows->pq->conn), on ? js_function_cclosure(ctx, js_pgrows_method, 0, ROWS_READABLE, pgrows_dup(rows), pgrows_free) : JS_NULL))
+    rows->reading = on;
+
+  JS_FreeValue(ctx, fn);
+}
+
+static void
+pgrows_settle(PGSQLRowStream* rows, BOOL reject, JSValueConst value, BOOL done) {
+  JSContext* ctx = rows->ctx;
+  JSValue funcs[2] = {rows->funcs[0], rows->funcs[1]};
+
+  rows->funcs[0] = rows->funcs[1] = JS_UNDEFINED;
+
+  if(reject)
+    value_yield(ctx, funcs[1], value);
+  else
+    value_yield_free(ctx, funcs[0], js_iterator_result(ctx, value, done));
+
+  JS_FreeValue(ctx, funcs[0]);
+  JS_FreeValue(ctx, funcs[1]);
+}
+
+/* settles the pending next() with a row, a batch of rows or the end of the result */
+static void
+pgrows_pump(PGSQLRowStream* rows) {
+  JSContext* ctx = rows->ctx;
+  PGconn* conn = rows->pq->conn;
+  JSValue batch = JS_UNDEFINED;
+  uint32_t n = 0;
+
+  for(;;) {
+    PGresult* res;
+
+    if(rows->chunk && rows->chunk->result) {
+      uint32_t ntuples = PQntuples(rows->chunk->result);
+
+      while(rows->chunk->row_index < ntuples) {
+        JSValue row = result_row(ctx, rows->chunk, rows->chunk->row_index++, rows->rtype);
+
+        if(!rows->batch) {
+          pgrows_settle(rows, FALSE, row, FALSE);
+          JS_FreeValue(ctx, row);
+          return;
+        }
+
+        if(n == 0)
+          batch = JS_NewArray(ctx);
+
+        JS_SetPropertyUint32(ctx, batch, n++, row);
+
+        if(n >= rows->batch)
+          goto yield;
+      }
+
+      PQclear(rows->chunk->result);
+      rows->chunk->result = 0;
+      rows->chunk->row_index = 0;
+    }
+
+    if(rows->done)
+      break;
+
+    /* a batch goes out with the rows at hand rather than waiting for more */
+    if(pgconn_nonblock(rows->pq) && PQisBusy(conn)) {
+      if(n)
+        goto yield;
+
+      pgrows_wait(rows, TRUE);
+      return;
+    }
+
+    if(!(res = PQgetResult(conn))) {
+      rows->done = TRUE;
+
+      if(rows->pq->stats)
+        querystats_rows(rows->pq->stats, rows, rows->count);
+      break;
+    }
+
+    /* the time to the first result is recorded, the rows follow once all have been read */
+    if(rows->pq->stats && !rows->recorded) {
+      ExecStatusType status = PQresultStatus(res);
+
+      rows->recorded = TRUE;
+      querystats_end(ctx, rows->pq->stats, -1, PQresultMemorySize(res), status == PGRES_BAD_RESPONSE || status == PGRES_FATAL_ERROR);
+      querystats_defer(rows->pq->stats, rows);
+    }
+
+    rows->count += PQntuples(res);
+
+    switch(PQresultStatus(res)) {
+      case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+      case PGRES_TUPLES_CHUNK:
+#endif
+      {
+        if(!rows->cancelled && (rows->chunk || (rows->chunk = pgresult_new(ctx)))) {
+          rows->chunk->result = res;
+          res = 0;
+        }
+        break;
+      }
+
+      case PGRES_FATAL_ERROR: {
+        if(!rows->cancelled && JS_IsUndefined(rows->error))
+          rows->error = js_pgsqlerror_new(ctx, PQresultErrorMessage(res));
+        break;
+      }
+
+      /* PGRES_TUPLES_OK (without rows) or PGRES_COMMAND_OK end the result */
+      default: break;
+    }
+
+    if(res)
+      PQclear(res);
+  }
+
+  pgrows_wait(rows, FALSE);
+
+  if(n)
+    goto yield;
+
+  if(!JS_IsUndefined(rows->error)) {
+    JSValue error = rows->error;
+
+    rows->error = JS_UNDEFINED;
+    pgrows_settle(rows, TRUE, error, TRUE);
+    JS_FreeValue(ctx, error);
+  } else {
+    pgrows_settle(rows, FALSE, JS_UNDEFINED, TRUE);
+  }
+
+  return;
+
+yield:
+  pgrows_settle(rows, FALSE, batch, FALSE);
+  JS_FreeValue(ctx, batch);
+}
+
+static JSValue
+js_pgrows_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, void* ptr) {
+  PGSQLRowStream* rows = ptr;
+  JSValue ret = JS_UNDEFINED;
+
+  switch(magic) {
+    case ROWS_ITERATOR: {
+      ret = JS_DupValue(ctx, this_val);
+      break;
+    }
+
+    case ROWS_NEXT:
+    case ROWS_RETURN: {
+      if(!JS_IsUndefined(rows->funcs[0]))
+        return JS_ThrowInternalError(ctx, "%s() while next() is pending", magic == ROWS_RETURN ? "return" : "next");
+
+      ret = JS_NewPromiseCapability(ctx, rows->funcs);
+
+      if(magic == ROWS_RETURN && !rows->cancelled) {
+        rows->cancelled = TRUE;
+
+        if(rows->chunk && rows->chunk->result) {
+          PQclear(rows->chunk->result);
+          rows->chunk->result = 0;
+        }
+
+        /* the rest of the result is discarded as it arrives */
+        if(!rows->done && rows->pq->conn)
+          pgconn_cancel(ctx, rows->pq);
+      }
+
+      if(!rows->pq->conn) {
+        rows->done = TRUE;
+
+        if(!rows->cancelled && JS_IsUndefined(rows->error))
+          rows->error = js_pgsqlerror_new(ctx, "connection closed");
+      }
+
+      if(!rows->reading)
+        pgrows_pump(rows);
+      break;
+    }
+
+    case ROWS_READABLE: {
+      if(rows->pq->conn && rows->pq->stats)
+        querystats_sent(rows->pq->stats);
+
+      if(!rows->pq->conn || !PQconsumeInput(rows->pq->conn)) {
+        rows->done = TRUE;
+
+        if(JS_IsUndefined(rows->error))
+          rows->error = js_pgsqlerror_new(ctx, pgconn_error(rows->pq));
+      } else if(PQisBusy(rows->pq->conn)) {
+        break;
+      }
+
+      pgrows_wait(rows, FALSE);
+      pgrows_pump(rows);
+      break;
+    }
+  }
+
+  return ret;
+}
+
+static JSValue
+js_pgconn_stream(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  PGSQLConnection* pq;
+  PGSQLRowStream* rows;
+  PGSQLParams params;
+  JSValueConst options = argv[2];
+  const char* sql;
+  JSValue ret;
+  JSAtom atom;
+  int batch = 0, ok;
+  BOOL has_params = TRUE;
+
+  if(!(pq = js_pgconn_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(pgconn_pipelined(ctx, pq))
+    return JS_EXCEPTION;
+
+  if(!pq->conn)
+    return JS_Throw(ctx, js_pgsqlerror_new(ctx, "not connected"));
+
+  /* stream(sql, options) */
+  if(JS_IsObject(argv[1]) && !JS_IsArray(ctx, argv[1])) {
+    options = argv[1];
+    has_params = FALSE;
+  }
+
+  if(JS_IsObject(options))
+    batch = js_get_propertystr_int32(ctx, options, "batch");
+
+  if(pgparams_init(ctx, &params, has_params ? argv[1] : JS_UNDEFINED)) {
+    pgparams_free(ctx, &params);
+    return JS_EXCEPTION;
+  }
+
+  if(!(sql = JS_ToCString(ctx, argv[0]))) {
+    pgparams_free(ctx, &params);
+    return JS_EXCEPTION;
+  }
+
+  if(pq->stats)
+    querystats_begin(ctx, pq->stats, sql, strlen(sql));
+
+  ok = params.num_params ? PQsendQueryParams(pq->conn, sql, params.num_params, 0, params.values, params.lengths, params.formats, 0) : PQsendQuery(pq->conn, sql);
+
+  JS_FreeCString(ctx, sql);
+  pgparams_free(ctx, &params);
+
+  if(!ok) {
+    if(pq->stats)
+      pgconn_querystats_end(ctx, pq, 0);
+
+    return JS_Throw(ctx, js_pgsqlerror_new(ctx, pgconn_error(pq)));
+  }
+
+  if(pq->stats && PQflush(pq->conn) == 0)
+    querystats_sent(pq->stats);
+
+#ifdef LIBPQ_HAS_CHUNK_MODE
+  if(batch > 1)
+    ok = PQsetChunkedRowsMode(pq->conn, batch);
+  else
+#endif
+    ok = PQsetSingleRowMode(pq->conn);
+
+  if(!ok || !(rows = js_mallocz(ctx, sizeof(PGSQLRowStream)))) {
+    PGresult* res;
+
+    while((res = PQgetResult(pq->conn)))
+      PQclear(res);
+
+    if(pq->stats)
+      pgconn_querystats_end(ctx, pq, 0);
+
+    return ok ? JS_EXCEPTION : JS_Throw(ctx, js_pgsqlerror_new(ctx, "could not enter single-row mode"));
+  }
+
+  rows->ref_count = 1;
+  rows->ctx = ctx;
+  rows->conn = JS_DupValue(ctx, this_val);
+  rows->pq = pq;
+  rows->funcs[0] = rows->funcs[1] = JS_UNDEFINED;
+  rows->error = JS_UNDEFINED;
+  rows->batch = batch > 0 ? batch : 0;
+  rows->rtype = JS_IsObject(options) && js_has_propertystr(ctx, options, "resultType") ? js_get_propertystr_int32(ctx, options, "resultType") : js_pgconn_rtype(ctx, this_val);
+
+  ret = JS_NewObject(ctx);
+
+  JS_SetPropertyStr(ctx, ret, "next", js_function_cclosure(ctx, js_pgrows_method, 0, ROWS_NEXT, pgrows_dup(rows), pgrows_free));
+  JS_SetPropertyStr(ctx, ret, "return", js_function_cclosure(ctx, js_pgrows_method, 0, ROWS_RETURN, pgrows_dup(rows), pgrows_free));
+
+  atom = js_symbol_static_atom(ctx, "asyncIterator");
+  JS_SetProperty(ctx, ret, atom, js_function_cclosure(ctx, js_pgrows_method, 0, ROWS_ITERATOR, pgrows_dup(rows), pgrows_free));
+  JS_FreeAtom(ctx, atom);
+
+  pgrows_free(rows);
+
+  return ret;
+}
+
+enum {
+  COPY_PULL = 0,
+  COPY_CANCEL,
+  COPY_WRITE,
+  COPY_CLOSE,
+  COPY_ABORT,
+  COPY_READABLE,
+  COPY_WRITABLE,
+};
+
+/* bytes of COPY TO data collected into one chunk */
+#define COPY_CHUNK_SIZE 65536
+
+/*
+ * State of a COPY ... TO STDOUT (ReadableStream) or COPY ... FROM STDIN
+ * (WritableStream). Shared by the stream callbacks and the I/O handlers, which
+ * are closures holding a reference each.
+ */
+struct PGCopy {
+  int ref_count;
+  JSContext* ctx;
+  JSValue conn;
+  PGSQLConnection* pq;
+  /* controller of the ReadableStream */
+  JSValue controller;
+  /* copyFrom()/copyTo() promise, then that of the write()/close() in progress */
+  JSValue funcs[2];
+  JSValue result, error;
+  /* chunk which PQputCopyData() could not queue yet */
+  InputBuffer pending;
+  char* abort_reason;
+  BOOL from : 1, binary : 1, started : 1, ending : 1, ended : 1, aborted : 1, cancelled : 1, reading : 1, writing : 1;
+};
+
+typedef struct PGCopy PGSQLCopy;
+
+static JSValue js_pgcopy_method(JSContext*, JSValueConst, int, JSValueConst[], int, void*);
+
+static PGSQLCopy*
+pgcopy_new(JSContext* ctx, JSValueConst conn, PGSQLConnection* pq, BOOL from) {
+  PGSQLCopy* copy;
+
+  if(!(copy = js_mallocz(ctx, sizeof(PGSQLCopy))))
+    return 0;
+
+  copy->ref_count = 1;
+  copy->ctx = ctx;
+  copy->conn = JS_DupValue(ctx, conn);
+  copy->pq = pq;
+  copy->controller = JS_UNDEFINED;
+  copy->funcs[0] = copy->funcs[1] = JS_UNDEFINED;
+  copy->result = JS_NULL;
+  copy->error = JS_UNDEFINED;
+  copy->pending.value = JS_UNDEFINED;
+  copy->from = from;
+
+  return copy;
+}
+
+static PGSQLCopy*
+pgcopy_dup(PGSQLCopy* copy) {
+  ++copy->ref_count;
+  return copy;
+}
+
+static void
+pgcopy_free(void* ptr) {
+  PGSQLCopy* copy = ptr;
+
+  if(--copy->ref_count == 0) {
+    JSContext* ctx = copy->ctx;
+
+    input_buffer_free(&copy->pending, ctx);
+    JS_FreeValue(ctx, copy->controller);
+    JS_FreeValue(ctx, copy->funcs[0]);
+    JS_FreeValue(ctx, copy->funcs[1]);
+    JS_FreeValue(ctx, copy->result);
+    JS_FreeValue(ctx, copy->error);
+    JS_FreeValue(ctx, copy->conn);
+    js_free(ctx, copy->abort_reason);
+    js_free(ctx, copy);
+  }
+}
+
+static JSValue
+pgcopy_closure(PGSQLCopy* copy, int magic, int length) {
+  return js_function_cclosure(copy->ctx, js_pgcopy_method, length, magic, pgcopy_dup(copy), pgcopy_free);
+}
+
+static void
+pgcopy_wait(PGSQLCopy* copy, BOOL write, BOOL on) {
+  JSContext* ctx = copy->ctx;
+  JSValue fn;
+
+  if(on == (write ? copy->writing : copy->reading))
+    return;
+
+  fn = js_iohandler_fn(ctx, write);
+
+  if(js_iohandler_set(ctx, fn, PQsocket(copy->pq->conn), on ? pgcopy_closure(copy, write ? COPY_WRITABLE : COPY_READABLE, 0) : JS_NULL)) {
+    if(write)
+      copy->writing = on;
+    else
+      copy->reading = on;
+  }
+
+  JS_FreeValue(ctx, fn);
+}
+
+static JSValue
+pgcopy_promise(PGSQLCopy* copy) {
+  JS_FreeValue(copy->ctx, copy->funcs[0]);
+  JS_FreeValue(copy->ctx, copy->funcs[1]);
+
+  return JS_NewPromiseCapability(copy->ctx, copy->funcs);
+}
+
+static void
+pgcopy_settle(PGSQLCopy* copy, BOOL reject, JSValueConst value) {
+  JSContext* ctx = copy->ctx;
+  JSValue funcs[2] = {copy->funcs[0], copy->funcs[1]};
+
+  copy->funcs[0] = copy->funcs[1] = JS_UNDEFINED;
+
+  if(!JS_IsUndefined(funcs[0]))
+    value_yield(ctx, funcs[!!reject], value);
+
+  JS_FreeValue(ctx, funcs[0]);
+  JS_FreeValue(ctx, funcs[1]);
+}
+
+static void
+pgcopy_fail(PGSQLCopy* copy, const char* msg) {
+  if(JS_IsUndefined(copy->error))
+    copy->error = js_pgsqlerror_new(copy->ctx, msg);
+}
+
+static JSValue
+pgcopy_stream(PGSQLCopy* copy) {
+  JSContext* ctx = copy->ctx;
+  JSValue ret, source = JS_NewObject(ctx);
+
+  /* the stream module may not have been imported into this runtime yet */
+  if(!JS_IsRegisteredClass(JS_GetRuntime(ctx), js_readable_class_id))
+    js_stream_init(ctx, 0);
+
+  if(copy->from) {
+    JS_SetPropertyStr(ctx, source, "write", pgcopy_closure(copy, COPY_WRITE, 2));
+    JS_SetPropertyStr(ctx, source, "close", pgcopy_closure(copy, COPY_CLOSE, 0));
+    JS_SetPropertyStr(ctx, source, "abort", pgcopy_closure(copy, COPY_ABORT, 1));
+    ret = JS_CallConstructor(ctx, writable_ctor, 1, &source);
+  } else {
+    JS_SetPropertyStr(ctx, source, "pull", pgcopy_closure(copy, COPY_PULL, 1));
+    JS_SetPropertyStr(ctx, source, "cancel", pgcopy_closure(copy, COPY_CANCEL, 1));
+    ret = JS_CallConstructor(ctx, readable_ctor, 1, &source);
+  }
+
+  JS_FreeValue(ctx, source);
+
+  if(!JS_IsException(ret))
+    JS_DefinePropertyValueStr(ctx, ret, "binary", JS_NewBool(ctx, copy->binary), JS_PROP_CONFIGURABLE | JS_PROP_ENUMERABLE);
+
+  return ret;
+}
+
+/* the COPY statement has been answered with PGRES_COPY_OUT/PGRES_COPY_IN, or an error */
+static void
+pgcopy_started(PGSQLCopy* copy, PGresult* res) {
+  JSContext* ctx = copy->ctx;
+  ExecStatusType status = PQresultStatus(res);
+  JSValue stream;
+
+  copy->started = TRUE;
+
+  if(status != (copy->from ? PGRES_COPY_IN : PGRES_COPY_OUT)) {
+    JSValue err;
+
+    if(copy->pq->stats)
+      pgconn_querystats_end(ctx, copy->pq, res);
+
+    err = js_pgsqlerror_new(ctx, status == PGRES_FATAL_ERROR ? PQresultErrorMessage(res) : copy->from ? "not a COPY ... FROM STDIN statement" : "not a COPY ... TO STDOUT statement");
+
+    pgcopy_settle(copy, TRUE, err);
+    JS_FreeValue(ctx, err);
+    PQclear(res);
+
+    /* consume the rest, so the connection is ready for the next command */
+    while(!PQisBusy(copy->pq->conn) && (res = PQgetResult(copy->pq->conn)))
+      PQclear(res);
+
+    return;
+  }
+
+  copy->binary = PQbinaryTuples(res);
+  PQclear(res);
+
+  stream = pgcopy_stream(copy);
+  pgcopy_settle(copy, JS_IsException(stream), JS_IsException(stream) ? JS_GetException(ctx) : stream);
+  JS_FreeValue(ctx, stream);
+}
+
+/* collects the results after the copy data, settling the stream */
+static void
+pgcopy_finish(PGSQLCopy* copy) {
+  JSContext* ctx = copy->ctx;
+  PGconn* conn = copy->pq->conn;
+  BOOL nonblock = pgconn_nonblock(copy->pq);
+  PGresult* res;
+
+  while(!nonblock || !PQisBusy(conn)) {
+    if(!(res = PQgetResult(conn))) {
+      BOOL failed = !JS_IsUndefined(copy->error);
+
+      pgcopy_wait(copy, FALSE, FALSE);
+
+      if(copy->from) {
+        if(copy->aborted)
+          pgcopy_settle(copy, FALSE, JS_UNDEFINED);
+        else
+          pgcopy_settle(copy, failed, failed ? copy->error : copy->result);
+      } else if(!copy->cancelled) {
+        JSValue ret = js_invoke(ctx, copy->controller, failed ? "error" : "close", failed, &copy->error);
+        JS_FreeValue(ctx, ret);
+      }
+
+      return;
+    }
+
+    /* a COPY is recorded with the time until the data has all been transferred */
+    if(copy->pq->stats)
+      pgconn_querystats_end(ctx, copy->pq, res);
+
+    if(PQresultStatus(res) == PGRES_FATAL_ERROR) {
+      pgcopy_fail(copy, PQresultErrorMessage(res));
+      PQclear(res);
+    } else {
+      JS_FreeValue(ctx, copy->result);
+      copy->result = pgconn_result(copy->pq, res, ctx);
+    }
+  }
+
+  pgcopy_wait(copy, FALSE, TRUE);
+}
+
+/* reads rows of COPY TO until a chunk is full or no more data is buffered */
+static void
+pgcopy_read(PGSQLCopy* copy) {
+  JSContext* ctx = copy->ctx;
+  PGconn* conn = copy->pq->conn;
+  DynBuf buf;
+  char* row;
+  int n;
+
+  if(copy->ending) {
+    pgcopy_finish(copy);
+    return;
+  }
+
+  js_dbuf_init(ctx, &buf);
+
+  while((n = PQgetCopyData(conn, &row, pgconn_nonblock(copy->pq))) > 0) {
+    if(!copy->cancelled)
+      dbuf_put(&buf, (const uint8_t*)row, n);
+
+    PQfreemem(row);
+
+    if(buf.size >= COPY_CHUNK_SIZE)
+      break;
+  }
+
+  if(buf.size) {
+    JSValue ret, chunk = copy->binary ? JS_NewArrayBufferCopy(ctx, buf.buf, buf.size) : JS_NewStringLen(ctx, (const char*)buf.buf, buf.size);
+
+    ret = js_invoke(ctx, copy->controller, "enqueue", 1, &chunk);
+    JS_FreeValue(ctx, ret);
+    JS_FreeValue(ctx, chunk);
+  }
+
+  if(n == 0) {
+    if(!buf.size)
+      pgcopy_wait(copy, FALSE, TRUE);
+  } else if(n < 0) {
+    if(n == -2)
+      pgcopy_fail(copy, pgconn_error(copy->pq));
+
+    copy->ending = TRUE;
+    pgcopy_finish(copy);
+  }
+
+  dbuf_free(&buf);
+}
+
+/* flushes queued COPY FROM data, then sends the end of data and waits for the result */
+static void
+pgcopy_flush(PGSQLCopy* copy) {
+  PGconn* conn = copy->pq->conn;
+  int r;
+
+  if(copy->pending.data) {
+    if((r = PQputCopyData(conn, (const char*)copy->pending.data, copy->pending.size)) == 0) {
+      pgcopy_wait(copy, TRUE, TRUE);
+      return;
+    }
+
+    input_buffer_free(&copy->pending, copy->ctx);
+
+    if(r < 0)
+      goto fail;
+  }
+
+  if(copy->ending && !copy->ended) {
+    if((r = PQputCopyEnd(conn, copy->abort_reason)) == 0) {
+      pgcopy_wait(copy, TRUE, TRUE);
+      return;
+    }
+
+    if(r < 0)
+      goto fail;
+
+    copy->ended = TRUE;
+  }
+
+  switch(PQflush(conn)) {
+    case 0: {
+      pgcopy_wait(copy, TRUE, FALSE);
+
+      if(copy->ending) {
+        pgcopy_finish(copy);
+      } else {
+        pgcopy_settle(copy, FALSE, JS_UNDEFINED);
+      }
+      return;
+    }
+
+    case 1: {
+      pgcopy_wait(copy, TRUE, TRUE);
+      return;
+    }
+  }
+
+fail:
+  pgcopy_wait(copy, TRUE, FALSE);
+  pgcopy_fail(copy, pgconn_error(copy->pq));
+  pgcopy_settle(copy, TRUE, copy->error);
+}
+
+static JSValue
+js_pgcopy_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, void* ptr) {
+  PGSQLCopy* copy = ptr;
+  PGconn* conn = copy->pq->conn;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!conn && magic != COPY_CANCEL)
+    return JS_Throw(ctx, js_pgsqlerror_new(ctx, "connection closed"));
+
+  switch(magic) {
+    case COPY_PULL: {
+      if(JS_IsUndefined(copy->controller))
+        copy->controller = JS_DupValue(ctx, argv[0]);
+
+      pgcopy_read(copy);
+      break;
+    }
+
+    case COPY_CANCEL: {
+      if(copy->cancelled || !conn)
+        break;
+
+      copy->cancelled = TRUE;
+
+      /* the server stops sending, what is still in transit gets discarded */
+      pgconn_cancel(ctx, copy->pq);
+
+      pgcopy_read(copy);
+      break;
+    }
+
+    case COPY_WRITE: {
+      if(copy->pending.data || copy->ending)
+        return JS_ThrowInternalError(ctx, "COPY write while %s", copy->ending ? "closing" : "another write is pending");
+
+      copy->pending = js_input_chars(ctx, argv[0]);
+
+      if(JS_IsException(copy->pending.value))
+        return JS_EXCEPTION;
+
+      ret = pgcopy_promise(copy);
+      pgcopy_flush(copy);
+      break;
+    }
+
+    case COPY_ABORT: {
+      const char* reason = argc > 0 && !JS_IsUndefined(argv[0]) ? JS_ToCString(ctx, argv[0]) : 0;
+
+      copy->abort_reason = js_strdup(ctx, reason ? reason : "aborted");
+      copy->aborted = TRUE;
+
+      if(reason)
+        JS_FreeCString(ctx, reason);
+    }
+      /* fall through */
+    case COPY_CLOSE: {
+      if(copy->ending)
+        return JS_ThrowInternalError(ctx, "COPY already closing");
+
+      copy->ending = TRUE;
+      ret = pgcopy_promise(copy);
+      pgcopy_flush(copy);
+      break;
+    }
+
+    case COPY_READABLE:
+    case COPY_WRITABLE: {
+      if(magic == COPY_READABLE && copy->pq->stats)
+        querystats_sent(copy->pq->stats);
+
+      if(magic == COPY_READABLE && !PQconsumeInput(conn)) {
+        if(copy->pq->stats)
+          pgconn_querystats_end(ctx, copy->pq, 0);
+
+        pgcopy_fail(copy, pgconn_error(copy->pq));
+        pgcopy_wait(copy, FALSE, FALSE);
+        pgcopy_wait(copy, TRUE, FALSE);
+
+        if(copy->from || !copy->started)
+          pgcopy_settle(copy, TRUE, copy->error);
+        else
+          JS_FreeValue(ctx, js_invoke(ctx, copy->controller, "error", 1, &copy->error));
+
+        break;
+      }
+
+      if(!copy->started) {
+        if(!PQisBusy(conn)) {
+          pgcopy_wait(copy, FALSE, FALSE);
+          pgcopy_started(copy, PQgetResult(conn));
+        }
+      } else if(copy->from) {
+        if(magic == COPY_WRITABLE)
+          pgcopy_flush(copy);
+        else
+          pgcopy_finish(copy);
+      } else {
+        pgcopy_wait(copy, FALSE, FALSE);
+        pgcopy_read(copy);
+      }
+      break;
+    }
+  }
+
+  return ret;
+}
+
+static JSValue
+js_pgconn_copy(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  PGSQLConnection* pq;
+  PGSQLCopy* copy;
+  const char* sql;
+  JSValue ret;
+
+  if(!(pq = js_pgconn_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(pgconn_pipelined(ctx, pq))
+    return JS_EXCEPTION;
+
+  if(!(sql = JS_ToCString(ctx, argv[0])))
+    return JS_EXCEPTION;
+
+  if(!(copy = pgcopy_new(ctx, this_val, pq, magic))) {
+    JS_FreeCString(ctx, sql);
+    return JS_EXCEPTION;
+  }
+
+  if(pq->stats)
+    querystats_begin(ctx, pq->stats, sql, strlen(sql));
+
+  if(!pgconn_nonblock(pq)) {
+    PGresult* res = PQexec(pq->conn, sql);
+
+    if(pq->stats)
+      querystats_sent(pq->stats);
+
+    ret = pgcopy_promise(copy);
+    pgcopy_started(copy, res);
+  } else if(!PQsendQuery(pq->conn, sql)) {
+    if(pq->stats)
+      pgconn_querystats_end(ctx, pq, 0);
+
+    ret = JS_Throw(ctx, js_pgsqlerror_new(ctx, pgconn_error(pq)));
+  } else {
+    if(pq->stats && PQflush(pq->conn) == 0)
+      querystats_sent(pq->stats);
+
+    ret = pgcopy_promise(copy);
+    pgcopy_wait(copy, FALSE, TRUE);
+  }
+
+  JS_FreeCString(ctx, sql);
+  pgcopy_free(copy);
+
+  return ret;
+}
+
+static JSValue
+js_pgconn_close(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  JSValue ret = JS_UNDEFINED;
+  PGSQLConnection* pq;
+
+  if(!(pq = js_pgconn_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+#ifdef LIBPQ_HAS_PIPELINING
+  if(pq->pipeline) {
+    PGSQLPipeline* pl = pq->pipeline;
+
+    pipeline_abort(ctx, pl, "connection closed");
+    pipeline_arm(ctx, pl, JS_UNDEFINED);
+  }
+#endif
+
+  pgconn_statements_clear(pq, JS_GetRuntime(ctx));
+
+  PQfinish(pq->conn);
+  pq->conn = 0;
+
+  return ret;
+}
+
+static void
+js_pgconn_finalizer(JSRuntime* rt, JSValue val) {
+  PGSQLConnection* pq;
+
+  if((pq = JS_GetOpaque(val, js_pgconn_class_id)))
+    pgconn_free(pq, rt);
+}
+
+static JSClassDef js_pgconn_class = {
+    .class_name = "PGconn",
+    .finalizer = js_pgconn_finalizer,
+};
+
+static const JSCFunctionListEntry js_pgconn_funcs[] = {
+    JS_CGETSET_MAGIC_DEF("cmdTuples", js_pgconn_get, 0, PROP_CMD_TUPLES),
+    JS_CGETSET_MAGIC_DEF("affectedRows", js_pgconn_get, 0, PROP_CMD_TUPLES),
+
+    JS_CGETSET_MAGIC_DEF("nonblocking", js_pgconn_get, js_pgconn_set, PROP_NONBLOCKING),
+    JS_CGETSET_MAGIC_DEF("fd", js_pgconn_get, 0, PROP_FD),
+    JS_CGETSET_MAGIC_DEF("errorMessage", js_pgconn_get, 0, PROP_ERROR_MESSAGE),
     JS_CGETSET_MAGIC_DEF("options", js_pgconn_get, 0, PROP_OPTIONS),
     JS_CGETSET_MAGIC_DEF("insertId", js_pgconn_get, 0, PROP_INSERT_ID),
     JS_CGETSET_MAGIC_DEF("charset", js_pgconn_get, js_pgconn_set, PROP_CLIENT_ENCODING),
@@ -1232,9 +3502,17 @@ static const JSCFunctionListEntry js_pgconn_funcs[] = {
     JS_CGETSET_MAGIC_DEF("db", js_pgconn_get, 0, PROP_DB),
     JS_CGETSET_MAGIC_DEF("conninfo", js_pgconn_get, 0, PROP_CONNINFO),
     JS_CFUNC_DEF("connect", 1, js_pgconn_connect),
+    JS_CGETSET_MAGIC_DEF("statementCacheSize", js_pgconn_get, js_pgconn_set, PROP_STATEMENT_CACHE_SIZE),
     JS_CFUNC_DEF("query", 1, js_pgconn_query),
+    JS_CFUNC_DEF("prepare", 2, js_pgconn_prepare),
+    JS_CFUNC_DEF("execute", 2, js_pgconn_execute),
+#ifdef LIBPQ_HAS_PIPELINING
+    JS_CFUNC_DEF("pipeline", 1, js_pgconn_pipeline),
+#endif
+    JS_CFUNC_DEF("stream", 3, js_pgconn_stream),
+    JS_CFUNC_MAGIC_DEF("copyTo", 1, js_pgconn_copy, 0),
+    JS_CFUNC_MAGIC_DEF("copyFrom", 1, js_pgconn_copy, 1),
     JS_CFUNC_DEF("close", 0, js_pgconn_close),
-    JS_ALIAS_DEF("execute", "query"),
     JS_CFUNC_DEF("escapeString", 1, js_pgconn_escape_string),
     JS_CFUNC_MAGIC_DEF("escapeLiteral", 1, js_pgconn_escape_alloc, 0),
     JS_CFUNC_MAGIC_DEF("escapeIdentifier", 1, js_pgconn_escape_alloc, 1),
@@ -1243,6 +3521,9 @@ static const JSCFunctionListEntry js_pgconn_funcs[] = {
     JS_CFUNC_DEF("valueString", 0, js_pgconn_value_string),
     JS_CFUNC_DEF("valuesString", 1, js_pgconn_values_string),
     JS_CFUNC_DEF("insertQuery", 2, js_pgconn_insert_query),
+    JS_CFUNC_DEF("bulkInsert", 3, js_pgconn_bulk_insert),
+    JS_CFUNC_DEF("instrument", 0, js_pgconn_instrument),
+    JS_CFUNC_DEF("stats", 0, js_pgconn_stats),
     // JS_CFUNC_MAGIC_DEF("escapeString", 1, js_pgconn_methods, METHOD_ESCAPE_STRING),
     JS_PROP_STRING_DEF("[Symbol.toStringTag]", "PGconn", JS_PROP_CONFIGURABLE),
 };
@@ -1259,6 +3540,103 @@ static const JSCFunctionListEntry js_pgconn_defines[] = {
     JS_PROP_INT32_DEF("RESULT_TBLNAM", RESULT_TBLNAM, JS_PROP_CONFIGURABLE),
 };
 
+enum {
+  STMT_NAME,
+  STMT_SQL,
+  STMT_PREPARED,
+};
+
+static JSValue
+js_pgstmt_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  PGSQLStatement* st;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(st = JS_GetOpaque2(ctx, this_val, js_pgstmt_class_id)))
+    return JS_EXCEPTION;
+
+  switch(magic) {
+    case STMT_NAME: {
+      ret = JS_NewString(ctx, st->name);
+      break;
+    }
+
+    case STMT_SQL: {
+      ret = JS_NewString(ctx, st->sql);
+      break;
+    }
+
+    case STMT_PREPARED: {
+      ret = JS_NewBool(ctx, st->prepared && st->conn);
+      break;
+    }
+  }
+
+  return ret;
+}
+
+static JSValue
+js_pgstmt_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  return JS_ThrowTypeError(ctx, "PGstatement objects are created by PGconn.prototype.prepare()");
+}
+
+static void
+js_pgstmt_finalizer(JSRuntime* rt, JSValue val) {
+  PGSQLStatement* st;
+
+  if((st = JS_GetOpaque(val, js_pgstmt_class_id)))
+    pgstmt_free(st, rt);
+}
+
+static JSClassDef js_pgstmt_class = {
+    .class_name = "PGstatement",
+    .finalizer = js_pgstmt_finalizer,
+};
+
+static const JSCFunctionListEntry js_pgstmt_funcs[] = {
+    JS_CGETSET_MAGIC_FLAGS_DEF("name", js_pgstmt_get, 0, STMT_NAME, JS_PROP_ENUMERABLE),
+    JS_CGETSET_MAGIC_FLAGS_DEF("sql", js_pgstmt_get, 0, STMT_SQL, JS_PROP_ENUMERABLE),
+    JS_CGETSET_MAGIC_DEF("prepared", js_pgstmt_get, 0, STMT_PREPARED),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "PGstatement", JS_PROP_CONFIGURABLE),
+};
+
+/* connected, outside of a transaction, and the server has not closed the socket */
+static BOOL
+pgpool_alive(JSContext* ctx, JSValueConst conn) {
+  PGSQLConnection* pq;
+
+  if(!(pq = JS_GetOpaque(conn, js_pgconn_class_id)) || !pq->conn)
+    return FALSE;
+
+  if(PQstatus(pq->conn) != CONNECTION_OK || PQtransactionStatus(pq->conn) != PQTRANS_IDLE)
+    return FALSE;
+
+#ifdef LIBPQ_HAS_PIPELINING
+  if(pq->pipeline)
+    return FALSE;
+#endif
+
+  /* notifications are buffered by libpq, EOF shows up as a bad status */
+  if(!connpool_socket_idle(PQsocket(pq->conn)))
+    if(!PQconsumeInput(pq->conn) || PQstatus(pq->conn) != CONNECTION_OK || PQisBusy(pq->conn))
+      return FALSE;
+
+  return TRUE;
+}
+
+static const ConnPoolDriver pgpool_driver = {
+    &js_pgconn_class_id,
+    pgpool_alive,
+};
+
+static JSValue
+js_pgpool_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  return js_connpool_new(ctx, new_target, argc, argv, &pgpool_driver);
+}
+
+static const JSCFunctionListEntry js_pgpool_funcs[] = {
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "PGpool", JS_PROP_CONFIGURABLE),
+};
+
 static JSValue
 js_pgsqlerror_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
   JSValue obj, proto;
@@ -1296,18 +3674,12 @@ js_pgsqlerror_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSV
 
 static JSValue
 js_pgsqlerror_new(JSContext* ctx, const char* msg) {
-  JSValue obj;
-  JSValue argv[2];
-
-  obj = JS_NewObjectProtoClass(ctx, pgsqlerror_proto, js_pgsqlerror_class_id);
-  if(JS_IsException(obj))
-    return JS_EXCEPTION;
+  JSValue obj, argv[1];
 
   argv[0] = JS_NewString(ctx, msg);
   obj = js_pgsqlerror_constructor(ctx, pgsqlerror_ctor, 1, argv);
 
   JS_FreeValue(ctx, argv[0]);
-  JS_FreeValue(ctx, argv[1]);
 
   return obj;
 }
@@ -1346,25 +3718,9 @@ result_value(JSContext* ctx, PGSQLResult* opaque, int field, char* buf, size_t l
 
   if(!(rtype & RESULT_STRING)) {
     if(field_is_number(res, field))
-      return string_to_number(ctx, buf);
-    if(field_is_date(res, field)) {
-      DynBuf tmp;
-      dbuf_init2(&tmp, 0, 0);
-      dbuf_putstr(&tmp, buf);
-
-      if(tmp.size > 10 && tmp.buf[10] == ' ')
-        tmp.buf[10] = 'T';
-
-      if(tmp.size >= 3 && tmp.buf[tmp.size - 3] == '+')
-        dbuf_putstr(&tmp, ":00");
-
-      dbuf_0(&tmp);
-
-      ret = string_to_date(ctx, (const char*)tmp.buf);
-      dbuf_free(&tmp);
-
-      return ret;
-    }
+      return column_parse_number(ctx, buf);
+    if(field_is_date(res, field))
+      return column_parse_date(ctx, buf);
   }
 
   if(!(rtype & RESULT_STRING)) {
@@ -1406,22 +3762,56 @@ result_array(JSContext* ctx, PGSQLResult* opaque, int row, int rtype) {
   return ret;
 }
 
-static JSValue
-result_object(JSContext* ctx, PGSQLResult* opaque, int row, int rtype) {
+static JSAtom*
+result_atoms(JSContext* ctx, PGSQLResult* opaque, int rtype) {
   PGresult* res = opaque->result;
-  JSValue ret = JS_NewObject(ctx);
   uint32_t i, num_fields = PQnfields(res);
-  FieldNameFunc* fn = (rtype & RESULT_TBLNAM) ? field_id : field_namefunc(res);
+  BOOL tblnam = !!(rtype & RESULT_TBLNAM);
+  FieldNameFunc* fn;
+
+  if(opaque->atoms && opaque->num_atoms == num_fields && opaque->atoms_tblnam == tblnam)
+    return opaque->atoms;
+
+  pgresult_atoms_free(JS_GetRuntime(ctx), opaque);
+
+  if(!(opaque->atoms = js_mallocz(ctx, sizeof(JSAtom) * (num_fields + 1))))
+    return 0;
+
+  opaque->num_atoms = num_fields;
+  opaque->atoms_tblnam = tblnam;
+  fn = tblnam ? field_id : field_namefunc(res);
 
   for(i = 0; i < num_fields; i++) {
     char* id;
 
     if((id = fn(ctx, opaque, i))) {
+      opaque->atoms[i] = JS_NewAtom(ctx, id);
+      js_free(ctx, id);
+    }
+  }
+
+  return opaque->atoms;
+}
+
+/* rows get their properties in the same order, so they share one shape */
+static JSValue
+result_object(JSContext* ctx, PGSQLResult* opaque, int row, int rtype) {
+  PGresult* res = opaque->result;
+  JSValue ret;
+  uint32_t i, num_fields = PQnfields(res);
+  JSAtom* atoms;
+
+  if(!(atoms = result_atoms(ctx, opaque, rtype)))
+    return JS_EXCEPTION;
+
+  ret = JS_NewObject(ctx);
+
+  for(i = 0; i < num_fields; i++) {
+    if(atoms[i] != JS_ATOM_NULL) {
       int len = PQgetlength(res, row, i);
       char* col = PQgetisnull(res, row, i) ? NULL : PQgetvalue(res, row, i);
 
-      JS_SetPropertyStr(ctx, ret, id, result_value(ctx, opaque, i, col, len, rtype));
-      js_free(ctx, id);
+      JS_DefinePropertyValue(ctx, ret, atoms[i], result_value(ctx, opaque, i, col, len, rtype), JS_PROP_C_W_E);
     }
   }
 
@@ -1474,7 +3864,7 @@ pgresult_new(JSContext* ctx) {
   if(!(opaque = js_malloc(ctx, sizeof(PGSQLResult))))
     return 0;
 
-  *opaque = (PGSQLResult){1, NULL, NULL, 0};
+  *opaque = (PGSQLResult){1, NULL, NULL, 0, NULL, 0, FALSE};
 
   return opaque;
 }
@@ -1485,10 +3875,22 @@ pgresult_dup(PGSQLResult* ptr) {
   return ptr;
 }
 
+static void
+pgresult_atoms_free(JSRuntime* rt, PGSQLResult* opaque) {
+  for(uint32_t i = 0; i < opaque->num_atoms; i++)
+    if(opaque->atoms[i] != JS_ATOM_NULL)
+      JS_FreeAtomRT(rt, opaque->atoms[i]);
+
+  js_free_rt(rt, opaque->atoms);
+  opaque->atoms = 0;
+  opaque->num_atoms = 0;
+}
+
 static void
 pgresult_free(JSRuntime* rt, void* ptr, void* mem) {
   PGSQLResult* opaque = ptr;
   if(--opaque->ref_count == 0) {
+    pgresult_atoms_free(rt, opaque);
     if(opaque->result) {
       PQclear(opaque->result);
       opaque->result = 0;
@@ -1735,6 +4137,90 @@ js_pgresult_iterator(JSContext* ctx, JSValueConst this_val, int argc, JSValueCon
   return ret;
 }
 
+static ColumnType
+result_column_type(PGresult* res, int field) {
+  if(PQfformat(res, field))
+    return COLUMN_STRING;
+
+  switch(PQftype(res, field)) {
+    case 16:
+    case 21:
+    case 23: return COLUMN_INT32;
+    case 20: return COLUMN_BIGINT64;
+    case 700:
+    case 701:
+    case 1700: return COLUMN_FLOAT64;
+    default: return COLUMN_STRING;
+  }
+}
+
+static JSValue
+js_pgresult_tocolumns(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  PGSQLResult* opaque;
+  PGresult* res;
+  Column* columns;
+  JSValue types = JS_UNDEFINED, ret = JS_EXCEPTION;
+  FieldNameFunc* fn;
+  char** names;
+  int i, row, num_fields, num_rows;
+
+  if(!(opaque = js_pgresult_opaque2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  res = opaque->result;
+  num_fields = PQnfields(res);
+  num_rows = PQntuples(res);
+  fn = field_namefunc(res);
+
+  if(argc > 0 && JS_IsObject(argv[0]))
+    types = JS_GetPropertyStr(ctx, argv[0], "types");
+
+  columns = js_mallocz(ctx, sizeof(Column) * (num_fields + 1));
+  names = js_mallocz(ctx, sizeof(char*) * (num_fields + 1));
+
+  if(!columns || !names)
+    goto fail;
+
+  for(i = 0; i < num_fields; i++) {
+    int type;
+
+    if(!(names[i] = fn(ctx, opaque, i)))
+      goto fail;
+
+    if((type = column_type_option(ctx, types, i, names[i])) == -2)
+      goto fail;
+
+    column_init(ctx, &columns[i], type == -1 ? result_column_type(res, i) : type);
+  }
+
+  for(i = 0; i < num_fields; i++)
+    for(row = 0; row < num_rows; row++)
+      if(column_append(&columns[i], PQgetisnull(res, row, i) ? 0 : PQgetvalue(res, row, i), PQgetlength(res, row, i))) {
+        JS_ThrowOutOfMemory(ctx);
+        goto fail;
+      }
+
+  ret = JS_NewObject(ctx);
+
+  for(i = 0; i < num_fields; i++)
+    JS_SetPropertyStr(ctx, ret, names[i], column_value(ctx, &columns[i]));
+
+fail:
+  for(i = 0; i < num_fields; i++) {
+    if(columns)
+      column_free(&columns[i]);
+
+    if(names && names[i])
+      js_free(ctx, names[i]);
+  }
+
+  js_free(ctx, columns);
+  js_free(ctx, names);
+  JS_FreeValue(ctx, types);
+
+  return ret;
+}
+
 static JSValue
 js_pgresult_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
   JSValue obj = JS_UNDEFINED;
@@ -1804,6 +4290,7 @@ static const JSCFunctionListEntry js_pgresult_funcs[] = {
     JS_CFUNC_MAGIC_DEF("fetchFields", 0, js_pgresult_functions, METHOD_FETCH_FIELDS),
     JS_CFUNC_MAGIC_DEF("fetchRow", 0, js_pgresult_functions, METHOD_FETCH_ROW),
     JS_CFUNC_MAGIC_DEF("fetchAssoc", 0, js_pgresult_functions, METHOD_FETCH_ASSOC),
+    JS_CFUNC_DEF("toColumns", 0, js_pgresult_tocolumns),
     JS_CFUNC_DEF("[Symbol.iterator]", 0, js_pgresult_iterator),
     JS_PROP_STRING_DEF("[Symbol.toStringTag]", "PGresult", JS_PROP_CONFIGURABLE),
 };
@@ -2140,22 +4627,6 @@ field_is_string(PGresult* res, int field) {
   return FALSE;
 }
 
-static JSValue
-string_to_value(JSContext* ctx, const char* func_name, const char* s) {
-  JSValue ret, arg = JS_NewString(ctx, s);
-  ret = js_value_coerce(ctx, func_name, arg);
-  JS_FreeValue(ctx, arg);
-  return ret;
-}
-
-static JSValue
-string_to_object(JSContext* ctx, const char* ctor_name, const char* s) {
-  JSValue ret, arg = JS_NewString(ctx, s);
-  ret = js_global_new(ctx, ctor_name, 1, &arg);
-  JS_FreeValue(ctx, arg);
-  return ret;
-}
-
 int
 js_pgsql_init(JSContext* ctx, JSModuleDef* m) {
   if(js_pgconn_class_id == 0) {
@@ -2195,12 +4666,42 @@ js_pgsql_init(JSContext* ctx, JSModuleDef* m) {
 
     JS_SetPropertyFunctionList(ctx, pgresult_proto, js_pgresult_funcs, countof(js_pgresult_funcs));
     JS_SetClassProto(ctx, js_pgresult_class_id, pgresult_proto);
+
+    JS_NewClassID(&js_pgstmt_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_pgstmt_class_id, &js_pgstmt_class);
+
+    pgstmt_ctor = JS_NewCFunction2(ctx, js_pgstmt_constructor, "PGstatement", 0, JS_CFUNC_constructor, 0);
+    pgstmt_proto = JS_NewObject(ctx);
+
+    JS_SetPropertyFunctionList(ctx, pgstmt_proto, js_pgstmt_funcs, countof(js_pgstmt_funcs));
+    JS_SetConstructor(ctx, pgstmt_ctor, pgstmt_proto);
+    JS_SetClassProto(ctx, js_pgstmt_class_id, pgstmt_proto);
+
+#ifdef LIBPQ_HAS_PIPELINING
+    JS_NewClassID(&js_pgpipeline_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_pgpipeline_class_id, &js_pgpipeline_class);
+
+    pgpipeline_proto = JS_NewObject(ctx);
+
+    JS_SetPropertyFunctionList(ctx, pgpipeline_proto, js_pgpipeline_funcs, countof(js_pgpipeline_funcs));
+    JS_SetClassProto(ctx, js_pgpipeline_class_id, pgpipeline_proto);
+#endif
+
+    js_connpool_init(ctx);
+
+    pgpool_ctor = JS_NewCFunction2(ctx, js_pgpool_constructor, "PGpool", 2, JS_CFUNC_constructor, 0);
+    pgpool_proto = JS_NewObjectProto(ctx, connpool_proto);
+
+    JS_SetPropertyFunctionList(ctx, pgpool_proto, js_pgpool_funcs, countof(js_pgpool_funcs));
+    JS_SetConstructor(ctx, pgpool_ctor, pgpool_proto);
   }
 
   if(m) {
     JS_SetModuleExport(ctx, m, "PGconn", pgsql_ctor);
     JS_SetModuleExport(ctx, m, "PGerror", pgsqlerror_ctor);
     JS_SetModuleExport(ctx, m, "PGresult", pgresult_ctor);
+    JS_SetModuleExport(ctx, m, "PGstatement", pgstmt_ctor);
+    JS_SetModuleExport(ctx, m, "PGpool", pgpool_ctor);
   }
 
   return 0;
@@ -2220,6 +4721,8 @@ JS_INIT_MODULE(JSContext* ctx, const char* module_name) {
     JS_AddModuleExport(ctx, m, "PGconn");
     JS_AddModuleExport(ctx, m, "PGerror");
     JS_AddModuleExport(ctx, m, "PGresult");
+    JS_AddModuleExport(ctx, m, "PGstatement");
+    JS_AddModuleExport(ctx, m, "PGpool");
   }
 
   return m;
@@ -2,6 +2,8 @@
 #include "queue.h"
 #include "utils.h"
 #include "buffer-utils.h"
+#include "quickjs-syscallerror.h"
+#include <errno.h>
 
 /**
  * \defgroup quickjs-queue quickjs-queue: Queue reader
@@ -63,6 +65,8 @@ enum {
   QUEUE_NEXT,
   QUEUE_CHUNK,
   QUEUE_AT,
+  QUEUE_WRITETO,
+  QUEUE_READFROM,
 };
 
 static JSValue
@@ -165,6 +169,33 @@ js_queue_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
 
       break;
     }
+
+#ifndef _WIN32
+    case QUEUE_WRITETO:
+    case QUEUE_READFROM: {
+      int32_t fd = -1;
+      int64_t arg = 0;
+      ssize_t r;
+
+      JS_ToInt32(ctx, &fd, argv[0]);
+
+      if(argc > 1) {
+        if(magic == QUEUE_WRITETO && JS_IsObject(argv[1]))
+          arg = js_get_propertystr_int32(ctx, argv[1], "maxChunks");
+        else
+          JS_ToInt64(ctx, &arg, argv[1]);
+      }
+
+      r = magic == QUEUE_WRITETO ? queue_writev(queue, fd, MAX_NUM(arg, 0)) : queue_readv(queue, fd, MAX_NUM(arg, 0));
+
+      if(r == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+        ret = js_syscallerror_throw_errno(ctx, magic == QUEUE_WRITETO ? "writev" : "readv", errno);
+      else
+        ret = JS_NewInt64(ctx, r);
+
+      break;
+    }
+#endif
   }
 
   return ret;
@@ -254,6 +285,10 @@ static const JSCFunctionListEntry js_queue_funcs[] = {
     JS_CFUNC_MAGIC_DEF("next", 0, js_queue_method, QUEUE_NEXT),
     JS_CFUNC_MAGIC_DEF("chunk", 1, js_queue_method, QUEUE_CHUNK),
     JS_CFUNC_MAGIC_DEF("at", 1, js_queue_method, QUEUE_AT),
+#ifndef _WIN32
+    JS_CFUNC_MAGIC_DEF("writeTo", 1, js_queue_method, QUEUE_WRITETO),
+    JS_CFUNC_MAGIC_DEF("readFrom", 1, js_queue_method, QUEUE_READFROM),
+#endif
     JS_CGETSET_MAGIC_DEF("size", js_queue_get, 0, QUEUE_SIZE),
     JS_CGETSET_MAGIC_DEF("empty", js_queue_get, 0, QUEUE_EMPTY),
     JS_CGETSET_MAGIC_DEF("head", js_queue_get, 0, QUEUE_HEAD),
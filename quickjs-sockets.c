@@ -3,6 +3,8 @@
 #include "quickjs-syscallerror.h"
 #include "utils.h"
 #include "buffer-utils.h"
+#include "io-uring.h"
+#include "resolver.h"
 #include "debug.h"
 
 #if defined(_WIN32) && !defined(__MSYS__) && !defined(__CYGWIN__)
@@ -25,6 +27,18 @@ typedef int SOCKET;
 #include <assert.h>
 #include <errno.h>
 
+#ifdef HAVE_EPOLL_CREATE1
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#endif
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#define HAVE_ZEROCOPY 1
+#endif
+
 /**
  * \addtogroup quickjs-sockets
  * @{
@@ -43,9 +57,10 @@ static JSValue js_socket_method(JSContext*, JSValueConst, int, JSValueConst[], i
     ret = (sock)->ret < 0 ? (on_fail) : (on_success); \
   } while(0)
 
-VISIBLE JSClassID js_sockaddr_class_id = 0, js_socket_class_id = 0, js_asyncsocket_class_id = 0;
+VISIBLE JSClassID js_sockaddr_class_id = 0, js_socket_class_id = 0, js_asyncsocket_class_id = 0, js_listener_class_id = 0;
 VISIBLE JSValue sockaddr_proto = {{0}, JS_TAG_UNDEFINED}, sockaddr_ctor = {{0}, JS_TAG_UNDEFINED}, socket_proto = {{0}, JS_TAG_UNDEFINED},
-                asyncsocket_proto = {{0}, JS_TAG_UNDEFINED}, socket_ctor = {{0}, JS_TAG_UNDEFINED}, asyncsocket_ctor = {{0}, JS_TAG_UNDEFINED};
+                asyncsocket_proto = {{0}, JS_TAG_UNDEFINED}, socket_ctor = {{0}, JS_TAG_UNDEFINED}, asyncsocket_ctor = {{0}, JS_TAG_UNDEFINED},
+                listener_proto = {{0}, JS_TAG_UNDEFINED}, listener_ctor = {{0}, JS_TAG_UNDEFINED};
 
 /*extern const uint32_t qjsm_fd_set_size;
 extern const uint8_t qjsm_fd_set[1030];
@@ -83,6 +98,11 @@ static const char* syscall_names[] = {
     "close",
     "getsockopt",
     "setsockopt",
+    "recvmmsg",
+    "sendmmsg",
+    "sendfile",
+    "recvmsg",
+    "sendmsg",
 };
 
 static const char*
@@ -546,6 +566,10 @@ static const JSCFunctionListEntry js_sockaddr_proto_funcs[] = {
     JS_PROP_STRING_DEF("[Symbol.toStringTag]", "SockAddr", 0),
 };
 
+static const JSCFunctionListEntry js_sockaddr_static_funcs[] = {
+    JS_PROP_INT32_DEF("BYTES_PER_ELEMENT", sizeof(SockAddr), JS_PROP_CONFIGURABLE),
+};
+
 static JSClassDef js_sockaddr_class = {
     .class_name = "SockAddr",
     .finalizer = js_sockaddr_finalizer,
@@ -977,9 +1001,9 @@ socket_method(int magic) {
       "accept",
       "connect",
       "listen",
-      0,
-      0,
-      0,
+      "sendfile",
+      "recvmmsg",
+      "sendmmsg",
       "recv",
       "send",
       "recvfrom",
@@ -992,16 +1016,65 @@ socket_method(int magic) {
   return methods[magic & 0x0f];
 }
 
+/**
+ * Synchronous Sockets keep their state in the opaque pointer itself when it
+ * fits (64-bit pointers, fd < 0xffff), tagged by bit 0. Otherwise the opaque
+ * points to a heap allocated Socket.
+ *
+ *   bit  0       tag (1)
+ *   bits 1-16    fd + 1
+ *   bits 17-24   error
+ *   bits 25-29   sysno
+ *   bit  30      nonblock
+ *   bit  31      owner
+ *   bits 32-63   ret
+ */
+#define SOCKET_PACKED(ptr) (((uintptr_t)(ptr)) & 1)
+
+static inline BOOL
+socket_packable(const Socket* s) {
+  return sizeof(void*) >= sizeof(uint64_t) && s->fd >= -1 && s->fd < 0xffff;
+}
+
+static inline void*
+socket_pack(const Socket* s) {
+  uint64_t u = 1;
+
+  u |= (uint64_t)((s->fd + 1) & 0xffff) << 1;
+  u |= (uint64_t)s->error << 17;
+  u |= (uint64_t)s->sysno << 25;
+  u |= (uint64_t)!!s->nonblock << 30;
+  u |= (uint64_t)!!s->owner << 31;
+  u |= (uint64_t)(uint32_t)s->ret << 32;
+
+  return (void*)(uintptr_t)u;
+}
+
+static inline Socket
+socket_unpack(const void* ptr) {
+  uint64_t u = (uintptr_t)ptr;
+  Socket s = SOCKET_INIT();
+
+  s.fd = (int)((u >> 1) & 0xffff) - 1;
+  s.error = (u >> 17) & 0xff;
+  s.sysno = (u >> 25) & 0x1f;
+  s.nonblock = (u >> 30) & 1;
+  s.owner = (u >> 31) & 1;
+  s.ret = (int32_t)(uint32_t)(u >> 32);
+
+  return s;
+}
+
 Socket
 js_socket_data(JSValueConst value) {
-  JSClassID id = JS_GetClassID(value);
+  JSClassID id;
   Socket sock = SOCKET_INIT();
 
   if((id = JS_GetClassID(value)) > 0) {
     void* opaque = JS_GetOpaque(value, id);
 
     if(id == js_socket_class_id)
-      sock = *(Socket*)&opaque;
+      sock = SOCKET_PACKED(opaque) ? socket_unpack(opaque) : *(Socket*)opaque;
     else if(id == js_asyncsocket_class_id)
       sock = *(Socket*)opaque;
   }
@@ -1009,15 +1082,36 @@ js_socket_data(JSValueConst value) {
   return sock;
 }
 
+/* write back the state of a synchronous Socket */
+static void
+js_socket_store(JSValueConst value, const Socket* s) {
+  void* opaque;
+
+  if(!(opaque = JS_GetOpaque(value, js_socket_class_id)))
+    return;
+
+  if(!SOCKET_PACKED(opaque))
+    *(Socket*)opaque = *s;
+  else if(socket_packable(s))
+    JS_SetOpaque(value, socket_pack(s));
+}
+
+/* when cleared by throwErrors(false), socket methods return -errno instead of throwing */
+static thread_local BOOL sockets_throw = TRUE;
+
 static JSValue
 js_socket_error(JSContext* ctx, Socket sock) {
   JSValue ret = JS_NewInt32(ctx, socket_retval(sock));
   int err;
 
   if((err = socket_error(sock))) {
-    if(!(sock.nonblock &&
-         ((sock.sysno == SYSCALL_RECV && err == EAGAIN) || (sock.sysno == SYSCALL_SEND && err == EWOULDBLOCK) || (sock.sysno == SYSCALL_CONNECT && err == EINPROGRESS))))
-      ret = JS_Throw(ctx, js_syscallerror_new(ctx, socket_syscall(sock), err));
+    if(!sockets_throw)
+      ret = JS_NewInt32(ctx, -err);
+    else if(!(sock.nonblock &&
+         ((sock.sysno == SYSCALL_RECV && err == EAGAIN) || (sock.sysno == SYSCALL_SEND && err == EWOULDBLOCK) || (sock.sysno == SYSCALL_CONNECT && err == EINPROGRESS) ||
+          ((sock.sysno == SYSCALL_RECVMMSG || sock.sysno == SYSCALL_SENDMMSG || sock.sysno == SYSCALL_SENDFILE || sock.sysno == SYSCALL_RECVMSG || sock.sysno == SYSCALL_SENDMSG) &&
+           err == EAGAIN))))
+      ret = js_syscallerror_throw_errno(ctx, socket_syscall(sock), err);
   }
 
   return ret;
@@ -1060,22 +1154,29 @@ js_socket_new_proto(JSContext* ctx, JSValueConst proto, int fd, BOOL async, BOOL
     AsyncSocket* asock;
 
     if(!(asock = js_mallocz(ctx, sizeof(AsyncSocket))))
-      return JS_EXCEPTION;
+      goto fail;
 
     JS_SetOpaque(obj, asock);
     s = (Socket*)asock;
 
     s->fd = fd;
     s->nonblock = TRUE;
+    s->owner = owner;
 
     socket_nonblocking(s, TRUE);
 
   } else {
     Socket sock = SOCKET(fd, 0, -1, FALSE, FALSE, owner);
-    assert(sizeof(Socket) == sizeof(sock.ptr));
 
-    JS_SetOpaque(obj, sock.ptr);
-    //  s = (Socket*)&(JS_VALUE_GET_OBJ(obj)->u.opaque);
+    if(socket_packable(&sock)) {
+      JS_SetOpaque(obj, socket_pack(&sock));
+    } else {
+      if(!(s = js_malloc(ctx, sizeof(Socket))))
+        goto fail;
+
+      *s = sock;
+      JS_SetOpaque(obj, s);
+    }
   }
 
   return obj;
@@ -1111,6 +1212,10 @@ enum {
   PROP_LOCAL,
   PROP_REMOTE,
   PROP_NONBLOCK,
+  PROP_TIMEOUT,
+  PROP_READ_TIMEOUT,
+  PROP_WRITE_TIMEOUT,
+  PROP_BUFFERED,
 };
 
 static JSValue
@@ -1120,7 +1225,7 @@ js_socket_get(JSContext* ctx, JSValueConst this_val, int magic) {
 
   switch(magic) {
     case PROP_FD: {
-      ret = JS_NewInt32(ctx, (int16_t)s.fd);
+      ret = JS_NewInt32(ctx, s.fd);
       break;
     }
 
@@ -1196,6 +1301,30 @@ js_socket_get(JSContext* ctx, JSValueConst this_val, int magic) {
   return ret;
 }
 
+static struct socket_deadlines* asyncsocket_deadlines(JSContext*, JSValueConst, AsyncSocket*);
+
+static JSValue
+js_asyncsocket_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  AsyncSocket* s;
+  struct socket_deadlines* d;
+  uint32_t ms = 0;
+
+  if(!(s = js_asyncsocket_ptr(this_val)))
+    return JS_UNDEFINED;
+
+  if(magic == PROP_BUFFERED)
+    return JS_NewInt64(ctx, s->writer ? queue_size(&s->writer->queue) : 0);
+
+  if((d = s->deadlines))
+    switch(magic) {
+      case PROP_TIMEOUT: ms = d->timeout; break;
+      case PROP_READ_TIMEOUT: ms = d->read_timeout; break;
+      case PROP_WRITE_TIMEOUT: ms = d->write_timeout; break;
+    }
+
+  return JS_NewUint32(ctx, ms);
+}
+
 static JSValue
 js_asyncsocket_set(JSContext* ctx, JSValueConst this_val, JSValueConst value, int magic) {
   AsyncSocket* s;
@@ -1221,6 +1350,32 @@ js_asyncsocket_set(JSContext* ctx, JSValueConst this_val, JSValueConst value, in
       s->nonblock = JS_ToBool(ctx, value);
       break;
     }
+
+    case PROP_TIMEOUT:
+    case PROP_READ_TIMEOUT:
+    case PROP_WRITE_TIMEOUT: {
+      struct socket_deadlines* d;
+      uint32_t ms = 0;
+
+      if(!js_is_null_or_undefined(value) && JS_ToUint32(ctx, &ms, value))
+        return JS_EXCEPTION;
+
+      if(!(d = asyncsocket_deadlines(ctx, this_val, s)))
+        return JS_EXCEPTION;
+
+      if(magic == PROP_TIMEOUT) {
+        if((d->timeout = ms))
+          timer_start(ctx, &d->idle, ms);
+        else
+          timer_stop(ctx, &d->idle);
+      } else if(magic == PROP_READ_TIMEOUT) {
+        d->read_timeout = ms;
+      } else {
+        d->write_timeout = ms;
+      }
+
+      break;
+    }
   }
 
   /* if(id == js_socket_class_id)
@@ -1253,7 +1408,7 @@ js_socket_set(JSContext* ctx, JSValueConst this_val, JSValueConst value, int mag
     }
   }
 
-  JS_SetOpaque(this_val, s.ptr);
+  js_socket_store(this_val, &s);
 
   return ret;
 }
@@ -1264,6 +1419,9 @@ enum {
   METHOD_ACCEPT = 0x02,
   METHOD_CONNECT = 0x03,
   METHOD_LISTEN = 0x04,
+  METHOD_SENDFILE = 0x05,
+  METHOD_RECVMMSG = 0x06,
+  METHOD_SENDMMSG = 0x07,
   METHOD_RECV = 0x08,
   METHOD_SEND = 0x09,
   METHOD_RECVFROM = 0x0a,
@@ -1274,486 +1432,3014 @@ enum {
   METHOD_CLOSE,
 };
 
+/* number of arguments an AsyncSocket keeps for retrying a method */
+static inline int
+socket_method_argc(int magic) {
+  switch(magic & 0x0f) {
+    case METHOD_RECV:
+    case METHOD_SEND:
+    case METHOD_RECVMMSG:
+    case METHOD_SENDMMSG: return 4;
+    case METHOD_RECVFROM:
+    case METHOD_SENDTO: return 5;
+    /* fd, offset, length and the number of bytes sent so far */
+    case METHOD_SENDFILE: return 4;
+  }
+
+  return 1;
+}
+
+#ifdef HAVE_SENDFILE
+/* sendfile() moves at most this many bytes per call on Linux */
+#define SENDFILE_MAX 0x7ffff000
+
+/* the rest of a regular file from 'offset', or from the file position when it is < 0 */
+static int64_t
+sendfile_length(int fd, int64_t offset) {
+  struct stat st;
+
+  if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    return SENDFILE_MAX;
+
+  if(offset < 0 && (offset = lseek(fd, 0, SEEK_CUR)) == -1)
+    offset = 0;
+
+  return MAX_NUM(st.st_size - offset, 0);
+}
+#endif
+
 enum {
   ASYNC_READY = 1 << 16,
   ASYNC_WAITONLY = 1 << 17,
 };
 
+static void asyncsocket_deadline_start(JSContext*, JSValueConst, AsyncSocket*, int, JSValueConst, void*);
+static void asyncsocket_deadline_done(JSContext*, AsyncSocket*, int);
+static void asyncsocket_idle_timeout(JSContext*, Timer*);
+static void asyncsocket_read_timeout(JSContext*, Timer*);
+static void asyncsocket_write_timeout(JSContext*, Timer*);
+#ifdef HAVE_ZEROCOPY
+static int asyncsocket_zerocopy_drain(JSContext*, JSValueConst, AsyncSocket*);
+#endif
+
+#ifdef HAVE_EPOLL_CREATE1
+#define SOCKETS_POLL_BATCH 256
+
 /**
- *   data[0]   Socket
- *   data[1]   resolve function
- *   data[2]   os.set(Read|Write)Handler function
- *   data[3]   buf
- *   data[4]   len
- *   data[5]   flags
- *   data[6]   dest_addr
- *   data[7]   addrlen
+ * One edge-triggered epoll instance per thread, shared by all AsyncSockets.
+ *
+ * Sockets are registered once for both directions. Readiness reported by epoll
+ * is cached in AsyncSocket.ready and is only cleared when an operation fails
+ * with EAGAIN. The epoll fd itself is registered with os.setReadHandler() only
+ * while there are pending operations.
  */
-static JSValue
-js_asyncsocket_resolve(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
-  AsyncSocket* asock = js_asyncsocket_ptr(data[0]);
-  JSValueConst value = data[0];
+static thread_local struct {
+  int fd, pending;
+  JSObject** sockets;
+  size_t size;
+} sockets_poll = {-1, 0, 0, 0};
 
-  assert(JS_VALUE_GET_TAG(data[1]) == JS_TAG_OBJECT);
-  assert(JS_VALUE_GET_OBJ(data[1]));
+static JSValue js_sockets_poll_handler(JSContext*, JSValueConst, int, JSValueConst[]);
 
-  if((magic & 0x0f) == METHOD_CONNECT) {
-    int err = 0;
-    socklen_t optlen = sizeof(err);
+static BOOL
+sockets_poll_arm(JSContext* ctx, BOOL arm) {
+  JSValue set_handler;
+  BOOL ret;
 
-    if(getsockopt(socket_handle(*asock), SOL_SOCKET, SO_ERROR, (void*)&err, &optlen) != 0) {
-      asock->ret = -1;
-      asock->sysno = SYSCALL_GETSOCKOPT;
-      err = errno;
-    }
+  if(JS_IsException((set_handler = js_iohandler_fn(ctx, FALSE))))
+    return FALSE;
 
-    asock->error = err;
+  ret = js_iohandler_set(ctx, set_handler, sockets_poll.fd, arm ? JS_NewCFunction(ctx, js_sockets_poll_handler, "poll", 0) : JS_NULL);
 
-    value = JS_NewInt32(ctx, err ? -1 : 0);
-  } else {
-    value = js_socket_method(ctx, data[0], (magic & 0x08) ? ((magic & 0x02) ? 5 : 4) : 1, &data[3], magic | ASYNC_READY);
-  }
+  JS_FreeValue(ctx, set_handler);
+  return ret;
+}
 
-  if(js_object_same(data[1], asock->pending[magic & 1])) {
-    JSValueConst args[2] = {data[0], JS_NULL};
-    JS_Call(ctx, data[2], JS_UNDEFINED, 2, args);
+static BOOL
+asyncsocket_poll(JSContext* ctx, JSValueConst obj, AsyncSocket* asock) {
+  struct epoll_event ev = {EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, {0}};
+  int fd = socket_fd(*asock);
 
-#ifdef DEBUG_OUTPUT
-    printf("[%p] set%sHandler(%d, null)\n", JS_VALUE_GET_OBJ(data[1]), magic & 1 ? "Write" : "Read", asock->fd);
-#endif
+  if(asock->polled)
+    return TRUE;
 
-    /* free ourselves */
-    JS_FreeValue(ctx, asock->pending[magic & 1]);
-    asock->pending[magic & 1] = JS_NULL;
+  if(sockets_poll.fd == -1)
+    if((sockets_poll.fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+      return FALSE;
+
+  if((size_t)fd >= sockets_poll.size) {
+    size_t n = MAX_NUM((size_t)fd + 1, sockets_poll.size * 2);
+    JSObject** ptr;
+
+    if(!(ptr = realloc(sockets_poll.sockets, n * sizeof(JSObject*))))
+      return FALSE;
+
+    memset(&ptr[sockets_poll.size], 0, (n - sockets_poll.size) * sizeof(JSObject*));
+    sockets_poll.sockets = ptr;
+    sockets_poll.size = n;
   }
 
-  JS_Call(ctx, data[1], JS_UNDEFINED, 1, &value);
+  ev.data.fd = fd;
 
-  /*  JS_FreeValue(ctx, data[1]);
-    data[1] = JS_UNDEFINED;*/
+  if(epoll_ctl(sockets_poll.fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    return FALSE;
 
-  return JS_UNDEFINED;
+  sockets_poll.sockets[fd] = JS_VALUE_GET_OBJ(obj);
+  asock->polled = TRUE;
+  asock->ready = 0;
+  asock->queued = 0;
+
+  return TRUE;
 }
 
-static JSValue
-js_asyncsocket_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
-  AsyncSocket* s;
-  int data_len;
-  JSValue ret = JS_UNDEFINED, set_handler, args[2], data[7], promise, resolving_funcs[2];
+static void
+asyncsocket_pend(JSContext* ctx, JSValueConst obj, AsyncSocket* asock, int dir, JSValue fn) {
+  /* a socket with pending operations must stay alive, like it would when referenced by os.setReadHandler() */
+  if(!JS_IsObject(asock->pending[!dir]))
+    JS_DupValue(ctx, obj);
 
-  if(!(s = js_asyncsocket_ptr(this_val)))
-    return JS_ThrowInternalError(ctx, "Must be an AsyncSocket");
+  asock->pending[dir] = fn;
 
-  if(!js_socket_check_open(ctx, *(Socket*)s))
-    return JS_EXCEPTION;
+  if(sockets_poll.pending++ == 0)
+    sockets_poll_arm(ctx, TRUE);
+}
 
-  if(JS_IsException((set_handler = js_iohandler_fn(ctx, magic & 1))))
-    return JS_EXCEPTION;
+static void
+asyncsocket_unpend(JSContext* ctx, JSValueConst obj, AsyncSocket* asock, int dir) {
+  JSValue fn = asock->pending[dir];
 
-  if(JS_IsObject(s->pending[magic & 1]))
-    return JS_ThrowInternalError(ctx, "Already a pending %s", magic & 1 ? "write" : "read");
+  if(!JS_IsObject(fn))
+    return;
 
-  promise = JS_NewPromiseCapability(ctx, resolving_funcs);
-  if(JS_IsException(promise))
-    return promise;
+  asock->pending[dir] = JS_NULL;
 
-  data[0] = this_val;
-  data[1] = resolving_funcs[0];
-  data[2] = set_handler;
-  data_len = 3;
+  if(--sockets_poll.pending == 0)
+    sockets_poll_arm(ctx, FALSE);
 
-  if(magic >= 2) {
-    int i, n = (magic & 0x08) ? ((magic & 0x02) ? 5 : 4) : 1;
+  JS_FreeValue(ctx, fn);
 
-    for(i = 0; i < n; i++)
-      data[data_len++] = i < argc ? argv[i] : JS_UNDEFINED;
+  /* release the reference taken in asyncsocket_pend() */
+  if(!JS_IsObject(asock->pending[!dir]))
+    JS_FreeValue(ctx, JS_MKPTR(JS_TAG_OBJECT, JS_VALUE_GET_OBJ(obj)));
+}
+
+static void
+asyncsocket_unpoll(JSRuntime* rt, AsyncSocket* asock) {
+  int fd = socket_fd(*asock);
+
+  if(!asock->polled)
+    return;
+
+  /* after the fd has been closed and reused, the slot belongs to another socket */
+  if((size_t)fd < sockets_poll.size && sockets_poll.sockets[fd] && js_asyncsocket_ptr(JS_MKPTR(JS_TAG_OBJECT, sockets_poll.sockets[fd])) == asock) {
+    epoll_ctl(sockets_poll.fd, EPOLL_CTL_DEL, fd, 0);
+    sockets_poll.sockets[fd] = 0;
   }
 
-  args[0] = JS_NewInt32(ctx, socket_fd(*s));
-  args[1] = JS_NewCFunctionData(ctx, js_asyncsocket_resolve, 0, magic, data_len, data);
+  asock->polled = FALSE;
+  asock->ready = 0;
+}
 
-#ifdef DEBUG_OUTPUT
-  printf("set%sHandler(%d, %p)\n", magic & 1 ? "Write" : "Read", socket_fd(*s), JS_VALUE_GET_OBJ(data[1]));
-#endif
+static JSValue
+js_asyncsocket_job(JSContext* ctx, int argc, JSValueConst argv[]) {
+  AsyncSocket* asock;
+  int32_t dir = 0;
+  JSValue fn, ret = JS_UNDEFINED;
 
-  s->pending[magic & 1] = JS_DupValue(ctx, resolving_funcs[0]);
+  if(!(asock = js_asyncsocket_ptr(argv[0])))
+    return ret;
 
-  ret = JS_Call(ctx, set_handler, JS_UNDEFINED, 2, args);
+  JS_ToInt32(ctx, &dir, argv[1]);
+  asock->queued &= ~(1 << dir);
 
-  JS_FreeValue(ctx, ret);
-  JS_FreeValue(ctx, set_handler);
-  JS_FreeValue(ctx, resolving_funcs[0]);
-  JS_FreeValue(ctx, resolving_funcs[1]);
+  if(JS_IsObject(asock->pending[dir])) {
+    fn = JS_DupValue(ctx, asock->pending[dir]);
+    ret = JS_Call(ctx, fn, JS_UNDEFINED, 0, 0);
+    JS_FreeValue(ctx, fn);
+  }
 
-  return promise;
+  return ret;
+}
+
+static void
+asyncsocket_dispatch(JSContext* ctx, JSValueConst obj, AsyncSocket* asock) {
+  int dir;
+
+  for(dir = 0; dir < 2; dir++) {
+    if(!(asock->ready & (1 << dir)) || (asock->queued & (1 << dir)) || !JS_IsObject(asock->pending[dir]))
+      continue;
+
+    JSValueConst args[2] = {obj, JS_NewInt32(ctx, dir)};
+
+    asock->queued |= 1 << dir;
+    JS_EnqueueJob(ctx, js_asyncsocket_job, 2, args);
+  }
 }
 
 static JSValue
-js_socket_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
-  Socket sock = js_socket_data(this_val);
-  JSValue ret = JS_UNDEFINED;
-  SockAddr* a = 0;
-  socklen_t alen = 0;
-  AsyncSocket* asock = js_asyncsocket_ptr(this_val);
-  Socket* s = asock ? (Socket*)asock : &sock;
-  BOOL wait = s->nonblock && !(magic & ASYNC_READY);
+js_sockets_poll_handler(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  struct epoll_event events[SOCKETS_POLL_BATCH];
+  int i, n;
 
-  magic &= (ASYNC_READY - 1);
+  if((n = epoll_wait(sockets_poll.fd, events, countof(events), 0)) == -1)
+    return errno == EINTR ? JS_UNDEFINED : js_syscallerror_throw_errno(ctx, "epoll_wait", errno);
 
-  if(magic >= METHOD_BIND && magic <= METHOD_CONNECT)
-    if(!(a = js_sockaddr_data(argv[0])))
-      return JS_ThrowTypeError(ctx, "argument 1 must be of type SockAddr");
+  for(i = 0; i < n; i++) {
+    int fd = events[i].data.fd;
+    uint32_t ev = events[i].events;
+    AsyncSocket* asock;
+    JSValue obj;
 
-  if(!js_socket_check_open(ctx, *s))
-    return JS_EXCEPTION;
+    if((size_t)fd >= sockets_poll.size || !sockets_poll.sockets[fd])
+      continue;
 
-  if(wait) {
-    switch(magic) {
-      case METHOD_ACCEPT:
-      case METHOD_RECV:
-      case METHOD_RECVFROM:
-      case METHOD_SEND:
-      case METHOD_SENDTO: {
-        assert(0);
-        //     return js_asyncsocket_method(ctx, this_val, argc, argv, magic);
-        break;
-      }
-      default: break;
+    obj = JS_MKPTR(JS_TAG_OBJECT, sockets_poll.sockets[fd]);
+
+    if(!(asock = js_asyncsocket_ptr(obj)))
+      continue;
+
+    if(ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+      asock->ready |= 1;
+
+    if(ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+      asock->ready |= 2;
+
+#ifdef HAVE_ZEROCOPY
+    /* MSG_ZEROCOPY completions are queued on the error queue */
+    if((ev & EPOLLERR) && asock->zerocopy) {
+      /* draining may drop the last reference to the socket */
+      JS_DupValue(ctx, obj);
+      asyncsocket_zerocopy_drain(ctx, obj, asock);
+      asyncsocket_dispatch(ctx, obj, asock);
+      JS_FreeValue(ctx, obj);
+      continue;
     }
+#endif
+
+    asyncsocket_dispatch(ctx, obj, asock);
   }
 
-  switch(magic) {
-    case METHOD_NDELAY: {
-      BOOL nonblock = TRUE;
-      if(argc >= 1)
-        nonblock = JS_ToBool(ctx, argv[0]);
+  return JS_UNDEFINED;
+}
+#endif
 
-      if(nonblock != s->nonblock) {
-        socket_nonblocking(s, nonblock);
-        s->nonblock = nonblock;
-      }
+#ifdef USE_IO_URING
+/**
+ * AsyncSocket operation submitted to the io_uring completion backend.
+ *
+ * Holds references to everything the kernel reads from or writes to until the
+ * completion arrives. When the socket is not ready (-EAGAIN) a poll SQE is
+ * chained in front of a resubmission, connect() only waits for POLLOUT.
+ */
+typedef struct {
+  JSValue socket, resolve, addr;
+  InputBuffer buf;
+  OffsetLength off;
+  int32_t flags;
+  socklen_t addrlen;
+  int magic;
+  uint64_t user_data;
+  BOOL polling, timedout;
+} AsyncSocketOp;
+
+static void asyncsocket_complete(JSContext*, int32_t, uint32_t, void*);
 
-      break;
-    }
+static BOOL
+asyncsocket_submit(JSContext* ctx, AsyncSocketOp* op) {
+  AsyncSocket* asock = js_asyncsocket_ptr(op->socket);
+  int fd = socket_handle(*asock);
+  struct io_uring_sqe* sqe;
 
-    case METHOD_BIND: {
-      JS_SOCKETCALL(SYSCALL_BIND, s, bind(socket_handle(*s), (struct sockaddr*)a, sockaddr_size(a)));
-      break;
-    }
+  if(!(sqe = io_ring_prepare(ctx, asyncsocket_complete, op)))
+    return FALSE;
 
-    case METHOD_ACCEPT: {
-      socklen_t addrlen = sizeof(SockAddr);
-      JS_SOCKETCALL(SYSCALL_ACCEPT, s, accept(socket_handle(*s), (struct sockaddr*)a, &addrlen));
-      break;
-    }
+  op->user_data = sqe->user_data;
 
-    case METHOD_CONNECT: {
-      JS_SOCKETCALL(SYSCALL_CONNECT, s, connect(socket_handle(*s), (struct sockaddr*)a, sockaddr_size(a)));
+  if(op->polling) {
+    io_ring_prep_rw(sqe, IORING_OP_POLL_ADD, fd, 0, 0, 0);
+    sqe->poll32_events = (op->magic & 1) ? POLLOUT : POLLIN;
+    return TRUE;
+  }
 
-      if(wait)
-        ret = js_asyncsocket_method(ctx, this_val, argc, argv, magic);
+  switch(op->magic & 0x0f) {
+    case METHOD_ACCEPT: {
+      SockAddr* a = js_sockaddr_data(op->addr);
 
+      op->addrlen = sizeof(SockAddr);
+      io_ring_prep_rw(sqe, IORING_OP_ACCEPT, fd, a, 0, a ? (uint64_t)(uintptr_t)&op->addrlen : 0);
       break;
     }
 
-    case METHOD_LISTEN: {
-      int32_t backlog = 5;
-      if(argc >= 1)
-        JS_ToInt32(ctx, &backlog, argv[0]);
-      JS_SOCKETCALL(SYSCALL_LISTEN, s, listen(socket_handle(*s), backlog));
+    case METHOD_RECV:
+    case METHOD_SEND: {
+      io_ring_prep_rw(sqe, (op->magic & 1) ? IORING_OP_SEND : IORING_OP_RECV, fd, op->buf.data + op->off.offset, offset_size(&op->off, op->buf.size), 0);
+      sqe->msg_flags = op->flags;
       break;
     }
+  }
 
-    case METHOD_RECV:
-    case METHOD_RECVFROM: {
-      int32_t flags = 0;
-      InputBuffer buf = js_input_buffer(ctx, argv[0]);
-      OffsetLength off;
-      js_offset_length(ctx, buf.size, argc - 1, argv + 1, &off);
+  return TRUE;
+}
 
-#ifdef DEBUG_OUTPUT
-      printf("recv(%d, %zu, %zu, %zu)\n", s->fd, off.offset, off.length, offset_size(&off, buf.size));
-#endif
+static void
+asyncsocket_op_free(JSContext* ctx, AsyncSocketOp* op) {
+  input_buffer_free(&op->buf, ctx);
+  JS_FreeValue(ctx, op->addr);
+  JS_FreeValue(ctx, op->resolve);
+  JS_FreeValue(ctx, op->socket);
+  js_free(ctx, op);
+}
 
-      if(argc >= 4)
+static void
+asyncsocket_complete(JSContext* ctx, int32_t res, uint32_t flags, void* opaque) {
+  static const int syscalls[] = {0, 0, SYSCALL_ACCEPT, SYSCALL_CONNECT, 0, 0, 0, 0, SYSCALL_RECV, SYSCALL_SEND};
+  AsyncSocketOp* op = opaque;
+  AsyncSocket* asock = js_asyncsocket_ptr(op->socket);
+  int dir = op->magic & 1;
+  BOOL open = socket_open(*asock);
+  JSValue value;
+
+  /* the deadline has already resolved the promise, this is the cancelled operation */
+  if(op->timedout || (flags & IO_RING_RELEASED)) {
+    asyncsocket_op_free(ctx, op);
+    return;
+  }
+
+  /* closed while in flight: settle, but leave the state of close() alone */
+  if(!open) {
+    res = -ECANCELED;
+  } else if(op->polling) {
+    op->polling = FALSE;
+
+    /* a connect() in progress has finished once the socket becomes writable */
+    if(res >= 0 && (op->magic & 0x0f) == METHOD_CONNECT) {
+      int err = 0;
+      socklen_t optlen = sizeof(err);
+
+      if(getsockopt(socket_handle(*asock), SOL_SOCKET, SO_ERROR, (void*)&err, &optlen) != 0)
+        err = errno;
+
+      res = -err;
+    } else if(res >= 0 && asyncsocket_submit(ctx, op)) {
+      return;
+    }
+  } else if(res == -EAGAIN) {
+    op->polling = TRUE;
+
+    if(asyncsocket_submit(ctx, op))
+      return;
+  }
+
+  if(open) {
+    asock->sysno = syscalls[op->magic & 0x0f];
+    asock->ret = res < 0 ? -1 : res;
+    asock->error = res < 0 ? -res : 0;
+  }
+
+  value = JS_NewInt32(ctx, res < 0 ? -1 : res);
+
+  JS_FreeValue(ctx, asock->pending[dir]);
+  asock->pending[dir] = JS_NULL;
+  asyncsocket_deadline_done(ctx, asock, dir);
+
+  JS_FreeValue(ctx, JS_Call(ctx, op->resolve, JS_UNDEFINED, 1, &value));
+  asyncsocket_op_free(ctx, op);
+}
+
+/**
+ * Submits accept/connect/recv/send through io_uring.
+ *
+ * Returns undefined when the operation should take the readiness path instead
+ * (no ring available, recvfrom/sendto).
+ */
+static JSValue
+js_asyncsocket_uring(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  AsyncSocket* s = js_asyncsocket_ptr(this_val);
+  AsyncSocketOp* op;
+  JSValue promise, resolving_funcs[2];
+
+  switch(magic & 0x0f) {
+    case METHOD_ACCEPT:
+    case METHOD_CONNECT:
+    case METHOD_RECV:
+    case METHOD_SEND: break;
+    default: return JS_UNDEFINED;
+  }
+
+  if(!io_ring_get(ctx))
+    return JS_UNDEFINED;
+
+  if(!(op = js_mallocz(ctx, sizeof(AsyncSocketOp))))
+    return JS_EXCEPTION;
+
+  op->magic = magic;
+  op->addr = JS_UNDEFINED;
+  op->buf.value = JS_UNDEFINED;
+
+  /* js_socket_method() has already called connect(), wait for POLLOUT and read SO_ERROR */
+  op->polling = (magic & 0x0f) == METHOD_CONNECT;
+
+  if((magic & 0x0f) == METHOD_ACCEPT || (magic & 0x0f) == METHOD_CONNECT) {
+    if(argc >= 1 && js_sockaddr_data(argv[0]))
+      op->addr = JS_DupValue(ctx, argv[0]);
+    else if((magic & 0x0f) == METHOD_CONNECT)
+      goto fail_type;
+  } else {
+    op->buf = (magic & 1) ? js_input_chars(ctx, argv[0]) : js_input_buffer(ctx, argv[0]);
+
+    if(JS_IsException(op->buf.value))
+      goto fail;
+
+    op->off = OFFSET_INIT();
+    js_offset_length(ctx, op->buf.size, argc - 1, argv + 1, &op->off);
+
+    if(argc >= 4)
+      JS_ToInt32(ctx, &op->flags, argv[3]);
+  }
+
+  promise = JS_NewPromiseCapability(ctx, resolving_funcs);
+  if(JS_IsException(promise))
+    goto fail;
+
+  op->socket = JS_DupValue(ctx, this_val);
+  op->resolve = resolving_funcs[0];
+  JS_FreeValue(ctx, resolving_funcs[1]);
+
+  if(!asyncsocket_submit(ctx, op)) {
+    /* ring full: let the readiness path handle this one */
+    asyncsocket_op_free(ctx, op);
+    JS_FreeValue(ctx, promise);
+    return JS_UNDEFINED;
+  }
+
+  s->pending[magic & 1] = JS_DupValue(ctx, op->resolve);
+  asyncsocket_deadline_start(ctx, this_val, s, magic & 1, op->resolve, op);
+  return promise;
+
+fail_type:
+  JS_ThrowTypeError(ctx, "argument 1 must be of type SockAddr");
+fail:
+  input_buffer_free(&op->buf, ctx);
+  JS_FreeValue(ctx, op->addr);
+  js_free(ctx, op);
+  return JS_EXCEPTION;
+}
+
+static void
+asyncsocket_cancel(JSContext* ctx, AsyncSocket* asock) {
+#ifdef IORING_ASYNC_CANCEL_FD
+  struct io_uring_sqe* sqe;
+
+  if(!JS_IsObject(asock->pending[0]) && !JS_IsObject(asock->pending[1]))
+    return;
+
+  if((sqe = io_ring_prepare(ctx, 0, 0))) {
+    io_ring_prep_rw(sqe, IORING_OP_ASYNC_CANCEL, socket_handle(*asock), 0, 0, 0);
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+
+    /* the cancel matches by fd, so it must reach the kernel before close() */
+    io_ring_submit(io_ring_get(ctx));
+  }
+#endif
+}
+#endif
+
+/**
+ * Deadlines live on the shared timer wheel. A read or write deadline runs
+ * from the start of an operation until its completion. When it expires, the
+ * operation is detached from whichever backend it is waiting on and its
+ * Promise resolves to -1 with socket.errno = ETIMEDOUT. The idle deadline is
+ * restarted by every completed operation and calls socket.ontimeout().
+ */
+static struct socket_deadlines*
+asyncsocket_deadlines(JSContext* ctx, JSValueConst obj, AsyncSocket* asock) {
+  struct socket_deadlines* d;
+
+  if((d = asock->deadlines))
+    return d;
+
+  if(!(d = js_mallocz(ctx, sizeof(struct socket_deadlines))))
+    return 0;
+
+  timer_init(&d->idle, asyncsocket_idle_timeout);
+  timer_init(&d->read, asyncsocket_read_timeout);
+  timer_init(&d->write, asyncsocket_write_timeout);
+  d->socket = JS_VALUE_GET_OBJ(obj);
+  d->resolve[0] = d->resolve[1] = JS_UNDEFINED;
+
+  return asock->deadlines = d;
+}
+
+static void
+asyncsocket_deadline_start(JSContext* ctx, JSValueConst obj, AsyncSocket* asock, int dir, JSValueConst resolve, void* op) {
+  struct socket_deadlines* d;
+  uint32_t ms;
+
+  if(!(d = asock->deadlines) || !(ms = dir ? d->write_timeout : d->read_timeout))
+    return;
+
+  JS_FreeValue(ctx, d->resolve[dir]);
+  d->resolve[dir] = JS_DupValue(ctx, resolve);
+  d->op[dir] = op;
+
+  timer_start(ctx, dir ? &d->write : &d->read, ms);
+}
+
+static void
+asyncsocket_deadline_done(JSContext* ctx, AsyncSocket* asock, int dir) {
+  struct socket_deadlines* d;
+
+  if(!(d = asock->deadlines))
+    return;
+
+  timer_stop(ctx, dir ? &d->write : &d->read);
+  JS_FreeValue(ctx, d->resolve[dir]);
+  d->resolve[dir] = JS_UNDEFINED;
+  d->op[dir] = 0;
+
+  if(d->timeout)
+    timer_start(ctx, &d->idle, d->timeout);
+}
+
+static void
+asyncsocket_deadlines_clear(JSContext* ctx, AsyncSocket* asock) {
+  struct socket_deadlines* d;
+
+  if(!(d = asock->deadlines))
+    return;
+
+  timer_stop(ctx, &d->idle);
+  timer_stop(ctx, &d->read);
+  timer_stop(ctx, &d->write);
+  JS_FreeValue(ctx, d->resolve[0]);
+  JS_FreeValue(ctx, d->resolve[1]);
+  d->resolve[0] = d->resolve[1] = JS_UNDEFINED;
+  d->op[0] = d->op[1] = 0;
+}
+
+static void
+asyncsocket_idle_timeout(JSContext* ctx, Timer* t) {
+  struct socket_deadlines* d = list_entry(t, struct socket_deadlines, idle);
+  JSValue obj = JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, d->socket)), fn;
+
+  fn = JS_GetPropertyStr(ctx, obj, "ontimeout");
+
+  if(JS_IsFunction(ctx, fn))
+    JS_FreeValue(ctx, JS_Call(ctx, fn, obj, 0, 0));
+
+  JS_FreeValue(ctx, fn);
+  JS_FreeValue(ctx, obj);
+}
+
+static void
+asyncsocket_io_timeout(JSContext* ctx, struct socket_deadlines* d, int dir) {
+  JSValue obj = JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, d->socket)), resolve = d->resolve[dir], value;
+  AsyncSocket* asock = js_asyncsocket_ptr(obj);
+
+  d->resolve[dir] = JS_UNDEFINED;
+
+#ifdef USE_IO_URING
+  if(d->op[dir]) {
+    AsyncSocketOp* op = d->op[dir];
+    struct io_uring_sqe* sqe;
+
+    op->timedout = TRUE;
+
+    if((sqe = io_ring_prepare(ctx, 0, 0)))
+      io_ring_prep_rw(sqe, IORING_OP_ASYNC_CANCEL, -1, (void*)(uintptr_t)op->user_data, 0, 0);
+
+    JS_FreeValue(ctx, asock->pending[dir]);
+    asock->pending[dir] = JS_NULL;
+  } else
+#endif
+#ifdef HAVE_EPOLL_CREATE1
+  if(asock->polled) {
+    asyncsocket_unpend(ctx, obj, asock, dir);
+  } else
+#endif
+  if(JS_IsObject(asock->pending[dir])) {
+    JSValue set_handler;
+
+    if(!JS_IsException((set_handler = js_iohandler_fn(ctx, dir)))) {
+      js_iohandler_set(ctx, set_handler, socket_fd(*asock), JS_NULL);
+      JS_FreeValue(ctx, set_handler);
+    }
+
+    JS_FreeValue(ctx, asock->pending[dir]);
+    asock->pending[dir] = JS_NULL;
+  }
+
+  d->op[dir] = 0;
+
+  asock->sysno = dir ? SYSCALL_SEND : SYSCALL_RECV;
+  asock->ret = -1;
+  asock->error = ETIMEDOUT;
+
+  value = JS_NewInt32(ctx, -1);
+  JS_FreeValue(ctx, JS_Call(ctx, resolve, JS_UNDEFINED, 1, &value));
+  JS_FreeValue(ctx, resolve);
+  JS_FreeValue(ctx, obj);
+}
+
+static void
+asyncsocket_read_timeout(JSContext* ctx, Timer* t) {
+  asyncsocket_io_timeout(ctx, list_entry(t, struct socket_deadlines, read), 0);
+}
+
+static void
+asyncsocket_write_timeout(JSContext* ctx, Timer* t) {
+  asyncsocket_io_timeout(ctx, list_entry(t, struct socket_deadlines, write), 1);
+}
+
+/**
+ * AsyncSocket.write() appends to a per-socket Queue instead of issuing a
+ * send() per call. All data written during one turn of the job queue (or
+ * between cork() and the matching uncork()) forms a batch, which is sent
+ * with as few writev() calls as possible. Every write() of a batch returns
+ * the same Promise, resolving to the size of the batch or -1 on error.
+ */
+#ifndef _WIN32
+static void asyncsocket_writer_flush(JSContext*, JSValueConst, AsyncSocket*);
+static JSValue js_asyncsocket_writable(JSContext*, JSValueConst, int, JSValueConst[], int, JSValue[]);
+
+static struct socket_writer*
+asyncsocket_writer(JSContext* ctx, AsyncSocket* asock) {
+  struct socket_writer* w;
+
+  if((w = asock->writer))
+    return w;
+
+  if(!(w = js_mallocz(ctx, sizeof(struct socket_writer))))
+    return 0;
+
+  queue_init(&w->queue);
+  w->promise = w->resolve = w->inflight = JS_UNDEFINED;
+
+  return asock->writer = w;
+}
+
+static JSValue
+js_asyncsocket_writer_job(JSContext* ctx, int argc, JSValueConst argv[]) {
+  AsyncSocket* asock;
+
+  if((asock = js_asyncsocket_ptr(argv[0])) && asock->writer) {
+    asock->writer->scheduled = FALSE;
+    asyncsocket_writer_flush(ctx, argv[0], asock);
+  }
+
+  return JS_UNDEFINED;
+}
+
+static void
+asyncsocket_writer_schedule(JSContext* ctx, JSValueConst obj, struct socket_writer* w) {
+  if(w->scheduled || w->corked || JS_IsUndefined(w->resolve))
+    return;
+
+  w->scheduled = TRUE;
+  JS_EnqueueJob(ctx, js_asyncsocket_writer_job, 1, &obj);
+}
+
+static void
+asyncsocket_writer_settle(JSContext* ctx, JSValue* resolve, int64_t result) {
+  JSValue value = JS_NewInt64(ctx, result), fn = *resolve;
+
+  if(JS_IsUndefined(fn))
+    return;
+
+  *resolve = JS_UNDEFINED;
+  JS_FreeValue(ctx, JS_Call(ctx, fn, JS_UNDEFINED, 1, &value));
+  JS_FreeValue(ctx, fn);
+}
+
+static void
+asyncsocket_writer_wait(JSContext* ctx, JSValueConst obj, AsyncSocket* asock, BOOL wait) {
+  struct socket_writer* w = asock->writer;
+  JSValue set_handler;
+
+  if(w->waiting == wait)
+    return;
+
+  if(JS_IsException((set_handler = js_iohandler_fn(ctx, TRUE))))
+    return;
+
+  if(js_iohandler_set(ctx, set_handler, socket_fd(*asock), wait ? JS_NewCFunctionData(ctx, js_asyncsocket_writable, 0, 0, 1, &obj) : JS_NULL))
+    w->waiting = wait;
+
+  JS_FreeValue(ctx, set_handler);
+}
+
+static void
+asyncsocket_writer_flush(JSContext* ctx, JSValueConst obj, AsyncSocket* asock) {
+  struct socket_writer* w = asock->writer;
+  JSValue inflight, resolve;
+
+  if(w->waiting)
+    return;
+
+  /* start the next batch */
+  if(JS_IsUndefined(w->inflight)) {
+    if(w->corked || JS_IsUndefined(w->resolve))
+      return;
+
+    w->inflight = w->resolve;
+    w->resolve = JS_UNDEFINED;
+    JS_FreeValue(ctx, w->promise);
+    w->promise = JS_UNDEFINED;
+
+    w->batch = w->size;
+    w->remain = w->unwritten;
+    w->size = w->unwritten = 0;
+  }
+
+  while(w->remain > 0) {
+    ssize_t r;
+
+    if((r = queue_writev(&w->queue, socket_fd(*asock), 0)) == -1) {
+      if(errno == EINTR)
+        continue;
+
+      if(errno == EAGAIN || errno == EWOULDBLOCK) {
+        asyncsocket_writer_wait(ctx, obj, asock, TRUE);
+        return;
+      }
+
+      asock->sysno = SYSCALL_SEND;
+      asock->ret = -1;
+      asock->error = errno;
+
+      queue_clear(&w->queue);
+      w->size = w->unwritten = w->remain = w->batch = 0;
+
+      inflight = w->inflight;
+      resolve = w->resolve;
+      JS_FreeValue(ctx, w->promise);
+      w->promise = w->inflight = w->resolve = JS_UNDEFINED;
+
+      /* the callbacks may close the socket, which frees the writer */
+      asyncsocket_writer_settle(ctx, &inflight, -1);
+      asyncsocket_writer_settle(ctx, &resolve, -1);
+      return;
+    }
+
+    /* anything beyond the current batch was written on behalf of the next one */
+    if((size_t)r > w->remain) {
+      w->unwritten -= r - w->remain;
+      r = w->remain;
+    }
+
+    w->remain -= r;
+  }
+
+  inflight = w->inflight;
+  w->inflight = JS_UNDEFINED;
+  asyncsocket_writer_settle(ctx, &inflight, w->batch);
+
+  if(asock->writer)
+    asyncsocket_writer_schedule(ctx, obj, asock->writer);
+}
+
+static JSValue
+js_asyncsocket_writable(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  AsyncSocket* asock;
+
+  if((asock = js_asyncsocket_ptr(data[0])) && asock->writer) {
+    asyncsocket_writer_wait(ctx, data[0], asock, FALSE);
+    asyncsocket_writer_flush(ctx, data[0], asock);
+  }
+
+  return JS_UNDEFINED;
+}
+
+/* settles the batches of a socket being closed, so no write() is left waiting */
+static void
+asyncsocket_writer_cancel(JSContext* ctx, AsyncSocket* asock) {
+  struct socket_writer* w = asock->writer;
+  JSValue inflight = w->inflight, resolve = w->resolve;
+
+  if(JS_IsUndefined(inflight) && JS_IsUndefined(resolve))
+    return;
+
+  w->inflight = w->resolve = JS_UNDEFINED;
+
+  asock->sysno = SYSCALL_SEND;
+  asock->ret = -1;
+  asock->error = ECANCELED;
+
+  asyncsocket_writer_settle(ctx, &inflight, -1);
+  asyncsocket_writer_settle(ctx, &resolve, -1);
+}
+
+static void
+asyncsocket_writer_clear(JSRuntime* rt, AsyncSocket* asock) {
+  struct socket_writer* w;
+
+  if(!(w = asock->writer))
+    return;
+
+  queue_clear(&w->queue);
+  JS_FreeValueRT(rt, w->promise);
+  JS_FreeValueRT(rt, w->resolve);
+  JS_FreeValueRT(rt, w->inflight);
+  js_free_rt(rt, w);
+  asock->writer = 0;
+}
+
+enum {
+  WRITER_WRITE,
+  WRITER_CORK,
+  WRITER_UNCORK,
+};
+
+static JSValue
+js_asyncsocket_writer(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  AsyncSocket* asock;
+  struct socket_writer* w;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(asock = js_asyncsocket_ptr(this_val)))
+    return JS_ThrowInternalError(ctx, "Must be an AsyncSocket");
+
+  if(!(w = asyncsocket_writer(ctx, asock)))
+    return JS_EXCEPTION;
+
+  switch(magic) {
+    case WRITER_WRITE: {
+      InputBuffer input;
+      OffsetLength off = OFFSET_INIT();
+      size_t len;
+
+      if(!js_socket_check_open(ctx, *(Socket*)asock))
+        return JS_EXCEPTION;
+
+      input = js_input_chars(ctx, argv[0]);
+
+      if(JS_IsException(input.value))
+        return JS_EXCEPTION;
+
+      js_offset_length(ctx, input.size, argc - 1, argv + 1, &off);
+      len = offset_size(&off, input.size);
+
+      if(len > 0 && queue_write(&w->queue, input.data + off.offset, len) == -1) {
+        input_buffer_free(&input, ctx);
+        return JS_ThrowOutOfMemory(ctx);
+      }
+
+      input_buffer_free(&input, ctx);
+
+      if(JS_IsUndefined(w->promise)) {
+        JSValue resolving_funcs[2];
+
+        if(JS_IsException((w->promise = JS_NewPromiseCapability(ctx, resolving_funcs)))) {
+          w->promise = JS_UNDEFINED;
+          return JS_EXCEPTION;
+        }
+
+        w->resolve = resolving_funcs[0];
+        JS_FreeValue(ctx, resolving_funcs[1]);
+      }
+
+      w->size += len;
+      w->unwritten += len;
+
+      if(JS_IsUndefined(w->inflight))
+        asyncsocket_writer_schedule(ctx, this_val, w);
+
+      ret = JS_DupValue(ctx, w->promise);
+      break;
+    }
+
+    case WRITER_CORK: {
+      w->corked++;
+      break;
+    }
+
+    case WRITER_UNCORK: {
+      if(w->corked > 0 && --w->corked == 0 && JS_IsUndefined(w->inflight))
+        asyncsocket_writer_schedule(ctx, this_val, w);
+
+      break;
+    }
+  }
+
+  return ret;
+}
+#endif
+
+/**
+ * AsyncSocket.sendZeroCopy() sends with MSG_ZEROCOPY, so the kernel transmits
+ * straight from the pages of the ArrayBuffer. The buffer stays referenced
+ * until the completion for its send has been read from the socket error
+ * queue; only then does the returned Promise resolve. Completions are drained
+ * on EPOLLERR and by a timer backing off from 1 to 64 ms while sends are
+ * outstanding.
+ */
+#ifdef HAVE_ZEROCOPY
+#define ZEROCOPY_INTERVAL_MIN 1
+#define ZEROCOPY_INTERVAL_MAX 64
+
+struct zerocopy_send {
+  struct list_head link;
+  uint32_t id;
+  int32_t ret;
+  JSValue buffer, resolve;
+};
+
+static void asyncsocket_zerocopy_timeout(JSContext*, Timer*);
+
+static struct socket_zerocopy*
+asyncsocket_zerocopy(JSContext* ctx, JSValueConst obj, AsyncSocket* asock) {
+  struct socket_zerocopy* z;
+
+  if((z = asock->zerocopy))
+    return z;
+
+  if(!(z = js_mallocz(ctx, sizeof(struct socket_zerocopy))))
+    return 0;
+
+  timer_init(&z->timer, asyncsocket_zerocopy_timeout);
+  init_list_head(&z->pending);
+  z->socket = JS_VALUE_GET_OBJ(obj);
+  z->interval = ZEROCOPY_INTERVAL_MIN;
+
+  return asock->zerocopy = z;
+}
+
+static void
+asyncsocket_zerocopy_settle(JSContext* ctx, struct zerocopy_send* zs) {
+  JSValue value = JS_NewInt32(ctx, zs->ret);
+
+  list_del(&zs->link);
+  JS_FreeValue(ctx, JS_Call(ctx, zs->resolve, JS_UNDEFINED, 1, &value));
+  JS_FreeValue(ctx, zs->resolve);
+  JS_FreeValue(ctx, zs->buffer);
+  js_free(ctx, zs);
+}
+
+/* drops the reference held on the socket while sends are outstanding */
+static void
+asyncsocket_zerocopy_release(JSContext* ctx, struct socket_zerocopy* z) {
+  timer_stop(ctx, &z->timer);
+  JS_FreeValue(ctx, JS_MKPTR(JS_TAG_OBJECT, z->socket));
+}
+
+/**
+ * Reads all notifications from the error queue and settles the sends in the
+ * reported ranges of ids. Returns the number of settled sends.
+ */
+static int
+asyncsocket_zerocopy_drain(JSContext* ctx, JSValueConst obj, AsyncSocket* asock) {
+  struct socket_zerocopy* z;
+  char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+  int n = 0;
+
+  if(!(z = asock->zerocopy) || list_empty(&z->pending))
+    return 0;
+
+  for(;;) {
+    struct msghdr msg = {0};
+    struct cmsghdr* cmsg;
+
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if(recvmsg(socket_handle(*asock), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+      break;
+
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      struct sock_extended_err ee;
+      struct list_head *el, *next;
+
+      if(cmsg->cmsg_len < CMSG_LEN(sizeof(ee)))
+        continue;
+
+      memcpy(&ee, CMSG_DATA(cmsg), sizeof(ee));
+
+      if(ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee.ee_errno != 0)
+        continue;
+
+      /* the kernel had to copy after all, further sends would only pay for the page pinning */
+      if(ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        z->copied = TRUE;
+
+      /* ids [ee_info, ee_data] have completed, the range may wrap around */
+      list_for_each_safe(el, next, &z->pending) {
+        struct zerocopy_send* zs = list_entry(el, struct zerocopy_send, link);
+
+        if(zs->id - ee.ee_info <= ee.ee_data - ee.ee_info) {
+          asyncsocket_zerocopy_settle(ctx, zs);
+          ++n;
+        }
+      }
+    }
+  }
+
+  if(n > 0)
+    z->interval = ZEROCOPY_INTERVAL_MIN;
+
+  if(list_empty(&z->pending))
+    asyncsocket_zerocopy_release(ctx, z);
+
+  return n;
+}
+
+static void
+asyncsocket_zerocopy_timeout(JSContext* ctx, Timer* t) {
+  struct socket_zerocopy* z = list_entry(t, struct socket_zerocopy, timer);
+  JSValue obj = JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, z->socket));
+  AsyncSocket* asock;
+
+  if((asock = js_asyncsocket_ptr(obj))) {
+    if(asyncsocket_zerocopy_drain(ctx, obj, asock) == 0)
+      z->interval = MIN_NUM(z->interval * 2, ZEROCOPY_INTERVAL_MAX);
+
+    if(!list_empty(&z->pending))
+      timer_start(ctx, &z->timer, z->interval);
+  }
+
+  JS_FreeValue(ctx, obj);
+}
+
+/* settles all outstanding sends, the kernel keeps its own references to the pages */
+static void
+asyncsocket_zerocopy_clear(JSContext* ctx, JSValueConst obj, AsyncSocket* asock) {
+  struct socket_zerocopy* z;
+
+  if(!(z = asock->zerocopy) || list_empty(&z->pending))
+    return;
+
+  asyncsocket_zerocopy_drain(ctx, obj, asock);
+
+  if(!list_empty(&z->pending)) {
+    while(!list_empty(&z->pending))
+      asyncsocket_zerocopy_settle(ctx, list_entry(z->pending.next, struct zerocopy_send, link));
+
+    asyncsocket_zerocopy_release(ctx, z);
+  }
+}
+
+static void
+asyncsocket_zerocopy_free(JSRuntime* rt, AsyncSocket* asock) {
+  struct socket_zerocopy* z;
+  struct list_head *el, *next;
+
+  if(!(z = asock->zerocopy))
+    return;
+
+  timer_stop(0, &z->timer);
+
+  list_for_each_safe(el, next, &z->pending) {
+    struct zerocopy_send* zs = list_entry(el, struct zerocopy_send, link);
+
+    JS_FreeValueRT(rt, zs->resolve);
+    JS_FreeValueRT(rt, zs->buffer);
+    js_free_rt(rt, zs);
+  }
+
+  js_free_rt(rt, z);
+  asock->zerocopy = 0;
+}
+
+/**
+ * Attempts the send, returns TRUE when it would block.
+ *
+ *   args[0]   buffer
+ *   args[1]   offset
+ *   args[2]   length
+ */
+static BOOL
+asyncsocket_zerocopy_send(JSContext* ctx, JSValueConst obj, AsyncSocket* asock, JSValueConst args[], JSValueConst resolve) {
+  struct socket_zerocopy* z;
+  InputBuffer input;
+  OffsetLength off = OFFSET_INIT();
+  JSValue value;
+  size_t len;
+  int flags = MSG_NOSIGNAL;
+
+  if(!socket_open(*asock) || !(z = asyncsocket_zerocopy(ctx, obj, asock))) {
+    value = JS_NewInt32(ctx, -1);
+    JS_FreeValue(ctx, JS_Call(ctx, resolve, JS_UNDEFINED, 1, &value));
+    return FALSE;
+  }
+
+  input = js_input_buffer(ctx, args[0]);
+  js_offset_length(ctx, input.size, 2, args + 1, &off);
+  len = offset_size(&off, input.size);
+
+  if(!z->enabled && !z->unsupported) {
+    int one = 1;
+
+    if(setsockopt(socket_handle(*asock), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
+      z->enabled = TRUE;
+    else
+      z->unsupported = TRUE;
+  }
+
+  if(z->enabled && !z->copied)
+    flags |= MSG_ZEROCOPY;
+
+  syscall_return((Socket*)asock, SYSCALL_SEND, send(socket_handle(*asock), input.data + off.offset, len, flags));
+
+  /* optmem_max exhausted by pinned pages: fall back to copying */
+  if(asock->ret < 0 && asock->error == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+    flags &= ~MSG_ZEROCOPY;
+    syscall_return((Socket*)asock, SYSCALL_SEND, send(socket_handle(*asock), input.data + off.offset, len, flags));
+  }
+
+  if(asock->ret < 0 && (asock->error == EAGAIN || asock->error == EWOULDBLOCK)) {
+    input_buffer_free(&input, ctx);
+    return TRUE;
+  }
+
+  if(asock->ret >= 0 && (flags & MSG_ZEROCOPY)) {
+    struct zerocopy_send* zs;
+
+    if((zs = js_malloc(ctx, sizeof(struct zerocopy_send)))) {
+      /* every successful MSG_ZEROCOPY send consumes one id, even when it only sent part of the buffer */
+      zs->id = z->next++;
+      zs->ret = asock->ret;
+      zs->buffer = JS_DupValue(ctx, input.value);
+      zs->resolve = JS_DupValue(ctx, resolve);
+
+      if(list_empty(&z->pending)) {
+        JS_DupValue(ctx, obj);
+        z->interval = ZEROCOPY_INTERVAL_MIN;
+        timer_start(ctx, &z->timer, z->interval);
+      }
+
+      list_add_tail(&zs->link, &z->pending);
+      input_buffer_free(&input, ctx);
+      return FALSE;
+    }
+
+    z->next++;
+  }
+
+  input_buffer_free(&input, ctx);
+
+  value = JS_NewInt32(ctx, asock->ret);
+  JS_FreeValue(ctx, JS_Call(ctx, resolve, JS_UNDEFINED, 1, &value));
+  return FALSE;
+}
+
+/**
+ *   data[0]   AsyncSocket
+ *   data[1]   resolve function
+ *   data[2]   buffer
+ *   data[3]   offset
+ *   data[4]   length
+ *   data[5]   fd the write handler is registered on
+ */
+static JSValue
+js_asyncsocket_zerocopy_writable(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  AsyncSocket* asock;
+  JSValue set_handler;
+  int32_t fd = -1;
+
+  /* asyncsocket_zerocopy_send() resolves -1 once the socket has been closed */
+  if((asock = js_asyncsocket_ptr(data[0])) && asyncsocket_zerocopy_send(ctx, data[0], asock, &data[2], data[1]))
+    return JS_UNDEFINED;
+
+  JS_ToInt32(ctx, &fd, data[5]);
+
+  if(!JS_IsException((set_handler = js_iohandler_fn(ctx, TRUE)))) {
+    js_iohandler_set(ctx, set_handler, fd, JS_NULL);
+    JS_FreeValue(ctx, set_handler);
+  }
+
+  return JS_UNDEFINED;
+}
+
+static JSValue
+js_asyncsocket_sendzerocopy(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  AsyncSocket* asock;
+  JSValue promise, resolving_funcs[2], args[3];
+  int i;
+
+  if(!(asock = js_asyncsocket_ptr(this_val)))
+    return JS_ThrowInternalError(ctx, "Must be an AsyncSocket");
+
+  if(!js_socket_check_open(ctx, *(Socket*)asock))
+    return JS_EXCEPTION;
+
+  if(!js_is_arraybuffer(ctx, argv[0]) && !js_is_typedarray(ctx, argv[0]))
+    return JS_ThrowTypeError(ctx, "argument 1 must be an ArrayBuffer or a TypedArray");
+
+  if(JS_IsException((promise = JS_NewPromiseCapability(ctx, resolving_funcs))))
+    return JS_EXCEPTION;
+
+  for(i = 0; i < 3; i++)
+    args[i] = i < argc ? argv[i] : JS_UNDEFINED;
+
+  if(asyncsocket_zerocopy_send(ctx, this_val, asock, args, resolving_funcs[0])) {
+    JSValue data[6] = {this_val, resolving_funcs[0], args[0], args[1], args[2], JS_NewInt32(ctx, socket_fd(*asock))}, set_handler;
+
+    if(JS_IsException((set_handler = js_iohandler_fn(ctx, TRUE)))) {
+      JS_FreeValue(ctx, promise);
+      promise = JS_EXCEPTION;
+    } else {
+      js_iohandler_set(ctx, set_handler, socket_fd(*asock), JS_NewCFunctionData(ctx, js_asyncsocket_zerocopy_writable, 0, 0, countof(data), data));
+      JS_FreeValue(ctx, set_handler);
+    }
+  }
+
+  JS_FreeValue(ctx, resolving_funcs[0]);
+  JS_FreeValue(ctx, resolving_funcs[1]);
+  return promise;
+}
+#endif
+
+/**
+ *   data[0]   Socket
+ *   data[1]   resolve function
+ *   data[2]   os.set(Read|Write)Handler function (null when polled through epoll)
+ *   data[3]   buf
+ *   data[4]   len
+ *   data[5]   flags
+ *   data[6]   dest_addr
+ *   data[7]   addrlen
+ */
+static JSValue
+js_asyncsocket_resolve(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  AsyncSocket* asock = js_asyncsocket_ptr(data[0]);
+  JSValueConst value = data[0];
+
+  assert(JS_VALUE_GET_TAG(data[1]) == JS_TAG_OBJECT);
+  assert(JS_VALUE_GET_OBJ(data[1]));
+
+  /* called by asyncsocket_pending_cancel() with the socket being closed */
+  if(argc > 0) {
+    asock->sysno = (magic & 1) ? SYSCALL_SEND : SYSCALL_RECV;
+    asock->ret = -1;
+    asock->error = ECANCELED;
+
+    asyncsocket_deadline_done(ctx, asock, magic & 1);
+
+    value = JS_NewInt32(ctx, -1);
+    JS_FreeValue(ctx, JS_Call(ctx, data[1], JS_UNDEFINED, 1, &value));
+    return JS_UNDEFINED;
+  }
+
+  if((magic & 0x0f) == METHOD_CONNECT) {
+    int err = 0;
+    socklen_t optlen = sizeof(err);
+
+    if(getsockopt(socket_handle(*asock), SOL_SOCKET, SO_ERROR, (void*)&err, &optlen) != 0) {
+      asock->ret = -1;
+      asock->sysno = SYSCALL_GETSOCKOPT;
+      err = errno;
+    }
+
+    asock->error = err;
+
+    value = JS_NewInt32(ctx, err ? -1 : 0);
+  } else {
+    value = js_socket_method(ctx, data[0], socket_method_argc(magic), &data[3], magic | ASYNC_READY);
+  }
+
+#ifdef HAVE_SENDFILE
+  /*
+   * resume a partial transfer: advance offset/length and wait for the socket
+   * to drain. The promise resolves with the total sent, also when the file
+   * ends early (0 returned).
+   */
+  if((magic & 0x0f) == METHOD_SENDFILE && asock->ret >= 0) {
+    int32_t fd = -1;
+    int64_t offset = -1, length, sent = 0;
+
+    JS_ToInt32(ctx, &fd, data[3]);
+
+    if(!js_is_null_or_undefined(data[4]))
+      JS_ToInt64(ctx, &offset, data[4]);
+
+    /* without an offset, the file position has already been advanced */
+    if(js_is_null_or_undefined(data[5])) {
+      length = sendfile_length(fd, offset >= 0 ? offset + asock->ret : -1);
+    } else {
+      JS_ToInt64(ctx, &length, data[5]);
+      length -= asock->ret;
+    }
+
+    if(!js_is_null_or_undefined(data[6]))
+      JS_ToInt64(ctx, &sent, data[6]);
+
+    sent += asock->ret;
+
+    JS_FreeValue(ctx, value);
+    value = JS_NewInt64(ctx, sent);
+
+    if(asock->ret > 0 && length > 0) {
+      if(offset >= 0) {
+        JS_FreeValue(ctx, data[4]);
+        data[4] = JS_NewInt64(ctx, offset + asock->ret);
+      }
+
+      JS_FreeValue(ctx, data[5]);
+      data[5] = JS_NewInt64(ctx, length);
+      JS_FreeValue(ctx, data[6]);
+      data[6] = value;
+
+#ifdef HAVE_EPOLL_CREATE1
+      if(JS_IsNull(data[2]))
+        asyncsocket_dispatch(ctx, data[0], asock);
+#endif
+      return JS_UNDEFINED;
+    }
+  }
+#endif
+
+#ifdef HAVE_EPOLL_CREATE1
+  if(JS_IsNull(data[2])) {
+    /* readiness cache was stale: wait for the next edge */
+    if(asock->ret < 0 && (asock->error == EAGAIN || asock->error == EWOULDBLOCK)) {
+      asock->ready &= ~(1 << (magic & 1));
+      JS_FreeValue(ctx, value);
+      return JS_UNDEFINED;
+    }
+
+    asyncsocket_unpend(ctx, data[0], asock, magic & 1);
+  } else
+#endif
+  if(js_object_same(data[1], asock->pending[magic & 1])) {
+    JSValueConst args[2] = {data[0], JS_NULL};
+    JS_Call(ctx, data[2], JS_UNDEFINED, 2, args);
+
+#ifdef DEBUG_OUTPUT
+    printf("[%p] set%sHandler(%d, null)\n", JS_VALUE_GET_OBJ(data[1]), magic & 1 ? "Write" : "Read", asock->fd);
+#endif
+
+    /* free ourselves */
+    JS_FreeValue(ctx, asock->pending[magic & 1]);
+    asock->pending[magic & 1] = JS_NULL;
+  }
+
+  asyncsocket_deadline_done(ctx, asock, magic & 1);
+
+  JS_Call(ctx, data[1], JS_UNDEFINED, 1, &value);
+  JS_FreeValue(ctx, value);
+
+  /*  JS_FreeValue(ctx, data[1]);
+    data[1] = JS_UNDEFINED;*/
+
+  return JS_UNDEFINED;
+}
+
+static JSValue
+js_asyncsocket_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  AsyncSocket* s;
+  int data_len;
+  JSValue ret = JS_UNDEFINED, set_handler, args[2], data[8], promise, resolving_funcs[2];
+
+  if(!(s = js_asyncsocket_ptr(this_val)))
+    return JS_ThrowInternalError(ctx, "Must be an AsyncSocket");
+
+  if(!js_socket_check_open(ctx, *(Socket*)s))
+    return JS_EXCEPTION;
+
+  if(JS_IsObject(s->pending[magic & 1]))
+    return JS_ThrowInternalError(ctx, "Already a pending %s", magic & 1 ? "write" : "read");
+
+#ifdef USE_IO_URING
+  if(!JS_IsUndefined((ret = js_asyncsocket_uring(ctx, this_val, argc, argv, magic))))
+    return ret;
+#endif
+
+#ifdef HAVE_EPOLL_CREATE1
+  if(asyncsocket_poll(ctx, this_val, s))
+    set_handler = JS_NULL;
+  else
+#endif
+  if(JS_IsException((set_handler = js_iohandler_fn(ctx, magic & 1))))
+    return JS_EXCEPTION;
+
+  promise = JS_NewPromiseCapability(ctx, resolving_funcs);
+  if(JS_IsException(promise))
+    return promise;
+
+  data[0] = this_val;
+  data[1] = resolving_funcs[0];
+  data[2] = set_handler;
+  data_len = 3;
+
+  if(magic >= 2) {
+    int i, n = socket_method_argc(magic);
+
+    for(i = 0; i < n; i++)
+      data[data_len++] = i < argc ? argv[i] : JS_UNDEFINED;
+  }
+
+  args[0] = JS_NewInt32(ctx, socket_fd(*s));
+  args[1] = JS_NewCFunctionData(ctx, js_asyncsocket_resolve, 0, magic, data_len, data);
+
+#ifdef HAVE_EPOLL_CREATE1
+  if(JS_IsNull(set_handler)) {
+    /* a connect() in progress completes with the next write edge */
+    if((magic & 0x0f) == METHOD_CONNECT)
+      s->ready &= ~2;
+
+    asyncsocket_pend(ctx, this_val, s, magic & 1, args[1]);
+    asyncsocket_deadline_start(ctx, this_val, s, magic & 1, resolving_funcs[0], 0);
+    asyncsocket_dispatch(ctx, this_val, s);
+
+    JS_FreeValue(ctx, resolving_funcs[0]);
+    JS_FreeValue(ctx, resolving_funcs[1]);
+    return promise;
+  }
+#endif
+
+#ifdef DEBUG_OUTPUT
+  printf("set%sHandler(%d, %p)\n", magic & 1 ? "Write" : "Read", socket_fd(*s), JS_VALUE_GET_OBJ(data[1]));
+#endif
+
+  s->pending[magic & 1] = JS_DupValue(ctx, resolving_funcs[0]);
+  asyncsocket_deadline_start(ctx, this_val, s, magic & 1, resolving_funcs[0], 0);
+
+  ret = JS_Call(ctx, set_handler, JS_UNDEFINED, 2, args);
+
+  JS_FreeValue(ctx, ret);
+  JS_FreeValue(ctx, set_handler);
+  JS_FreeValue(ctx, resolving_funcs[0]);
+  JS_FreeValue(ctx, resolving_funcs[1]);
+
+  return promise;
+}
+
+/* settles the pending recv()/send()/accept()/connect() of a socket being closed with -1 (ECANCELED) */
+static void
+asyncsocket_pending_cancel(JSContext* ctx, JSValueConst obj, AsyncSocket* asock) {
+  JSValue cancel = JS_NewInt32(ctx, -ECANCELED), value = JS_NewInt32(ctx, -1);
+  int dir;
+
+  for(dir = 0; dir < 2; dir++) {
+    JSValue fn, set_handler;
+
+    if(!JS_IsObject(asock->pending[dir]))
+      continue;
+
+    fn = JS_DupValue(ctx, asock->pending[dir]);
+
+#ifdef HAVE_EPOLL_CREATE1
+    /* the poller holds the continuation, which settles its promise when passed an argument */
+    if(asock->polled) {
+      asyncsocket_unpend(ctx, obj, asock, dir);
+      JS_FreeValue(ctx, JS_Call(ctx, fn, JS_UNDEFINED, 1, &cancel));
+      JS_FreeValue(ctx, fn);
+      continue;
+    }
+#endif
+
+    /* otherwise pending[] is the resolve function itself; io_uring completions settle it a second time, which is a no-op */
+    if(!JS_IsException((set_handler = js_iohandler_fn(ctx, dir)))) {
+      js_iohandler_set(ctx, set_handler, socket_fd(*asock), JS_NULL);
+      JS_FreeValue(ctx, set_handler);
+    }
+
+    JS_FreeValue(ctx, asock->pending[dir]);
+    asock->pending[dir] = JS_NULL;
+    asyncsocket_deadline_done(ctx, asock, dir);
+
+    asock->sysno = dir ? SYSCALL_SEND : SYSCALL_RECV;
+    asock->ret = -1;
+    asock->error = ECANCELED;
+
+    JS_FreeValue(ctx, JS_Call(ctx, fn, JS_UNDEFINED, 1, &value));
+    JS_FreeValue(ctx, fn);
+  }
+}
+
+static JSValue
+js_socket_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  Socket sock = js_socket_data(this_val);
+  JSValue ret = JS_UNDEFINED;
+  SockAddr* a = 0;
+  socklen_t alen = 0;
+  AsyncSocket* asock = js_asyncsocket_ptr(this_val);
+  Socket* s = asock ? (Socket*)asock : &sock;
+  BOOL wait = s->nonblock && !(magic & ASYNC_READY);
+
+  magic &= (ASYNC_READY - 1);
+
+  if(magic >= METHOD_BIND && magic <= METHOD_CONNECT)
+    if(!(a = js_sockaddr_data(argv[0])))
+      return JS_ThrowTypeError(ctx, "argument 1 must be of type SockAddr");
+
+  if(!js_socket_check_open(ctx, *s))
+    return JS_EXCEPTION;
+
+  if(wait) {
+    switch(magic) {
+      case METHOD_ACCEPT:
+      case METHOD_RECV:
+      case METHOD_RECVFROM:
+      case METHOD_SEND:
+      case METHOD_SENDTO: {
+        assert(0);
+        //     return js_asyncsocket_method(ctx, this_val, argc, argv, magic);
+        break;
+      }
+      default: break;
+    }
+  }
+
+  switch(magic) {
+    case METHOD_NDELAY: {
+      BOOL nonblock = TRUE;
+      if(argc >= 1)
+        nonblock = JS_ToBool(ctx, argv[0]);
+
+      if(nonblock != s->nonblock) {
+        socket_nonblocking(s, nonblock);
+        s->nonblock = nonblock;
+      }
+
+      break;
+    }
+
+    case METHOD_BIND: {
+      JS_SOCKETCALL(SYSCALL_BIND, s, bind(socket_handle(*s), (struct sockaddr*)a, sockaddr_size(a)));
+      break;
+    }
+
+    case METHOD_ACCEPT: {
+      socklen_t addrlen = sizeof(SockAddr);
+      JS_SOCKETCALL(SYSCALL_ACCEPT, s, accept(socket_handle(*s), (struct sockaddr*)a, &addrlen));
+      break;
+    }
+
+    case METHOD_CONNECT: {
+      JS_SOCKETCALL(SYSCALL_CONNECT, s, connect(socket_handle(*s), (struct sockaddr*)a, sockaddr_size(a)));
+
+      if(wait)
+        ret = js_asyncsocket_method(ctx, this_val, argc, argv, magic);
+
+      break;
+    }
+
+#ifdef HAVE_SENDFILE
+    case METHOD_SENDFILE: {
+      int32_t fd = -1;
+      int64_t offset = -1, length;
+      off_t off;
+
+      JS_ToInt32(ctx, &fd, argv[0]);
+
+      if(argc >= 2 && !js_is_null_or_undefined(argv[1]))
+        JS_ToInt64(ctx, &offset, argv[1]);
+
+      if(argc >= 3 && !js_is_null_or_undefined(argv[2]))
+        JS_ToInt64(ctx, &length, argv[2]);
+      else
+        length = sendfile_length(fd, offset);
+
+      off = offset;
+
+      JS_SOCKETCALL(SYSCALL_SENDFILE, s, sendfile(socket_handle(*s), fd, offset >= 0 ? &off : 0, MIN_NUM(length, SENDFILE_MAX)));
+      break;
+    }
+#endif
+
+    case METHOD_LISTEN: {
+      int32_t backlog = 5;
+      if(argc >= 1)
+        JS_ToInt32(ctx, &backlog, argv[0]);
+      JS_SOCKETCALL(SYSCALL_LISTEN, s, listen(socket_handle(*s), backlog));
+      break;
+    }
+
+    case METHOD_RECV:
+    case METHOD_RECVFROM: {
+      int32_t flags = 0;
+      InputBuffer buf = js_input_buffer(ctx, argv[0]);
+      OffsetLength off;
+      js_offset_length(ctx, buf.size, argc - 1, argv + 1, &off);
+
+#ifdef DEBUG_OUTPUT
+      printf("recv(%d, %zu, %zu, %zu)\n", s->fd, off.offset, off.length, offset_size(&off, buf.size));
+#endif
+
+      if(argc >= 4)
+        JS_ToInt32(ctx, &flags, argv[3]);
+
+      if(magic == METHOD_RECVFROM) {
+        if((a = argc >= 5 ? js_sockaddr_data(argv[4]) : 0))
+          alen = sizeof(SockAddr);
+
+        JS_SOCKETCALL(SYSCALL_RECVFROM, s, recvfrom(socket_handle(*s), (void*)(buf.data + off.offset), offset_size(&off, buf.size), flags, &a->s, &alen));
+      } else {
+        JS_SOCKETCALL(SYSCALL_RECV, s, recv(socket_handle(*s), (void*)(buf.data + off.offset), offset_size(&off, buf.size), flags));
+      }
+
+      break;
+    }
+
+    case METHOD_SEND:
+    case METHOD_SENDTO: {
+      int32_t flags = 0;
+      InputBuffer buf = js_input_chars(ctx, argv[0]);
+      OffsetLength off;
+
+      js_offset_length(ctx, buf.size, argc - 1, argv + 1, &off);
+
+      if(argc >= 4)
         JS_ToInt32(ctx, &flags, argv[3]);
 
-      if(magic == METHOD_RECVFROM) {
-        if((a = argc >= 5 ? js_sockaddr_data(argv[4]) : 0))
-          alen = sizeof(SockAddr);
+      if(magic == METHOD_SENDTO) {
+        if((a = argc >= 5 ? js_sockaddr_data(argv[4]) : 0))
+          alen = sockaddr_size(a);
+        JS_SOCKETCALL(SYSCALL_SENDTO, s, sendto(socket_handle(*s), (const void*)(buf.data + off.offset), offset_size(&off, buf.size), flags, &a->s, alen));
+      } else {
+        JS_SOCKETCALL(SYSCALL_SEND, s, send(socket_handle(*s), (const void*)(buf.data + off.offset), offset_size(&off, buf.size), flags));
+      }
+      break;
+    }
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+    case METHOD_RECVMMSG:
+    case METHOD_SENDMMSG: {
+      int32_t flags = 0;
+      int64_t i, n = js_array_length(ctx, argv[0]);
+      InputBuffer addrs = {{{0, 0}}, 0, 0, JS_UNDEFINED, OFFSET_INIT()};
+      size_t naddrs = 0;
+      struct mmsghdr* msgs;
+      struct iovec* iov;
+      InputBuffer* bufs;
+
+      if(n < 0) {
+        ret = JS_ThrowTypeError(ctx, "argument 1 must be an array of buffers");
+        break;
+      }
+
+      /* the kernel processes at most UIO_MAXIOV messages per call */
+      n = MIN_NUM(n, 1024);
+
+      if(argc >= 2 && !js_is_null_or_undefined(argv[1])) {
+        addrs = js_input_buffer(ctx, argv[1]);
+
+        if(JS_IsException(addrs.value)) {
+          ret = JS_EXCEPTION;
+          break;
+        }
+
+        naddrs = input_buffer_length(&addrs) / sizeof(SockAddr);
+      }
+
+      if(argc >= 3)
+        JS_ToInt32(ctx, &flags, argv[2]);
+
+      if(!(msgs = js_mallocz(ctx, MAX_NUM(n, 1) * (sizeof(struct mmsghdr) + sizeof(struct iovec) + sizeof(InputBuffer))))) {
+        input_buffer_free(&addrs, ctx);
+        ret = JS_EXCEPTION;
+        break;
+      }
+
+      iov = (struct iovec*)&msgs[n];
+      bufs = (InputBuffer*)&iov[n];
+
+      for(i = 0; i < n; i++) {
+        JSValue item = JS_GetPropertyUint32(ctx, argv[0], i);
+
+        bufs[i] = magic == METHOD_SENDMMSG ? js_input_chars(ctx, item) : js_input_buffer(ctx, item);
+        JS_FreeValue(ctx, item);
+
+        if(JS_IsException(bufs[i].value)) {
+          ret = JS_EXCEPTION;
+          break;
+        }
+
+        iov[i].iov_base = input_buffer_data(&bufs[i]);
+        iov[i].iov_len = input_buffer_length(&bufs[i]);
+
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+
+        if((size_t)i < naddrs) {
+          SockAddr* a = (SockAddr*)(input_buffer_data(&addrs) + i * sizeof(SockAddr));
+
+          msgs[i].msg_hdr.msg_name = a;
+          msgs[i].msg_hdr.msg_namelen = magic == METHOD_SENDMMSG ? sockaddr_size(a) : sizeof(SockAddr);
+        }
+      }
+
+      if(i == n) {
+        if(magic == METHOD_SENDMMSG)
+          JS_SOCKETCALL(SYSCALL_SENDMMSG, s, sendmmsg(socket_handle(*s), msgs, n, flags));
+        else
+          JS_SOCKETCALL(SYSCALL_RECVMMSG, s, recvmmsg(socket_handle(*s), msgs, n, flags, 0));
+
+        if(s->ret > 0 && argc >= 4 && JS_IsObject(argv[3]))
+          for(int64_t j = 0; j < s->ret; j++)
+            JS_SetPropertyUint32(ctx, argv[3], j, JS_NewUint32(ctx, msgs[j].msg_len));
+      }
+
+      while(--i >= 0)
+        input_buffer_free(&bufs[i], ctx);
+
+      input_buffer_free(&addrs, ctx);
+      js_free(ctx, msgs);
+      break;
+    }
+#endif
+
+    case METHOD_GETSOCKOPT: {
+      int32_t level, optname;
+      uint32_t optlen = sizeof(int);
+      uint8_t* buf;
+      int32_t val = -1, *tmp = 0;
+      socklen_t len;
+
+      JS_ToInt32(ctx, &level, argv[0]);
+      JS_ToInt32(ctx, &optname, argv[1]);
+      if(argc >= 4)
+        JS_ToUint32(ctx, &optlen, argv[3]);
+      JS_ToInt32(ctx, &optname, argv[1]);
+
+      buf = optval_buf(ctx, argv[2], &tmp, &len);
+
+      JS_SOCKETCALL(SYSCALL_GETSOCKOPT, s, getsockopt(socket_handle(*s), level, optname, (void*)buf, &len));
+      if(tmp) {
+        js_array_clear(ctx, argv[2]);
+        JS_SetPropertyUint32(ctx, argv[2], 0, JS_NewInt32(ctx, *(int32_t*)buf));
+      }
+
+      // val = (void*)buf;
+      if(tmp)
+        js_free(ctx, tmp);
+
+#ifdef DEBUG_OUTPUT
+      printf("SYSCALL_GETSOCKOPT(%d, %d, %d (%d), %lu) = %d\n", socket_fd(*s), level, optname, val, (unsigned long int)len, s->ret);
+#endif
+
+      break;
+    }
+
+    case METHOD_SETSOCKOPT: {
+      int32_t level, optname, num = 0, *tmp = 0;
+      socklen_t len = 0;
+      uint8_t* buf = 0;
+
+      if(argc >= 3)
+        buf = optval_buf(ctx, argv[2], &tmp, &len);
+
+      if(!buf) {
+        buf = (uint8_t*)&num;
+        len = sizeof(num);
+      }
+
+      JS_ToInt32(ctx, &level, argv[0]);
+      JS_ToInt32(ctx, &optname, argv[1]);
+
+      if(argc >= 4) {
+        uint32_t newlen = 0;
+
+        if(!JS_ToUint32(ctx, &newlen, argv[3])) {
+          newlen = MIN_NUM(newlen, len);
+
+          if(newlen)
+            len = newlen;
+        }
+      }
+
+      /*    JS_SOCKETCALL(SYSCALL_SETSOCKOPT, s, setsockopt(socket_handle(*s), level, optname, (const void*)buf, len));
+
+        #define JS_SOCKETCALL(syscall_no, sock, result) \
+               JS_SOCKETCALL_RETURN(syscall_no, sock, result, JS_NewInt32(ctx, (sock)->ret), js_socket_error(ctx, *(sock)))
+
+         #define JS_SOCKETCALL_FAIL(syscall_no, sock, on_fail) \
+               JS_SOCKETCALL_RETURN(syscall_no, sock, result, JS_NewInt32(ctx, (sock)->ret), on_fail)
+
+         #define JS_SOCKETCALL_RETURN(syscall_no, sock, result, on_success, on_fail) \
+           do { \
+             syscall_return((sock), (syscall_no), (result)); \
+             ret = (sock)->ret < 0 ? (on_fail) : (on_success); \
+           } while(0)
+         */
+      syscall_return(s, SYSCALL_SETSOCKOPT, setsockopt(socket_handle(*s), level, optname, (const void*)buf, len));
+
+      // JS_SOCKETCALL_RETURN(SYSCALL_SETSOCKOPT, s, setsockopt(socket_handle(*s),  JS_NewInt32(ctx, (s)->ret), js_socket_error(ctx, *(sock)))
+
+#ifdef DEBUG_OUTPUT
+      printf("SYSCALL_SETSOCKOPT(%d, %d, %d, %i (%p), %lu) = %d\n", socket_fd(*s), level, optname, *(int*)buf, buf, (unsigned long int)len, s->ret);
+#endif
+
+      if(tmp)
+        js_free(ctx, tmp);
+
+      break;
+    }
+
+    case METHOD_SHUTDOWN: {
+      int32_t how;
+
+      JS_ToInt32(ctx, &how, argv[0]);
+      JS_SOCKETCALL(SYSCALL_SHUTDOWN, s, shutdown(socket_handle(*s), how));
+      break;
+    }
+
+    case METHOD_CLOSE: {
+      /*AsyncSocket* asock;
+      if((asock = js_asyncsocket_ptr(this_val))) {
+        if(JS_IsObject(asock->pending[magic & 1]))
+          JS_FreeValue(ctx, JS_Call(ctx, asock->pending[magic & 1], JS_NULL, 0, 0));
+      }*/
+
+      if(asock) {
+        asyncsocket_deadlines_clear(ctx, asock);
+#ifdef HAVE_ZEROCOPY
+        asyncsocket_zerocopy_clear(ctx, this_val, asock);
+#endif
+
+#ifndef _WIN32
+        if(asock->writer) {
+          asyncsocket_writer_wait(ctx, this_val, asock, FALSE);
+          asyncsocket_writer_cancel(ctx, asock);
+          asyncsocket_writer_clear(JS_GetRuntime(ctx), asock);
+        }
+#endif
+      }
+#ifdef USE_IO_URING
+      if(asock)
+        asyncsocket_cancel(ctx, asock);
+#endif
+      if(asock)
+        asyncsocket_pending_cancel(ctx, this_val, asock);
+#ifdef HAVE_EPOLL_CREATE1
+      if(asock && asock->polled)
+        asyncsocket_unpoll(JS_GetRuntime(ctx), asock);
+#endif
+
+      JS_SOCKETCALL(SYSCALL_CLOSE, s, closesocket(socket_fd(*s)));
+
+      if(socket_retval(*s) == 0)
+        s->fd = -1;
+
+      break;
+    }
+  }
+
+  if(js_asyncsocket_ptr(this_val) == NULL)
+    js_socket_store(this_val, &sock);
+
+  return ret;
+}
+
+#ifdef SCM_RIGHTS
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+/* kernel limit of descriptors per SCM_RIGHTS message (SCM_MAX_FD) */
+#define SOCKET_MAX_FDS 253
+
+enum {
+  FDS_RECV = 0,
+  FDS_SEND = 1,
+};
+
+/* sendFds(fds, data = '\0', credentials = false) */
+static JSValue
+socket_sendfds(JSContext* ctx, Socket* s, int argc, JSValueConst argv[]) {
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS) + CMSG_SPACE(sizeof(struct ucred))];
+  } control;
+  struct msghdr msg = {0};
+  struct iovec iov;
+  InputBuffer input = {{{0, 0}}, 0, 0, JS_UNDEFINED, OFFSET_INIT()};
+  int64_t i, n = js_array_length(ctx, argv[0]);
+  char nul = '\0';
+
+  if(n < 0)
+    return JS_ThrowTypeError(ctx, "argument 1 must be an array of file descriptors");
+
+  if(n > SOCKET_MAX_FDS)
+    return JS_ThrowRangeError(ctx, "at most %d file descriptors per message", SOCKET_MAX_FDS);
+
+  if(argc > 1 && !js_is_null_or_undefined(argv[1])) {
+    input = js_input_chars(ctx, argv[1]);
+
+    if(JS_IsException(input.value))
+      return JS_EXCEPTION;
+  }
+
+  /* stream sockets need at least one byte of payload to carry ancillary data */
+  iov.iov_base = input.size ? (void*)input.data : &nul;
+  iov.iov_len = input.size ? input.size : 1;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+
+  if(n > 0) {
+    struct cmsghdr* cmsg = (struct cmsghdr*)control.buf;
+    int* fds = (int*)CMSG_DATA(cmsg);
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+
+    for(i = 0; i < n; i++) {
+      JSValue item = JS_GetPropertyUint32(ctx, argv[0], i);
+      int32_t fd = -1;
+
+      /* Socket objects convert through valueOf() */
+      JS_ToInt32(ctx, &fd, item);
+      JS_FreeValue(ctx, item);
+      memcpy(&fds[i], &fd, sizeof(int));
+    }
+
+    msg.msg_controllen += CMSG_SPACE(sizeof(int) * n);
+  }
+
+#ifdef SCM_CREDENTIALS
+  if(argc > 2 && JS_ToBool(ctx, argv[2])) {
+    struct cmsghdr* cmsg = (struct cmsghdr*)(control.buf + msg.msg_controllen);
+    struct ucred cred = {getpid(), getuid(), getgid()};
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_CREDENTIALS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+    memcpy(CMSG_DATA(cmsg), &cred, sizeof(struct ucred));
+
+    msg.msg_controllen += CMSG_SPACE(sizeof(struct ucred));
+  }
+#endif
+
+  if(msg.msg_controllen == 0)
+    msg.msg_control = 0;
+
+  syscall_return(s, SYSCALL_SENDMSG, sendmsg(socket_handle(*s), &msg, MSG_NOSIGNAL));
+  input_buffer_free(&input, ctx);
+
+  return s->ret < 0 ? js_socket_error(ctx, *s) : JS_NewInt32(ctx, s->ret);
+}
+
+/* recvFds(max = 16, size = 4096): { data, fds, pid, uid, gid }, null on EOF or the error return */
+static JSValue
+socket_recvfds(JSContext* ctx, Socket* s, int argc, JSValueConst argv[]) {
+  struct msghdr msg = {0};
+  struct iovec iov;
+  struct cmsghdr* cmsg;
+  int32_t max = 16, size = 4096;
+  size_t controllen;
+  uint8_t* buf;
+  JSValue ret, fds;
+  uint32_t nfds = 0;
+
+  if(argc > 0 && !js_is_null_or_undefined(argv[0]))
+    JS_ToInt32(ctx, &max, argv[0]);
+
+  if(argc > 1 && !js_is_null_or_undefined(argv[1]))
+    JS_ToInt32(ctx, &size, argv[1]);
+
+  max = MAX_NUM(MIN_NUM(max, SOCKET_MAX_FDS), 0);
+  size = MAX_NUM(size, 1);
+  controllen = CMSG_SPACE(sizeof(int) * MAX_NUM(max, 1)) + CMSG_SPACE(sizeof(struct ucred));
+
+  if(!(buf = js_malloc(ctx, size + controllen)))
+    return JS_EXCEPTION;
+
+  iov.iov_base = buf;
+  iov.iov_len = size;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = buf + size;
+  msg.msg_controllen = controllen;
+
+  syscall_return(s, SYSCALL_RECVMSG, recvmsg(socket_handle(*s), &msg, MSG_CMSG_CLOEXEC));
+
+  if(s->ret <= 0) {
+    js_free(ctx, buf);
+    return s->ret < 0 ? js_socket_error(ctx, *s) : JS_NULL;
+  }
+
+  ret = JS_NewObject(ctx);
+  fds = JS_NewArray(ctx);
+
+  JS_SetPropertyStr(ctx, ret, "data", JS_NewArrayBufferCopy(ctx, buf, s->ret));
+
+  for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if(cmsg->cmsg_level != SOL_SOCKET)
+      continue;
+
+    if(cmsg->cmsg_type == SCM_RIGHTS) {
+      size_t i, n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+      for(i = 0; i < n; i++) {
+        int fd;
+
+        memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        JS_SetPropertyUint32(ctx, fds, nfds++, JS_NewInt32(ctx, fd));
+      }
+    }
+#ifdef SCM_CREDENTIALS
+    else if(cmsg->cmsg_type == SCM_CREDENTIALS) {
+      struct ucred cred;
+
+      memcpy(&cred, CMSG_DATA(cmsg), sizeof(struct ucred));
+      JS_SetPropertyStr(ctx, ret, "pid", JS_NewInt32(ctx, cred.pid));
+      JS_SetPropertyStr(ctx, ret, "uid", JS_NewUint32(ctx, cred.uid));
+      JS_SetPropertyStr(ctx, ret, "gid", JS_NewUint32(ctx, cred.gid));
+    }
+#endif
+  }
+
+  JS_SetPropertyStr(ctx, ret, "fds", fds);
+
+  if(msg.msg_flags & MSG_CTRUNC)
+    JS_SetPropertyStr(ctx, ret, "truncated", JS_TRUE);
+
+  js_free(ctx, buf);
+  return ret;
+}
+
+static JSValue js_socket_fds(JSContext*, JSValueConst, int, JSValueConst[], int);
+
+/**
+ *   data[0]   AsyncSocket
+ *   data[1]   resolve function
+ *   data[2]   reject function
+ *   data[3..] arguments
+ */
+static JSValue
+js_socket_fds_ready(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  AsyncSocket* asock = js_asyncsocket_ptr(data[0]);
+  JSValue value, set_handler;
+
+  if(!asock || !socket_open(*asock))
+    return JS_UNDEFINED;
+
+  value = js_socket_fds(ctx, data[0], 3, &data[3], magic | ASYNC_READY);
+
+  /* spurious wakeup: keep waiting */
+  if(asock->ret < 0 && (asock->error == EAGAIN || asock->error == EWOULDBLOCK)) {
+    JS_FreeValue(ctx, value);
+    return JS_UNDEFINED;
+  }
+
+  if(!JS_IsException((set_handler = js_iohandler_fn(ctx, magic)))) {
+    js_iohandler_set(ctx, set_handler, socket_fd(*asock), JS_NULL);
+    JS_FreeValue(ctx, set_handler);
+  }
+
+  if(JS_IsException(value)) {
+    value = JS_GetException(ctx);
+    JS_FreeValue(ctx, JS_Call(ctx, data[2], JS_UNDEFINED, 1, &value));
+  } else {
+    JS_FreeValue(ctx, JS_Call(ctx, data[1], JS_UNDEFINED, 1, &value));
+  }
+
+  JS_FreeValue(ctx, value);
+  return JS_UNDEFINED;
+}
+
+/**
+ * Passes file descriptors (SCM_RIGHTS) and credentials (SCM_CREDENTIALS)
+ * over an AF_UNIX socket. On an AsyncSocket which would block, a Promise is
+ * returned which settles once the socket has become ready.
+ */
+static JSValue
+js_socket_fds(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  Socket sock = js_socket_data(this_val);
+  AsyncSocket* asock = js_asyncsocket_ptr(this_val);
+  Socket* s = asock ? (Socket*)asock : &sock;
+  BOOL ready = !!(magic & ASYNC_READY);
+  JSValue ret;
+
+  magic &= (ASYNC_READY - 1);
+
+  if(!js_socket_check_open(ctx, *s))
+    return JS_EXCEPTION;
+
+  ret = magic == FDS_SEND ? socket_sendfds(ctx, s, argc, argv) : socket_recvfds(ctx, s, argc, argv);
+
+  if(!asock) {
+    js_socket_store(this_val, &sock);
+  } else if(!ready && s->ret < 0 && (s->error == EAGAIN || s->error == EWOULDBLOCK)) {
+    JSValue data[6], promise, resolving_funcs[2], set_handler;
+    int i;
+
+    JS_FreeValue(ctx, ret);
+
+    if(JS_IsException((set_handler = js_iohandler_fn(ctx, magic))))
+      return JS_EXCEPTION;
+
+    promise = JS_NewPromiseCapability(ctx, resolving_funcs);
+
+    data[0] = this_val;
+    data[1] = resolving_funcs[0];
+    data[2] = resolving_funcs[1];
+
+    for(i = 0; i < 3; i++)
+      data[3 + i] = i < argc ? argv[i] : JS_UNDEFINED;
+
+    js_iohandler_set(ctx, set_handler, socket_fd(*s), JS_NewCFunctionData(ctx, js_socket_fds_ready, 0, magic, countof(data), data));
+
+    JS_FreeValue(ctx, set_handler);
+    JS_FreeValue(ctx, resolving_funcs[0]);
+    JS_FreeValue(ctx, resolving_funcs[1]);
+    return promise;
+  }
+
+  return ret;
+}
+#endif
+
+static JSValue
+js_socket_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[], int async) {
+  JSValue proto;
+  SockType st = {AF_UNSPEC, SOCK_STREAM, IPPROTO_IP};
+  int fd = -1;
+
+  proto = JS_GetPropertyStr(ctx, new_target, "prototype");
+  if(JS_IsException(proto))
+    goto fail;
+
+  switch(js_socktype(ctx, &st, argc, argv)) {
+    case 0: return JS_ThrowTypeError(ctx, "argument 1 must be address family");
+    case 1: return JS_ThrowTypeError(ctx, "argument 2 must be socket type");
+    /*case 2: return JS_ThrowTypeError(ctx, "argument 3 must be protocol");*/
+    default: break;
+  }
+
+  for(;;) {
+#if defined(_WIN32) && !defined(__MSYS__) && !defined(__CYGWIN__)
+    SOCKET h = socket(st.family, st.type, st.protocol);
+
+    fd = h == INVALID_SOCKET ? -1 : _open_osfhandle(h, 0);
+#else
+    fd = socket(st.family, st.type, st.protocol);
+#endif
+
+    if(fd == -1) {
+#if defined(_WIN32) && !defined(__MSYS__) && !defined(__CYGWIN__)
+      static BOOL initialized;
+      int err;
+      WSADATA d;
+
+      if(!initialized) {
+        initialized++;
+        if((err = WSAStartup(MAKEWORD(2, 3), &d)))
+          return js_syscallerror_throw_errno(ctx, "WSAStartup", err);
+
+        continue;
+      }
+
+      return js_syscallerror_throw_errno(ctx, "socket", WSAGetLastError());
+#else
+      return js_syscallerror_throw_errno(ctx, "socket", errno);
+#endif
+    }
+
+    break;
+  }
+
+  return js_socket_new_proto(ctx, proto, fd, async, TRUE);
+
+fail:
+  return JS_EXCEPTION;
+}
+
+static JSValue
+js_asyncsocket_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  return js_socket_constructor(ctx, new_target, argc, argv, TRUE);
+}
+static JSValue
+js_syncsocket_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  return js_socket_constructor(ctx, new_target, argc, argv, FALSE);
+}
+
+static JSValue
+js_socket_inspect(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  Socket sock = js_socket_data(this_val);
+  JSValue obj = JS_NewObjectClass(ctx, sock.async ? js_asyncsocket_class_id : js_socket_class_id);
+
+  JS_DefinePropertyValueStr(ctx, obj, "fd", JS_NewInt32(ctx, sock.fd), JS_PROP_ENUMERABLE);
+  JS_DefinePropertyValueStr(ctx, obj, "ret", JS_NewUint32(ctx, sock.ret), JS_PROP_CONFIGURABLE);
+
+  JS_DefinePropertyValueStr(ctx, obj, "errno", JS_NewUint32(ctx, sock.error), JS_PROP_CONFIGURABLE | (sock.error ? JS_PROP_ENUMERABLE : 0));
+  JS_DefinePropertyValueStr(ctx, obj, "error", JS_NewString(ctx, strerror(sock.error)), JS_PROP_CONFIGURABLE | (sock.error ? JS_PROP_ENUMERABLE : 0));
+
+  if(sock.sysno > 0 && sock.sysno < countof(syscall_names))
+    JS_DefinePropertyValueStr(ctx, obj, "syscall", JS_NewString(ctx, socket_syscall(sock)), JS_PROP_ENUMERABLE);
+
+  JSAtom to_string_tag = js_symbol_static_atom(ctx, "toStringTag");
+  JS_DefinePropertyValue(ctx, obj, to_string_tag, JS_GetProperty(ctx, this_val, to_string_tag), JS_PROP_CONFIGURABLE);
+  JS_FreeAtom(ctx, to_string_tag);
+
+  return obj;
+}
+
+static JSValue
+js_socket_valueof(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  Socket s = js_socket_data(this_val);
+
+  return JS_NewInt32(ctx, socket_fd(s));
+}
+
+static JSValue
+js_socket_adopt(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  int32_t fd = -1;
+
+  JS_ToInt32(ctx, &fd, argv[0]);
+
+  /* AsyncSocket.adopt(fd) wraps the descriptor as an AsyncSocket */
+  if(js_object_same(this_val, asyncsocket_ctor))
+    return js_socket_new_proto(ctx, asyncsocket_proto, fd, TRUE, FALSE);
 
-        JS_SOCKETCALL(SYSCALL_RECVFROM, s, recvfrom(socket_handle(*s), (void*)(buf.data + off.offset), offset_size(&off, buf.size), flags, &a->s, &alen));
-      } else {
-        JS_SOCKETCALL(SYSCALL_RECV, s, recv(socket_handle(*s), (void*)(buf.data + off.offset), offset_size(&off, buf.size), flags));
+  return js_socket_new_proto(ctx, socket_proto, fd, FALSE, FALSE);
+}
+
+static void
+js_socket_finalizer(JSRuntime* rt, JSValue val) {
+  Socket sock = js_socket_data(val);
+  AsyncSocket* asock;
+
+  if(!socket_adopted(sock))
+    if(socket_open(sock))
+      close(socket_fd(sock));
+
+  if((asock = js_asyncsocket_ptr(val))) {
+#ifdef HAVE_EPOLL_CREATE1
+    asyncsocket_unpoll(rt, asock);
+#endif
+    JS_FreeValueRT(rt, asock->pending[0]);
+    JS_FreeValueRT(rt, asock->pending[1]);
+
+#ifndef _WIN32
+    asyncsocket_writer_clear(rt, asock);
+#endif
+#ifdef HAVE_ZEROCOPY
+    asyncsocket_zerocopy_free(rt, asock);
+#endif
+
+    if(asock->deadlines) {
+      timer_stop(0, &asock->deadlines->idle);
+      timer_stop(0, &asock->deadlines->read);
+      timer_stop(0, &asock->deadlines->write);
+      JS_FreeValueRT(rt, asock->deadlines->resolve[0]);
+      JS_FreeValueRT(rt, asock->deadlines->resolve[1]);
+      js_free_rt(rt, asock->deadlines);
+    }
+
+    js_free_rt(rt, asock);
+  } else {
+    void* opaque = JS_GetOpaque(val, js_socket_class_id);
+
+    if(opaque && !SOCKET_PACKED(opaque))
+      js_free_rt(rt, opaque);
+  }
+}
+
+static JSClassDef js_socket_class = {
+    .class_name = "Socket",
+    .finalizer = js_socket_finalizer,
+};
+
+static JSClassDef js_asyncsocket_class = {
+    .class_name = "AsyncSocket",
+    .finalizer = js_socket_finalizer,
+};
+
+/**
+ * Listener: a non-blocking listening socket which drains its whole accept
+ * backlog on every readiness event and hands the connections to a callback
+ * as arrays of AsyncSockets.
+ */
+#define LISTENER_BATCH 64
+
+/* delay before accepting again when out of file descriptors, in milliseconds */
+#define LISTENER_RETRY 100
+
+enum {
+  LISTENER_START,
+  LISTENER_STOP,
+  LISTENER_CLOSE,
+};
+
+enum {
+  LISTENER_FD,
+  LISTENER_ADDRESS,
+  LISTENER_BATCHSIZE,
+};
+
+static Listener*
+js_listener_data2(JSContext* ctx, JSValueConst value) {
+  return JS_GetOpaque2(ctx, value, js_listener_class_id);
+}
+
+static int
+listener_accept(int fd) {
+  int ret;
+
+#ifdef HAVE_ACCEPT4
+  ret = accept4(fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  if((ret = accept(fd, 0, 0)) != -1) {
+    fcntl(ret, F_SETFL, fcntl(ret, F_GETFL) | O_NONBLOCK);
+    fcntl(ret, F_SETFD, FD_CLOEXEC);
+  }
+#endif
+
+  return ret;
+}
+
+static JSValue
+js_listener_deliver(JSContext* ctx, Listener* l, JSValueConst this_obj, JSValue batch) {
+  JSValue ret = JS_Call(ctx, l->callback, this_obj, 1, (JSValueConst*)&batch);
+
+  JS_FreeValue(ctx, batch);
+  return ret;
+}
+
+static BOOL js_listener_handler(JSContext*, Listener*, JSValue);
+
+static void
+js_listener_retry(JSContext* ctx, Timer* t) {
+  Listener* l = list_entry(t, Listener, retry);
+
+  if(l->fd != -1 && !JS_IsUndefined(l->handler))
+    js_listener_handler(ctx, l, JS_DupValue(ctx, l->handler));
+}
+
+/**
+ * When the process is out of file descriptors (or memory), the pending
+ * connection stays in the backlog and the Listener would be woken up again
+ * right away. It stops waiting for LISTENER_RETRY ms instead. Any other
+ * accept() error stops the Listener and is thrown.
+ */
+static JSValue
+js_listener_ready(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  Listener* l;
+  JSValue batch = JS_UNDEFINED, ret = JS_UNDEFINED;
+  uint32_t n = 0;
+
+  if(!(l = js_listener_data2(ctx, data[0])))
+    return JS_EXCEPTION;
+
+  while(l->fd != -1) {
+    JSValue sock;
+    int fd;
+
+    if((fd = listener_accept(l->fd)) == -1) {
+      int err = errno;
+
+      if(err == EINTR || err == ECONNABORTED)
+        continue;
+
+      if(err == EAGAIN || err == EWOULDBLOCK)
+        break;
+
+      js_listener_handler(ctx, l, JS_NULL);
+
+      if(err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+        timer_start(ctx, &l->retry, LISTENER_RETRY);
+        break;
       }
 
+      JS_FreeValue(ctx, l->handler);
+      l->handler = JS_UNDEFINED;
+      ret = js_syscallerror_throw_errno(ctx, "accept4", err);
       break;
     }
 
-    case METHOD_SEND:
-    case METHOD_SENDTO: {
-      int32_t flags = 0;
-      InputBuffer buf = js_input_chars(ctx, argv[0]);
-      OffsetLength off;
+    /* accepted connections own their descriptor and are closed on GC */
+    if(JS_IsException((sock = js_socket_new_proto(ctx, asyncsocket_proto, fd, TRUE, TRUE)))) {
+      close(fd);
+      JS_FreeValue(ctx, JS_GetException(ctx));
+      continue;
+    }
 
-      js_offset_length(ctx, buf.size, argc - 1, argv + 1, &off);
+    if(n == 0)
+      batch = JS_NewArray(ctx);
 
-      if(argc >= 4)
-        JS_ToInt32(ctx, &flags, argv[3]);
+    JS_SetPropertyUint32(ctx, batch, n++, sock);
 
-      if(magic == METHOD_SENDTO) {
-        if((a = argc >= 5 ? js_sockaddr_data(argv[4]) : 0))
-          alen = sockaddr_size(a);
-        JS_SOCKETCALL(SYSCALL_SENDTO, s, sendto(socket_handle(*s), (const void*)(buf.data + off.offset), offset_size(&off, buf.size), flags, &a->s, alen));
+    if(n == l->batch) {
+      ret = js_listener_deliver(ctx, l, data[0], batch);
+      n = 0;
+
+      if(JS_IsException(ret))
+        return ret;
+
+      JS_FreeValue(ctx, ret);
+      ret = JS_UNDEFINED;
+    }
+  }
+
+  if(n > 0) {
+    JSValue result = js_listener_deliver(ctx, l, data[0], batch);
+
+    if(JS_IsException(result)) {
+      JS_FreeValue(ctx, ret);
+      return result;
+    }
+
+    JS_FreeValue(ctx, result);
+  }
+
+  return ret;
+}
+
+static BOOL
+js_listener_handler(JSContext* ctx, Listener* l, JSValue handler) {
+  JSValue set_handler;
+  BOOL ret;
+
+  if(JS_IsException((set_handler = js_iohandler_fn(ctx, FALSE))))
+    return FALSE;
+
+  ret = js_iohandler_set(ctx, set_handler, l->fd, handler);
+  JS_FreeValue(ctx, set_handler);
+  return ret;
+}
+
+static JSValue
+js_listener_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  JSValue proto, obj = JS_UNDEFINED;
+  Listener* l;
+  SockAddr* a;
+  int32_t backlog = SOMAXCONN, one = 1;
+  BOOL reuseport = FALSE;
+  const char* syscall = "socket";
+
+  if(js_sockaddr_class_id == 0 && js_socket_class_id == 0 && js_asyncsocket_class_id == 0)
+    js_sockets_init(ctx, 0);
+
+  if(argc < 1 || !(a = js_sockaddr_data(argv[0])))
+    return JS_ThrowTypeError(ctx, "argument 1 must be of type SockAddr");
+
+  if(!(l = js_mallocz(ctx, sizeof(Listener))))
+    return JS_EXCEPTION;
+
+  l->fd = -1;
+  l->batch = LISTENER_BATCH;
+  l->callback = JS_UNDEFINED;
+  l->handler = JS_UNDEFINED;
+  timer_init(&l->retry, js_listener_retry);
+
+  if(argc >= 2 && JS_IsObject(argv[1])) {
+    if(js_has_propertystr(ctx, argv[1], "backlog"))
+      backlog = js_get_propertystr_int32(ctx, argv[1], "backlog");
+
+    if(js_has_propertystr(ctx, argv[1], "batch"))
+      l->batch = MAX_NUM(js_get_propertystr_int32(ctx, argv[1], "batch"), 1);
+
+    reuseport = js_get_propertystr_bool(ctx, argv[1], "reusePort");
+  }
+
+  if((l->fd = socket(a->family, SOCK_STREAM, 0)) == -1)
+    goto fail_syscall;
+
+  syscall = "fcntl";
+  if(fcntl(l->fd, F_SETFL, fcntl(l->fd, F_GETFL) | O_NONBLOCK) == -1 || fcntl(l->fd, F_SETFD, FD_CLOEXEC) == -1)
+    goto fail_syscall;
+
+  syscall = "setsockopt";
+  if(setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, (void*)&one, sizeof(one)) == -1)
+    goto fail_syscall;
+
+#ifdef SO_REUSEPORT
+  if(reuseport && setsockopt(l->fd, SOL_SOCKET, SO_REUSEPORT, (void*)&one, sizeof(one)) == -1)
+    goto fail_syscall;
+#endif
+
+  syscall = "bind";
+  if(bind(l->fd, (struct sockaddr*)a, sockaddr_size(a)) == -1)
+    goto fail_syscall;
+
+  syscall = "listen";
+  if(listen(l->fd, backlog) == -1)
+    goto fail_syscall;
+
+  proto = JS_GetPropertyStr(ctx, new_target, "prototype");
+  if(JS_IsException(proto))
+    goto fail;
+
+  obj = JS_NewObjectProtoClass(ctx, proto, js_listener_class_id);
+  JS_FreeValue(ctx, proto);
+
+  if(JS_IsException(obj))
+    goto fail;
+
+  JS_SetOpaque(obj, l);
+  return obj;
+
+fail_syscall:
+  js_syscallerror_throw_errno(ctx, syscall, errno);
+fail:
+  if(l->fd != -1)
+    close(l->fd);
+
+  js_free(ctx, l);
+  return JS_EXCEPTION;
+}
+
+static JSValue
+js_listener_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  Listener* l;
+
+  if(!(l = js_listener_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  switch(magic) {
+    case LISTENER_START: {
+      if(l->fd == -1)
+        return JS_ThrowInternalError(ctx, "Listener has already been closed");
+
+      if(argc < 1 || !JS_IsFunction(ctx, argv[0]))
+        return JS_ThrowTypeError(ctx, "argument 1 must be a function");
+
+      JS_FreeValue(ctx, l->callback);
+      l->callback = JS_DupValue(ctx, argv[0]);
+
+      if(JS_IsUndefined(l->handler)) {
+        l->handler = JS_NewCFunctionData(ctx, js_listener_ready, 0, 0, 1, &this_val);
+
+        if(!js_listener_handler(ctx, l, JS_DupValue(ctx, l->handler)))
+          return JS_EXCEPTION;
+      }
+
+      break;
+    }
+
+    case LISTENER_STOP:
+    case LISTENER_CLOSE: {
+      timer_stop(ctx, &l->retry);
+
+      if(!JS_IsUndefined(l->handler)) {
+        js_listener_handler(ctx, l, JS_NULL);
+        JS_FreeValue(ctx, l->handler);
+        l->handler = JS_UNDEFINED;
+      }
+
+      if(magic == LISTENER_CLOSE && l->fd != -1) {
+        if(close(l->fd) == -1)
+          return js_syscallerror_throw_errno(ctx, "close", errno);
+
+        l->fd = -1;
+      }
+
+      break;
+    }
+  }
+
+  return JS_UNDEFINED;
+}
+
+static JSValue
+js_listener_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  Listener* l;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(l = js_listener_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  switch(magic) {
+    case LISTENER_FD: {
+      ret = JS_NewInt32(ctx, l->fd);
+      break;
+    }
+
+    case LISTENER_ADDRESS: {
+      SockAddr* a = js_mallocz(ctx, sizeof(SockAddr));
+      socklen_t len = sizeof(SockAddr);
+
+      if(getsockname(l->fd, (struct sockaddr*)a, &len) == -1) {
+        js_free(ctx, a);
+        ret = JS_NULL;
       } else {
-        JS_SOCKETCALL(SYSCALL_SEND, s, send(socket_handle(*s), (const void*)(buf.data + off.offset), offset_size(&off, buf.size), flags));
+        ret = js_sockaddr_wrap(ctx, a);
       }
+
       break;
     }
 
-    case METHOD_GETSOCKOPT: {
-      int32_t level, optname;
-      uint32_t optlen = sizeof(int);
-      uint8_t* buf;
-      int32_t val = -1, *tmp = 0;
-      socklen_t len;
+    case LISTENER_BATCHSIZE: {
+      ret = JS_NewUint32(ctx, l->batch);
+      break;
+    }
+  }
+
+  return ret;
+}
+
+/**
+ * Listener.workers(url, count = number of CPUs)
+ *
+ * Starts one os.Worker per core running the module at url. Each worker gets a
+ * message { index, count } and is expected to create its own Listener with
+ * { reusePort: true }, so the kernel spreads incoming connections.
+ */
+static JSValue
+js_listener_workers(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  JSModuleDef* os;
+  JSValue worker_ctor, ret;
+  int32_t i, n = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+  if(argc >= 2)
+    JS_ToInt32(ctx, &n, argv[1]);
+
+  if(!(os = js_module_load(ctx, "os")))
+    return JS_ThrowReferenceError(ctx, "'os' module required");
+
+  worker_ctor = module_exports_find_str(ctx, os, "Worker");
+
+  if(!JS_IsFunction(ctx, worker_ctor)) {
+    JS_FreeValue(ctx, worker_ctor);
+    return JS_ThrowReferenceError(ctx, "no os.Worker constructor");
+  }
+
+  ret = JS_NewArray(ctx);
+
+  for(i = 0; i < n; i++) {
+    JSValue worker, message, post;
+
+    if(JS_IsException((worker = JS_CallConstructor(ctx, worker_ctor, 1, argv)))) {
+      JS_FreeValue(ctx, ret);
+      ret = JS_EXCEPTION;
+      break;
+    }
+
+    message = JS_NewObject(ctx);
+    JS_SetPropertyStr(ctx, message, "index", JS_NewInt32(ctx, i));
+    JS_SetPropertyStr(ctx, message, "count", JS_NewInt32(ctx, n));
+
+    post = JS_GetPropertyStr(ctx, worker, "postMessage");
+    JS_FreeValue(ctx, JS_Call(ctx, post, worker, 1, &message));
+    JS_FreeValue(ctx, post);
+    JS_FreeValue(ctx, message);
+
+    JS_SetPropertyUint32(ctx, ret, i, worker);
+  }
+
+  JS_FreeValue(ctx, worker_ctor);
+  return ret;
+}
+
+static void
+js_listener_finalizer(JSRuntime* rt, JSValue val) {
+  Listener* l;
+
+  if((l = JS_GetOpaque(val, js_listener_class_id))) {
+    timer_stop(0, &l->retry);
+
+    if(l->fd != -1)
+      close(l->fd);
+
+    JS_FreeValueRT(rt, l->callback);
+    JS_FreeValueRT(rt, l->handler);
+    js_free_rt(rt, l);
+  }
+}
+
+static void
+js_listener_mark(JSRuntime* rt, JSValueConst val, JS_MarkFunc* mark_func) {
+  Listener* l;
+
+  if((l = JS_GetOpaque(val, js_listener_class_id))) {
+    JS_MarkValue(rt, l->callback, mark_func);
+    JS_MarkValue(rt, l->handler, mark_func);
+  }
+}
+
+static JSClassDef js_listener_class = {
+    .class_name = "Listener",
+    .finalizer = js_listener_finalizer,
+    .gc_mark = js_listener_mark,
+};
+
+static const JSCFunctionListEntry js_listener_proto_funcs[] = {
+    JS_CGETSET_MAGIC_FLAGS_DEF("fd", js_listener_get, 0, LISTENER_FD, JS_PROP_ENUMERABLE),
+    JS_CGETSET_MAGIC_DEF("address", js_listener_get, 0, LISTENER_ADDRESS),
+    JS_CGETSET_MAGIC_DEF("batch", js_listener_get, 0, LISTENER_BATCHSIZE),
+    JS_CFUNC_MAGIC_DEF("start", 1, js_listener_method, LISTENER_START),
+    JS_CFUNC_MAGIC_DEF("stop", 0, js_listener_method, LISTENER_STOP),
+    JS_CFUNC_MAGIC_DEF("close", 0, js_listener_method, LISTENER_CLOSE),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "Listener", JS_PROP_CONFIGURABLE),
+};
 
-      JS_ToInt32(ctx, &level, argv[0]);
-      JS_ToInt32(ctx, &optname, argv[1]);
-      if(argc >= 4)
-        JS_ToUint32(ctx, &optlen, argv[3]);
-      JS_ToInt32(ctx, &optname, argv[1]);
+static const JSCFunctionListEntry js_listener_static_funcs[] = {
+    JS_CFUNC_DEF("workers", 1, js_listener_workers),
+};
 
-      buf = optval_buf(ctx, argv[2], &tmp, &len);
+#ifdef HAVE_SPLICE
+static JSValue js_splice_ready(JSContext*, JSValueConst, int, JSValueConst[], int, JSValue[]);
 
-      JS_SOCKETCALL(SYSCALL_GETSOCKOPT, s, getsockopt(socket_handle(*s), level, optname, (void*)buf, &len));
-      if(tmp) {
-        js_array_clear(ctx, argv[2]);
-        JS_SetPropertyUint32(ctx, argv[2], 0, JS_NewInt32(ctx, *(int32_t*)buf));
-      }
+/* splice() ends are file descriptors, Socket or AsyncSocket objects */
+static int
+splice_fd(JSContext* ctx, JSValueConst value) {
+  int32_t fd = -1;
 
-      // val = (void*)buf;
-      if(tmp)
-        js_free(ctx, tmp);
+  if(JS_IsNumber(value))
+    JS_ToInt32(ctx, &fd, value);
+  else
+    fd = socket_fd(js_socket_data(value));
 
-#ifdef DEBUG_OUTPUT
-      printf("SYSCALL_GETSOCKOPT(%d, %d, %d (%d), %lu) = %d\n", socket_fd(*s), level, optname, val, (unsigned long int)len, s->ret);
-#endif
+  return fd;
+}
 
-      break;
+/**
+ * Moves data until all of the length has been transferred, the input has
+ * ended or a splice() would block. In the latter case it waits for the input
+ * to become readable, or for the output to become writable when the input
+ * has data, and carries on from there.
+ *
+ *   data[0]  resolve function
+ *   data[1]  reject function
+ *   data[2]  input
+ *   data[3]  output
+ *   data[4]  length left
+ *   data[5]  flags
+ *   data[6]  bytes transferred so far
+ */
+static void
+splice_continue(JSContext* ctx, JSValue data[]) {
+  int fd_in = splice_fd(ctx, data[2]), fd_out = splice_fd(ctx, data[3]);
+  int64_t len = 0, total = 0;
+  uint32_t flags = 0;
+  ssize_t r = 0;
+  JSValue value;
+
+  JS_ToInt64(ctx, &len, data[4]);
+  JS_ToUint32(ctx, &flags, data[5]);
+  JS_ToInt64(ctx, &total, data[6]);
+
+  while(len > 0 && (r = splice(fd_in, 0, fd_out, 0, len, flags)) > 0) {
+    len -= r;
+    total += r;
+  }
+
+  if(len > 0 && r == -1 && errno == EAGAIN) {
+    struct pollfd pfd = {fd_in, POLLIN, 0};
+    BOOL write = poll(&pfd, 1, 0) == 1;
+    JSValue set_handler;
+
+    JS_FreeValue(ctx, data[4]);
+    data[4] = JS_NewInt64(ctx, len);
+    JS_FreeValue(ctx, data[6]);
+    data[6] = JS_NewInt64(ctx, total);
+
+    if(!JS_IsException((set_handler = js_iohandler_fn(ctx, write)))) {
+      js_iohandler_set(ctx, set_handler, write ? fd_out : fd_in, JS_NewCFunctionData(ctx, js_splice_ready, 0, write, 7, data));
+      JS_FreeValue(ctx, set_handler);
+      return;
     }
 
-    case METHOD_SETSOCKOPT: {
-      int32_t level, optname, num = 0, *tmp = 0;
-      socklen_t len = 0;
-      uint8_t* buf = 0;
+    value = JS_GetException(ctx);
+    JS_FreeValue(ctx, JS_Call(ctx, data[1], JS_UNDEFINED, 1, &value));
+  } else if(len > 0 && r == -1) {
+    value = js_syscallerror_new(ctx, "splice", errno);
+    JS_FreeValue(ctx, JS_Call(ctx, data[1], JS_UNDEFINED, 1, &value));
+  } else {
+    /* the input may also have ended early (0 returned) */
+    value = JS_NewInt64(ctx, total);
+    JS_FreeValue(ctx, JS_Call(ctx, data[0], JS_UNDEFINED, 1, &value));
+  }
 
-      if(argc >= 3)
-        buf = optval_buf(ctx, argv[2], &tmp, &len);
+  JS_FreeValue(ctx, value);
+}
 
-      if(!buf) {
-        buf = (uint8_t*)&num;
-        len = sizeof(num);
-      }
+static JSValue
+js_splice_ready(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  JSValue set_handler;
 
-      JS_ToInt32(ctx, &level, argv[0]);
-      JS_ToInt32(ctx, &optname, argv[1]);
+  if(!JS_IsException((set_handler = js_iohandler_fn(ctx, magic)))) {
+    js_iohandler_set(ctx, set_handler, splice_fd(ctx, data[magic ? 3 : 2]), JS_NULL);
+    JS_FreeValue(ctx, set_handler);
+  }
 
-      if(argc >= 4) {
-        uint32_t newlen = 0;
+  splice_continue(ctx, data);
+  return JS_UNDEFINED;
+}
 
-        if(!JS_ToUint32(ctx, &newlen, argv[3])) {
-          newlen = MIN_NUM(newlen, len);
+/**
+ * splice(in, out, len, flags) moves data between a pipe and a file
+ * descriptor or socket. With an AsyncSocket on either end, a Promise is
+ * returned which resolves with the bytes transferred once all of 'len' has
+ * been moved or the input has ended, resuming partial transfers whenever an
+ * end becomes ready. Otherwise a single splice() is made, returning -1 when
+ * it would block.
+ */
+static JSValue
+js_splice(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  uint32_t flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+  int64_t len = 0;
+  ssize_t ret;
 
-          if(newlen)
-            len = newlen;
-        }
-      }
+  JS_ToInt64(ctx, &len, argv[2]);
 
-      /*    JS_SOCKETCALL(SYSCALL_SETSOCKOPT, s, setsockopt(socket_handle(*s), level, optname, (const void*)buf, len));
+  if(argc >= 4)
+    JS_ToUint32(ctx, &flags, argv[3]);
 
-        #define JS_SOCKETCALL(syscall_no, sock, result) \
-               JS_SOCKETCALL_RETURN(syscall_no, sock, result, JS_NewInt32(ctx, (sock)->ret), js_socket_error(ctx, *(sock)))
+  if(js_asyncsocket_ptr(argv[0]) || js_asyncsocket_ptr(argv[1])) {
+    JSValue promise, data[7];
 
-         #define JS_SOCKETCALL_FAIL(syscall_no, sock, on_fail) \
-               JS_SOCKETCALL_RETURN(syscall_no, sock, result, JS_NewInt32(ctx, (sock)->ret), on_fail)
+    promise = JS_NewPromiseCapability(ctx, data);
+    data[2] = JS_DupValue(ctx, argv[0]);
+    data[3] = JS_DupValue(ctx, argv[1]);
+    data[4] = JS_NewInt64(ctx, len);
+    data[5] = JS_NewUint32(ctx, flags);
+    data[6] = JS_NewInt64(ctx, 0);
 
-         #define JS_SOCKETCALL_RETURN(syscall_no, sock, result, on_success, on_fail) \
-           do { \
-             syscall_return((sock), (syscall_no), (result)); \
-             ret = (sock)->ret < 0 ? (on_fail) : (on_success); \
-           } while(0)
-         */
-      syscall_return(s, SYSCALL_SETSOCKOPT, setsockopt(socket_handle(*s), level, optname, (const void*)buf, len));
+    if(!JS_IsException(promise))
+      splice_continue(ctx, data);
 
-      // JS_SOCKETCALL_RETURN(SYSCALL_SETSOCKOPT, s, setsockopt(socket_handle(*s),  JS_NewInt32(ctx, (s)->ret), js_socket_error(ctx, *(sock)))
+    for(size_t i = 0; i < countof(data); i++)
+      JS_FreeValue(ctx, data[i]);
 
-#ifdef DEBUG_OUTPUT
-      printf("SYSCALL_SETSOCKOPT(%d, %d, %d, %i (%p), %lu) = %d\n", socket_fd(*s), level, optname, *(int*)buf, buf, (unsigned long int)len, s->ret);
+    return promise;
+  }
+
+  if((ret = splice(splice_fd(ctx, argv[0]), 0, splice_fd(ctx, argv[1]), 0, len, flags)) == -1 && errno != EAGAIN)
+    return js_syscallerror_throw_errno(ctx, "splice", errno);
+
+  return JS_NewInt64(ctx, ret);
+}
 #endif
 
-      if(tmp)
-        js_free(ctx, tmp);
+#ifndef _WIN32
+typedef struct {
+  JSValue resolve, reject;
+  BOOL all;
+} LookupRequest;
 
-      break;
-    }
+static JSValue
+js_sockets_lookup_result(JSContext* ctx, const struct addrinfo* result, BOOL all) {
+  const struct addrinfo* ai;
+  JSValue ret = all ? JS_NewArray(ctx) : JS_NULL;
+  uint32_t i = 0;
 
-    case METHOD_SHUTDOWN: {
-      int32_t how;
+  for(ai = result; ai; ai = ai->ai_next) {
+    SockAddr* a;
+    JSValue obj;
 
-      JS_ToInt32(ctx, &how, argv[0]);
-      JS_SOCKETCALL(SYSCALL_SHUTDOWN, s, shutdown(socket_handle(*s), how));
-      break;
-    }
+    if(ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+      continue;
 
-    case METHOD_CLOSE: {
-      /*AsyncSocket* asock;
-      if((asock = js_asyncsocket_ptr(this_val))) {
-        if(JS_IsObject(asock->pending[magic & 1]))
-          JS_FreeValue(ctx, JS_Call(ctx, asock->pending[magic & 1], JS_NULL, 0, 0));
-      }*/
+    if(!(a = js_mallocz(ctx, sizeof(SockAddr))))
+      break;
 
-      JS_SOCKETCALL(SYSCALL_CLOSE, s, closesocket(socket_fd(*s)));
+    memcpy(a, ai->ai_addr, MIN_NUM((size_t)ai->ai_addrlen, sizeof(SockAddr)));
+    obj = js_sockaddr_wrap(ctx, a);
 
-      if(socket_retval(*s) == 0)
-        s->fd = UINT16_MAX;
+    if(!all)
+      return obj;
 
-      break;
-    }
+    JS_SetPropertyUint32(ctx, ret, i++, obj);
   }
 
-  if(js_asyncsocket_ptr(this_val) == NULL)
-    JS_SetOpaque(this_val, sock.ptr);
-
   return ret;
 }
 
-static JSValue
-js_socket_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[], int async) {
-  JSValue proto;
-  SockType st = {AF_UNSPEC, SOCK_STREAM, IPPROTO_IP};
-  int fd = -1;
+static void
+js_sockets_lookup_done(JSContext* ctx, int error, const struct addrinfo* result, void* opaque) {
+  LookupRequest* req = opaque;
+  JSValue value;
 
-  proto = JS_GetPropertyStr(ctx, new_target, "prototype");
-  if(JS_IsException(proto))
-    goto fail;
+  if(error) {
+    value = JS_NewError(ctx);
 
-  switch(js_socktype(ctx, &st, argc, argv)) {
-    case 0: return JS_ThrowTypeError(ctx, "argument 1 must be address family");
-    case 1: return JS_ThrowTypeError(ctx, "argument 2 must be socket type");
-    /*case 2: return JS_ThrowTypeError(ctx, "argument 3 must be protocol");*/
-    default: break;
+    JS_DefinePropertyValueStr(ctx, value, "message", JS_NewString(ctx, gai_strerror(error)), JS_PROP_CONFIGURABLE | JS_PROP_WRITABLE);
+    JS_SetPropertyStr(ctx, value, "code", JS_NewInt32(ctx, error));
+    JS_FreeValue(ctx, JS_Call(ctx, req->reject, JS_UNDEFINED, 1, &value));
+  } else {
+    value = js_sockets_lookup_result(ctx, result, req->all);
+    JS_FreeValue(ctx, JS_Call(ctx, req->resolve, JS_UNDEFINED, 1, &value));
   }
 
-  for(;;) {
-#if defined(_WIN32) && !defined(__MSYS__) && !defined(__CYGWIN__)
-    SOCKET h = socket(st.family, st.type, st.protocol);
-
-    fd = h == INVALID_SOCKET ? -1 : _open_osfhandle(h, 0);
-#else
-    fd = socket(st.family, st.type, st.protocol);
-#endif
+  JS_FreeValue(ctx, value);
+  JS_FreeValue(ctx, req->resolve);
+  JS_FreeValue(ctx, req->reject);
+  js_free(ctx, req);
+}
 
-    if(fd == -1) {
-#if defined(_WIN32) && !defined(__MSYS__) && !defined(__CYGWIN__)
-      static BOOL initialized;
-      int err;
-      WSADATA d;
+/**
+ * lookup(host, { family, all, numeric }) resolves to a SockAddr (or an array
+ * of them when all is true). Names are resolved by getaddrinfo() on a thread
+ * pool, numeric addresses without leaving the event loop. With numeric set a
+ * name rejects with EAI_NONAME instead of being resolved.
+ */
+static JSValue
+js_sockets_lookup(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  LookupRequest* req;
+  JSValue promise, resolving_funcs[2];
+  const char* host;
+  int32_t family = AF_UNSPEC;
+  BOOL all = FALSE, numeric = FALSE;
+  int ret;
 
-      if(!initialized) {
-        initialized++;
-        if((err = WSAStartup(MAKEWORD(2, 3), &d)))
-          return JS_Throw(ctx, js_syscallerror_new(ctx, "WSAStartup", err));
+  if(argc > 1 && JS_IsNumber(argv[1])) {
+    JS_ToInt32(ctx, &family, argv[1]);
+  } else if(argc > 1 && JS_IsObject(argv[1])) {
+    JSValue value = JS_GetPropertyStr(ctx, argv[1], "family");
 
-        continue;
-      }
+    if(!JS_IsUndefined(value))
+      JS_ToInt32(ctx, &family, value);
 
-      return JS_Throw(ctx, js_syscallerror_new(ctx, "socket", WSAGetLastError()));
-#else
-      return JS_Throw(ctx, js_syscallerror_new(ctx, "socket", errno));
-#endif
-    }
+    JS_FreeValue(ctx, value);
 
-    break;
+    all = js_get_propertystr_bool(ctx, argv[1], "all");
+    numeric = js_get_propertystr_bool(ctx, argv[1], "numeric");
   }
 
-  return js_socket_new_proto(ctx, proto, fd, async, TRUE);
+  /* as in node.js, 4 and 6 select the family too */
+  if(family == 4)
+    family = AF_INET;
+  else if(family == 6)
+    family = AF_INET6;
 
-fail:
-  return JS_EXCEPTION;
-}
+  if(family != AF_UNSPEC && family != AF_INET && family != AF_INET6)
+    return JS_ThrowRangeError(ctx, "family must be AF_INET or AF_INET6");
 
-static JSValue
-js_asyncsocket_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
-  return js_socket_constructor(ctx, new_target, argc, argv, TRUE);
-}
-static JSValue
-js_syncsocket_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
-  return js_socket_constructor(ctx, new_target, argc, argv, FALSE);
-}
+  if(!(host = JS_ToCString(ctx, argv[0])))
+    return JS_EXCEPTION;
 
-static JSValue
-js_socket_inspect(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
-  Socket sock = js_socket_data(this_val);
-  JSValue obj = JS_NewObjectClass(ctx, sock.async ? js_asyncsocket_class_id : js_socket_class_id);
+  if(!(req = js_malloc(ctx, sizeof(LookupRequest)))) {
+    JS_FreeCString(ctx, host);
+    return JS_EXCEPTION;
+  }
 
-  JS_DefinePropertyValueStr(ctx, obj, "fd", JS_NewInt32(ctx, (int16_t)sock.fd), JS_PROP_ENUMERABLE);
-  JS_DefinePropertyValueStr(ctx, obj, "ret", JS_NewUint32(ctx, sock.ret), JS_PROP_CONFIGURABLE);
+  if(JS_IsException((promise = JS_NewPromiseCapability(ctx, resolving_funcs)))) {
+    JS_FreeCString(ctx, host);
+    js_free(ctx, req);
+    return JS_EXCEPTION;
+  }
 
-  JS_DefinePropertyValueStr(ctx, obj, "errno", JS_NewUint32(ctx, sock.error), JS_PROP_CONFIGURABLE | (sock.error ? JS_PROP_ENUMERABLE : 0));
-  JS_DefinePropertyValueStr(ctx, obj, "error", JS_NewString(ctx, strerror(sock.error)), JS_PROP_CONFIGURABLE | (sock.error ? JS_PROP_ENUMERABLE : 0));
+  req->resolve = resolving_funcs[0];
+  req->reject = resolving_funcs[1];
+  req->all = all;
 
-  if(sock.sysno > 0 && sock.sysno < countof(syscall_names))
-    JS_DefinePropertyValueStr(ctx, obj, "syscall", JS_NewString(ctx, socket_syscall(sock)), JS_PROP_ENUMERABLE);
+  {
+    struct addrinfo hints = {0}, *result = 0;
 
-  JSAtom to_string_tag = js_symbol_static_atom(ctx, "toStringTag");
-  JS_DefinePropertyValue(ctx, obj, to_string_tag, JS_GetProperty(ctx, this_val, to_string_tag), JS_PROP_CONFIGURABLE);
-  JS_FreeAtom(ctx, to_string_tag);
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
 
-  return obj;
-}
+    if((ret = getaddrinfo(host, 0, &hints, &result)) == 0 || numeric) {
+      js_sockets_lookup_done(ctx, ret, result, req);
 
-static JSValue
-js_socket_valueof(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
-  Socket s = js_socket_data(this_val);
+      if(result)
+        freeaddrinfo(result);
 
-  return JS_NewInt32(ctx, socket_fd(s));
-}
+      JS_FreeCString(ctx, host);
+      return promise;
+    }
+  }
 
-static JSValue
-js_socket_adopt(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
-  int32_t fd = -1;
+  ret = resolver_lookup(ctx, host, family, js_sockets_lookup_done, req);
+  JS_FreeCString(ctx, host);
 
-  JS_ToInt32(ctx, &fd, argv[0]);
+  if(ret == -1)
+    js_sockets_lookup_done(ctx, EAI_MEMORY, 0, req);
 
-  return js_socket_new_proto(ctx, socket_proto, fd, FALSE, FALSE);
+  return promise;
 }
 
-static void
-js_socket_finalizer(JSRuntime* rt, JSValue val) {
-  Socket sock = js_socket_data(val);
-  AsyncSocket* asock;
+/**
+ * lookupStats() returns the counters of this thread's lookup() cache:
+ * getaddrinfo() calls (queries), cache hits, lookups coalesced with one in
+ * flight, cached entries and pending calls.
+ */
+static JSValue
+js_sockets_lookupstats(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  ResolverStats st;
+  JSValue ret;
 
-  if(!socket_adopted(sock))
-    if(socket_open(sock))
-      close(socket_fd(sock));
+  resolver_stats(&st);
 
-  if((asock = js_asyncsocket_ptr(val))) {
-    JS_FreeValueRT(rt, asock->pending[0]);
-    JS_FreeValueRT(rt, asock->pending[1]);
-    js_free_rt(rt, asock);
-  }
+  if(JS_IsException((ret = JS_NewObject(ctx))))
+    return ret;
+
+  JS_SetPropertyStr(ctx, ret, "queries", JS_NewInt64(ctx, st.queries));
+  JS_SetPropertyStr(ctx, ret, "hits", JS_NewInt64(ctx, st.hits));
+  JS_SetPropertyStr(ctx, ret, "coalesced", JS_NewInt64(ctx, st.coalesced));
+  JS_SetPropertyStr(ctx, ret, "entries", JS_NewUint32(ctx, st.entries));
+  JS_SetPropertyStr(ctx, ret, "pending", JS_NewUint32(ctx, st.pending));
+  return ret;
 }
+#endif
 
-static JSClassDef js_socket_class = {
-    .class_name = "Socket",
-    .finalizer = js_socket_finalizer,
-};
+/**
+ * throwErrors(enable) switches between throwing a SyscallError and returning
+ * -errno from failed socket methods. Returns the previous setting.
+ */
+static JSValue
+js_sockets_throwerrors(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  BOOL prev = sockets_throw;
 
-static JSClassDef js_asyncsocket_class = {
-    .class_name = "AsyncSocket",
-    .finalizer = js_socket_finalizer,
-};
+  if(argc > 0)
+    sockets_throw = JS_ToBool(ctx, argv[0]);
+
+  return JS_NewBool(ctx, prev);
+}
 
 static JSValue
 js_sockopt(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
@@ -1769,6 +4455,14 @@ static const JSCFunctionListEntry js_sockets_funcs[] = {
 #endif
     JS_CFUNC_MAGIC_DEF("getsockopt", 4, js_sockopt, METHOD_GETSOCKOPT),
     JS_CFUNC_MAGIC_DEF("setsockopt", 4, js_sockopt, METHOD_SETSOCKOPT),
+#ifdef HAVE_SPLICE
+    JS_CFUNC_DEF("splice", 3, js_splice),
+#endif
+#ifndef _WIN32
+    JS_CFUNC_DEF("lookup", 1, js_sockets_lookup),
+    JS_CFUNC_DEF("lookupStats", 0, js_sockets_lookupstats),
+#endif
+    JS_CFUNC_DEF("throwErrors", 1, js_sockets_throwerrors),
 };
 
 static const JSCFunctionListEntry js_socket_proto_funcs[] = {
@@ -1793,6 +4487,17 @@ static const JSCFunctionListEntry js_socket_proto_funcs[] = {
     JS_CFUNC_MAGIC_DEF("sendto", 2, js_socket_method, METHOD_SENDTO),
     JS_CFUNC_MAGIC_DEF("recv", 1, js_socket_method, METHOD_RECV),
     JS_CFUNC_MAGIC_DEF("recvfrom", 2, js_socket_method, METHOD_RECVFROM),
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+    JS_CFUNC_MAGIC_DEF("recvmmsg", 1, js_socket_method, METHOD_RECVMMSG),
+    JS_CFUNC_MAGIC_DEF("sendmmsg", 1, js_socket_method, METHOD_SENDMMSG),
+#endif
+#ifdef HAVE_SENDFILE
+    JS_CFUNC_MAGIC_DEF("sendfile", 1, js_socket_method, METHOD_SENDFILE),
+#endif
+#ifdef SCM_RIGHTS
+    JS_CFUNC_MAGIC_DEF("sendFds", 1, js_socket_fds, FDS_SEND),
+    JS_CFUNC_MAGIC_DEF("recvFds", 0, js_socket_fds, FDS_RECV),
+#endif
     JS_CFUNC_MAGIC_DEF("shutdown", 1, js_socket_method, METHOD_SHUTDOWN),
     JS_CFUNC_MAGIC_DEF("close", 0, js_socket_method, METHOD_CLOSE),
     JS_CFUNC_MAGIC_DEF("getsockopt", 3, js_socket_method, METHOD_GETSOCKOPT),
@@ -1815,6 +4520,10 @@ static const JSCFunctionListEntry js_asyncsocket_proto_funcs[] = {
     JS_CGETSET_MAGIC_DEF("mode", js_socket_get, js_asyncsocket_set, PROP_MODE),
     JS_CGETSET_MAGIC_DEF("ret", js_socket_get, js_asyncsocket_set, PROP_RET),
     JS_CGETSET_MAGIC_DEF("nonblock", js_socket_get, js_asyncsocket_set, PROP_NONBLOCK),
+    JS_CGETSET_MAGIC_DEF("timeout", js_asyncsocket_get, js_asyncsocket_set, PROP_TIMEOUT),
+    JS_CGETSET_MAGIC_DEF("readTimeout", js_asyncsocket_get, js_asyncsocket_set, PROP_READ_TIMEOUT),
+    JS_CGETSET_MAGIC_DEF("writeTimeout", js_asyncsocket_get, js_asyncsocket_set, PROP_WRITE_TIMEOUT),
+    JS_CGETSET_MAGIC_DEF("bufferedAmount", js_asyncsocket_get, 0, PROP_BUFFERED),
     JS_CFUNC_MAGIC_DEF("ndelay", 0, js_socket_method, METHOD_NDELAY),
     JS_CFUNC_MAGIC_DEF("bind", 1, js_socket_method, METHOD_BIND),
     JS_CFUNC_MAGIC_DEF("connect", 1, js_socket_method, METHOD_CONNECT),
@@ -1824,6 +4533,25 @@ static const JSCFunctionListEntry js_asyncsocket_proto_funcs[] = {
     JS_CFUNC_MAGIC_DEF("sendto", 2, js_asyncsocket_method, METHOD_SENDTO),
     JS_CFUNC_MAGIC_DEF("recv", 1, js_asyncsocket_method, METHOD_RECV),
     JS_CFUNC_MAGIC_DEF("recvfrom", 2, js_asyncsocket_method, METHOD_RECVFROM),
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+    JS_CFUNC_MAGIC_DEF("recvmmsg", 1, js_asyncsocket_method, METHOD_RECVMMSG),
+    JS_CFUNC_MAGIC_DEF("sendmmsg", 1, js_asyncsocket_method, METHOD_SENDMMSG),
+#endif
+#ifdef HAVE_SENDFILE
+    JS_CFUNC_MAGIC_DEF("sendfile", 1, js_asyncsocket_method, METHOD_SENDFILE),
+#endif
+#ifdef SCM_RIGHTS
+    JS_CFUNC_MAGIC_DEF("sendFds", 1, js_socket_fds, FDS_SEND),
+    JS_CFUNC_MAGIC_DEF("recvFds", 0, js_socket_fds, FDS_RECV),
+#endif
+#ifndef _WIN32
+    JS_CFUNC_MAGIC_DEF("write", 1, js_asyncsocket_writer, WRITER_WRITE),
+    JS_CFUNC_MAGIC_DEF("cork", 0, js_asyncsocket_writer, WRITER_CORK),
+    JS_CFUNC_MAGIC_DEF("uncork", 0, js_asyncsocket_writer, WRITER_UNCORK),
+#endif
+#ifdef HAVE_ZEROCOPY
+    JS_CFUNC_DEF("sendZeroCopy", 1, js_asyncsocket_sendzerocopy),
+#endif
     JS_CFUNC_MAGIC_DEF("shutdown", 1, js_socket_method, METHOD_SHUTDOWN),
     JS_CFUNC_MAGIC_DEF("close", 0, js_socket_method, METHOD_CLOSE),
     JS_CFUNC_MAGIC_DEF("getsockopt", 3, js_socket_method, METHOD_GETSOCKOPT),
@@ -1970,6 +4698,13 @@ static const JSCFunctionListEntry js_sockets_errnos[] = {
 };
 
 static const JSCFunctionListEntry js_sockets_defines[] = {
+#ifdef EAI_NONAME
+    JS_CONSTANT_NONENUMERABLE(EAI_AGAIN),
+    JS_CONSTANT_NONENUMERABLE(EAI_FAIL),
+    JS_CONSTANT_NONENUMERABLE(EAI_FAMILY),
+    JS_CONSTANT_NONENUMERABLE(EAI_MEMORY),
+    JS_CONSTANT_NONENUMERABLE(EAI_NONAME),
+#endif
 #ifdef AF_UNSPEC
     JS_CONSTANT_NONENUMERABLE(AF_UNSPEC),
 #endif
@@ -2339,6 +5074,33 @@ static const JSCFunctionListEntry js_sockets_defines[] = {
 #ifdef SHUT_RDWR
     JS_CONSTANT_NONENUMERABLE(SHUT_RDWR),
 #endif
+#ifdef MSG_PEEK
+    JS_CONSTANT_NONENUMERABLE(MSG_PEEK),
+#endif
+#ifdef MSG_TRUNC
+    JS_CONSTANT_NONENUMERABLE(MSG_TRUNC),
+#endif
+#ifdef MSG_DONTWAIT
+    JS_CONSTANT_NONENUMERABLE(MSG_DONTWAIT),
+#endif
+#ifdef MSG_WAITALL
+    JS_CONSTANT_NONENUMERABLE(MSG_WAITALL),
+#endif
+#ifdef MSG_WAITFORONE
+    JS_CONSTANT_NONENUMERABLE(MSG_WAITFORONE),
+#endif
+#ifdef MSG_ZEROCOPY
+    JS_CONSTANT_NONENUMERABLE(MSG_ZEROCOPY),
+#endif
+#ifdef SPLICE_F_MOVE
+    JS_CONSTANT_NONENUMERABLE(SPLICE_F_MOVE),
+#endif
+#ifdef SPLICE_F_NONBLOCK
+    JS_CONSTANT_NONENUMERABLE(SPLICE_F_NONBLOCK),
+#endif
+#ifdef SPLICE_F_MORE
+    JS_CONSTANT_NONENUMERABLE(SPLICE_F_MORE),
+#endif
 #ifdef SO_DEBUG
     JS_CONSTANT_NONENUMERABLE(SO_DEBUG),
 #endif
@@ -2384,6 +5146,15 @@ static const JSCFunctionListEntry js_sockets_defines[] = {
 #ifdef SO_PEERCRED
     JS_CONSTANT_NONENUMERABLE(SO_PEERCRED),
 #endif
+#ifdef SO_ZEROCOPY
+    JS_CONSTANT_NONENUMERABLE(SO_ZEROCOPY),
+#endif
+#ifdef SCM_RIGHTS
+    JS_CONSTANT_NONENUMERABLE(SCM_RIGHTS),
+#endif
+#ifdef SCM_CREDENTIALS
+    JS_CONSTANT_NONENUMERABLE(SCM_CREDENTIALS),
+#endif
 #ifdef SO_RCVLOWAT
     JS_CONSTANT_NONENUMERABLE(SO_RCVLOWAT),
 #endif
@@ -2545,8 +5316,6 @@ static const JSCFunctionListEntry js_sockets_defines[] = {
 static int
 js_sockets_init(JSContext* ctx, JSModuleDef* m) {
 
-  assert(sizeof(Socket) <= sizeof(void*));
-
   js_syscallerror_init(ctx, m);
 
   // JSValue fdset_module, fdset_ns, fdset_ctor = JS_UNDEFINED, socklen_module, socklen_ns, socklen_ctor = JS_UNDEFINED;
@@ -2560,6 +5329,7 @@ js_sockets_init(JSContext* ctx, JSModuleDef* m) {
 
   JS_SetClassProto(ctx, js_sockaddr_class_id, sockaddr_proto);
   JS_SetConstructor(ctx, sockaddr_ctor, sockaddr_proto);
+  JS_SetPropertyFunctionList(ctx, sockaddr_ctor, js_sockaddr_static_funcs, countof(js_sockaddr_static_funcs));
 
   // js_set_inspect_method(ctx, sockaddr_proto, js_sockaddr_inspect);
 
@@ -2593,10 +5363,23 @@ js_sockets_init(JSContext* ctx, JSModuleDef* m) {
   JS_SetClassProto(ctx, js_asyncsocket_class_id, asyncsocket_proto);
   JS_SetConstructor(ctx, asyncsocket_ctor, asyncsocket_proto);
 
+  JS_NewClassID(&js_listener_class_id);
+  JS_NewClass(JS_GetRuntime(ctx), js_listener_class_id, &js_listener_class);
+
+  listener_ctor = JS_NewCFunction2(ctx, js_listener_constructor, "Listener", 2, JS_CFUNC_constructor, 0);
+  listener_proto = JS_NewObject(ctx);
+
+  JS_SetPropertyFunctionList(ctx, listener_proto, js_listener_proto_funcs, countof(js_listener_proto_funcs));
+  JS_SetPropertyFunctionList(ctx, listener_ctor, js_listener_static_funcs, countof(js_listener_static_funcs));
+
+  JS_SetClassProto(ctx, js_listener_class_id, listener_proto);
+  JS_SetConstructor(ctx, listener_ctor, listener_proto);
+
   if(m) {
     JS_SetModuleExport(ctx, m, "SockAddr", sockaddr_ctor);
     JS_SetModuleExport(ctx, m, "Socket", socket_ctor);
     JS_SetModuleExport(ctx, m, "AsyncSocket", asyncsocket_ctor);
+    JS_SetModuleExport(ctx, m, "Listener", listener_ctor);
     /*JS_SetModuleExport(ctx, m, "fd_set", fdset_ctor);
     JS_SetModuleExport(ctx, m, "socklen_t", socklen_ctor);*/
 
@@ -2629,6 +5412,7 @@ JS_INIT_MODULE(JSContext* ctx, const char* module_name) {
     JS_AddModuleExport(ctx, m, "SockAddr");
     JS_AddModuleExport(ctx, m, "Socket");
     JS_AddModuleExport(ctx, m, "AsyncSocket");
+    JS_AddModuleExport(ctx, m, "Listener");
     JS_AddModuleExport(ctx, m, "fd_set");
     JS_AddModuleExport(ctx, m, "socklen_t");
 
@@ -16,6 +16,8 @@
 #include <quickjs.h>
 
 #include "utils.h"
+#include "timer-wheel.h"
+#include "queue.h"
 
 #if !defined(_WIN32) || defined(HAVE_AFUNIX_H)
 #define HAVE_AF_UNIX
@@ -41,17 +43,14 @@ typedef union {
 } SockAddr;
 
 #define SOCKET_PROPS() \
-  unsigned fd : 16; \
+  int fd; \
   unsigned error : 8; \
-  unsigned sysno : 4; \
+  unsigned sysno : 5; \
   BOOL nonblock : 1, async : 1, owner : 1; \
   signed ret : 32
 
-union PACK socket_state {
-  PACK struct { SOCKET_PROPS(); };
-  ENDPACK
-  uint64_t u64;
-  void* ptr;
+struct PACK socket_state {
+  SOCKET_PROPS();
 };
 ENDPACK
 
@@ -59,6 +58,33 @@ struct socket_handlers {
   JSValue close, connect, data, drain, end, error, lookup, ready, timeout;
 };
 
+/* idle, read and write deadlines of an AsyncSocket, in milliseconds */
+struct socket_deadlines {
+  Timer idle, read, write;
+  uint32_t timeout, read_timeout, write_timeout;
+  JSObject* socket;
+  JSValue resolve[2];
+  void* op[2];
+};
+
+/* outgoing data of an AsyncSocket, coalesced into one writev() per flush */
+struct socket_writer {
+  Queue queue;
+  JSValue promise, resolve, inflight;
+  size_t size, unwritten, remain, batch;
+  uint32_t corked;
+  BOOL scheduled : 1, waiting : 1;
+};
+
+/* MSG_ZEROCOPY sends of an AsyncSocket, pinned until the kernel reports their completion */
+struct socket_zerocopy {
+  Timer timer;
+  struct list_head pending;
+  JSObject* socket;
+  uint32_t next, interval;
+  BOOL enabled : 1, unsupported : 1, copied : 1;
+};
+
 struct async_closure {
   JSCFunctionMagic* set_mux;
 };
@@ -67,26 +93,35 @@ struct PACK asyncsocket_state {
   SOCKET_PROPS();
   /*struct socket_handlers handlers;*/
   JSValue pending[2];
+  struct socket_deadlines* deadlines;
+  struct socket_writer* writer;
+  struct socket_zerocopy* zerocopy;
+  unsigned ready : 2, queued : 2, polled : 1;
 };
 ENDPACK
 
 #define SOCKET(fd, err, sys, nonb, asyn, own) \
-  { \
-    { (fd), (err), (sys), (nonb), (asyn), (own), (0) } \
-  }
+  { (fd), (err), (sys), (nonb), (asyn), (own), (0) }
 
 #define SOCKET_INIT() SOCKET(-1, 0, -1, FALSE, FALSE, FALSE)
 
-typedef union socket_state Socket;
+typedef struct socket_state Socket;
 typedef struct asyncsocket_state AsyncSocket;
 
+typedef struct listener_state {
+  int fd;
+  uint32_t batch;
+  JSValue callback, handler;
+  Timer retry;
+} Listener;
+
 VISIBLE SockAddr* js_sockaddr_data(JSValueConst);
 VISIBLE SockAddr* js_sockaddr_data2(JSContext*, JSValueConst value);
 VISIBLE Socket js_socket_data(JSValueConst);
 void* optval_buf(JSContext*, JSValueConst arg, int32_t** tmp_ptr, socklen_t* lenp);
 
-extern VISIBLE JSClassID js_sockaddr_class_id, js_socket_class_id, js_asyncsocket_class_id;
-extern VISIBLE JSValue sockaddr_proto, sockaddr_ctor, socket_proto, socket_ctor, asyncsocket_proto, asyncsocket_ctor;
+extern VISIBLE JSClassID js_sockaddr_class_id, js_socket_class_id, js_asyncsocket_class_id, js_listener_class_id;
+extern VISIBLE JSValue sockaddr_proto, sockaddr_ctor, socket_proto, socket_ctor, asyncsocket_proto, asyncsocket_ctor, listener_proto, listener_ctor;
 
 enum SocketCalls {
   SYSCALL_SOCKET = 0,
@@ -104,13 +139,18 @@ enum SocketCalls {
   SYSCALL_SHUTDOWN,
   SYSCALL_CLOSE,
   SYSCALL_GETSOCKOPT,
-  SYSCALL_SETSOCKOPT
+  SYSCALL_SETSOCKOPT,
+  SYSCALL_RECVMMSG,
+  SYSCALL_SENDMMSG,
+  SYSCALL_SENDFILE,
+  SYSCALL_RECVMSG,
+  SYSCALL_SENDMSG,
 };
 
 #define socket_fd(sock) ((sock).fd)
 #define socket_closed(sock) ((sock).sysno == SYSCALL_CLOSE && (sock).ret == 0)
 #define socket_eof(sock) (((sock).sysno == SYSCALL_RECV || (sock).sysno == SYSCALL_RECVFROM) && (sock).ret == 0)
-#define socket_open(sock) ((sock).fd != UINT16_MAX && !socket_closed(sock))
+#define socket_open(sock) ((sock).fd >= 0 && !socket_closed(sock))
 #define socket_retval(sock) ((sock).ret)
 #if defined(_WIN32) && !defined(__MSYS__) && !defined(__CYGWIN__)
 #define socket_error(sock) ((sock).ret < 0 ? (int)(sock).error + WSABASEERR : 0)
@@ -18,6 +18,20 @@ VISIBLE JSValue syscallerror_proto = {{0}, JS_TAG_UNDEFINED}, syscallerror_ctor
 int js_syscallerror_init(JSContext*, JSModuleDef*);
 static const char* error_get(int number);
 
+/*
+ * Non-blocking I/O produces errors at a high rate, most of which are only
+ * tested for their errno. So the SyscallError records are recycled through a
+ * small per-thread pool, the syscall name is not copied and neither the stack
+ * nor the message is computed before they are accessed. Errors which are
+ * thrown capture the stack right away.
+ */
+#define SYSCALLERROR_POOL 32
+
+static thread_local struct {
+  SyscallError* items[SYSCALLERROR_POOL];
+  int count;
+} syscallerror_pool;
+
 static char*
 stack_get(JSContext* ctx) {
   const char* stack;
@@ -45,16 +59,56 @@ js_syscallerror_data2(JSContext* ctx, JSValueConst value) {
   return JS_GetOpaque2(ctx, value, js_syscallerror_class_id);
 }
 
+static SyscallError*
+syscallerror_alloc(JSContext* ctx) {
+  SyscallError* err;
+
+  if(syscallerror_pool.count > 0)
+    err = syscallerror_pool.items[--syscallerror_pool.count];
+  else if(!(err = malloc(sizeof(SyscallError)))) {
+    JS_ThrowOutOfMemory(ctx);
+    return 0;
+  }
+
+  memset(err, 0, sizeof(SyscallError));
+  return err;
+}
+
+static void
+syscallerror_release(JSRuntime* rt, SyscallError* err) {
+  if(err->owned && err->syscall)
+    js_free_rt(rt, (char*)err->syscall);
+
+  if(err->stack)
+    js_free_rt(rt, err->stack);
+
+  if(syscallerror_pool.count < SYSCALLERROR_POOL)
+    syscallerror_pool.items[syscallerror_pool.count++] = err;
+  else
+    free(err);
+}
+
+static void
+syscallerror_capture(JSContext* ctx, SyscallError* err) {
+  if(!err->captured) {
+    err->stack = stack_get(ctx);
+    err->captured = TRUE;
+  }
+}
+
+/**
+ * syscall is not copied, it must be a string literal (or otherwise outlive
+ * the error).
+ */
 SyscallError*
 syscallerror_new(JSContext* ctx, const char* syscall, int number) {
   SyscallError* err;
 
-  if(!(err = js_mallocz(ctx, sizeof(SyscallError))))
+  if(!(err = syscallerror_alloc(ctx)))
     return 0;
 
-  err->syscall = syscall ? js_strdup(ctx, syscall) : 0;
+  err->syscall = syscall;
   err->number = number;
-  err->stack = stack_get(ctx);
   return err;
 }
 
@@ -84,14 +138,24 @@ js_syscallerror_new(JSContext* ctx, const char* syscall, int number) {
   JS_SetOpaque(obj, err);
   return obj;
 fail:
-  js_free(ctx, err);
+  syscallerror_release(JS_GetRuntime(ctx), err);
   JS_FreeValue(ctx, obj);
   return JS_EXCEPTION;
 }
 
 JSValue
 js_syscallerror_throw(JSContext* ctx, const char* syscall) {
-  JSValue error = js_syscallerror_new(ctx, syscall, errno);
+  return js_syscallerror_throw_errno(ctx, syscall, errno);
+}
+
+JSValue
+js_syscallerror_throw_errno(JSContext* ctx, const char* syscall, int number) {
+  JSValue error = js_syscallerror_new(ctx, syscall, number);
+  SyscallError* err;
+
+  if((err = js_syscallerror_data(error)))
+    syscallerror_capture(ctx, err);
+
   return JS_Throw(ctx, error);
 }
 
@@ -100,7 +164,7 @@ js_syscallerror_constructor(JSContext* ctx, JSValueConst new_target, int argc, J
   SyscallError* err;
   JSValue obj = JS_UNDEFINED, proto = JS_UNDEFINED, st = JS_UNDEFINED;
 
-  if(!(err = js_mallocz(ctx, sizeof(SyscallError))))
+  if(!(err = syscallerror_alloc(ctx)))
     return JS_EXCEPTION;
 
   proto = JS_GetPropertyStr(ctx, new_target, "prototype");
@@ -112,6 +176,7 @@ js_syscallerror_constructor(JSContext* ctx, JSValueConst new_target, int argc, J
     goto fail;
   if(argc >= 2) {
     err->syscall = js_tostring(ctx, argv[0]);
+    err->owned = TRUE;
     argc--;
     argv++;
   }
@@ -128,13 +193,13 @@ js_syscallerror_constructor(JSContext* ctx, JSValueConst new_target, int argc, J
 
     err->number = number;
   }
-  err->stack = stack_get(ctx);
+  syscallerror_capture(ctx, err);
   JS_FreeValue(ctx, st);
 
   JS_SetOpaque(obj, err);
   return obj;
 fail:
-  js_free(ctx, err);
+  syscallerror_release(JS_GetRuntime(ctx), err);
   JS_FreeValue(ctx, obj);
   return JS_EXCEPTION;
 }
@@ -293,8 +358,10 @@ js_syscallerror_get(JSContext* ctx, JSValueConst this_val, int magic) {
     }
 
     case PROP_STACK: {
-      if(err)
+      if(err) {
+        syscallerror_capture(ctx, err);
         ret = err->stack ? JS_NewString(ctx, err->stack) : JS_NULL;
+      }
       break;
     }
 
@@ -729,14 +796,8 @@ static void
 js_syscallerror_finalizer(JSRuntime* rt, JSValue val) {
   SyscallError* err;
 
-  if((err = JS_GetOpaque(val, js_syscallerror_class_id))) {
-    if(err->syscall)
-      js_free_rt(rt, err->syscall);
-    if(err->stack)
-      js_free_rt(rt, err->stack);
-
-    js_free_rt(rt, err);
-  }
+  if((err = JS_GetOpaque(val, js_syscallerror_class_id)))
+    syscallerror_release(rt, err);
 }
 
 static JSClassDef js_syscallerror_class = {
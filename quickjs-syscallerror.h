@@ -9,9 +9,11 @@
  * @{
  */
 typedef struct {
-  char* syscall;
+  const char* syscall;
   int number;
   char* stack;
+  /* syscall has been allocated (by the constructor), stack has been captured */
+  BOOL owned : 1, captured : 1;
 } SyscallError;
 
 #define js_syscall(name, retval) js_syscall_return(name, retval, JS_NewInt32(ctx, result))
@@ -33,6 +35,7 @@ VISIBLE SyscallError* syscallerror_new(JSContext*, const char* syscall, int numb
 VISIBLE JSValue js_syscallerror_wrap(JSContext*, SyscallError* err);
 VISIBLE JSValue js_syscallerror_new(JSContext*, const char* syscall, int number);
 VISIBLE JSValue js_syscallerror_throw(JSContext*, const char* syscall);
+VISIBLE JSValue js_syscallerror_throw_errno(JSContext*, const char* syscall, int number);
 
 VISIBLE int js_syscallerror_init(JSContext* ctx, JSModuleDef* m);
 
@@ -0,0 +1,486 @@
+#include "bulk-insert.h"
+#include "buffer-utils.h"
+#include "utils.h"
+
+/**
+ * \addtogroup bulk-insert
+ * @{
+ */
+
+/*
+ * Rows are pulled one at a time from a (sync or async) iterator and formatted
+ * by the driver into 'row', then appended to 'batch', which starts with the
+ * "INSERT INTO ... VALUES " header. A batch is submitted through the
+ * connection's query() method once the next row would push it over
+ * 'max_bytes'. While it is in flight the following batch is being filled;
+ * pulling rows stops when that one is complete as well.
+ */
+typedef struct {
+  int ref_count;
+  JSContext* ctx;
+  const BulkInsertDriver* driver;
+  JSValue conn, iter, next, funcs[2];
+  JSAtom* columns;
+  uint32_t num_columns, batch_rows;
+  DynBuf batch, row;
+  size_t header_len, max_bytes;
+  int64_t rows, statements, affected;
+  BOOL async : 1, waiting : 1, in_flight : 1, has_row : 1, done : 1, failed : 1;
+} BulkInsert;
+
+enum {
+  BULK_NEXT = 0,
+  BULK_SENT,
+  BULK_ERROR,
+  BULK_NEXT_ERROR,
+};
+
+static BulkInsert*
+bulk_dup(BulkInsert* b) {
+  ++b->ref_count;
+  return b;
+}
+
+static void
+bulk_free(void* ptr) {
+  BulkInsert* b = ptr;
+
+  if(--b->ref_count == 0) {
+    JSContext* ctx = b->ctx;
+
+    for(uint32_t i = 0; i < b->num_columns; i++)
+      JS_FreeAtom(ctx, b->columns[i]);
+
+    js_free(ctx, b->columns);
+    dbuf_free(&b->batch);
+    dbuf_free(&b->row);
+    JS_FreeValue(ctx, b->conn);
+    JS_FreeValue(ctx, b->iter);
+    JS_FreeValue(ctx, b->next);
+    JS_FreeValue(ctx, b->funcs[0]);
+    JS_FreeValue(ctx, b->funcs[1]);
+    js_free(ctx, b);
+  }
+}
+
+static JSValue js_bulkinsert_callback(JSContext*, JSValueConst, int, JSValueConst[], int, void*);
+
+static int
+bulk_then(BulkInsert* b, JSValue promise, int magic) {
+  JSContext* ctx = b->ctx;
+  JSValue ret;
+  JSValueConst args[2] = {
+      js_function_cclosure(ctx, js_bulkinsert_callback, 1, magic, bulk_dup(b), bulk_free),
+      js_function_cclosure(ctx, js_bulkinsert_callback, 1, magic == BULK_NEXT ? BULK_NEXT_ERROR : BULK_ERROR, bulk_dup(b), bulk_free),
+  };
+
+  ret = js_invoke(ctx, promise, "then", 2, args);
+
+  JS_FreeValue(ctx, (JSValue)args[0]);
+  JS_FreeValue(ctx, (JSValue)args[1]);
+  JS_FreeValue(ctx, promise);
+
+  if(JS_IsException(ret))
+    return -1;
+
+  JS_FreeValue(ctx, ret);
+  return 0;
+}
+
+static void
+bulk_settle(BulkInsert* b, BOOL reject, JSValueConst value) {
+  JSContext* ctx = b->ctx;
+  JSValue ret = JS_Call(ctx, b->funcs[reject], JS_UNDEFINED, 1, &value);
+
+  JS_FreeValue(ctx, ret);
+}
+
+/* rejects with the pending exception, or 'error' when given */
+static void
+bulk_fail(BulkInsert* b, JSValueConst error) {
+  JSContext* ctx = b->ctx;
+  JSValue exception = JS_IsUndefined(error) ? JS_GetException(ctx) : JS_DupValue(ctx, error);
+
+  if(!b->failed) {
+    b->failed = TRUE;
+
+    /* let the iterator clean up */
+    if(!b->done) {
+      JSValue fn = JS_GetPropertyStr(ctx, b->iter, "return");
+
+      if(JS_IsFunction(ctx, fn)) {
+        JSValue ret = JS_Call(ctx, fn, b->iter, 0, 0);
+
+        if(JS_IsException(ret))
+          ret = JS_GetException(ctx);
+
+        JS_FreeValue(ctx, ret);
+      }
+
+      JS_FreeValue(ctx, fn);
+    }
+
+    bulk_settle(b, TRUE, exception);
+  }
+
+  JS_FreeValue(ctx, exception);
+}
+
+/* formats the row into b->row, from an array by position or an object by column name */
+static int
+bulk_format(BulkInsert* b, JSValueConst value) {
+  JSContext* ctx = b->ctx;
+  BOOL array = JS_IsArray(ctx, value);
+
+  if(!JS_IsObject(value)) {
+    JS_ThrowTypeError(ctx, "row %" PRId64 " must be an array or an object", b->rows);
+    return -1;
+  }
+
+  b->row.size = 0;
+  dbuf_putc(&b->row, '(');
+
+  for(uint32_t i = 0; i < b->num_columns; i++) {
+    JSValue item = array ? JS_GetPropertyUint32(ctx, value, i) : JS_GetProperty(ctx, value, b->columns[i]);
+
+    if(JS_IsException(item))
+      return -1;
+
+    if(i > 0)
+      dbuf_putstr(&b->row, ", ");
+
+    if(b->driver->print_value(ctx, b->conn, &b->row, item)) {
+      JS_FreeValue(ctx, item);
+      return -1;
+    }
+
+    JS_FreeValue(ctx, item);
+  }
+
+  dbuf_putc(&b->row, ')');
+  b->has_row = TRUE;
+
+  return 0;
+}
+
+/* handles an iterator result, returns -1 on error */
+static int
+bulk_result(BulkInsert* b, JSValueConst result) {
+  JSContext* ctx = b->ctx;
+  JSValue value;
+  int ret;
+
+  /* a broken iterator is not closed, like for...of does */
+  if(!JS_IsObject(result)) {
+    b->done = TRUE;
+    JS_ThrowTypeError(ctx, "iterator result is not an object");
+    return -1;
+  }
+
+  if(js_get_propertystr_bool(ctx, result, "done")) {
+    b->done = TRUE;
+    return 0;
+  }
+
+  value = JS_GetPropertyStr(ctx, result, "value");
+  ret = bulk_format(b, value);
+  JS_FreeValue(ctx, value);
+
+  return ret;
+}
+
+static void
+bulk_append(BulkInsert* b) {
+  if(b->batch_rows++ == 0)
+    b->batch.size = b->header_len;
+  else
+    dbuf_putstr(&b->batch, ", ");
+
+  dbuf_put(&b->batch, b->row.buf, b->row.size);
+  b->has_row = FALSE;
+  b->rows++;
+}
+
+static int
+bulk_submit(BulkInsert* b) {
+  JSContext* ctx = b->ctx;
+  JSValue sql, promise;
+
+  sql = JS_NewStringLen(ctx, (const char*)b->batch.buf, b->batch.size);
+
+  /* the header stays in place for the next batch */
+  b->batch.size = b->header_len;
+  b->batch_rows = 0;
+
+  promise = js_invoke(ctx, b->conn, "query", 1, &sql);
+  JS_FreeValue(ctx, sql);
+
+  if(JS_IsException(promise) || bulk_then(b, promise, BULK_SENT))
+    return -1;
+
+  b->in_flight = TRUE;
+  return 0;
+}
+
+static void
+bulk_pump(BulkInsert* b) {
+  JSContext* ctx = b->ctx;
+
+  while(!b->failed) {
+    if(b->has_row) {
+      if(b->batch_rows && b->batch.size + 2 + b->row.size > b->max_bytes) {
+        /* both batches are complete, wait for the one in flight */
+        if(b->in_flight)
+          return;
+
+        if(bulk_submit(b))
+          break;
+      }
+
+      bulk_append(b);
+      continue;
+    }
+
+    if(b->done) {
+      if(!b->in_flight) {
+        if(b->batch_rows) {
+          if(bulk_submit(b))
+            break;
+        } else {
+          JSValue ret = JS_NewObject(ctx);
+
+          JS_SetPropertyStr(ctx, ret, "rows", JS_NewInt64(ctx, b->rows));
+          JS_SetPropertyStr(ctx, ret, "statements", JS_NewInt64(ctx, b->statements));
+          JS_SetPropertyStr(ctx, ret, "affectedRows", JS_NewInt64(ctx, b->affected));
+          bulk_settle(b, FALSE, ret);
+          JS_FreeValue(ctx, ret);
+        }
+      }
+
+      return;
+    }
+
+    if(b->waiting)
+      return;
+
+    {
+      JSValue result = JS_Call(ctx, b->next, b->iter, 0, 0);
+
+      if(JS_IsException(result)) {
+        b->done = TRUE;
+        break;
+      }
+
+      if(b->async) {
+        if(bulk_then(b, result, BULK_NEXT))
+          break;
+
+        b->waiting = TRUE;
+        return;
+      }
+
+      if(bulk_result(b, result)) {
+        JS_FreeValue(ctx, result);
+        break;
+      }
+
+      JS_FreeValue(ctx, result);
+    }
+  }
+
+  if(!b->failed)
+    bulk_fail(b, JS_UNDEFINED);
+}
+
+static JSValue
+js_bulkinsert_callback(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, void* ptr) {
+  BulkInsert* b = ptr;
+  JSValueConst arg = argc > 0 ? argv[0] : JS_UNDEFINED;
+
+  bulk_dup(b);
+
+  switch(magic) {
+    case BULK_NEXT: {
+      b->waiting = FALSE;
+
+      if(!b->failed && bulk_result(b, arg)) {
+        bulk_fail(b, JS_UNDEFINED);
+        break;
+      }
+
+      bulk_pump(b);
+      break;
+    }
+
+    case BULK_SENT: {
+      JSValue affected = JS_GetPropertyStr(ctx, b->conn, "affectedRows");
+      int64_t n = 0;
+
+      if(JS_IsNumber(affected))
+        JS_ToInt64(ctx, &n, affected);
+
+      JS_FreeValue(ctx, affected);
+
+      b->in_flight = FALSE;
+      b->statements++;
+      b->affected += n;
+
+      bulk_pump(b);
+      break;
+    }
+
+    /* next() rejected: the iterator is done and isn't closed */
+    case BULK_NEXT_ERROR: {
+      b->waiting = FALSE;
+      b->done = TRUE;
+    }
+      /* fall through */
+    case BULK_ERROR: {
+      bulk_fail(b, JS_IsUndefined(arg) ? JS_NULL : arg);
+      break;
+    }
+  }
+
+  bulk_free(b);
+  return JS_UNDEFINED;
+}
+
+/**
+ * conn.bulkInsert(table, columns, rows, { maxBytes })
+ *
+ * table and columns are quoted as identifiers, a table may be given as
+ * 'schema.table'. rows is an iterable or async iterable of arrays (by column
+ * position) or objects (by column name). Resolves to { rows, statements,
+ * affectedRows }.
+ * 'limit' is the largest statement the server accepts (0 for none), maxBytes
+ * is capped to it.
+ */
+JSValue
+js_bulkinsert(JSContext* ctx, JSValueConst conn, int argc, JSValueConst argv[], const BulkInsertDriver* driver, size_t max_bytes, size_t limit) {
+  BulkInsert* b;
+  JSValue fn, ret;
+  JSAtom async_iterator;
+  const char* table;
+  size_t table_len;
+  int64_t len;
+
+  if(argc < 3)
+    return JS_ThrowTypeError(ctx, "expecting (table, columns, rows[, options])");
+
+  if(!JS_IsArray(ctx, argv[1]) || (len = js_array_length(ctx, argv[1])) <= 0)
+    return JS_ThrowTypeError(ctx, "argument 2 must be a non-empty array of column names");
+
+  if(argc > 3 && JS_IsObject(argv[3])) {
+    JSValue value = JS_GetPropertyStr(ctx, argv[3], "maxBytes");
+
+    if(JS_IsNumber(value)) {
+      int64_t n = 0;
+
+      JS_ToInt64(ctx, &n, value);
+
+      if(n > 0)
+        max_bytes = n;
+    }
+
+    JS_FreeValue(ctx, value);
+  }
+
+  if(limit && max_bytes > limit)
+    max_bytes = limit;
+
+  if(!(b = js_mallocz(ctx, sizeof(BulkInsert))))
+    return JS_EXCEPTION;
+
+  b->ref_count = 1;
+  b->ctx = ctx;
+  b->driver = driver;
+  b->conn = JS_DupValue(ctx, conn);
+  b->iter = JS_UNDEFINED;
+  b->next = JS_UNDEFINED;
+  b->funcs[0] = b->funcs[1] = JS_UNDEFINED;
+  b->max_bytes = max_bytes;
+  js_dbuf_init(ctx, &b->batch);
+  js_dbuf_init(ctx, &b->row);
+
+  if(!(b->columns = js_mallocz(ctx, sizeof(JSAtom) * len))) {
+    bulk_free(b);
+    return JS_EXCEPTION;
+  }
+
+  b->num_columns = len;
+
+  if(!(table = JS_ToCStringLen(ctx, &table_len, argv[0]))) {
+    bulk_free(b);
+    return JS_EXCEPTION;
+  }
+
+  dbuf_putstr(&b->batch, "INSERT INTO ");
+
+  /* 'schema.table' is quoted part by part */
+  for(size_t i = 0, n; i <= table_len; i += n + 1) {
+    JSValue part;
+
+    n = byte_chr(&table[i], table_len - i, '.');
+    part = JS_NewStringLen(ctx, &table[i], n);
+
+    if(i > 0)
+      dbuf_putc(&b->batch, '.');
+
+    driver->print_identifier(ctx, conn, &b->batch, part);
+    JS_FreeValue(ctx, part);
+  }
+
+  dbuf_putstr(&b->batch, " (");
+  JS_FreeCString(ctx, table);
+
+  for(uint32_t i = 0; i < b->num_columns; i++) {
+    JSValue name = JS_GetPropertyUint32(ctx, argv[1], i);
+
+    b->columns[i] = JS_ValueToAtom(ctx, name);
+
+    if(i > 0)
+      dbuf_putstr(&b->batch, ", ");
+
+    driver->print_identifier(ctx, conn, &b->batch, name);
+    JS_FreeValue(ctx, name);
+  }
+
+  dbuf_putstr(&b->batch, ") VALUES ");
+  b->header_len = b->batch.size;
+
+  async_iterator = js_symbol_static_atom(ctx, "asyncIterator");
+  fn = JS_GetProperty(ctx, argv[2], async_iterator);
+  JS_FreeAtom(ctx, async_iterator);
+
+  if((b->async = JS_IsFunction(ctx, fn)))
+    b->iter = JS_Call(ctx, fn, argv[2], 0, 0);
+  else
+    b->iter = js_iterator_new(ctx, argv[2]);
+
+  JS_FreeValue(ctx, fn);
+
+  if(!JS_IsObject(b->iter)) {
+    if(!JS_IsException(b->iter))
+      JS_ThrowTypeError(ctx, "argument 3 must be iterable");
+
+    bulk_free(b);
+    return JS_EXCEPTION;
+  }
+
+  b->next = JS_GetPropertyStr(ctx, b->iter, "next");
+
+  if(JS_IsException((ret = JS_NewPromiseCapability(ctx, b->funcs)))) {
+    bulk_free(b);
+    return ret;
+  }
+
+  /* from here on errors reject the promise */
+  bulk_pump(b);
+  bulk_free(b);
+
+  return ret;
+}
+
+/**
+ * @}
+ */
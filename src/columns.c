@@ -0,0 +1,390 @@
+#include "columns.h"
+#include "buffer-utils.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+/**
+ * \addtogroup columns
+ * @{
+ */
+static const char* const column_types[] = {
+    "string",
+    "float64",
+    "int32",
+    "bigint64",
+};
+
+static void
+column_arraybuffer_free(JSRuntime* rt, void* opaque, void* ptr) {
+  js_free_rt(rt, ptr);
+}
+
+/* hands the buffer over to an ArrayBuffer */
+static JSValue
+column_buffer(JSContext* ctx, DynBuf* db) {
+  JSValue ret;
+
+  if(!db->buf)
+    return JS_NewArrayBufferCopy(ctx, 0, 0);
+
+  ret = JS_NewArrayBuffer(ctx, db->buf, db->size, column_arraybuffer_free, 0, FALSE);
+
+  if(!JS_IsException(ret))
+    db->buf = 0;
+
+  db->size = db->allocated_size = 0;
+  return ret;
+}
+
+static JSValue
+column_typedarray(JSContext* ctx, DynBuf* db, int bits, BOOL floating, BOOL sign) {
+  JSValue buffer = column_buffer(ctx, db), ret;
+
+  if(JS_IsException(buffer))
+    return buffer;
+
+  ret = js_typedarray_new(ctx, bits, floating, sign, buffer);
+  JS_FreeValue(ctx, buffer);
+  return ret;
+}
+
+void
+column_init(JSContext* ctx, Column* col, ColumnType type) {
+  col->type = type;
+  col->rows = 0;
+  col->has_nulls = FALSE;
+
+  js_dbuf_init(ctx, &col->data);
+  js_dbuf_init(ctx, &col->offsets);
+  js_dbuf_init(ctx, &col->nulls);
+
+  if(type == COLUMN_STRING)
+    dbuf_put_u32(&col->offsets, 0);
+}
+
+void
+column_free(Column* col) {
+  dbuf_free(&col->data);
+  dbuf_free(&col->offsets);
+  dbuf_free(&col->nulls);
+}
+
+/*
+ * Appends the text representation of a value, buf is NULL for SQL NULL.
+ * Numbers are parsed from the whole text, anything that is not entirely a
+ * number (or out of range) is stored as NULL.
+ */
+int
+column_append(Column* col, const char* buf, size_t len) {
+  uint32_t row = col->rows++;
+  BOOL null = buf == 0;
+  char tmp[64], *str = tmp, *end = 0;
+  DynBuf text = {0};
+  double d = 0;
+  int64_t i = 0;
+  int ret = -1;
+
+  if((row & 7) == 0 && dbuf_putc(&col->nulls, 0))
+    return -1;
+
+  /* the text is not necessarily NUL terminated, long numerals are copied to the heap */
+  if(!null && col->type != COLUMN_STRING) {
+    if(len >= sizeof(tmp)) {
+      dbuf_init2(&text, col->data.opaque, col->data.realloc_func);
+
+      if(dbuf_put(&text, (const uint8_t*)buf, len) || dbuf_putc(&text, '\0'))
+        goto fail;
+
+      str = (char*)text.buf;
+    } else {
+      memcpy(tmp, buf, len);
+      tmp[len] = '\0';
+    }
+
+    errno = 0;
+  }
+
+  switch(col->type) {
+    case COLUMN_STRING: {
+      if(!null && dbuf_put(&col->data, (const uint8_t*)buf, len))
+        goto fail;
+
+      if(dbuf_put_u32(&col->offsets, col->data.size))
+        goto fail;
+      break;
+    }
+
+    case COLUMN_FLOAT64: {
+      if(!null) {
+        d = strtod(str, &end);
+
+        if(end == str || end != str + len)
+          null = TRUE, d = 0;
+      }
+
+      if(dbuf_put(&col->data, (const uint8_t*)&d, sizeof(d)))
+        goto fail;
+      break;
+    }
+
+    case COLUMN_INT32:
+    case COLUMN_BIGINT64: {
+      if(!null) {
+        /* booleans as 't'/'f' (PostgreSQL) */
+        if(len == 1 && (str[0] == 't' || str[0] == 'f'))
+          i = str[0] == 't';
+        else if((i = strtoll(str, &end, 10)), end == str || end != str + len || errno == ERANGE)
+          null = TRUE, i = 0;
+      }
+
+      if(col->type == COLUMN_INT32) {
+        int32_t i32 = i;
+
+        if(i != i32)
+          null = TRUE, i32 = 0;
+
+        if(dbuf_put(&col->data, (const uint8_t*)&i32, sizeof(i32)))
+          goto fail;
+      } else if(dbuf_put(&col->data, (const uint8_t*)&i, sizeof(i))) {
+        goto fail;
+      }
+      break;
+    }
+  }
+
+  if(null) {
+    col->nulls.buf[row >> 3] |= 1 << (row & 7);
+    col->has_nulls = TRUE;
+  }
+
+  ret = 0;
+
+fail:
+  dbuf_free(&text);
+  return ret;
+}
+
+/**
+ * Returns { type, length, nulls, values } for numeric columns and
+ * { type, length, nulls, offsets, bytes } for string columns. 'nulls' is a
+ * Uint8Array bitmap, or null when no row is NULL. The buffers are moved into
+ * the ArrayBuffers, the column is empty afterwards.
+ */
+JSValue
+column_value(JSContext* ctx, Column* col) {
+  JSValue ret = JS_NewObject(ctx);
+
+  JS_SetPropertyStr(ctx, ret, "type", JS_NewString(ctx, column_types[col->type]));
+  JS_SetPropertyStr(ctx, ret, "length", JS_NewUint32(ctx, col->rows));
+  JS_SetPropertyStr(ctx, ret, "nulls", col->has_nulls ? column_typedarray(ctx, &col->nulls, 8, FALSE, FALSE) : JS_NULL);
+
+  switch(col->type) {
+    case COLUMN_STRING: {
+      JS_SetPropertyStr(ctx, ret, "offsets", column_typedarray(ctx, &col->offsets, 32, FALSE, FALSE));
+      JS_SetPropertyStr(ctx, ret, "bytes", column_typedarray(ctx, &col->data, 8, FALSE, FALSE));
+      break;
+    }
+
+    case COLUMN_FLOAT64: JS_SetPropertyStr(ctx, ret, "values", column_typedarray(ctx, &col->data, 64, TRUE, TRUE)); break;
+    case COLUMN_INT32: JS_SetPropertyStr(ctx, ret, "values", column_typedarray(ctx, &col->data, 32, FALSE, TRUE)); break;
+    case COLUMN_BIGINT64: JS_SetPropertyStr(ctx, ret, "values", column_typedarray(ctx, &col->data, 64, FALSE, TRUE)); break;
+  }
+
+  return ret;
+}
+
+/* returns -1 for an unknown name */
+int
+column_type_parse(const char* str) {
+  for(size_t i = 0; i < countof(column_types); i++)
+    if(!strcmp(str, column_types[i]))
+      return i;
+
+  return -1;
+}
+
+/* like Number(s) for the text form of a numeric column */
+JSValue
+column_parse_number(JSContext* ctx, const char* s) {
+  char* end;
+  long long i;
+  double d;
+
+  errno = 0;
+  i = strtoll(s, &end, 10);
+
+  if(end != s && *end == '\0' && errno == 0)
+    return i == (int32_t)i ? JS_NewInt32(ctx, i) : JS_NewInt64(ctx, i);
+
+  d = strtod(s, &end);
+
+  return JS_NewFloat64(ctx, end != s && *end == '\0' ? d : NAN);
+}
+
+static const char*
+parse_digits(const char* s, int n, int* out) {
+  int v = 0;
+
+  while(n--) {
+    if(*s < '0' || *s > '9')
+      return 0;
+
+    v = v * 10 + (*s++ - '0');
+  }
+
+  *out = v;
+  return s;
+}
+
+/* days since 1970-01-01 of a proleptic gregorian date */
+static int64_t
+days_from_civil(int64_t y, int m, int d) {
+  int64_t era, yoe, doy, doe;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+  return era * 146097 + doe - 719468;
+}
+
+/**
+ * Parses 'YYYY-MM-DD', 'YYYY-MM-DD HH:MM:SS[.ffffff][Z|+HH[:MM]|-HH[:MM]]'
+ * (with ' ' or 'T') into milliseconds since the epoch. Like Date.parse(), a
+ * date alone is UTC and a date-time without an offset is local time.
+ */
+BOOL
+column_parse_time(const char* s, double* ms) {
+  int year, mon, day, hour = 0, min = 0, sec = 0, off = 0, v;
+  double frac = 0;
+  BOOL local = FALSE;
+
+  if(!(s = parse_digits(s, 4, &year)) || *s++ != '-' || !(s = parse_digits(s, 2, &mon)) || *s++ != '-' || !(s = parse_digits(s, 2, &day)))
+    return FALSE;
+
+  if(*s == ' ' || *s == 'T') {
+    s++;
+
+    if(!(s = parse_digits(s, 2, &hour)) || *s++ != ':' || !(s = parse_digits(s, 2, &min)) || *s++ != ':' || !(s = parse_digits(s, 2, &sec)))
+      return FALSE;
+
+    if(*s == '.') {
+      double scale = 0.1;
+
+      for(s++; *s >= '0' && *s <= '9'; s++, scale /= 10)
+        frac += (*s - '0') * scale;
+    }
+
+    if(*s == 'Z') {
+      s++;
+    } else if(*s == '+' || *s == '-') {
+      int sign = *s++ == '-' ? -1 : 1;
+
+      if(!(s = parse_digits(s, 2, &v)))
+        return FALSE;
+
+      off = v * 60;
+
+      if(*s == ':')
+        s++;
+
+      if(*s >= '0' && *s <= '9') {
+        if(!(s = parse_digits(s, 2, &v)))
+          return FALSE;
+
+        off += v;
+      }
+
+      off *= sign;
+    } else {
+      local = TRUE;
+    }
+  }
+
+  if(*s != '\0' || mon < 1 || mon > 12 || day < 1 || day > 31 || hour > 24 || min > 59 || sec > 60)
+    return FALSE;
+
+  if(local) {
+    struct tm tm = {0};
+    time_t t;
+
+    tm.tm_year = year - 1900;
+    tm.tm_mon = mon - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = min;
+    tm.tm_sec = sec;
+    tm.tm_isdst = -1;
+
+    if((t = mktime(&tm)) == (time_t)-1 && !(year == 1969 && mon == 12 && day == 31))
+      return FALSE;
+
+    *ms = (double)t * 1000;
+  } else {
+    *ms = ((double)days_from_civil(year, mon, day) * 86400 + hour * 3600 + min * 60 + sec - off * 60) * 1000;
+  }
+
+  *ms += floor(frac * 1000);
+  return TRUE;
+}
+
+/* a Date from the text form of a date/timestamp column, through the Date constructor only when it can't be parsed here */
+JSValue
+column_parse_date(JSContext* ctx, const char* s) {
+  JSValue ret, arg, ctor = js_global_get_str(ctx, "Date");
+  double ms;
+
+  arg = column_parse_time(s, &ms) ? JS_NewFloat64(ctx, ms) : JS_NewString(ctx, s);
+  ret = JS_CallConstructor(ctx, ctor, 1, &arg);
+
+  JS_FreeValue(ctx, arg);
+  JS_FreeValue(ctx, ctor);
+  return ret;
+}
+
+/**
+ * Looks up the type requested for a column in the 'types' option, which is
+ * either an array indexed by column or an object keyed by column name.
+ *
+ * Returns the ColumnType, -1 when there is none and -2 on error.
+ */
+int
+column_type_option(JSContext* ctx, JSValueConst types, uint32_t index, const char* name) {
+  JSValue value;
+  const char* str;
+  int ret = -1;
+
+  if(!JS_IsObject(types))
+    return -1;
+
+  value = JS_IsArray(ctx, types) ? JS_GetPropertyUint32(ctx, types, index) : JS_GetPropertyStr(ctx, types, name);
+
+  if(JS_IsException(value))
+    return -2;
+
+  if(!JS_IsUndefined(value)) {
+    if(!(str = JS_ToCString(ctx, value))) {
+      ret = -2;
+    } else {
+      if((ret = column_type_parse(str)) == -1) {
+        JS_ThrowTypeError(ctx, "column '%s': unknown type '%s'", name, str);
+        ret = -2;
+      }
+
+      JS_FreeCString(ctx, str);
+    }
+  }
+
+  JS_FreeValue(ctx, value);
+  return ret;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,714 @@
+#include "conn-pool.h"
+#include "timer-wheel.h"
+#include "utils.h"
+#include <list.h>
+#include <time.h>
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+/**
+ * \addtogroup conn-pool
+ * @{
+ */
+
+/*
+ * Connections come from the create() function passed to the constructor,
+ * which may return a promise. acquire() callers are served in FIFO order;
+ * a connection is created for every waiter which can not be served from the
+ * idle list as long as the pool is below 'max'.
+ *
+ * Idle connections are handed out most recently used first and checked with
+ * the driver's alive() function before. A single reaper timer closes idle
+ * connections above 'min' after 'idleTimeout' ms and any idle connection
+ * older than 'maxLifetime' ms, then tops the pool up to 'min'.
+ */
+#define CONNPOOL_REAP_INTERVAL 1000
+
+typedef struct conn_pool ConnPool;
+
+typedef struct {
+  struct list_head link;
+  JSValue conn;
+  uint64_t created, since;
+} PoolConnection;
+
+typedef struct {
+  struct list_head link;
+  ConnPool* pool;
+  JSValue funcs[2];
+  uint64_t enqueued;
+  Timer timer;
+} PoolWaiter;
+
+struct conn_pool {
+  const ConnPoolDriver* driver;
+  JSObject* obj;
+  JSValue create;
+  struct list_head idle, busy, waiters;
+  uint32_t num_idle, num_busy, num_waiters, num_pending;
+  uint32_t min, max, acquire_timeout, idle_timeout, max_lifetime;
+  Timer reaper;
+  BOOL ended;
+  struct {
+    uint64_t created, destroyed, acquired, timeouts, errors;
+    /* microseconds */
+    uint64_t waits, wait_total, wait_max;
+  } stats;
+};
+
+VISIBLE JSClassID js_connpool_class_id = 0;
+VISIBLE JSValue connpool_proto = {{0}, JS_TAG_UNDEFINED};
+
+static void connpool_grow(JSContext*, ConnPool*);
+
+static uint64_t
+connpool_now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint32_t
+connpool_size(ConnPool* pool) {
+  return pool->num_idle + pool->num_busy + pool->num_pending;
+}
+
+/**
+ * TRUE when nothing is waiting to be read on the socket of an idle
+ * connection. Data or a hangup there means the server has closed it (or a
+ * result was left unread).
+ */
+BOOL
+connpool_socket_idle(int fd) {
+#ifndef _WIN32
+  struct pollfd pfd = {fd, POLLIN, 0};
+
+  if(fd < 0)
+    return FALSE;
+
+  return poll(&pfd, 1, 0) == 0;
+#else
+  return fd >= 0;
+#endif
+}
+
+static void
+connpool_close(JSContext* ctx, ConnPool* pool, JSValue conn) {
+  JSValue ret = js_invoke(ctx, conn, "close", 0, 0);
+
+  if(JS_IsException(ret))
+    ret = JS_GetException(ctx);
+
+  JS_FreeValue(ctx, ret);
+  JS_FreeValue(ctx, conn);
+  pool->stats.destroyed++;
+}
+
+static void
+connpool_destroy(JSContext* ctx, ConnPool* pool, PoolConnection* pc) {
+  connpool_close(ctx, pool, pc->conn);
+  js_free(ctx, pc);
+}
+
+static BOOL
+connpool_expired(ConnPool* pool, PoolConnection* pc, uint64_t now) {
+  return pool->max_lifetime && now - pc->created >= pool->max_lifetime;
+}
+
+static void
+connpool_settle(JSContext* ctx, PoolWaiter* w, BOOL reject, JSValueConst value) {
+  ConnPool* pool = w->pool;
+  JSValue ret;
+
+  timer_stop(ctx, &w->timer);
+  list_del(&w->link);
+  pool->num_waiters--;
+
+  ret = JS_Call(ctx, w->funcs[reject], JS_UNDEFINED, 1, &value);
+  JS_FreeValue(ctx, ret);
+  JS_FreeValue(ctx, w->funcs[0]);
+  JS_FreeValue(ctx, w->funcs[1]);
+  js_free(ctx, w);
+}
+
+static void
+connpool_error(JSContext* ctx, PoolWaiter* w, const char* message) {
+  JSValue error = js_object_error(ctx, message);
+
+  connpool_settle(ctx, w, TRUE, error);
+  JS_FreeValue(ctx, error);
+}
+
+/* passes a connection to the longest waiting acquire() */
+static void
+connpool_handout(JSContext* ctx, ConnPool* pool, PoolConnection* pc) {
+  PoolWaiter* w = list_entry(pool->waiters.next, PoolWaiter, link);
+  uint64_t wait = connpool_now_us() - w->enqueued;
+
+  list_add_tail(&pc->link, &pool->busy);
+  pool->num_busy++;
+
+  pool->stats.acquired++;
+  pool->stats.waits++;
+  pool->stats.wait_total += wait;
+
+  if(wait > pool->stats.wait_max)
+    pool->stats.wait_max = wait;
+
+  connpool_settle(ctx, w, FALSE, pc->conn);
+}
+
+static void
+connpool_reap_arm(JSContext* ctx, ConnPool* pool) {
+  uint32_t interval = CONNPOOL_REAP_INTERVAL;
+
+  if(timer_pending(&pool->reaper) || pool->ended)
+    return;
+
+  if(!(pool->num_idle && (pool->idle_timeout || pool->max_lifetime)) && connpool_size(pool) >= pool->min)
+    return;
+
+  if(pool->idle_timeout && pool->idle_timeout < interval)
+    interval = pool->idle_timeout;
+
+  if(pool->max_lifetime && pool->max_lifetime < interval)
+    interval = pool->max_lifetime;
+
+  timer_start(ctx, &pool->reaper, MAX_NUM(interval, 10));
+}
+
+static void
+connpool_idle(JSContext* ctx, ConnPool* pool, PoolConnection* pc) {
+  pc->since = timer_now();
+  list_add_tail(&pc->link, &pool->idle);
+  pool->num_idle++;
+
+  connpool_reap_arm(ctx, pool);
+}
+
+/* serves waiters from the idle list, then creates connections for the rest */
+static void
+connpool_dispatch(JSContext* ctx, ConnPool* pool) {
+  uint64_t now = timer_now();
+
+  while(!list_empty(&pool->waiters) && !list_empty(&pool->idle)) {
+    PoolConnection* pc = list_entry(pool->idle.prev, PoolConnection, link);
+
+    list_del(&pc->link);
+    pool->num_idle--;
+
+    if(connpool_expired(pool, pc, now) || !pool->driver->alive(ctx, pc->conn)) {
+      connpool_destroy(ctx, pool, pc);
+      continue;
+    }
+
+    connpool_handout(ctx, pool, pc);
+  }
+
+  connpool_grow(ctx, pool);
+}
+
+static void
+connpool_created(JSContext* ctx, ConnPool* pool, JSValue conn) {
+  PoolConnection* pc;
+
+  pool->num_pending--;
+  pool->stats.created++;
+
+  if(pool->ended || !(pc = js_mallocz(ctx, sizeof(PoolConnection)))) {
+    connpool_close(ctx, pool, conn);
+    return;
+  }
+
+  pc->conn = conn;
+  pc->created = timer_now();
+
+  if(!list_empty(&pool->waiters))
+    connpool_handout(ctx, pool, pc);
+  else
+    connpool_idle(ctx, pool, pc);
+}
+
+/* a failed create() rejects the longest waiting acquire() */
+static void
+connpool_failed(JSContext* ctx, ConnPool* pool, JSValueConst error) {
+  pool->num_pending--;
+  pool->stats.errors++;
+
+  if(!list_empty(&pool->waiters))
+    connpool_settle(ctx, list_entry(pool->waiters.next, PoolWaiter, link), TRUE, error);
+}
+
+static void
+connpool_result(JSContext* ctx, ConnPool* pool, JSValue conn) {
+  if(!JS_GetOpaque(conn, *pool->driver->class_id)) {
+    JSValue error;
+
+    JS_FreeValue(ctx, conn);
+    JS_ThrowTypeError(ctx, "create() must return a connection of the pool's driver");
+    error = JS_GetException(ctx);
+    connpool_failed(ctx, pool, error);
+    JS_FreeValue(ctx, error);
+    return;
+  }
+
+  connpool_created(ctx, pool, conn);
+}
+
+static JSValue
+js_connpool_settled(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue* data) {
+  ConnPool* pool;
+
+  if((pool = JS_GetOpaque(data[0], js_connpool_class_id))) {
+    if(magic)
+      connpool_failed(ctx, pool, argv[0]);
+    else
+      connpool_result(ctx, pool, JS_DupValue(ctx, argv[0]));
+  }
+
+  return JS_UNDEFINED;
+}
+
+static int
+connpool_spawn(JSContext* ctx, ConnPool* pool) {
+  JSValue ret;
+
+  pool->num_pending++;
+  ret = JS_Call(ctx, pool->create, JS_UNDEFINED, 0, 0);
+
+  if(JS_IsException(ret)) {
+    JSValue error = JS_GetException(ctx);
+
+    connpool_failed(ctx, pool, error);
+    JS_FreeValue(ctx, error);
+    return -1;
+  }
+
+  if(js_is_promise(ctx, ret)) {
+    JSValue obj = JS_MKPTR(JS_TAG_OBJECT, pool->obj);
+    JSValueConst funcs[2] = {
+        JS_NewCFunctionData(ctx, js_connpool_settled, 1, 0, 1, &obj),
+        JS_NewCFunctionData(ctx, js_connpool_settled, 1, 1, 1, &obj),
+    };
+    JSValue promise = js_invoke(ctx, ret, "then", 2, funcs);
+
+    JS_FreeValue(ctx, promise);
+    JS_FreeValue(ctx, (JSValue)funcs[0]);
+    JS_FreeValue(ctx, (JSValue)funcs[1]);
+    JS_FreeValue(ctx, ret);
+    return 0;
+  }
+
+  connpool_result(ctx, pool, ret);
+  return 0;
+}
+
+/* one connection per waiter without a pending create(), and up to 'min' */
+static void
+connpool_grow(JSContext* ctx, ConnPool* pool) {
+  while(!pool->ended && connpool_size(pool) < pool->max && (pool->num_pending < pool->num_waiters || connpool_size(pool) < pool->min))
+    if(connpool_spawn(ctx, pool) == -1)
+      break;
+}
+
+static void
+connpool_reap(JSContext* ctx, Timer* t) {
+  ConnPool* pool = list_entry(t, ConnPool, reaper);
+  JSValue obj = JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, pool->obj));
+  struct list_head *el, *next;
+  uint64_t now = timer_now();
+
+  /* oldest first, so the most recently used connections are kept */
+  list_for_each_safe(el, next, &pool->idle) {
+    PoolConnection* pc = list_entry(el, PoolConnection, link);
+    BOOL idle = pool->idle_timeout && now - pc->since >= pool->idle_timeout && connpool_size(pool) > pool->min;
+
+    if(idle || connpool_expired(pool, pc, now)) {
+      list_del(&pc->link);
+      pool->num_idle--;
+      connpool_destroy(ctx, pool, pc);
+    }
+  }
+
+  connpool_grow(ctx, pool);
+  connpool_reap_arm(ctx, pool);
+
+  JS_FreeValue(ctx, obj);
+}
+
+static void
+connpool_waiter_timeout(JSContext* ctx, Timer* t) {
+  PoolWaiter* w = list_entry(t, PoolWaiter, timer);
+  ConnPool* pool = w->pool;
+  char msg[64];
+
+  pool->stats.timeouts++;
+
+  snprintf(msg, sizeof(msg), "timeout acquiring a connection after %" PRIu32 "ms", pool->acquire_timeout);
+  connpool_error(ctx, w, msg);
+}
+
+static uint32_t
+connpool_option(JSContext* ctx, JSValueConst options, const char* name, uint32_t def) {
+  JSValue value = JS_GetPropertyStr(ctx, options, name);
+  uint32_t ret = def;
+
+  if(!js_is_null_or_undefined(value))
+    JS_ToUint32(ctx, &ret, value);
+
+  JS_FreeValue(ctx, value);
+  return ret;
+}
+
+static ConnPool*
+js_connpool_data2(JSContext* ctx, JSValueConst value) {
+  return JS_GetOpaque2(ctx, value, js_connpool_class_id);
+}
+
+/**
+ * new Pool(create, { min = 0, max = 10, acquireTimeout = 0, idleTimeout = 30000, maxLifetime = 0 })
+ *
+ * create() returns a connection (or a promise of one).
+ */
+JSValue
+js_connpool_new(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[], const ConnPoolDriver* driver) {
+  JSValue proto, obj, options = argc > 1 ? argv[1] : JS_UNDEFINED;
+  BOOL create_option = argc > 0 && JS_IsObject(argv[0]) && !JS_IsFunction(ctx, argv[0]);
+  ConnPool* pool;
+
+  /* new Pool({ create, ...options }) */
+  if(create_option)
+    options = argv[0];
+
+  if(!(pool = js_mallocz(ctx, sizeof(ConnPool))))
+    return JS_EXCEPTION;
+
+  pool->driver = driver;
+  pool->create = create_option ? JS_GetPropertyStr(ctx, options, "create") : JS_DupValue(ctx, argc > 0 ? argv[0] : JS_UNDEFINED);
+  init_list_head(&pool->idle);
+  init_list_head(&pool->busy);
+  init_list_head(&pool->waiters);
+  timer_init(&pool->reaper, connpool_reap);
+
+  if(!JS_IsFunction(ctx, pool->create)) {
+    JS_ThrowTypeError(ctx, "argument 1 must be a function creating connections");
+    goto fail;
+  }
+
+  pool->min = 0;
+  pool->max = 10;
+  pool->idle_timeout = 30000;
+
+  if(JS_IsObject(options)) {
+    pool->min = connpool_option(ctx, options, "min", pool->min);
+    pool->max = connpool_option(ctx, options, "max", pool->max);
+    pool->acquire_timeout = connpool_option(ctx, options, "acquireTimeout", 0);
+    pool->idle_timeout = connpool_option(ctx, options, "idleTimeout", pool->idle_timeout);
+    pool->max_lifetime = connpool_option(ctx, options, "maxLifetime", 0);
+  }
+
+  if(pool->max == 0 || pool->min > pool->max) {
+    JS_ThrowRangeError(ctx, "need 0 <= min <= max and max > 0 (min = %" PRIu32 ", max = %" PRIu32 ")", pool->min, pool->max);
+    goto fail;
+  }
+
+  proto = JS_GetPropertyStr(ctx, new_target, "prototype");
+
+  if(JS_IsException(proto))
+    goto fail;
+
+  obj = JS_NewObjectProtoClass(ctx, proto, js_connpool_class_id);
+  JS_FreeValue(ctx, proto);
+
+  if(JS_IsException(obj))
+    goto fail;
+
+  pool->obj = JS_VALUE_GET_OBJ(obj);
+  JS_SetOpaque(obj, pool);
+
+  connpool_grow(ctx, pool);
+
+  return obj;
+
+fail:
+  JS_FreeValue(ctx, pool->create);
+  js_free(ctx, pool);
+  return JS_EXCEPTION;
+}
+
+static JSValue
+js_connpool_acquire(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  ConnPool* pool;
+  PoolWaiter* w;
+  JSValue ret;
+
+  if(!(pool = js_connpool_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(!(w = js_mallocz(ctx, sizeof(PoolWaiter))))
+    return JS_EXCEPTION;
+
+  if(JS_IsException((ret = JS_NewPromiseCapability(ctx, w->funcs)))) {
+    js_free(ctx, w);
+    return ret;
+  }
+
+  w->pool = pool;
+  w->enqueued = connpool_now_us();
+  timer_init(&w->timer, connpool_waiter_timeout);
+  list_add_tail(&w->link, &pool->waiters);
+  pool->num_waiters++;
+
+  if(pool->ended) {
+    connpool_error(ctx, w, "pool has ended");
+    return ret;
+  }
+
+  /* started before dispatching, settling the waiter stops it */
+  if(pool->acquire_timeout)
+    timer_start(ctx, &w->timer, pool->acquire_timeout);
+
+  connpool_dispatch(ctx, pool);
+
+  return ret;
+}
+
+/**
+ * release(conn, discard = false) returns a connection to the pool, or closes it
+ */
+static JSValue
+js_connpool_release(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  ConnPool* pool;
+  PoolConnection* pc = 0;
+  struct list_head* el;
+  BOOL discard = argc > 1 && JS_ToBool(ctx, argv[1]);
+
+  if(!(pool = js_connpool_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(JS_IsObject(argv[0]))
+    list_for_each(el, &pool->busy) {
+      PoolConnection* entry = list_entry(el, PoolConnection, link);
+
+      if(JS_VALUE_GET_OBJ(entry->conn) == JS_VALUE_GET_OBJ(argv[0])) {
+        pc = entry;
+        break;
+      }
+    }
+
+  if(!pc)
+    return JS_ThrowTypeError(ctx, "connection was not acquired from this pool");
+
+  list_del(&pc->link);
+  pool->num_busy--;
+
+  if(discard || pool->ended || connpool_expired(pool, pc, timer_now()) || !pool->driver->alive(ctx, pc->conn))
+    connpool_destroy(ctx, pool, pc);
+  else if(!list_empty(&pool->waiters))
+    connpool_handout(ctx, pool, pc);
+  else
+    connpool_idle(ctx, pool, pc);
+
+  connpool_dispatch(ctx, pool);
+
+  return JS_UNDEFINED;
+}
+
+/**
+ * end() rejects the waiters and closes the idle connections, the ones in use
+ * are closed when released
+ */
+static JSValue
+js_connpool_end(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  ConnPool* pool;
+
+  if(!(pool = js_connpool_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  pool->ended = TRUE;
+  timer_stop(ctx, &pool->reaper);
+
+  while(!list_empty(&pool->waiters))
+    connpool_error(ctx, list_entry(pool->waiters.next, PoolWaiter, link), "pool has ended");
+
+  while(!list_empty(&pool->idle)) {
+    PoolConnection* pc = list_entry(pool->idle.next, PoolConnection, link);
+
+    list_del(&pc->link);
+    pool->num_idle--;
+    connpool_destroy(ctx, pool, pc);
+  }
+
+  return JS_UNDEFINED;
+}
+
+/**
+ * stats(reset = false) returns the counters, wait times are in milliseconds
+ */
+static JSValue
+js_connpool_stats(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  ConnPool* pool;
+  JSValue ret, wait;
+
+  if(!(pool = js_connpool_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  ret = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, ret, "size", JS_NewUint32(ctx, connpool_size(pool)));
+  JS_SetPropertyStr(ctx, ret, "idle", JS_NewUint32(ctx, pool->num_idle));
+  JS_SetPropertyStr(ctx, ret, "inUse", JS_NewUint32(ctx, pool->num_busy));
+  JS_SetPropertyStr(ctx, ret, "pending", JS_NewUint32(ctx, pool->num_pending));
+  JS_SetPropertyStr(ctx, ret, "waiting", JS_NewUint32(ctx, pool->num_waiters));
+  JS_SetPropertyStr(ctx, ret, "created", JS_NewInt64(ctx, pool->stats.created));
+  JS_SetPropertyStr(ctx, ret, "destroyed", JS_NewInt64(ctx, pool->stats.destroyed));
+  JS_SetPropertyStr(ctx, ret, "acquired", JS_NewInt64(ctx, pool->stats.acquired));
+  JS_SetPropertyStr(ctx, ret, "timeouts", JS_NewInt64(ctx, pool->stats.timeouts));
+  JS_SetPropertyStr(ctx, ret, "errors", JS_NewInt64(ctx, pool->stats.errors));
+
+  wait = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, wait, "count", JS_NewInt64(ctx, pool->stats.waits));
+  JS_SetPropertyStr(ctx, wait, "total", JS_NewFloat64(ctx, pool->stats.wait_total / 1000.0));
+  JS_SetPropertyStr(ctx, wait, "mean", JS_NewFloat64(ctx, pool->stats.waits ? pool->stats.wait_total / 1000.0 / pool->stats.waits : 0));
+  JS_SetPropertyStr(ctx, wait, "max", JS_NewFloat64(ctx, pool->stats.wait_max / 1000.0));
+  JS_SetPropertyStr(ctx, ret, "waitTime", wait);
+
+  if(argc > 0 && JS_ToBool(ctx, argv[0]))
+    memset(&pool->stats, 0, sizeof(pool->stats));
+
+  return ret;
+}
+
+enum {
+  POOL_SIZE = 0,
+  POOL_IDLE,
+  POOL_IN_USE,
+  POOL_WAITING,
+  POOL_MIN,
+  POOL_MAX,
+  POOL_ENDED,
+};
+
+static JSValue
+js_connpool_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  ConnPool* pool;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(pool = js_connpool_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  switch(magic) {
+    case POOL_SIZE: ret = JS_NewUint32(ctx, connpool_size(pool)); break;
+    case POOL_IDLE: ret = JS_NewUint32(ctx, pool->num_idle); break;
+    case POOL_IN_USE: ret = JS_NewUint32(ctx, pool->num_busy); break;
+    case POOL_WAITING: ret = JS_NewUint32(ctx, pool->num_waiters); break;
+    case POOL_MIN: ret = JS_NewUint32(ctx, pool->min); break;
+    case POOL_MAX: ret = JS_NewUint32(ctx, pool->max); break;
+    case POOL_ENDED: ret = JS_NewBool(ctx, pool->ended); break;
+  }
+
+  return ret;
+}
+
+static void
+connpool_free_list(JSRuntime* rt, struct list_head* list) {
+  while(!list_empty(list)) {
+    PoolConnection* pc = list_entry(list->next, PoolConnection, link);
+
+    list_del(&pc->link);
+    JS_FreeValueRT(rt, pc->conn);
+    js_free_rt(rt, pc);
+  }
+}
+
+static void
+js_connpool_finalizer(JSRuntime* rt, JSValue val) {
+  ConnPool* pool;
+
+  if((pool = JS_GetOpaque(val, js_connpool_class_id))) {
+    timer_stop(0, &pool->reaper);
+
+    while(!list_empty(&pool->waiters)) {
+      PoolWaiter* w = list_entry(pool->waiters.next, PoolWaiter, link);
+
+      timer_stop(0, &w->timer);
+      list_del(&w->link);
+      JS_FreeValueRT(rt, w->funcs[0]);
+      JS_FreeValueRT(rt, w->funcs[1]);
+      js_free_rt(rt, w);
+    }
+
+    connpool_free_list(rt, &pool->idle);
+    connpool_free_list(rt, &pool->busy);
+
+    JS_FreeValueRT(rt, pool->create);
+    js_free_rt(rt, pool);
+  }
+}
+
+static void
+js_connpool_mark(JSRuntime* rt, JSValueConst val, JS_MarkFunc* mark_func) {
+  ConnPool* pool;
+  struct list_head* el;
+
+  if((pool = JS_GetOpaque(val, js_connpool_class_id))) {
+    JS_MarkValue(rt, pool->create, mark_func);
+
+    list_for_each(el, &pool->idle) { JS_MarkValue(rt, list_entry(el, PoolConnection, link)->conn, mark_func); }
+    list_for_each(el, &pool->busy) { JS_MarkValue(rt, list_entry(el, PoolConnection, link)->conn, mark_func); }
+
+    list_for_each(el, &pool->waiters) {
+      PoolWaiter* w = list_entry(el, PoolWaiter, link);
+
+      JS_MarkValue(rt, w->funcs[0], mark_func);
+      JS_MarkValue(rt, w->funcs[1], mark_func);
+    }
+  }
+}
+
+static JSClassDef js_connpool_class = {
+    .class_name = "Pool",
+    .finalizer = js_connpool_finalizer,
+    .gc_mark = js_connpool_mark,
+};
+
+static const JSCFunctionListEntry js_connpool_funcs[] = {
+    JS_CFUNC_DEF("acquire", 0, js_connpool_acquire),
+    JS_CFUNC_DEF("release", 1, js_connpool_release),
+    JS_CFUNC_DEF("end", 0, js_connpool_end),
+    JS_CFUNC_DEF("stats", 0, js_connpool_stats),
+    JS_CGETSET_MAGIC_FLAGS_DEF("size", js_connpool_get, 0, POOL_SIZE, JS_PROP_ENUMERABLE),
+    JS_CGETSET_MAGIC_FLAGS_DEF("idle", js_connpool_get, 0, POOL_IDLE, JS_PROP_ENUMERABLE),
+    JS_CGETSET_MAGIC_FLAGS_DEF("inUse", js_connpool_get, 0, POOL_IN_USE, JS_PROP_ENUMERABLE),
+    JS_CGETSET_MAGIC_FLAGS_DEF("waiting", js_connpool_get, 0, POOL_WAITING, JS_PROP_ENUMERABLE),
+    JS_CGETSET_MAGIC_DEF("min", js_connpool_get, 0, POOL_MIN),
+    JS_CGETSET_MAGIC_DEF("max", js_connpool_get, 0, POOL_MAX),
+    JS_CGETSET_MAGIC_DEF("ended", js_connpool_get, 0, POOL_ENDED),
+};
+
+/**
+ * Sets up the class shared by the drivers' pools, which derive their
+ * prototypes from connpool_proto.
+ */
+int
+js_connpool_init(JSContext* ctx) {
+  if(js_connpool_class_id == 0)
+    JS_NewClassID(&js_connpool_class_id);
+
+  /* both drivers call this, the second one in a runtime shares the class */
+  if(!JS_IsRegisteredClass(JS_GetRuntime(ctx), js_connpool_class_id)) {
+    JS_NewClass(JS_GetRuntime(ctx), js_connpool_class_id, &js_connpool_class);
+
+    connpool_proto = JS_NewObject(ctx);
+
+    JS_SetPropertyFunctionList(ctx, connpool_proto, js_connpool_funcs, countof(js_connpool_funcs));
+    JS_SetClassProto(ctx, js_connpool_class_id, connpool_proto);
+  }
+
+  return 0;
+}
+
+/**
+ * @}
+ */
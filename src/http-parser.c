@@ -0,0 +1,590 @@
+#include "http-parser.h"
+#include <string.h>
+#include <strings.h>
+#include "defines.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HTTP_PARSER_X86 1
+#endif
+
+/**
+ * \addtogroup http-parser
+ * @{
+ */
+
+/*
+ * Parses the head of a request or response in place: nothing is copied, all
+ * results are spans into the input. The long runs (request target and header
+ * values) are scanned for their terminating control character 32 (AVX2) or 16
+ * (SSE4.2) bytes at a time, the implementation is picked once at runtime.
+ *
+ * When the head is incomplete, the length of the input is remembered and the
+ * next call first checks whether the bytes appended since contain the empty
+ * line, before parsing anything again.
+ */
+typedef const uint8_t* FindCtlFunc(const uint8_t*, const uint8_t*, int);
+
+/* returns the first byte which is a control character (or SP if space is set), end if none */
+static const uint8_t*
+http_findctl_scalar(const uint8_t* p, const uint8_t* end, int space) {
+  for(; p < end; p++)
+    if(*p < 0x20 ? (space || *p != '\t') : (*p == 0x7f || (space && *p == ' ')))
+      break;
+
+  return p;
+}
+
+#ifdef HTTP_PARSER_X86
+__attribute__((target("avx2"))) static const uint8_t*
+http_findctl_avx2(const uint8_t* p, const uint8_t* end, int space) {
+  const __m256i lim = _mm256_set1_epi8(space ? 0x21 : 0x20), del = _mm256_set1_epi8(0x7f), tab = _mm256_set1_epi8('\t');
+
+  while(end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i ctl = _mm256_or_si256(_mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, lim), v), _mm256_set1_epi8(-1)), _mm256_cmpeq_epi8(v, del));
+    uint32_t mask;
+
+    if(!space)
+      ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), ctl);
+
+    if((mask = _mm256_movemask_epi8(ctl)))
+      return p + __builtin_ctz(mask);
+
+    p += 32;
+  }
+
+  return http_findctl_scalar(p, end, space);
+}
+
+__attribute__((target("sse4.2"))) static const uint8_t*
+http_findctl_sse42(const uint8_t* p, const uint8_t* end, int space) {
+  static const char ranges_space[16] = "\x00\x20\x7f\x7f";
+  static const char ranges_value[16] = "\x00\x08\x0a\x1f\x7f\x7f";
+  const __m128i ranges = _mm_loadu_si128((const __m128i*)(space ? ranges_space : ranges_value));
+  const int nranges = space ? 4 : 6;
+
+  while(end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int i = _mm_cmpestri(ranges, nranges, v, 16, _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+
+    if(i != 16)
+      return p + i;
+
+    p += 16;
+  }
+
+  return http_findctl_scalar(p, end, space);
+}
+#endif
+
+static FindCtlFunc* http_findctl_impl;
+
+static const uint8_t*
+http_findctl(const uint8_t* p, const uint8_t* end, int space) {
+  if(!http_findctl_impl) {
+    http_findctl_impl = http_findctl_scalar;
+#ifdef HTTP_PARSER_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+      http_findctl_impl = http_findctl_avx2;
+    else if(__builtin_cpu_supports("sse4.2"))
+      http_findctl_impl = http_findctl_sse42;
+#endif
+  }
+
+  return http_findctl_impl(p, end, space);
+}
+
+/* RFC 7230 tchar */
+static const uint8_t http_token[256] = {
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1, ['+'] = 1, ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1,
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1, ['G'] = 1, ['H'] = 1, ['I'] = 1, ['J'] = 1, ['K'] = 1, ['L'] = 1, ['M'] = 1,
+    ['N'] = 1, ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1, ['S'] = 1, ['T'] = 1, ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1, ['Y'] = 1, ['Z'] = 1,
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1, ['g'] = 1, ['h'] = 1, ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1, ['m'] = 1,
+    ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1, ['s'] = 1, ['t'] = 1, ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1, ['y'] = 1, ['z'] = 1,
+};
+
+#define EXPECT(cond) \
+  do { \
+    if(!(cond)) \
+      return p >= end ? HTTP_INCOMPLETE : HTTP_ERROR; \
+  } while(0)
+
+/* has the head been terminated in the bytes appended since the last call? */
+static int
+http_is_complete(const uint8_t* buf, size_t len, size_t last_len) {
+  const uint8_t *p = buf + (last_len < 3 ? 0 : last_len - 3), *end = buf + len;
+  int newlines = 0;
+
+  for(; p < end; p++) {
+    if(*p == '\r')
+      continue;
+
+    if(*p == '\n') {
+      if(++newlines == 2)
+        return 1;
+    } else {
+      newlines = 0;
+    }
+  }
+
+  return 0;
+}
+
+/* parses CRLF or a bare LF */
+static int
+http_eol(const uint8_t** pp, const uint8_t* end) {
+  const uint8_t* p = *pp;
+
+  if(p < end && *p == '\r')
+    p++;
+
+  EXPECT(p < end && *p == '\n');
+  *pp = p + 1;
+  return 0;
+}
+
+static int
+http_version(const uint8_t** pp, const uint8_t* end, int* minor_version) {
+  const uint8_t* p = *pp;
+
+  if(end - p < 8)
+    return memcmp(p, "HTTP/1.", MIN_NUM(end - p, 7)) ? HTTP_ERROR : HTTP_INCOMPLETE;
+
+  if(memcmp(p, "HTTP/1.", 7) || p[7] < '0' || p[7] > '9')
+    return HTTP_ERROR;
+
+  *minor_version = p[7] - '0';
+  p += 8;
+
+  *pp = p;
+  return 0;
+}
+
+static int
+http_token_end(const uint8_t** pp, const uint8_t* end) {
+  const uint8_t* p = *pp;
+
+  while(p < end && http_token[*p])
+    p++;
+
+  EXPECT(p < end);
+  *pp = p;
+  return 0;
+}
+
+static int
+http_headers(HttpParser* hp, const uint8_t* buf, const uint8_t** pp, const uint8_t* end) {
+  const uint8_t* p = *pp;
+  int r;
+
+  for(;;) {
+    HttpHeader* h;
+    const uint8_t *name, *value, *value_end;
+
+    EXPECT(p < end);
+
+    if(*p == '\r' || *p == '\n') {
+      if((r = http_eol(&p, end)))
+        return r;
+
+      break;
+    }
+
+    if(hp->num_headers == HTTP_MAX_HEADERS)
+      return HTTP_ERROR;
+
+    /* obsolete line folding is rejected (RFC 7230, 3.2.4) */
+    name = p;
+
+    if((r = http_token_end(&p, end)))
+      return r;
+
+    if(p == name || *p != ':')
+      return HTTP_ERROR;
+
+    h = &hp->headers[hp->num_headers];
+    h->name = name - buf;
+    h->name_len = p - name;
+
+    for(++p; p < end && (*p == ' ' || *p == '\t'); p++) {}
+
+    value = p;
+    p = http_findctl(p, end, 0);
+    EXPECT(p < end);
+
+    if(*p != '\r' && *p != '\n')
+      return HTTP_ERROR;
+
+    for(value_end = p; value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'); value_end--) {}
+
+    h->value = value - buf;
+    h->value_len = value_end - value;
+
+    if((r = http_eol(&p, end)))
+      return r;
+
+    hp->num_headers++;
+  }
+
+  *pp = p;
+  return 0;
+}
+
+static int
+http_value_is(const uint8_t* buf, const HttpHeader* h, const char* token) {
+  size_t n = strlen(token);
+  const uint8_t *p = buf + h->value, *end = p + h->value_len;
+
+  /* matches the last element of a comma separated list */
+  while(end > p && (end[-1] == ' ' || end[-1] == '\t'))
+    end--;
+
+  return (size_t)(end - p) >= n && !strncasecmp((const char*)end - n, token, n) && (end - n == p || end[-n - 1] == ',' || end[-n - 1] == ' ');
+}
+
+static int
+http_framing(HttpParser* hp, const uint8_t* buf) {
+  uint32_t i;
+
+  hp->content_length = -1;
+  hp->chunked = 0;
+  hp->keep_alive = hp->minor_version >= 1;
+
+  for(i = 0; i < hp->num_headers; i++) {
+    const HttpHeader* h = &hp->headers[i];
+    const char* name = (const char*)buf + h->name;
+
+    if(h->name_len == 14 && !strncasecmp(name, "content-length", 14)) {
+      const uint8_t *p = buf + h->value, *end = p + h->value_len;
+      int64_t n = 0;
+
+      if(p == end)
+        return HTTP_ERROR;
+
+      for(; p < end; p++) {
+        if(*p < '0' || *p > '9' || n > (INT64_MAX - 9) / 10)
+          return HTTP_ERROR;
+
+        n = n * 10 + (*p - '0');
+      }
+
+      if(hp->content_length != -1 && hp->content_length != n)
+        return HTTP_ERROR;
+
+      hp->content_length = n;
+    } else if(h->name_len == 17 && !strncasecmp(name, "transfer-encoding", 17)) {
+      hp->chunked = http_value_is(buf, h, "chunked");
+    } else if(h->name_len == 10 && !strncasecmp(name, "connection", 10)) {
+      if(http_value_is(buf, h, "close"))
+        hp->keep_alive = 0;
+      else if(http_value_is(buf, h, "keep-alive"))
+        hp->keep_alive = 1;
+    }
+  }
+
+  /* Transfer-Encoding overrides Content-Length (RFC 7230, 3.3.3) */
+  if(hp->chunked)
+    hp->content_length = -1;
+
+  return 0;
+}
+
+void
+http_parser_init(HttpParser* hp, enum http_type type) {
+  memset(hp, 0, sizeof(HttpParser));
+  hp->type = type;
+  hp->minor_version = -1;
+  hp->content_length = -1;
+  hp->chunk.consume_trailer = 1;
+}
+
+/**
+ * Parses the request or status line and headers.
+ *
+ * Returns the length of the head, HTTP_INCOMPLETE when more input is needed
+ * (call again with the same, extended buffer) or HTTP_ERROR.
+ */
+int
+http_parse(HttpParser* hp, const uint8_t* buf, size_t len) {
+  const uint8_t *p = buf, *end = buf + len, *start;
+  size_t last_len = hp->last_len;
+  int r;
+
+  if(last_len && last_len < len && !http_is_complete(buf, len, last_len)) {
+    hp->last_len = len;
+    return HTTP_INCOMPLETE;
+  }
+
+  http_parser_init(hp, hp->type);
+
+  /* ignore leading empty lines (RFC 7230, 3.5) */
+  while(p < end && (*p == '\r' || *p == '\n'))
+    p++;
+
+  if(hp->type == HTTP_REQUEST) {
+    start = p;
+
+    if((r = http_token_end(&p, end)))
+      goto incomplete;
+
+    if(p == start || *p != ' ') {
+      r = HTTP_ERROR;
+      goto incomplete;
+    }
+
+    hp->method = start - buf;
+    hp->method_len = p - start;
+
+    start = ++p;
+    p = http_findctl(p, end, 1);
+
+    if(p == end) {
+      r = HTTP_INCOMPLETE;
+      goto incomplete;
+    }
+
+    if(p == start || *p != ' ') {
+      r = HTTP_ERROR;
+      goto incomplete;
+    }
+
+    hp->path = start - buf;
+    hp->path_len = p - start;
+    p++;
+
+    if((r = http_version(&p, end, &hp->minor_version)) || (r = http_eol(&p, end)))
+      goto incomplete;
+
+  } else {
+    if((r = http_version(&p, end, &hp->minor_version)))
+      goto incomplete;
+
+    if(end - p < 5) {
+      r = HTTP_INCOMPLETE;
+      goto incomplete;
+    }
+
+    if(p[0] != ' ' || p[1] < '0' || p[1] > '9' || p[2] < '0' || p[2] > '9' || p[3] < '0' || p[3] > '9') {
+      r = HTTP_ERROR;
+      goto incomplete;
+    }
+
+    hp->status = (p[1] - '0') * 100 + (p[2] - '0') * 10 + (p[3] - '0');
+    p += 4;
+
+    while(p < end && *p == ' ')
+      p++;
+
+    start = p;
+    p = http_findctl(p, end, 0);
+
+    if(p == end) {
+      r = HTTP_INCOMPLETE;
+      goto incomplete;
+    }
+
+    hp->reason = start - buf;
+    hp->reason_len = p - start;
+
+    if((r = http_eol(&p, end)))
+      goto incomplete;
+  }
+
+  if((r = http_headers(hp, buf, &p, end)) || (r = http_framing(hp, buf)))
+    goto incomplete;
+
+  hp->last_len = 0;
+  return p - buf;
+
+incomplete:
+  hp->last_len = r == HTTP_INCOMPLETE ? len : 0;
+  return r;
+}
+
+/**
+ * Returns the index of the first header with the given name, or -1.
+ */
+int
+http_header_find(const HttpParser* hp, const uint8_t* buf, const char* name, size_t name_len) {
+  uint32_t i;
+
+  for(i = 0; i < hp->num_headers; i++)
+    if(hp->headers[i].name_len == name_len && !strncasecmp((const char*)buf + hp->headers[i].name, name, name_len))
+      return i;
+
+  return -1;
+}
+
+enum {
+  CHUNKED_SIZE,
+  CHUNKED_EXT,
+  CHUNKED_DATA,
+  CHUNKED_CRLF,
+  CHUNKED_TRAILER_HEAD,
+  CHUNKED_TRAILER_LINE,
+};
+
+static int
+http_hex(uint8_t c) {
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * Decodes chunked transfer encoding in place.
+ *
+ * On return *len holds the number of decoded bytes moved to the front of buf.
+ * Returns HTTP_INCOMPLETE when the body continues in the next buffer, the
+ * number of bytes following the body (also moved to buf + *len) when it is
+ * complete, or HTTP_ERROR.
+ */
+ssize_t
+http_decode_chunked(HttpChunked* d, uint8_t* buf, size_t* len) {
+  size_t dst = 0, src = 0, size = *len;
+  ssize_t ret = HTTP_INCOMPLETE;
+
+  for(;;) {
+    switch(d->state) {
+      case CHUNKED_SIZE: {
+        int v;
+
+        for(;; src++) {
+          if(src == size)
+            goto exit;
+
+          if((v = http_hex(buf[src])) == -1) {
+            if(d->hex_count == 0) {
+              ret = HTTP_ERROR;
+              goto exit;
+            }
+
+            break;
+          }
+
+          if(d->hex_count == sizeof(size_t) * 2) {
+            ret = HTTP_ERROR;
+            goto exit;
+          }
+
+          d->bytes_left = d->bytes_left * 16 + v;
+          d->hex_count++;
+        }
+
+        d->hex_count = 0;
+        d->state = CHUNKED_EXT;
+      }
+      /* fall through */
+      case CHUNKED_EXT: {
+        for(;; src++) {
+          if(src == size)
+            goto exit;
+
+          if(buf[src] == '\n')
+            break;
+        }
+
+        src++;
+
+        if(d->bytes_left == 0) {
+          if(!d->consume_trailer)
+            goto complete;
+
+          d->state = CHUNKED_TRAILER_HEAD;
+          break;
+        }
+
+        d->state = CHUNKED_DATA;
+      }
+      /* fall through */
+      case CHUNKED_DATA: {
+        size_t n = size - src;
+
+        if(n < d->bytes_left) {
+          memmove(buf + dst, buf + src, n);
+          src += n;
+          dst += n;
+          d->bytes_left -= n;
+          goto exit;
+        }
+
+        memmove(buf + dst, buf + src, d->bytes_left);
+        src += d->bytes_left;
+        dst += d->bytes_left;
+        d->bytes_left = 0;
+        d->state = CHUNKED_CRLF;
+      }
+      /* fall through */
+      case CHUNKED_CRLF: {
+        for(;; src++) {
+          if(src == size)
+            goto exit;
+
+          if(buf[src] != '\r')
+            break;
+        }
+
+        if(buf[src] != '\n') {
+          ret = HTTP_ERROR;
+          goto exit;
+        }
+
+        src++;
+        d->state = CHUNKED_SIZE;
+        break;
+      }
+
+      case CHUNKED_TRAILER_HEAD: {
+        for(;; src++) {
+          if(src == size)
+            goto exit;
+
+          if(buf[src] != '\r')
+            break;
+        }
+
+        if(buf[src++] == '\n')
+          goto complete;
+
+        d->state = CHUNKED_TRAILER_LINE;
+      }
+      /* fall through */
+      case CHUNKED_TRAILER_LINE: {
+        for(;; src++) {
+          if(src == size)
+            goto exit;
+
+          if(buf[src] == '\n')
+            break;
+        }
+
+        src++;
+        d->state = CHUNKED_TRAILER_HEAD;
+        break;
+      }
+    }
+  }
+
+complete:
+  ret = size - src;
+  d->state = CHUNKED_SIZE;
+
+exit:
+  if(dst != src)
+    memmove(buf + dst, buf + src, size - src);
+
+  *len = dst;
+  return ret;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,383 @@
+#include "io-uring.h"
+
+#ifdef USE_IO_URING
+#include "defines.h"
+#include "utils.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+#define IO_RING_ENTRIES 256
+/* SQEs are consumed on submit, so far more operations than SQ entries can be in flight */
+#define IO_RING_CQ_FACTOR 8
+
+/**
+ * \addtogroup io-uring
+ * @{
+ */
+typedef struct {
+  struct list_head link;
+  JSContext* ctx;
+  IORingCallback* func;
+  void* opaque;
+} IORingOp;
+
+static thread_local IORing io_ring = {-1, -1};
+static thread_local int io_ring_state = 0;
+static thread_local struct list_head io_ring_ops;
+static thread_local JSObject* io_ring_driver;
+static JSClassID js_io_ring_class_id;
+
+int
+io_ring_init(IORing* r, unsigned entries) {
+  struct io_uring_params p;
+  int fd;
+
+  memset(&p, 0, sizeof(p));
+  memset(r, 0, sizeof(IORing));
+  r->fd = r->eventfd = -1;
+
+#ifdef IORING_SETUP_CQSIZE
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = entries * IO_RING_CQ_FACTOR;
+
+  if((fd = syscall(__NR_io_uring_setup, entries, &p)) == -1 && errno == EINVAL) {
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, entries, &p);
+  }
+#else
+  fd = syscall(__NR_io_uring_setup, entries, &p);
+#endif
+
+  if(fd == -1)
+    return -1;
+
+  r->fd = fd;
+  r->sq_entries = p.sq_entries;
+  r->cq_entries = p.cq_entries;
+  r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  if(p.features & IORING_FEAT_SINGLE_MMAP)
+    r->sq_size = r->cq_size = MAX_NUM(r->sq_size, r->cq_size);
+
+  if((r->sq_ptr = mmap(0, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING)) == MAP_FAILED)
+    goto fail;
+
+  if(p.features & IORING_FEAT_SINGLE_MMAP)
+    r->cq_ptr = r->sq_ptr;
+  else if((r->cq_ptr = mmap(0, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+    goto fail;
+
+  if((r->sqes = mmap(0, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES)) == MAP_FAILED)
+    goto fail;
+
+  r->sq_head = (unsigned*)((uint8_t*)r->sq_ptr + p.sq_off.head);
+  r->sq_tail = (unsigned*)((uint8_t*)r->sq_ptr + p.sq_off.tail);
+  r->sq_mask = (unsigned*)((uint8_t*)r->sq_ptr + p.sq_off.ring_mask);
+  r->sq_array = (unsigned*)((uint8_t*)r->sq_ptr + p.sq_off.array);
+  r->sq_flags = (unsigned*)((uint8_t*)r->sq_ptr + p.sq_off.flags);
+  r->cq_head = (unsigned*)((uint8_t*)r->cq_ptr + p.cq_off.head);
+  r->cq_tail = (unsigned*)((uint8_t*)r->cq_ptr + p.cq_off.tail);
+  r->cq_mask = (unsigned*)((uint8_t*)r->cq_ptr + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe*)((uint8_t*)r->cq_ptr + p.cq_off.cqes);
+  r->sqe_tail = *r->sq_tail;
+
+  /* completions are signalled through an eventfd, so they can be waited on by the os.setReadHandler() loop */
+  if((r->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+    goto fail;
+
+  if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &r->eventfd, 1) == -1)
+    goto fail;
+
+  return 0;
+
+fail:
+  io_ring_free(r);
+  return -1;
+}
+
+void
+io_ring_free(IORing* r) {
+  if(r->sqes && r->sqes != MAP_FAILED)
+    munmap(r->sqes, r->sqes_size);
+
+  if(r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+    munmap(r->cq_ptr, r->cq_size);
+
+  if(r->sq_ptr && r->sq_ptr != MAP_FAILED)
+    munmap(r->sq_ptr, r->sq_size);
+
+  if(r->eventfd != -1)
+    close(r->eventfd);
+
+  if(r->fd != -1)
+    close(r->fd);
+
+  memset(r, 0, sizeof(IORing));
+  r->fd = r->eventfd = -1;
+}
+
+struct io_uring_sqe*
+io_ring_sqe(IORing* r) {
+  unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+  struct io_uring_sqe* sqe;
+
+  if(r->sqe_tail - head >= r->sq_entries)
+    return 0;
+
+  sqe = &r->sqes[r->sqe_tail++ & *r->sq_mask];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  return sqe;
+}
+
+int
+io_ring_submit(IORing* r) {
+  unsigned tail = *r->sq_tail, n = r->sqe_tail - tail;
+
+  if(n == 0)
+    return 0;
+
+  for(; tail != r->sqe_tail; tail++)
+    r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+
+  __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+  return syscall(__NR_io_uring_enter, r->fd, n, 0, 0, NULL, 0);
+}
+
+struct io_uring_cqe*
+io_ring_peek(IORing* r) {
+  unsigned head = *r->cq_head;
+
+  if(head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+    return 0;
+
+  return &r->cqes[head & *r->cq_mask];
+}
+
+void
+io_ring_seen(IORing* r) {
+  __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Completions that did not fit into a full CQ are kept on the kernel's
+ * overflow list and only move into the ring on io_uring_enter(GETEVENTS).
+ * Returns TRUE if there were any, so the CQ has to be drained again.
+ */
+int
+io_ring_overflow(IORing* r) {
+#ifdef IORING_SQ_CQ_OVERFLOW
+  if(__atomic_load_n(r->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+    syscall(__NR_io_uring_enter, r->fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    return 1;
+  }
+#endif
+
+  return 0;
+}
+
+static JSValue js_io_ring_handler(JSContext*, JSValueConst, int, JSValueConst[], int, JSValue[]);
+
+/*
+ * Tears the ring down with operations still in flight. Closing the ring
+ * cancels them in the kernel, their callbacks get IO_RING_RELEASED and must
+ * only free their state.
+ */
+static void
+io_ring_release(void) {
+  struct list_head *el, *next;
+
+  list_for_each_safe(el, next, &io_ring_ops) {
+    IORingOp* op = list_entry(el, IORingOp, link);
+
+    list_del(&op->link);
+    op->func(op->ctx, -ECANCELED, IO_RING_RELEASED, op->opaque);
+    free(op);
+  }
+
+  io_ring_free(&io_ring);
+  io_ring_state = 0;
+}
+
+/* the armed read handler is only dropped without io_ring_arm() when the runtime goes away */
+static void
+js_io_ring_finalizer(JSRuntime* rt, JSValue val) {
+  if(io_ring_driver == JS_VALUE_GET_OBJ(val)) {
+    io_ring_driver = 0;
+    io_ring_release();
+  }
+}
+
+static JSClassDef js_io_ring_class = {
+    .class_name = "IORing",
+    .finalizer = js_io_ring_finalizer,
+};
+
+static void
+io_ring_arm(JSContext* ctx, BOOL arm) {
+  JSRuntime* rt = JS_GetRuntime(ctx);
+  JSValue set_handler, driver = JS_NULL, handler = JS_NULL;
+
+  if(io_ring.armed == arm)
+    return;
+
+  if(JS_IsException((set_handler = js_iohandler_fn(ctx, FALSE))))
+    return;
+
+  if(arm) {
+    if(js_io_ring_class_id == 0)
+      JS_NewClassID(&js_io_ring_class_id);
+
+    if(!JS_IsRegisteredClass(rt, js_io_ring_class_id))
+      JS_NewClass(rt, js_io_ring_class_id, &js_io_ring_class);
+
+    if(JS_IsException((driver = JS_NewObjectClass(ctx, js_io_ring_class_id)))) {
+      JS_FreeValue(ctx, set_handler);
+      return;
+    }
+
+    handler = JS_NewCFunctionData(ctx, js_io_ring_handler, 0, 0, 1, &driver);
+  }
+
+  /* removing the handler frees the driver, which must not release the ring then */
+  io_ring_driver = 0;
+
+  if(js_iohandler_set(ctx, set_handler, io_ring.eventfd, handler)) {
+    io_ring.armed = arm;
+
+    if(arm)
+      io_ring_driver = JS_VALUE_GET_OBJ(driver);
+  }
+
+  JS_FreeValue(ctx, driver);
+  JS_FreeValue(ctx, set_handler);
+}
+
+static JSValue
+js_io_ring_flush(JSContext* ctx, int argc, JSValueConst argv[]) {
+  io_ring.flushing = FALSE;
+  io_ring_submit(&io_ring);
+  return JS_UNDEFINED;
+}
+
+static JSValue
+js_io_ring_handler(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  struct io_uring_cqe* cqe;
+  uint64_t count;
+
+  /* reset the eventfd counter, the completion queue is drained below anyway */
+  if(read(io_ring.eventfd, &count, sizeof(count)) == -1)
+    count = 0;
+
+  do {
+    while((cqe = io_ring_peek(&io_ring))) {
+      IORingOp* op = (IORingOp*)(uintptr_t)cqe->user_data;
+      int32_t res = cqe->res;
+      uint32_t flags = cqe->flags;
+
+      io_ring_seen(&io_ring);
+
+      if(!op)
+        continue;
+
+      op->func(op->ctx, res, flags, op->opaque);
+
+      if(!(flags & IORING_CQE_F_MORE)) {
+        list_del(&op->link);
+        free(op);
+        --io_ring.pending;
+      }
+    }
+  } while(io_ring_overflow(&io_ring));
+
+  if(io_ring.pending == 0)
+    io_ring_arm(ctx, FALSE);
+
+  return JS_UNDEFINED;
+}
+
+/**
+ * Returns the per-thread ring, set up on first use.
+ *
+ * Returns NULL when io_uring is not available (old kernel, seccomp, ENOMEM),
+ * callers should then fall back to readiness-based I/O.
+ */
+IORing*
+io_ring_get(JSContext* ctx) {
+  if(io_ring_state == 0) {
+    io_ring_state = io_ring_init(&io_ring, IO_RING_ENTRIES) == 0 ? 1 : -1;
+    init_list_head(&io_ring_ops);
+  }
+
+  return io_ring_state > 0 ? &io_ring : 0;
+}
+
+/**
+ * Gets a SQE whose completion calls func(ctx, res, flags, opaque).
+ *
+ * All SQEs prepared during one turn of the event loop are submitted together
+ * with a single io_uring_enter() from a queued job. When func is NULL the
+ * completion is ignored (e.g. for IORING_OP_ASYNC_CANCEL).
+ */
+struct io_uring_sqe*
+io_ring_prepare(JSContext* ctx, IORingCallback* func, void* opaque) {
+  struct io_uring_sqe* sqe;
+  IORingOp* op = 0;
+
+  if(!io_ring_get(ctx))
+    return 0;
+
+  if(!(sqe = io_ring_sqe(&io_ring))) {
+    io_ring_submit(&io_ring);
+
+    if(!(sqe = io_ring_sqe(&io_ring)))
+      return 0;
+  }
+
+  if(func) {
+    if(!(op = malloc(sizeof(IORingOp)))) {
+      /* turn the slot into a no-op */
+      sqe->opcode = IORING_OP_NOP;
+      return 0;
+    }
+
+    op->ctx = ctx;
+    op->func = func;
+    op->opaque = opaque;
+    list_add_tail(&op->link, &io_ring_ops);
+
+    if(io_ring.pending++ == 0)
+      io_ring_arm(ctx, TRUE);
+  }
+
+  sqe->user_data = (uint64_t)(uintptr_t)op;
+
+  if(!io_ring.flushing) {
+    io_ring.flushing = TRUE;
+    JS_EnqueueJob(ctx, js_io_ring_flush, 0, 0);
+  }
+
+  return sqe;
+}
+
+/**
+ * @}
+ */
+#endif /* defined(USE_IO_URING) */
@@ -0,0 +1,628 @@
+#include "query-stats.h"
+#include "utils.h"
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+/**
+ * \addtogroup query-stats
+ * @{
+ */
+
+/*
+ * Queries are grouped by fingerprint: the SQL text with comments removed,
+ * whitespace collapsed, lower-cased and every string, number and $n
+ * placeholder replaced by '?', so that "IN (1, 2, 3)" becomes "in (?)".
+ * Every fingerprint keeps its counters and a latency histogram, the
+ * connection as a whole has histograms for the total, send and execute times.
+ *
+ * The histograms are log-linear like HdrHistogram: values below 2 * HIST_SUB
+ * microseconds have a bucket each, above that every power of two is split
+ * into HIST_SUB buckets, which bounds the error of a percentile to
+ * 1 / HIST_SUB (~3%) for values up to 2^32 µs (~71 minutes).
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+#define FINGERPRINT_MAX 1024
+
+typedef struct {
+  /* microseconds */
+  uint64_t count, total, max;
+  uint32_t buckets[HIST_BUCKETS];
+} Histogram;
+
+typedef struct {
+  uint32_t hash;
+  char* query;
+  uint64_t errors, rows, sent, received;
+  Histogram time;
+} QueryStatsEntry;
+
+struct query_stats {
+  JSValue slow_query;
+  /* microseconds */
+  uint64_t slow_threshold;
+  uint32_t max_queries;
+  /* open addressing, the size is a power of two */
+  QueryStatsEntry** table;
+  uint32_t table_size, num_entries;
+  /* queries beyond 'max_queries' fingerprints */
+  QueryStatsEntry* other;
+  uint64_t queries, errors, slow, rows, sent, received;
+  Histogram time, send, execute;
+  /* the query in flight */
+  struct {
+    QueryStatsEntry* entry;
+    uint64_t start, sent;
+    size_t bytes;
+    char* sql;
+    BOOL active;
+  } current;
+  /* result set whose rows are added once it has been read to the end */
+  struct {
+    const void* key;
+    QueryStatsEntry* entry;
+  } deferred;
+};
+
+static inline uint32_t
+hist_index(uint64_t value) {
+  int shift;
+
+  if(value < 2 * HIST_SUB)
+    return value;
+
+  if(value > UINT32_MAX)
+    value = UINT32_MAX;
+
+  shift = 63 - clz64(value) - HIST_SUB_BITS;
+
+  return (shift + 1) * HIST_SUB + (value >> shift) - HIST_SUB;
+}
+
+/* highest value counted in bucket 'index' */
+static inline uint64_t
+hist_value(uint32_t index) {
+  uint32_t shift;
+
+  if(index < 2 * HIST_SUB)
+    return index;
+
+  shift = index / HIST_SUB - 1;
+
+  return ((uint64_t)(index % HIST_SUB + HIST_SUB + 1) << shift) - 1;
+}
+
+static inline void
+hist_record(Histogram* h, uint64_t value) {
+  h->count++;
+  h->total += value;
+
+  if(value > h->max)
+    h->max = value;
+
+  h->buckets[hist_index(value)]++;
+}
+
+static uint64_t
+hist_percentile(const Histogram* h, double p) {
+  uint64_t target = ceil(p * h->count), n = 0;
+
+  if(target == 0)
+    target = 1;
+
+  for(uint32_t i = 0; i < HIST_BUCKETS; i++)
+    if((n += h->buckets[i]) >= target)
+      return MIN_NUM(hist_value(i), h->max);
+
+  return h->max;
+}
+
+/* times in milliseconds */
+static JSValue
+hist_object(JSContext* ctx, const Histogram* h) {
+  static const struct {
+    const char* name;
+    double p;
+  } percentiles[] = {{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}};
+  JSValue ret = JS_NewObject(ctx);
+
+  JS_SetPropertyStr(ctx, ret, "count", JS_NewInt64(ctx, h->count));
+  JS_SetPropertyStr(ctx, ret, "total", JS_NewFloat64(ctx, h->total / 1000.0));
+  JS_SetPropertyStr(ctx, ret, "mean", JS_NewFloat64(ctx, h->count ? h->total / 1000.0 / h->count : 0));
+  JS_SetPropertyStr(ctx, ret, "max", JS_NewFloat64(ctx, h->max / 1000.0));
+
+  for(size_t i = 0; i < countof(percentiles); i++)
+    JS_SetPropertyStr(ctx, ret, percentiles[i].name, JS_NewFloat64(ctx, h->count ? hist_percentile(h, percentiles[i].p) / 1000.0 : 0));
+
+  return ret;
+}
+
+static inline BOOL
+fingerprint_word(char c) {
+  return isalnum((unsigned char)c) || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+
+/* appends a '?', "?, ?" collapses into one */
+static size_t
+fingerprint_placeholder(char* out, size_t n, BOOL* space) {
+  if(n >= 2 && out[n - 1] == ',' && out[n - 2] == '?') {
+    *space = FALSE;
+    return n - 1;
+  }
+
+  if(*space && n > 0 && n < FINGERPRINT_MAX)
+    out[n++] = ' ';
+
+  *space = FALSE;
+
+  if(n < FINGERPRINT_MAX)
+    out[n++] = '?';
+
+  return n;
+}
+
+/* length of the opening "$tag$" at 'i', 0 if there is none */
+static size_t
+fingerprint_dollar_tag(const char* sql, size_t i, size_t len) {
+  size_t j = i + 1;
+
+  while(j < len && sql[j] != '$' && fingerprint_word(sql[j]))
+    j++;
+
+  return j < len && sql[j] == '$' ? j + 1 - i : 0;
+}
+
+static size_t
+fingerprint(const char* sql, size_t len, char* out) {
+  size_t i = 0, n = 0;
+  BOOL space = FALSE;
+
+  while(i < len) {
+    char c = sql[i];
+    BOOL boundary = !(i > 0 && fingerprint_word(sql[i - 1]));
+    size_t tag;
+
+    if(isspace((unsigned char)c)) {
+      space = TRUE;
+      i++;
+    } else if(c == '-' && i + 1 < len && sql[i + 1] == '-') {
+      while(i < len && sql[i] != '\n')
+        i++;
+      space = TRUE;
+    } else if(c == '/' && i + 1 < len && sql[i + 1] == '*') {
+      for(i += 2; i < len && !(sql[i] == '*' && i + 1 < len && sql[i + 1] == '/'); i++) {}
+      i = MIN_NUM(i + 2, len);
+      space = TRUE;
+    } else if(c == '\'') {
+      for(i++; i < len; i++) {
+        if(sql[i] == '\\')
+          i++;
+        else if(sql[i] == '\'' && !(i + 1 < len && sql[i + 1] == '\''))
+          break;
+        else if(sql[i] == '\'')
+          i++;
+      }
+
+      i++;
+      n = fingerprint_placeholder(out, n, &space);
+    } else if(c == '$' && boundary && i + 1 < len && isdigit((unsigned char)sql[i + 1])) {
+      for(i++; i < len && isdigit((unsigned char)sql[i]); i++) {}
+
+      n = fingerprint_placeholder(out, n, &space);
+    } else if(c == '$' && boundary && (tag = fingerprint_dollar_tag(sql, i, len))) {
+      /* dollar-quoted string: $tag$ ... $tag$ */
+      size_t j;
+
+      for(j = i + tag; j + tag <= len && memcmp(&sql[j], &sql[i], tag); j++) {}
+
+      i = MIN_NUM(j + tag, len);
+      n = fingerprint_placeholder(out, n, &space);
+    } else if(isdigit((unsigned char)c) && boundary) {
+      for(i++; i < len; i++) {
+        if((sql[i] == '+' || sql[i] == '-') && (sql[i - 1] == 'e' || sql[i - 1] == 'E'))
+          continue;
+
+        if(!fingerprint_word(sql[i]) && sql[i] != '.')
+          break;
+      }
+
+      n = fingerprint_placeholder(out, n, &space);
+    } else if(c == '"' || c == '`') {
+      /* quoted identifiers are kept as they are */
+      size_t j = i + 1;
+
+      while(j < len && sql[j] != c)
+        j++;
+
+      j = MIN_NUM(j + 1, len);
+
+      if(space && n > 0 && n < FINGERPRINT_MAX)
+        out[n++] = ' ';
+
+      space = FALSE;
+
+      while(i < j)
+        if(n < FINGERPRINT_MAX)
+          out[n++] = sql[i++];
+        else
+          i++;
+    } else {
+      if(space && n > 0 && n < FINGERPRINT_MAX)
+        out[n++] = ' ';
+
+      space = FALSE;
+
+      if(n < FINGERPRINT_MAX)
+        out[n++] = tolower((unsigned char)c);
+
+      i++;
+    }
+  }
+
+  return n;
+}
+
+static uint32_t
+fingerprint_hash(const char* s, size_t len) {
+  uint32_t h = 2166136261u;
+
+  while(len--)
+    h = (h ^ (uint8_t)*s++) * 16777619u;
+
+  return h;
+}
+
+static QueryStatsEntry*
+querystats_entry_new(JSContext* ctx, const char* text, size_t len, uint32_t hash) {
+  QueryStatsEntry* e;
+
+  if(!(e = js_mallocz(ctx, sizeof(QueryStatsEntry))))
+    return 0;
+
+  if(!(e->query = js_strndup(ctx, text, len))) {
+    js_free(ctx, e);
+    return 0;
+  }
+
+  e->hash = hash;
+  return e;
+}
+
+static BOOL
+querystats_grow(JSContext* ctx, QueryStats* qs) {
+  uint32_t size = qs->table_size ? qs->table_size * 2 : 64;
+  QueryStatsEntry** table;
+
+  if(!(table = js_mallocz(ctx, sizeof(QueryStatsEntry*) * size)))
+    return FALSE;
+
+  for(uint32_t i = 0; i < qs->table_size; i++) {
+    QueryStatsEntry* e;
+    uint32_t j;
+
+    if(!(e = qs->table[i]))
+      continue;
+
+    for(j = e->hash & (size - 1); table[j]; j = (j + 1) & (size - 1)) {}
+
+    table[j] = e;
+  }
+
+  js_free(ctx, qs->table);
+  qs->table = table;
+  qs->table_size = size;
+  return TRUE;
+}
+
+/* NULL when out of memory, the query is then only counted in the totals */
+static QueryStatsEntry*
+querystats_entry(JSContext* ctx, QueryStats* qs, const char* text, size_t len) {
+  uint32_t hash = fingerprint_hash(text, len), i;
+  QueryStatsEntry* e;
+
+  if(qs->table_size)
+    for(i = hash & (qs->table_size - 1); (e = qs->table[i]); i = (i + 1) & (qs->table_size - 1))
+      if(e->hash == hash && !strncmp(e->query, text, len) && e->query[len] == '\0')
+        return e;
+
+  if(qs->num_entries >= qs->max_queries) {
+    if(!qs->other)
+      qs->other = querystats_entry_new(ctx, "(other)", 7, 0);
+
+    return qs->other;
+  }
+
+  if((qs->num_entries + 1) * 2 > qs->table_size && !querystats_grow(ctx, qs))
+    return 0;
+
+  if(!(e = querystats_entry_new(ctx, text, len, hash)))
+    return 0;
+
+  for(i = hash & (qs->table_size - 1); qs->table[i]; i = (i + 1) & (qs->table_size - 1)) {}
+
+  qs->table[i] = e;
+  qs->num_entries++;
+  return e;
+}
+
+static void
+querystats_entry_reset(QueryStatsEntry* e) {
+  e->errors = e->rows = e->sent = e->received = 0;
+  memset(&e->time, 0, sizeof(Histogram));
+}
+
+/**
+ * options: { slowQuery(info), slowThreshold = 100 (ms), maxQueries = 1000 }
+ */
+QueryStats*
+querystats_new(JSContext* ctx, JSValueConst options) {
+  QueryStats* qs;
+
+  if(!(qs = js_mallocz(ctx, sizeof(QueryStats))))
+    return 0;
+
+  qs->slow_query = JS_UNDEFINED;
+  qs->slow_threshold = QUERYSTATS_SLOW_THRESHOLD * 1000;
+  qs->max_queries = QUERYSTATS_MAX_QUERIES;
+
+  if(JS_IsObject(options)) {
+    JSValue value;
+    double ms;
+
+    value = JS_GetPropertyStr(ctx, options, "slowQuery");
+
+    if(JS_IsFunction(ctx, value))
+      qs->slow_query = value;
+    else
+      JS_FreeValue(ctx, value);
+
+    value = JS_GetPropertyStr(ctx, options, "slowThreshold");
+
+    if(!js_is_null_or_undefined(value) && !JS_ToFloat64(ctx, &ms, value) && ms >= 0)
+      qs->slow_threshold = ms * 1000;
+
+    JS_FreeValue(ctx, value);
+
+    value = JS_GetPropertyStr(ctx, options, "maxQueries");
+
+    if(!js_is_null_or_undefined(value))
+      JS_ToUint32(ctx, &qs->max_queries, value);
+
+    JS_FreeValue(ctx, value);
+  }
+
+  return qs;
+}
+
+void
+querystats_free(JSRuntime* rt, QueryStats* qs) {
+  for(uint32_t i = 0; i < qs->table_size; i++) {
+    QueryStatsEntry* e;
+
+    if((e = qs->table[i])) {
+      js_free_rt(rt, e->query);
+      js_free_rt(rt, e);
+    }
+  }
+
+  if(qs->other) {
+    js_free_rt(rt, qs->other->query);
+    js_free_rt(rt, qs->other);
+  }
+
+  js_free_rt(rt, qs->table);
+  js_free_rt(rt, qs->current.sql);
+  JS_FreeValueRT(rt, qs->slow_query);
+  js_free_rt(rt, qs);
+}
+
+/**
+ * Called before the query is sent. Fingerprinting is a single pass over the
+ * text, the original is only copied when there is a slowQuery callback.
+ */
+void
+querystats_begin(JSContext* ctx, QueryStats* qs, const char* sql, size_t len) {
+  char text[FINGERPRINT_MAX];
+  size_t n = fingerprint(sql, len, text);
+
+  qs->current.entry = querystats_entry(ctx, qs, text, n);
+  qs->current.bytes = len;
+  qs->current.sent = 0;
+
+  /* a result set which hasn't been read to the end can't be anymore */
+  qs->deferred.key = 0;
+
+  if(JS_IsFunction(ctx, qs->slow_query)) {
+    js_free(ctx, qs->current.sql);
+    qs->current.sql = js_strndup(ctx, sql, len);
+  }
+
+  qs->current.active = TRUE;
+  qs->current.start = time_us();
+}
+
+/* the request has been written, what follows is network and server time */
+void
+querystats_sent(QueryStats* qs) {
+  if(qs->current.active && !qs->current.sent)
+    qs->current.sent = time_us();
+}
+
+static void
+querystats_slow(JSContext* ctx, QueryStats* qs, uint64_t total, uint64_t send, int64_t rows, BOOL error) {
+  JSValue info = JS_NewObject(ctx), fn, ret;
+
+  JS_SetPropertyStr(ctx, info, "query", qs->current.entry ? JS_NewString(ctx, qs->current.entry->query) : JS_NULL);
+  JS_SetPropertyStr(ctx, info, "sql", qs->current.sql ? JS_NewString(ctx, qs->current.sql) : JS_NULL);
+  JS_SetPropertyStr(ctx, info, "time", JS_NewFloat64(ctx, total / 1000.0));
+  JS_SetPropertyStr(ctx, info, "send", JS_NewFloat64(ctx, send / 1000.0));
+  JS_SetPropertyStr(ctx, info, "execute", JS_NewFloat64(ctx, (total - send) / 1000.0));
+  JS_SetPropertyStr(ctx, info, "rows", rows >= 0 ? JS_NewInt64(ctx, rows) : JS_UNDEFINED);
+  JS_SetPropertyStr(ctx, info, "error", JS_NewBool(ctx, error));
+
+  /* the callback may replace or free the stats */
+  fn = JS_DupValue(ctx, qs->slow_query);
+  ret = JS_Call(ctx, fn, JS_UNDEFINED, 1, &info);
+
+  if(JS_IsException(ret))
+    js_error_print(ctx, JS_GetException(ctx));
+
+  JS_FreeValue(ctx, ret);
+  JS_FreeValue(ctx, fn);
+  JS_FreeValue(ctx, info);
+}
+
+/**
+ * Records the query begun last. 'rows' is -1 when not known yet, the
+ * driver then passes the result to querystats_defer().
+ */
+void
+querystats_end(JSContext* ctx, QueryStats* qs, int64_t rows, size_t received, BOOL error) {
+  QueryStatsEntry* e = qs->current.entry;
+  uint64_t total, send;
+
+  if(!qs->current.active)
+    return;
+
+  qs->current.active = FALSE;
+  total = time_us() - qs->current.start;
+  send = qs->current.sent ? qs->current.sent - qs->current.start : 0;
+
+  qs->queries++;
+  qs->sent += qs->current.bytes;
+  qs->received += received;
+
+  if(rows > 0)
+    qs->rows += rows;
+
+  if(error)
+    qs->errors++;
+
+  hist_record(&qs->time, total);
+  hist_record(&qs->send, send);
+  hist_record(&qs->execute, total - send);
+
+  if(e) {
+    hist_record(&e->time, total);
+    e->sent += qs->current.bytes;
+    e->received += received;
+
+    if(rows > 0)
+      e->rows += rows;
+
+    if(error)
+      e->errors++;
+  }
+
+  if(total >= qs->slow_threshold) {
+    qs->slow++;
+
+    if(JS_IsFunction(ctx, qs->slow_query))
+      querystats_slow(ctx, qs, total, send, rows, error);
+  }
+}
+
+/* rows of 'key' are added by querystats_rows() once they have all been fetched */
+void
+querystats_defer(QueryStats* qs, const void* key) {
+  qs->deferred.key = key;
+  qs->deferred.entry = qs->current.entry;
+}
+
+void
+querystats_rows(QueryStats* qs, const void* key, uint64_t rows) {
+  if(!key || key != qs->deferred.key)
+    return;
+
+  qs->rows += rows;
+
+  if(qs->deferred.entry)
+    qs->deferred.entry->rows += rows;
+
+  qs->deferred.key = 0;
+}
+
+static int
+querystats_compare(const void* a, const void* b) {
+  const QueryStatsEntry *x = *(QueryStatsEntry* const*)a, *y = *(QueryStatsEntry* const*)b;
+
+  return x->time.total < y->time.total ? 1 : x->time.total > y->time.total ? -1 : 0;
+}
+
+static JSValue
+querystats_entry_object(JSContext* ctx, const QueryStatsEntry* e) {
+  JSValue ret = JS_NewObject(ctx);
+
+  JS_SetPropertyStr(ctx, ret, "query", JS_NewString(ctx, e->query));
+  JS_SetPropertyStr(ctx, ret, "count", JS_NewInt64(ctx, e->time.count));
+  JS_SetPropertyStr(ctx, ret, "errors", JS_NewInt64(ctx, e->errors));
+  JS_SetPropertyStr(ctx, ret, "rows", JS_NewInt64(ctx, e->rows));
+  JS_SetPropertyStr(ctx, ret, "bytesSent", JS_NewInt64(ctx, e->sent));
+  JS_SetPropertyStr(ctx, ret, "bytesReceived", JS_NewInt64(ctx, e->received));
+  JS_SetPropertyStr(ctx, ret, "time", hist_object(ctx, &e->time));
+
+  return ret;
+}
+
+/**
+ * Returns the totals and one record per fingerprint, most total time first.
+ * Times are in milliseconds. With 'reset' the counters start over, the
+ * fingerprints are kept.
+ */
+JSValue
+querystats_snapshot(JSContext* ctx, QueryStats* qs, BOOL reset) {
+  JSValue ret = JS_NewObject(ctx), statements = JS_NewArray(ctx);
+  QueryStatsEntry** entries;
+  uint32_t i, n = 0;
+
+  JS_SetPropertyStr(ctx, ret, "queries", JS_NewInt64(ctx, qs->queries));
+  JS_SetPropertyStr(ctx, ret, "errors", JS_NewInt64(ctx, qs->errors));
+  JS_SetPropertyStr(ctx, ret, "slow", JS_NewInt64(ctx, qs->slow));
+  JS_SetPropertyStr(ctx, ret, "rows", JS_NewInt64(ctx, qs->rows));
+  JS_SetPropertyStr(ctx, ret, "bytesSent", JS_NewInt64(ctx, qs->sent));
+  JS_SetPropertyStr(ctx, ret, "bytesReceived", JS_NewInt64(ctx, qs->received));
+  JS_SetPropertyStr(ctx, ret, "time", hist_object(ctx, &qs->time));
+  JS_SetPropertyStr(ctx, ret, "send", hist_object(ctx, &qs->send));
+  JS_SetPropertyStr(ctx, ret, "execute", hist_object(ctx, &qs->execute));
+
+  if((entries = js_malloc(ctx, sizeof(QueryStatsEntry*) * (qs->num_entries + 1)))) {
+    for(i = 0; i < qs->table_size; i++)
+      if(qs->table[i] && (qs->table[i]->time.count || qs->table[i]->rows))
+        entries[n++] = qs->table[i];
+
+    if(qs->other && qs->other->time.count)
+      entries[n++] = qs->other;
+
+    qsort(entries, n, sizeof(QueryStatsEntry*), querystats_compare);
+
+    for(i = 0; i < n; i++)
+      JS_SetPropertyUint32(ctx, statements, i, querystats_entry_object(ctx, entries[i]));
+
+    js_free(ctx, entries);
+  }
+
+  JS_SetPropertyStr(ctx, ret, "statements", statements);
+
+  if(reset) {
+    qs->queries = qs->errors = qs->slow = qs->rows = qs->sent = qs->received = 0;
+    memset(&qs->time, 0, sizeof(Histogram));
+    memset(&qs->send, 0, sizeof(Histogram));
+    memset(&qs->execute, 0, sizeof(Histogram));
+
+    for(i = 0; i < qs->table_size; i++)
+      if(qs->table[i])
+        querystats_entry_reset(qs->table[i]);
+
+    if(qs->other)
+      querystats_entry_reset(qs->other);
+  }
+
+  return ret;
+}
+
+/**
+ * @}
+ */
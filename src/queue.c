@@ -3,6 +3,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include "debug.h"
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <limits.h>
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define QUEUE_BLOCK_SIZE 4096
 
 /**
  * \addtogroup queue
@@ -200,6 +210,100 @@ queue_clear(Queue* q) {
   assert(q->nbytes == 0);
 }
 
+#ifndef _WIN32
+/**
+ * Writes up to max_chunks chunks (oldest first) to fd with a single writev() call.
+ * Fully written chunks are freed, a partially written chunk has its pos advanced.
+ *
+ * @return  number of bytes written, or -1 on error (errno is set)
+ */
+ssize_t
+queue_writev(Queue* q, int fd, size_t max_chunks) {
+  struct iovec iov[IOV_MAX];
+  struct list_head* el;
+  int n = 0;
+  ssize_t ret;
+
+  if(max_chunks == 0 || max_chunks > IOV_MAX)
+    max_chunks = IOV_MAX;
+
+  list_for_each_prev(el, &q->list) {
+    Chunk* ch = list_entry(el, Chunk, link);
+
+    if((size_t)n >= max_chunks)
+      break;
+
+    if(ch->pos == ch->size)
+      continue;
+
+    iov[n].iov_base = &ch->data[ch->pos];
+    iov[n].iov_len = ch->size - ch->pos;
+    ++n;
+  }
+
+  if(n == 0)
+    return 0;
+
+  if((ret = writev(fd, iov, n)) > 0)
+    queue_skip(q, ret);
+
+  return ret;
+}
+
+/**
+ * Reads up to size bytes from fd with a single readv() call into newly allocated
+ * blocks of QUEUE_BLOCK_SIZE bytes, which are appended to the queue.
+ *
+ * @return  number of bytes read, 0 on EOF or -1 on error (errno is set)
+ */
+ssize_t
+queue_readv(Queue* q, int fd, size_t size) {
+  struct iovec iov[IOV_MAX];
+  Chunk* chunks[IOV_MAX];
+  int i, n = 0;
+  ssize_t ret, remain;
+
+  if(size == 0)
+    size = QUEUE_BLOCK_SIZE;
+
+  while(size > 0 && n < IOV_MAX) {
+    size_t len = MIN_NUM(size, QUEUE_BLOCK_SIZE);
+
+    if(!(chunks[n] = chunk_alloc(len)))
+      break;
+
+    iov[n].iov_base = chunks[n]->data;
+    iov[n].iov_len = len;
+    size -= len;
+    ++n;
+  }
+
+  if(n == 0)
+    return -1;
+
+  ret = readv(fd, iov, n);
+  remain = ret;
+
+  for(i = 0; i < n; i++) {
+    Chunk* ch = chunks[i];
+
+    if(remain <= 0) {
+      chunk_free(ch);
+      continue;
+    }
+
+    ch->size = MIN_NUM((size_t)remain, iov[i].iov_len);
+    remain -= ch->size;
+
+    list_add(&ch->link, &q->list);
+    q->nbytes += ch->size;
+    q->nchunks++;
+  }
+
+  return ret;
+}
+#endif
+
 Chunk*
 queue_chunk(Queue* q, ssize_t pos) {
   struct list_head* el;
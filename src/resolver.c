@@ -0,0 +1,456 @@
+#include "resolver.h"
+
+#ifndef _WIN32
+#include "defines.h"
+#include "utils.h"
+#include "timer-wheel.h"
+#include <list.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+/**
+ * \addtogroup resolver
+ * @{
+ */
+
+/*
+ * getaddrinfo() blocks, so it runs on a small pool of detached threads shared
+ * by all contexts. Every JS thread has a loop with a pipe on which the workers
+ * signal finished requests; its read end is registered with
+ * os.setReadHandler() only while requests are in flight.
+ *
+ * Results are cached per JS thread, keyed by host name and family, for
+ * RESOLVER_TTL (or RESOLVER_NEGATIVE_TTL for names which do not exist). A
+ * lookup of a name which is already in flight only adds a waiter to the
+ * pending entry.
+ */
+#define RESOLVER_THREADS 4
+#define RESOLVER_BUCKETS 256
+#define RESOLVER_ENTRIES 1024
+
+typedef struct resolver_entry {
+  struct list_head link, age, waiters;
+  char* host;
+  int family, error;
+  uint32_t hash;
+  struct addrinfo* result;
+  /* 0 while the lookup is in flight */
+  uint64_t expires;
+  BOOL settling;
+} ResolverEntry;
+
+typedef struct {
+  struct list_head link;
+  JSContext* ctx;
+  ResolverCallback* func;
+  void* opaque;
+} ResolverWaiter;
+
+typedef struct resolver_loop ResolverLoop;
+
+typedef struct {
+  struct list_head link;
+  ResolverEntry* entry;
+  ResolverLoop* loop;
+  int error;
+  struct addrinfo* result;
+} ResolverRequest;
+
+struct resolver_loop {
+  int fd[2];
+  pthread_mutex_t lock;
+  struct list_head done;
+  struct list_head buckets[RESOLVER_BUCKETS], age;
+  uint32_t entries, pending;
+  uint64_t queries, hits, coalesced;
+  BOOL armed;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct list_head queue;
+  uint32_t threads, idle;
+} resolver_pool = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    LIST_HEAD_INIT(resolver_pool.queue),
+    0,
+    0,
+};
+
+/* never freed, workers may still post to it after the JS thread is gone */
+static thread_local ResolverLoop* resolver_loop;
+
+static void*
+resolver_worker(void* arg) {
+  pthread_mutex_lock(&resolver_pool.lock);
+
+  for(;;) {
+    struct addrinfo hints;
+    ResolverRequest* req;
+    ResolverLoop* loop;
+
+    while(list_empty(&resolver_pool.queue)) {
+      resolver_pool.idle++;
+      pthread_cond_wait(&resolver_pool.cond, &resolver_pool.lock);
+      resolver_pool.idle--;
+    }
+
+    req = list_entry(resolver_pool.queue.next, ResolverRequest, link);
+    list_del(&req->link);
+
+    pthread_mutex_unlock(&resolver_pool.lock);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = req->entry->family;
+    /* one result per address instead of one per socket type */
+    hints.ai_socktype = SOCK_STREAM;
+
+    req->error = getaddrinfo(req->entry->host, 0, &hints, &req->result);
+
+    loop = req->loop;
+
+    pthread_mutex_lock(&loop->lock);
+    list_add_tail(&req->link, &loop->done);
+    pthread_mutex_unlock(&loop->lock);
+
+    while(write(loop->fd[1], "", 1) == -1 && errno == EINTR) {}
+
+    pthread_mutex_lock(&resolver_pool.lock);
+  }
+
+  return 0;
+}
+
+static int
+resolver_submit(ResolverRequest* req) {
+  int ret = 0;
+
+  pthread_mutex_lock(&resolver_pool.lock);
+
+  if(resolver_pool.idle == 0 && resolver_pool.threads < RESOLVER_THREADS) {
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if(pthread_create(&thread, &attr, resolver_worker, 0) == 0)
+      resolver_pool.threads++;
+    else if(resolver_pool.threads == 0)
+      ret = -1;
+
+    pthread_attr_destroy(&attr);
+  }
+
+  if(ret == 0) {
+    list_add_tail(&req->link, &resolver_pool.queue);
+    pthread_cond_signal(&resolver_pool.cond);
+  }
+
+  pthread_mutex_unlock(&resolver_pool.lock);
+  return ret;
+}
+
+static JSValue js_resolver_handler(JSContext*, JSValueConst, int, JSValueConst[]);
+
+static void
+resolver_arm(JSContext* ctx, ResolverLoop* loop, BOOL arm) {
+  JSValue set_handler;
+
+  if(loop->armed == arm)
+    return;
+
+  if(JS_IsException((set_handler = js_iohandler_fn(ctx, FALSE))))
+    return;
+
+  if(js_iohandler_set(ctx, set_handler, loop->fd[0], arm ? JS_NewCFunction(ctx, js_resolver_handler, "resolver", 0) : JS_NULL))
+    loop->armed = arm;
+
+  JS_FreeValue(ctx, set_handler);
+}
+
+static ResolverLoop*
+resolver_get(void) {
+  ResolverLoop* loop;
+  int i;
+
+  if((loop = resolver_loop))
+    return loop;
+
+  if(!(loop = calloc(1, sizeof(ResolverLoop))))
+    return 0;
+
+  if(pipe(loop->fd) == -1) {
+    free(loop);
+    return 0;
+  }
+
+  for(i = 0; i < 2; i++) {
+    fcntl(loop->fd[i], F_SETFL, fcntl(loop->fd[i], F_GETFL) | O_NONBLOCK);
+    fcntl(loop->fd[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  pthread_mutex_init(&loop->lock, 0);
+  init_list_head(&loop->done);
+  init_list_head(&loop->age);
+
+  for(i = 0; i < RESOLVER_BUCKETS; i++)
+    init_list_head(&loop->buckets[i]);
+
+  return resolver_loop = loop;
+}
+
+static uint32_t
+resolver_hash(const char* host, int family) {
+  uint32_t h = 2166136261u;
+
+  while(*host)
+    h = (h ^ (uint8_t)*host++) * 16777619u;
+
+  return (h ^ (uint32_t)family) * 16777619u;
+}
+
+static void
+resolver_entry_free(ResolverLoop* loop, ResolverEntry* entry) {
+  list_del(&entry->link);
+  list_del(&entry->age);
+
+  if(entry->result)
+    freeaddrinfo(entry->result);
+
+  free(entry->host);
+  free(entry);
+  loop->entries--;
+}
+
+/* drops the oldest entry which is not in flight */
+static void
+resolver_evict(ResolverLoop* loop) {
+  struct list_head* el;
+
+  list_for_each(el, &loop->age) {
+    ResolverEntry* entry = list_entry(el, ResolverEntry, age);
+
+    if(entry->expires && !entry->settling) {
+      resolver_entry_free(loop, entry);
+      break;
+    }
+  }
+}
+
+static void
+resolver_settle(ResolverEntry* entry) {
+  const struct addrinfo* result = entry->result;
+  int error = entry->error;
+  struct list_head waiters;
+
+  if(list_empty(&entry->waiters))
+    return;
+
+  waiters = entry->waiters;
+  waiters.next->prev = &waiters;
+  waiters.prev->next = &waiters;
+  init_list_head(&entry->waiters);
+
+  /* callbacks may start other lookups, which must not evict this entry */
+  entry->settling = TRUE;
+
+  while(!list_empty(&waiters)) {
+    ResolverWaiter* w = list_entry(waiters.next, ResolverWaiter, link);
+
+    list_del(&w->link);
+    w->func(w->ctx, error, result, w->opaque);
+    free(w);
+  }
+
+  entry->settling = FALSE;
+}
+
+static JSValue
+js_resolver_handler(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  ResolverLoop* loop = resolver_loop;
+  struct list_head done;
+  char buf[64];
+  uint64_t now = timer_now();
+
+  while(read(loop->fd[0], buf, sizeof(buf)) > 0) {}
+
+  init_list_head(&done);
+
+  pthread_mutex_lock(&loop->lock);
+
+  while(!list_empty(&loop->done)) {
+    struct list_head* el = loop->done.next;
+
+    list_del(el);
+    list_add_tail(el, &done);
+  }
+
+  pthread_mutex_unlock(&loop->lock);
+
+  while(!list_empty(&done)) {
+    ResolverRequest* req = list_entry(done.next, ResolverRequest, link);
+    ResolverEntry* entry = req->entry;
+
+    list_del(&req->link);
+    loop->pending--;
+
+    entry->error = req->error;
+    entry->result = req->result;
+
+    switch(req->error) {
+      case 0: entry->expires = now + RESOLVER_TTL; break;
+      case EAI_NONAME:
+#ifdef EAI_NODATA
+      case EAI_NODATA:
+#endif
+        entry->expires = now + RESOLVER_NEGATIVE_TTL;
+        break;
+      /* transient failures are not cached */
+      default: entry->expires = now; break;
+    }
+
+    free(req);
+    resolver_settle(entry);
+  }
+
+  if(loop->pending == 0)
+    resolver_arm(ctx, loop, FALSE);
+
+  return JS_UNDEFINED;
+}
+
+/**
+ * Resolves host, calling func(ctx, error, result, opaque) with the result of
+ * getaddrinfo(). A cached result is delivered synchronously.
+ *
+ * Returns 1 when answered from the cache, 0 when the lookup is in flight and
+ * -1 on failure (out of memory, no threads).
+ */
+int
+resolver_lookup(JSContext* ctx, const char* host, int family, ResolverCallback* func, void* opaque) {
+  ResolverLoop* loop;
+  ResolverEntry* entry = 0;
+  ResolverWaiter* w;
+  struct list_head* el;
+  uint32_t hash = resolver_hash(host, family);
+  uint64_t now = timer_now();
+
+  if(!(loop = resolver_get()))
+    return -1;
+
+  list_for_each(el, &loop->buckets[hash % RESOLVER_BUCKETS]) {
+    ResolverEntry* e = list_entry(el, ResolverEntry, link);
+
+    if(e->hash == hash && e->family == family && !strcmp(e->host, host)) {
+      entry = e;
+      break;
+    }
+  }
+
+  if(entry && entry->expires > now) {
+    loop->hits++;
+    func(ctx, entry->error, entry->result, opaque);
+    return 1;
+  }
+
+  if(!(w = malloc(sizeof(ResolverWaiter))))
+    return -1;
+
+  w->ctx = ctx;
+  w->func = func;
+  w->opaque = opaque;
+
+  /* in flight: coalesce */
+  if(entry && entry->expires == 0) {
+    loop->coalesced++;
+    list_add_tail(&w->link, &entry->waiters);
+    return 0;
+  }
+
+  if(!entry) {
+    if(loop->entries >= RESOLVER_ENTRIES)
+      resolver_evict(loop);
+
+    if(!(entry = calloc(1, sizeof(ResolverEntry))) || !(entry->host = strdup(host))) {
+      free(entry);
+      free(w);
+      return -1;
+    }
+
+    entry->family = family;
+    entry->hash = hash;
+    init_list_head(&entry->waiters);
+    list_add_tail(&entry->link, &loop->buckets[hash % RESOLVER_BUCKETS]);
+    list_add_tail(&entry->age, &loop->age);
+    loop->entries++;
+  } else {
+    /* stale */
+    if(entry->result)
+      freeaddrinfo(entry->result);
+
+    entry->result = 0;
+    entry->error = 0;
+    list_del(&entry->age);
+    list_add_tail(&entry->age, &loop->age);
+  }
+
+  {
+    ResolverRequest* req;
+
+    if(!(req = calloc(1, sizeof(ResolverRequest)))) {
+      resolver_entry_free(loop, entry);
+      free(w);
+      return -1;
+    }
+
+    req->entry = entry;
+    req->loop = loop;
+    entry->expires = 0;
+
+    if(resolver_submit(req) == -1) {
+      free(req);
+      resolver_entry_free(loop, entry);
+      free(w);
+      return -1;
+    }
+  }
+
+  list_add_tail(&w->link, &entry->waiters);
+  loop->queries++;
+
+  if(loop->pending++ == 0)
+    resolver_arm(ctx, loop, TRUE);
+
+  return 0;
+}
+
+/**
+ * Fills st with the counters of the calling thread's cache, all zero before
+ * its first lookup.
+ */
+void
+resolver_stats(ResolverStats* st) {
+  ResolverLoop* loop = resolver_loop;
+
+  memset(st, 0, sizeof(ResolverStats));
+
+  if(loop) {
+    st->queries = loop->queries;
+    st->hits = loop->hits;
+    st->coalesced = loop->coalesced;
+    st->entries = loop->entries;
+    st->pending = loop->pending;
+  }
+}
+
+/**
+ * @}
+ */
+#endif /* !defined(_WIN32) */
@@ -0,0 +1,371 @@
+#include "timer-wheel.h"
+#include "defines.h"
+#include "utils.h"
+#include <time.h>
+
+/**
+ * \addtogroup timer-wheel
+ * @{
+ */
+
+/*
+ * Four levels of 64 slots with a resolution of 1ms: level 0 holds the timers
+ * expiring within the next 64ms, level 1 the ones within 4s, level 2 within
+ * 4.5min and level 3 within 4.6h (later expiries are parked in the last slot
+ * and re-cascaded). Inserting and cancelling is a list operation, advancing
+ * the clock redistributes a single upper level slot every 64 ticks.
+ *
+ * The wheel is driven by a single os.setTimeout() which is only armed while
+ * timers are pending. Its callback carries a TimerWheel object holding the
+ * os timer handle; when that object is freed while it still drives the wheel,
+ * the runtime is being torn down and the pending timers are released.
+ */
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SPAN(level) ((uint64_t)1 << (TIMER_WHEEL_BITS * (level)))
+#define TIMER_WHEEL_INDEX(t, level) (((t) >> (TIMER_WHEEL_BITS * (level))) & TIMER_WHEEL_MASK)
+
+static thread_local struct {
+  struct list_head slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  uint64_t current, armed;
+  uint32_t count;
+  JSObject* driver;
+  BOOL initialized : 1, running : 1;
+} timer_wheel;
+
+static JSClassID js_timer_wheel_class_id;
+
+static void timer_wheel_arm(JSContext*);
+
+uint64_t
+timer_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+timer_wheel_init(void) {
+  int i, j;
+
+  for(i = 0; i < TIMER_WHEEL_LEVELS; i++)
+    for(j = 0; j < TIMER_WHEEL_SLOTS; j++)
+      init_list_head(&timer_wheel.slots[i][j]);
+
+  timer_wheel.current = timer_now();
+  timer_wheel.driver = 0;
+  timer_wheel.initialized = TRUE;
+}
+
+/* unlinks all pending timers and lets their owners drop what the wheel kept alive */
+static void
+timer_wheel_clear(JSRuntime* rt) {
+  int i, j;
+
+  for(i = 0; i < TIMER_WHEEL_LEVELS; i++)
+    for(j = 0; j < TIMER_WHEEL_SLOTS; j++) {
+      struct list_head* head = &timer_wheel.slots[i][j];
+
+      while(!list_empty(head)) {
+        Timer* t = list_entry(head->next, Timer, link);
+
+        list_del(&t->link);
+
+        if(t->release)
+          t->release(rt, t);
+      }
+    }
+
+  timer_wheel.count = 0;
+  timer_wheel.armed = 0;
+  timer_wheel.driver = 0;
+  timer_wheel.initialized = FALSE;
+}
+
+static void
+timer_wheel_add(Timer* t) {
+  uint64_t expires = t->expires, delta;
+  int level;
+
+  /* while the current slot is being run, due timers go into the next one */
+  if(expires < timer_wheel.current + (timer_wheel.running ? 1 : 0))
+    expires = timer_wheel.current + (timer_wheel.running ? 1 : 0);
+
+  delta = expires - timer_wheel.current;
+
+  if(delta >= TIMER_WHEEL_SPAN(TIMER_WHEEL_LEVELS)) {
+    delta = TIMER_WHEEL_SPAN(TIMER_WHEEL_LEVELS) - 1;
+    expires = timer_wheel.current + delta;
+  }
+
+  for(level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+    if(delta < TIMER_WHEEL_SPAN(level + 1))
+      break;
+
+  list_add_tail(&t->link, &timer_wheel.slots[level][TIMER_WHEEL_INDEX(expires, level)]);
+}
+
+/* moves the timers of the current slot on level one step closer to level 0 */
+static uint32_t
+timer_wheel_cascade(int level) {
+  uint32_t index = TIMER_WHEEL_INDEX(timer_wheel.current, level);
+  struct list_head *el, *next, *head = &timer_wheel.slots[level][index];
+
+  list_for_each_safe(el, next, head) {
+    list_del(el);
+    timer_wheel_add(list_entry(el, Timer, link));
+  }
+
+  return index;
+}
+
+static void
+timer_wheel_tick(JSContext* ctx) {
+  uint32_t index = timer_wheel.current & TIMER_WHEEL_MASK;
+  struct list_head* head;
+  int level;
+
+  if(index == 0)
+    for(level = 1; level < TIMER_WHEEL_LEVELS; level++)
+      if(timer_wheel_cascade(level) != 0)
+        break;
+
+  head = &timer_wheel.slots[0][index];
+
+  /* callbacks may start or stop any timer, including the next one in this slot */
+  while(!list_empty(head)) {
+    Timer* t = list_entry(head->next, Timer, link);
+
+    list_del(&t->link);
+    timer_wheel.count--;
+    t->func(ctx, t);
+  }
+
+  timer_wheel.current++;
+}
+
+/*
+ * Returns the tick at which the wheel has to be advanced next: the first
+ * non-empty slot on level 0, or the first cascade of a non-empty slot on an
+ * upper level. All the ticks before it are no-ops.
+ */
+static uint64_t
+timer_wheel_next(void) {
+  uint64_t next = UINT64_MAX, current = timer_wheel.current;
+  uint32_t i;
+  int level;
+
+  for(i = 0; i < TIMER_WHEEL_SLOTS; i++)
+    if(!list_empty(&timer_wheel.slots[0][(current + i) & TIMER_WHEEL_MASK]))
+      return current + i;
+
+  for(level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+    /* slot j of a level is cascaded on the first multiple of its span whose index is j */
+    uint64_t span = TIMER_WHEEL_SPAN(level), base = (current + span - 1) & ~(span - 1);
+    uint32_t index = TIMER_WHEEL_INDEX(base, level);
+
+    for(i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+      uint64_t tick = base + (uint64_t)((i - index) & TIMER_WHEEL_MASK) * span;
+
+      if(tick < next && !list_empty(&timer_wheel.slots[level][i]))
+        next = tick;
+    }
+  }
+
+  return next != UINT64_MAX ? next : (current | TIMER_WHEEL_MASK) + 1;
+}
+
+static JSValue
+js_timer_wheel_handler(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  uint64_t now = timer_now();
+
+  timer_wheel.driver = 0;
+  timer_wheel.armed = 0;
+  timer_wheel.running = TRUE;
+
+  while(timer_wheel.count > 0 && timer_wheel.current <= now) {
+    uint64_t next = timer_wheel_next();
+
+    /* skip the empty ticks in between */
+    if(next > now) {
+      timer_wheel.current = now + 1;
+      break;
+    }
+
+    timer_wheel.current = next;
+    timer_wheel_tick(ctx);
+  }
+
+  if(timer_wheel.count == 0)
+    timer_wheel.current = now;
+
+  timer_wheel.running = FALSE;
+
+  timer_wheel_arm(ctx);
+  return JS_UNDEFINED;
+}
+
+static JSValue
+timer_wheel_os(JSContext* ctx, const char* name) {
+  JSModuleDef* m;
+
+  if(!(m = js_module_load(ctx, "os")))
+    return JS_ThrowReferenceError(ctx, "'os' module required");
+
+  return module_exports_find_str(ctx, m, name);
+}
+
+static void
+js_timer_wheel_finalizer(JSRuntime* rt, JSValue val) {
+  JSValue* handle;
+
+  if((handle = JS_GetOpaque(val, js_timer_wheel_class_id))) {
+    if(timer_wheel.driver == JS_VALUE_GET_OBJ(val))
+      timer_wheel_clear(rt);
+
+    JS_FreeValueRT(rt, *handle);
+    js_free_rt(rt, handle);
+  }
+}
+
+static void
+js_timer_wheel_mark(JSRuntime* rt, JSValueConst val, JS_MarkFunc* mark_func) {
+  JSValue* handle;
+
+  if((handle = JS_GetOpaque(val, js_timer_wheel_class_id)))
+    JS_MarkValue(rt, *handle, mark_func);
+}
+
+static JSClassDef js_timer_wheel_class = {
+    .class_name = "TimerWheel",
+    .finalizer = js_timer_wheel_finalizer,
+    .gc_mark = js_timer_wheel_mark,
+};
+
+static void
+timer_wheel_disarm(JSContext* ctx) {
+  JSValue clear_timeout, handle;
+  JSValue* ptr;
+
+  if(!timer_wheel.driver)
+    return;
+
+  ptr = JS_GetOpaque(JS_MKPTR(JS_TAG_OBJECT, timer_wheel.driver), js_timer_wheel_class_id);
+  handle = JS_DupValue(ctx, *ptr);
+
+  /* clearing the os timer may free the driver, which must not clear the wheel then */
+  timer_wheel.driver = 0;
+  timer_wheel.armed = 0;
+
+  clear_timeout = timer_wheel_os(ctx, "clearTimeout");
+  JS_FreeValue(ctx, JS_Call(ctx, clear_timeout, JS_UNDEFINED, 1, &handle));
+  JS_FreeValue(ctx, clear_timeout);
+  JS_FreeValue(ctx, handle);
+}
+
+/* (re)schedules the os.setTimeout() which drives the wheel, if it has to fire earlier */
+static void
+timer_wheel_arm(JSContext* ctx) {
+  JSRuntime* rt = JS_GetRuntime(ctx);
+  JSValue set_timeout, driver, handle, args[2];
+  JSValue* ptr;
+  uint64_t next, now;
+
+  if(timer_wheel.running)
+    return;
+
+  if(timer_wheel.count == 0) {
+    timer_wheel_disarm(ctx);
+    return;
+  }
+
+  next = timer_wheel_next();
+
+  if(timer_wheel.armed && timer_wheel.armed <= next)
+    return;
+
+  timer_wheel_disarm(ctx);
+
+  if(js_timer_wheel_class_id == 0)
+    JS_NewClassID(&js_timer_wheel_class_id);
+
+  if(!JS_IsRegisteredClass(rt, js_timer_wheel_class_id))
+    JS_NewClass(rt, js_timer_wheel_class_id, &js_timer_wheel_class);
+
+  if(!(ptr = js_malloc(ctx, sizeof(JSValue))))
+    return;
+
+  driver = JS_NewObjectClass(ctx, js_timer_wheel_class_id);
+
+  if(JS_IsException(driver)) {
+    js_free(ctx, ptr);
+    return;
+  }
+
+  *ptr = JS_UNDEFINED;
+  JS_SetOpaque(driver, ptr);
+
+  now = timer_now();
+  set_timeout = timer_wheel_os(ctx, "setTimeout");
+
+  args[0] = JS_NewCFunctionData(ctx, js_timer_wheel_handler, 0, 0, 1, &driver);
+  args[1] = JS_NewInt64(ctx, next > now ? next - now : 0);
+
+  handle = JS_Call(ctx, set_timeout, JS_UNDEFINED, 2, args);
+
+  if(!JS_IsException(handle)) {
+    *ptr = handle;
+    timer_wheel.driver = JS_VALUE_GET_OBJ(driver);
+    timer_wheel.armed = next;
+  }
+
+  JS_FreeValue(ctx, args[0]);
+  JS_FreeValue(ctx, driver);
+  JS_FreeValue(ctx, set_timeout);
+}
+
+void
+timer_init(Timer* t, TimerFunc* func) {
+  t->link.prev = t->link.next = NULL;
+  t->expires = 0;
+  t->func = func;
+  t->release = NULL;
+}
+
+/**
+ * (Re)starts the timer to call t->func(ctx, t) in ms milliseconds.
+ */
+void
+timer_start(JSContext* ctx, Timer* t, uint32_t ms) {
+  if(!timer_wheel.initialized)
+    timer_wheel_init();
+
+  if(timer_pending(t))
+    list_del(&t->link);
+  else
+    timer_wheel.count++;
+
+  /* the wheel lags behind while idle */
+  if(timer_wheel.count == 1 && !timer_wheel.running)
+    timer_wheel.current = timer_now();
+
+  t->expires = timer_now() + ms;
+  timer_wheel_add(t);
+  timer_wheel_arm(ctx);
+}
+
+void
+timer_stop(JSContext* ctx, Timer* t) {
+  if(!timer_pending(t))
+    return;
+
+  list_del(&t->link);
+
+  /* without a context (from a finalizer) the driving timeout fires once more and finds nothing */
+  if(--timer_wheel.count == 0 && ctx)
+    timer_wheel_arm(ctx);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,320 @@
+/*
+ * Socket throughput/latency benchmark
+ *
+ *   qjsm tests/bench_sockets.js [--quick] [--output file.json] [--filter substring]
+ *
+ * Runs echo (pipelined) and request/response workloads over socketpair(),
+ * loopback TCP and loopback UDP, with both Socket and AsyncSocket, for
+ * several message sizes and concurrency levels. Results are printed (and
+ * optionally written) as JSON, one record per scenario:
+ *
+ *   { api, transport, workload, size, concurrency, messages, seconds,
+ *     msgsPerSec, mbPerSec, latency: { p50, p99, p999 } }   (latency in µs)
+ */
+import * as os from 'os';
+import * as std from 'std';
+import { performance } from 'perf_hooks';
+import { AF_INET, AF_UNIX, AsyncSocket, IPPROTO_TCP, IPPROTO_UDP, SO_REUSEADDR, SOCK_DGRAM, SOCK_STREAM, SockAddr, Socket, socketpair, SOL_SOCKET } from 'sockets';
+
+const TCP_NODELAY = 1,
+  SHUT_WR = 1;
+
+/* bytes in flight on one connection, stays below the default socket buffers so the synchronous runs can't deadlock */
+const WINDOW_BYTES = 65536;
+
+function percentile(sorted, p) {
+  if(sorted.length == 0) return 0;
+
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+function summarize(scenario, messages, seconds, latencies) {
+  latencies.sort((a, b) => a - b);
+
+  const us = ms => Math.round(ms * 1000 * 10) / 10;
+
+  return {
+    ...scenario,
+    messages,
+    seconds: Math.round(seconds * 1e6) / 1e6,
+    msgsPerSec: Math.round(messages / seconds),
+    mbPerSec: Math.round(((messages * scenario.size * 2) / seconds / 1048576) * 100) / 100,
+    latency: {
+      p50: us(percentile(latencies, 0.5)),
+      p99: us(percentile(latencies, 0.99)),
+      p999: us(percentile(latencies, 0.999))
+    }
+  };
+}
+
+/* returns [client, server], both of the given class */
+function pair(transport, Class) {
+  const adopt = s => {
+    const fd = os.dup(s.fd);
+    s.close();
+    return Class.adopt(fd);
+  };
+
+  switch (transport) {
+    case 'socketpair': {
+      const fds = [];
+
+      if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) throw new Error('socketpair() failed');
+
+      return [Class.adopt(fds[0]), Class.adopt(fds[1])];
+    }
+
+    case 'tcp': {
+      const listener = new Socket(AF_INET, SOCK_STREAM, IPPROTO_TCP),
+        client = new Socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+      listener.setsockopt(SOL_SOCKET, SO_REUSEADDR, [1]);
+      listener.bind(new SockAddr(AF_INET, '127.0.0.1', 0));
+      listener.listen(1);
+      client.connect(listener.local);
+
+      const server = Socket.adopt(listener.accept(new SockAddr(AF_INET)));
+
+      listener.close();
+
+      for(const s of [client, server]) s.setsockopt(IPPROTO_TCP, TCP_NODELAY, [1]);
+
+      return [adopt(client), Class.adopt(server.fd)];
+    }
+
+    case 'udp': {
+      const a = new Socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP),
+        b = new Socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+      a.bind(new SockAddr(AF_INET, '127.0.0.1', 0));
+      b.bind(new SockAddr(AF_INET, '127.0.0.1', 0));
+      a.connect(b.local);
+      b.connect(a.local);
+
+      return [adopt(a), adopt(b)];
+    }
+  }
+}
+
+function recvAll(sock, buf, size) {
+  for(let n = 0; n < size; ) {
+    const r = sock.recv(buf, n, size - n);
+
+    if(r <= 0) throw new Error(`recv() = ${r}`);
+
+    n += r;
+  }
+}
+
+function sendAll(sock, buf, size) {
+  for(let n = 0; n < size; ) {
+    const r = sock.send(buf, n, size - n);
+
+    if(r <= 0) throw new Error(`send() = ${r}`);
+
+    n += r;
+  }
+}
+
+async function recvAllAsync(sock, buf, size) {
+  for(let n = 0; n < size; ) {
+    const r = await sock.recv(buf, n, size - n);
+
+    if(r <= 0) throw new Error(`recv() = ${r}`);
+
+    n += r;
+  }
+}
+
+async function sendAllAsync(sock, buf, size) {
+  for(let n = 0; n < size; ) {
+    const r = await sock.send(buf, n, size - n);
+
+    if(r <= 0) throw new Error(`send() = ${r}`);
+
+    n += r;
+  }
+}
+
+/* window: messages in flight per connection (1 = request/response) */
+function runSync(scenario, count) {
+  const { transport, size, concurrency, workload } = scenario;
+  const pairs = Array.from({ length: concurrency }, () => pair(transport, Socket));
+  const request = new ArrayBuffer(size),
+    response = new ArrayBuffer(size),
+    scratch = new ArrayBuffer(size);
+  const window = workload == 'echo' ? Math.max(1, Math.floor(WINDOW_BYTES / size)) : 1;
+  const latencies = [],
+    sent = new Array(window);
+  let done = 0;
+
+  const start = performance.now();
+
+  while(done < count) {
+    for(const [client, server] of pairs) {
+      const n = Math.min(window, count - done);
+
+      if(n <= 0) break;
+
+      for(let i = 0; i < n; i++) {
+        sent[i] = performance.now();
+        sendAll(client, request, size);
+      }
+
+      for(let i = 0; i < n; i++) {
+        recvAll(server, scratch, size);
+        sendAll(server, scratch, size);
+      }
+
+      for(let i = 0; i < n; i++) {
+        recvAll(client, response, size);
+        latencies.push(performance.now() - sent[i]);
+      }
+
+      done += n;
+    }
+  }
+
+  const seconds = (performance.now() - start) / 1000;
+
+  for(const [client, server] of pairs) {
+    client.close();
+    server.close();
+  }
+
+  return summarize(scenario, done, seconds, latencies);
+}
+
+async function runAsync(scenario, count) {
+  const { transport, size, concurrency, workload } = scenario;
+  const pairs = Array.from({ length: concurrency }, () => pair(transport, AsyncSocket));
+  const window = workload == 'echo' ? Math.max(1, Math.floor(WINDOW_BYTES / size)) : 1;
+  const latencies = [];
+  let remaining = count;
+
+  const echo = async server => {
+    const buf = new ArrayBuffer(size);
+
+    for(;;) {
+      /* ends on EOF (stream) or on a short datagram (udp) */
+      for(let n = 0; n < size; ) {
+        const r = await server.recv(buf, n, size - n);
+
+        if(r <= 0 || (transport == 'udp' && r != size)) return;
+
+        n += r;
+      }
+
+      await sendAllAsync(server, buf, size);
+    }
+  };
+
+  const client = async sock => {
+    const request = new ArrayBuffer(size),
+      response = new ArrayBuffer(size);
+
+    while(remaining > 0) {
+      const n = Math.min(window, remaining),
+        sent = [];
+
+      remaining -= n;
+
+      /* the reader runs concurrently, so a window larger than the socket buffers can't stall */
+      const reader = (async () => {
+        for(let i = 0; i < n; i++) {
+          await recvAllAsync(sock, response, size);
+          latencies.push(performance.now() - sent[i]);
+        }
+      })();
+
+      for(let i = 0; i < n; i++) {
+        sent[i] = performance.now();
+        await sendAllAsync(sock, request, size);
+      }
+
+      await reader;
+    }
+  };
+
+  const servers = pairs.map(([, server]) => echo(server));
+  const start = performance.now();
+
+  await Promise.all(pairs.map(([c]) => client(c)));
+
+  const seconds = (performance.now() - start) / 1000;
+
+  for(const [c] of pairs) {
+    if(transport == 'udp') await c.send(new ArrayBuffer(1));
+    else c.shutdown(SHUT_WR);
+  }
+
+  await Promise.allSettled(servers);
+
+  for(const [c, server] of pairs) {
+    c.close();
+    server.close();
+  }
+
+  return summarize(scenario, count, seconds, latencies);
+}
+
+async function main(...args) {
+  let quick = false,
+    output,
+    filter;
+
+  for(let i = 0; i < args.length; i++) {
+    if(args[i] == '--quick') quick = true;
+    else if(args[i] == '--output') output = args[++i];
+    else if(args[i] == '--filter') filter = args[++i];
+  }
+
+  const sizes = quick ? [64, 4096] : [64, 1024, 16384, 65000];
+  const concurrencies = quick ? [1, 8] : [1, 8, 64];
+  const budget = quick ? 4 << 20 : 64 << 20;
+  const results = [];
+
+  for(const api of ['Socket', 'AsyncSocket'])
+    for(const transport of ['socketpair', 'tcp', 'udp'])
+      for(const workload of ['rr', 'echo'])
+        for(const size of sizes)
+          for(const concurrency of concurrencies) {
+            const scenario = { api, transport, workload, size, concurrency };
+            const name = `${api}/${transport}/${workload}/${size}/${concurrency}`;
+
+            if(filter && name.indexOf(filter) == -1) continue;
+
+            /* pipelined datagrams may be dropped by the kernel, only request/response is reliable over UDP */
+            if(transport == 'udp' && workload == 'echo') continue;
+
+            const count = Math.max(quick ? 200 : 1000, Math.min(quick ? 5000 : 100000, Math.floor(budget / size)));
+
+            try {
+              const result = api == 'Socket' ? runSync(scenario, count) : await runAsync(scenario, count);
+
+              results.push(result);
+              console.log(name.padEnd(40), `${result.msgsPerSec} msgs/s`.padStart(16), `${result.mbPerSec} MB/s`.padStart(14), `p99 ${result.latency.p99}µs`.padStart(16));
+            } catch(e) {
+              results.push({ ...scenario, error: e.message });
+              console.log(name.padEnd(40), 'FAILED', e.message);
+            }
+          }
+
+  const json = JSON.stringify({ date: new Date().toISOString(), quick, results }, null, 2);
+
+  if(output) {
+    const file = std.open(output, 'w');
+
+    file.puts(json + '\n');
+    file.close();
+  } else {
+    std.puts(json + '\n');
+  }
+
+  if(results.some(r => r.error)) std.exit(1);
+}
+
+main(...scriptArgs.slice(1)).catch(e => {
+  console.log('FAIL:', e.message + '\n' + e.stack);
+  std.exit(1);
+});
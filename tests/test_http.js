@@ -0,0 +1,65 @@
+import { HttpParser } from 'http';
+import { toArrayBuffer } from 'misc';
+import { TextDecoder } from 'textcode';
+import { assert, eq, tests } from './tinytest.js';
+
+tests({
+  'request head'() {
+    const p = new HttpParser(HttpParser.REQUEST);
+    const req = 'GET /index.html?q=1 HTTP/1.1\r\nHost: example.com\r\nContent-Length: 4\r\nX-Empty:\r\n\r\nbody';
+    const buf = toArrayBuffer(req);
+
+    for(let i = 1; i < req.length - 4; i++) eq(HttpParser.INCOMPLETE, p.parse(buf, i));
+
+    eq(req.length - 4, p.parse(buf));
+    eq('GET', p.method);
+    eq('/index.html?q=1', p.path);
+    eq(1, p.minorVersion);
+    eq(3, p.headerCount);
+    eq('example.com', p.header('host'));
+    eq('', p.header('X-Empty'));
+    eq(undefined, p.header('Accept'));
+    eq(4, p.contentLength);
+    assert(p.keepAlive, 'keep-alive');
+
+    const spans = p.headers;
+    eq(12, spans.length);
+    eq('Host', req.slice(spans[0], spans[0] + spans[1]));
+  },
+
+  'response head'() {
+    const p = new HttpParser(HttpParser.RESPONSE);
+
+    eq(HttpParser.ERROR, p.parse(toArrayBuffer('HTTP/2.0 200 OK\r\n\r\n')));
+    eq(HttpParser.INCOMPLETE, p.parse(toArrayBuffer('HTTP/1.0 404 Not')));
+
+    const res = 'HTTP/1.0 404 Not Found\r\nTransfer-Encoding: chunked\r\n\r\n';
+    eq(res.length, p.parse(toArrayBuffer(res)));
+    eq(404, p.status);
+    eq('Not Found', p.reason);
+    assert(p.chunked, 'chunked');
+    eq(-1, p.contentLength);
+    assert(!p.keepAlive, 'HTTP/1.0 closes');
+  },
+
+  'chunked body'() {
+    const p = new HttpParser();
+    const body = new Uint8Array(toArrayBuffer('4\r\nWiki\r\n5;ext=1\r\npedia\r\n0\r\n\r\nNEXT'));
+    const dec = new TextDecoder();
+    let out = '';
+
+    for(let i = 0; i < body.length; i += 7) {
+      const chunk = body.slice(i, i + 7);
+      const n = p.decodeChunked(chunk.buffer);
+
+      assert(n >= 0, 'decode error');
+      out += dec.decode(chunk.subarray(0, n));
+      if(p.trailing >= 0) {
+        eq('NEXT', dec.decode(chunk.subarray(n, n + p.trailing)));
+        break;
+      }
+    }
+
+    eq('Wikipedia', out);
+  }
+});
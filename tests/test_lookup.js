@@ -0,0 +1,60 @@
+import { AF_INET, AF_INET6, EAI_NONAME, lookup, lookupStats, SockAddr } from 'sockets';
+import { assert, eq, tests } from './tinytest.js';
+
+tests({
+  async 'numeric address'() {
+    const addr = await lookup('127.0.0.1');
+
+    assert(addr instanceof SockAddr, 'result is a SockAddr');
+    eq(AF_INET, addr.family);
+    eq('127.0.0.1', addr.addr);
+  },
+
+  async 'localhost from /etc/hosts'() {
+    const addr = await lookup('localhost', { family: 4 });
+
+    eq(AF_INET, addr.family);
+    eq('127.0.0.1', addr.addr);
+  },
+
+  async 'all addresses'() {
+    const addrs = await lookup('localhost', { all: true });
+
+    assert(Array.isArray(addrs), 'result is an array');
+    assert(addrs.length >= 1, 'at least one address');
+    assert(
+      addrs.every(a => a.family == AF_INET || a.family == AF_INET6),
+      'only internet addresses'
+    );
+  },
+
+  async 'concurrent lookups are coalesced'() {
+    /* /etc/hosts matches case-insensitively, the cache does not: a key no other test has looked up */
+    const before = lookupStats();
+    const results = await Promise.all([lookup('LOCALHOST', 4), lookup('LOCALHOST', 4), lookup('LOCALHOST', 4)]);
+    const after = lookupStats();
+
+    for(const addr of results) eq('127.0.0.1', addr.addr);
+
+    eq(1, after.queries - before.queries);
+    eq(2, after.coalesced - before.coalesced);
+    eq(0, after.pending);
+
+    eq('127.0.0.1', (await lookup('LOCALHOST', 4)).addr);
+    eq(after.queries, lookupStats().queries);
+  },
+
+  async 'unknown name rejects'() {
+    let error;
+
+    /* numeric only, so no resolver is asked */
+    try {
+      await lookup('does-not-exist.invalid', { numeric: true });
+    } catch(e) {
+      error = e;
+    }
+
+    assert(error instanceof Error, 'lookup rejected');
+    eq(EAI_NONAME, error.code);
+  }
+});
@@ -1,7 +1,7 @@
 import { abbreviate, ansiStyles, className, randStr } from 'util';
 import extendArray from '../lib/extendArray.js';
 import { Console } from 'console';
-import { MySQL, MySQLResult } from 'mysql';
+import { MySQL, MySQLPool, MySQLResult } from 'mysql';
 import { exit } from 'std';
 extendArray();
 
@@ -153,6 +153,39 @@ async function main(...args) {
 
   for await(let row of await q(`SELECT id,username FROM users ORDER BY created DESC LIMIT 0,10;`)) console.log(`user[${i++}] =`, row);
 
+  console.log('toColumns =', await (await q(`SELECT id,username FROM users LIMIT 0,100;`)).toColumns({ types: { id: 'float64' } }));
+
+  const stmt = await my.prepare(`SELECT id,username,created FROM users WHERE id > ? LIMIT ?;`);
+
+  console.log('stmt', stmt.paramCount, stmt.fieldCount);
+  console.log('stmt.execute =', await stmt.execute(0, 10));
+  stmt.close();
+
+  const pool = new MySQLPool(
+    async () => {
+      const c = new MySQL();
+      await c.connect('192.168.178.23', 'roman', 'r4eHuJ', 'web');
+      return c;
+    },
+    { max: 2, idleTimeout: 5000 }
+  );
+  const conn = await pool.acquire();
+  for await(let row of await conn.query(`SELECT 1;`)) console.log('pool row =', row);
+  pool.release(conn);
+  console.log('pool.stats() =', pool.stats());
+  pool.end();
+
+  function* sessionRows(n) {
+    for(let i = 0; i < n; i++) yield [1, randStr(32), new Date()];
+  }
+
+  my.instrument({ slowQuery: info => console.log('slow query', info), slowThreshold: 50 });
+
+  console.log('bulkInsert =', await my.bulkInsert('sessions', ['user_id', 'cookie', 'created'], sessionRows(10000), { maxBytes: 65536 }));
+
+  console.log('my.stats() =', my.stats(true));
+  my.instrument(false);
+
   /* await q(insert);
   console.log('affected =', (affected = my.affectedRows));*/
 
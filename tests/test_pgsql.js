@@ -1,7 +1,7 @@
 import { abbreviate, randStr, startInteractive } from 'util';
 import extendArray from '../lib/extendArray.js';
 import { Console } from 'console';
-import { PGconn, PGresult } from 'pgsql';
+import { PGconn, PGpool, PGresult } from 'pgsql';
 import { exit } from 'std';
 extendArray();
 
@@ -93,6 +93,64 @@ async function main(...args) {
   console.log('pq.affectedRows =', pq.affectedRows);
   console.log('id =', (id = pq.insertId));
 
+  let stmt = await pq.prepare('SELECT * FROM users WHERE id = $1');
+  console.log('stmt =', stmt);
+  result(await pq.execute(stmt, [id]));
+  result(await pq.execute('SELECT name, email FROM users WHERE name = $1 OR email = $2', [randStr(32), null]));
+  console.log('pq.statementCacheSize =', pq.statementCacheSize);
+
+  if(pq.nonblocking)
+    console.log(
+      'pq.pipeline() =',
+      await pq.pipeline(p => Promise.all([p.query('SELECT 1'), p.execute('SELECT * FROM users WHERE id = $1', [id]), p.query('SELECT $1::int + 1', [41])]))
+    );
+
+  if(pq.nonblocking)
+    await pq.pipeline(async p => {
+      try {
+        await pq.query('SELECT 1');
+      } catch(e) {
+        console.log('pq.query() in pipeline mode =', e.message);
+      }
+    });
+
+  for await(let row of pq.stream('SELECT * FROM users WHERE id > $1', [0], { batch: 100 })) console.log('stream rows =', row.length);
+
+  console.log('toColumns =', (await q('SELECT id, name, email FROM users')).toColumns({ types: { id: 'bigint64' } }));
+
+  let out = await pq.copyTo('COPY users TO STDOUT');
+  let reader = out.getReader(),
+    chunk;
+  while(!(chunk = await reader.read()).done) console.log('copyTo chunk =', chunk.value.length);
+
+  let sink = await pq.copyFrom('COPY sessions (user_id, uuid) FROM STDIN');
+  let writer = sink.getWriter();
+  await writer.write(`${id}\t${[8, 4, 4, 4, 12].map(n => randStr(n, '0123456789abcdef')).join('-')}\n`);
+  console.log('copyFrom =', await writer.close());
+
+  const pool = new PGpool(
+    async () => {
+      const c = new PGconn();
+      await c.connect('localhost', 'roman', 'r4eHuJ', 'roman', 5432, 10);
+      return c;
+    },
+    { min: 1, max: 4, acquireTimeout: 1000 }
+  );
+  const conns = await Promise.all([1, 2, 3, 4, 5].map(() => pool.acquire().then(async c => (await c.query('SELECT pg_sleep(0.1)'), pool.release(c)))));
+  console.log('pool.stats() =', conns.length, pool.stats());
+  pool.end();
+
+  async function* sessionRows(n) {
+    for(let i = 0; i < n; i++) yield { user_id: id, uuid: [8, 4, 4, 4, 12].map(n => randStr(n, '0123456789abcdef')).join('-') };
+  }
+
+  pq.instrument({ slowQuery: info => console.log('slow query', info), slowThreshold: 50 });
+
+  console.log('bulkInsert =', await pq.bulkInsert('sessions', ['user_id', 'uuid'], sessionRows(10000)));
+
+  console.log('pq.stats() =', pq.stats(true));
+  pq.instrument(false);
+
   startInteractive();
 }
 
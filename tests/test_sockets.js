@@ -2,7 +2,10 @@ import * as os from 'os';
 import Console from 'console';
 import inspect from 'inspect';
 import { error, quote, randi, srand, toString } from 'misc';
-import { AF_INET, AsyncSocket, fd_set, IPPROTO_TCP, SO_BROADCAST, SO_DEBUG, SO_DONTROUTE, SO_ERROR, SO_KEEPALIVE, SO_OOBINLINE, SO_RCVBUF, SO_REUSEADDR, SO_REUSEPORT, SO_SNDBUF, SOCK_STREAM, SockAddr, Socket, socklen_t, SOL_SOCKET } from 'sockets';
+import { AF_INET, AF_UNIX, AsyncSocket, fd_set, IPPROTO_TCP, Listener, SO_BROADCAST, SO_DEBUG, SO_DONTROUTE, SO_ERROR, SO_KEEPALIVE, SO_OOBINLINE, SO_RCVBUF, SO_REUSEADDR, SO_REUSEPORT, SO_SNDBUF, SOCK_DGRAM, SOCK_STREAM, SockAddr, Socket, socketpair, socklen_t, SOL_SOCKET } from 'sockets';
+import * as sockets from 'sockets';
+import { Queue } from 'queue';
+import { assert, eq, tests } from './tinytest.js';
 
 function main() {
   globalThis.console = new Console({
@@ -150,3 +153,377 @@ function main() {
 }
 
 main();
+
+const sleep = ms => new Promise(resolve => os.setTimeout(resolve, ms));
+
+function connectTo(addr, count) {
+  const clients = [];
+
+  for(let i = 0; i < count; i++) {
+    const sock = new Socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    eq(0, sock.connect(addr));
+    clients.push(sock);
+  }
+
+  return clients;
+}
+
+function asyncPair(type = SOCK_STREAM) {
+  const fds = [];
+
+  eq(0, socketpair(AF_UNIX, type, 0, fds));
+
+  return [AsyncSocket.adopt(fds[0]), AsyncSocket.adopt(fds[1])];
+}
+
+tests({
+  async 'Listener accepts in batches'() {
+    const listener = new Listener(new SockAddr(AF_INET, '127.0.0.1', 0), { batch: 2 });
+    const batches = [];
+
+    eq(2, listener.batch);
+    assert(listener.address.port > 0, 'bound to a port');
+
+    const clients = connectTo(listener.address, 5);
+
+    listener.start(socks => batches.push(socks));
+    await sleep(50);
+
+    const accepted = batches.flat();
+
+    eq(5, accepted.length);
+    assert(
+      batches.every(b => b.length >= 1 && b.length <= 2),
+      'batches hold at most 2 sockets'
+    );
+    assert(
+      accepted.every(s => s instanceof AsyncSocket && s.fd >= 0),
+      'batches hold AsyncSockets'
+    );
+
+    for(const s of accepted) s.close();
+    for(const s of clients) s.close();
+    listener.close();
+  },
+
+  async 'Listener stop() and close()'() {
+    const listener = new Listener(new SockAddr(AF_INET, '127.0.0.1', 0));
+    let accepted = [];
+
+    listener.start(socks => (accepted = accepted.concat(socks)));
+    listener.stop();
+
+    const clients = connectTo(listener.address, 1);
+
+    await sleep(30);
+    eq(0, accepted.length);
+
+    listener.start(socks => (accepted = accepted.concat(socks)));
+    await sleep(30);
+    eq(1, accepted.length);
+
+    listener.close();
+    eq(-1, listener.fd);
+
+    let error;
+
+    try {
+      listener.start(() => {});
+    } catch(e) {
+      error = e;
+    }
+
+    assert(error instanceof Error, 'start() after close() throws');
+
+    for(const s of accepted.concat(clients)) s.close();
+  },
+
+  async 'close() settles pending write()s'() {
+    const [a, b] = asyncPair();
+    const chunk = new ArrayBuffer(1 << 20);
+
+    /* nobody reads from b, so the first batch stays in flight */
+    const inflight = a.write(chunk);
+    await sleep(10);
+    const queued = a.write(chunk);
+
+    a.close();
+
+    eq(-1, await inflight);
+    eq(-1, await queued);
+
+    b.close();
+  },
+
+  'Queue writeTo() and readFrom()'() {
+    const fds = [];
+    const out = new Queue(),
+      input = new Queue(),
+      buf = new ArrayBuffer(16);
+
+    eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    out.write('hello ');
+    out.write('world');
+    eq(2, out.chunks);
+
+    /* one chunk per writev() call, then the rest */
+    eq(6, out.writeTo(fds[0], { maxChunks: 1 }));
+    eq(5, out.writeTo(fds[0]));
+    assert(out.empty, 'written chunks are freed');
+
+    eq(11, input.readFrom(fds[1], 4096));
+    eq(11, input.size);
+    eq(11, input.read(buf));
+    eq('hello world', toString(buf, 0, 11));
+
+    os.close(fds[0]);
+    eq(0, input.readFrom(fds[1]));
+    os.close(fds[1]);
+  },
+
+  async 'recv() and send() settle on readiness'() {
+    const [a, b] = asyncPair();
+    const buf = new ArrayBuffer(16);
+
+    /* nothing to read yet: the recv() waits for the next edge */
+    const pending = b.recv(buf);
+    await sleep(10);
+
+    eq(3, await a.send('abc'));
+    eq(3, await pending);
+    eq('abc', toString(buf, 0, 3));
+
+    const next = b.recv(buf);
+
+    eq(2, await a.send('de'));
+    eq(2, await next);
+    eq('de', toString(buf, 0, 2));
+
+    const eof = b.recv(buf);
+    let error;
+
+    try {
+      b.recv(buf);
+    } catch(e) {
+      error = e;
+    }
+
+    assert(error instanceof Error, 'a second pending recv() throws');
+
+    a.close();
+    eq(0, await eof);
+    b.close();
+  },
+
+  async 'sendmmsg() and recvmmsg() move several datagrams per call'() {
+    const [a, b] = asyncPair(SOCK_DGRAM);
+
+    if(!a.sendmmsg) {
+      console.log('sendmmsg()/recvmmsg() not available');
+      return;
+    }
+
+    const bufs = [new ArrayBuffer(8), new ArrayBuffer(8), new ArrayBuffer(8), new ArrayBuffer(8)],
+      lens = [];
+
+    eq(3, await a.sendmmsg(['one', 'two', 'three']));
+    eq(3, await b.recvmmsg(bufs, null, 0, lens));
+    eq('3,3,5', lens.join());
+    eq('one', toString(bufs[0], 0, lens[0]));
+    eq('three', toString(bufs[2], 0, lens[2]));
+
+    a.close();
+    b.close();
+  },
+
+  async 'sendfile() resumes partial transfers'() {
+    const [a, b] = asyncPair();
+
+    if(!a.sendfile) {
+      console.log('sendfile() not available');
+      return;
+    }
+
+    const file = `/tmp/test_sockets.${randi()}`,
+      size = 1 << 18,
+      data = new Uint8Array(size).map((_, i) => i & 0xff),
+      fd = os.open(file, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0o600);
+
+    try {
+      eq(size, os.write(fd, data.buffer, 0, size));
+
+      /* larger than the socket buffer, so it only completes while b drains */
+      const sent = a.sendfile(fd, 0),
+        buf = new ArrayBuffer(size);
+      let received = 0,
+        n;
+
+      while(received < size && (n = await b.recv(buf, received)) > 0) received += n;
+
+      eq(size, received);
+      eq(size, await sent);
+
+      const bytes = new Uint8Array(buf);
+      assert(
+        bytes.every((c, i) => c == (i & 0xff)),
+        'received the file contents'
+      );
+    } finally {
+      os.close(fd);
+      os.remove(file);
+      a.close();
+      b.close();
+    }
+  },
+
+  async 'splice() resumes partial transfers'() {
+    const [a, b] = asyncPair();
+
+    if(!sockets.splice) {
+      console.log('splice() not available');
+      return;
+    }
+
+    const [r, w] = os.pipe(),
+      buf = new ArrayBuffer(8);
+    let received = 0,
+      n;
+
+    try {
+      os.write(w, new Uint8Array([1, 2, 3, 4]).buffer, 0, 4);
+
+      /* only half of it is in the pipe yet, the rest follows once it is readable again */
+      const moved = sockets.splice(r, a, 8);
+
+      os.write(w, new Uint8Array([5, 6, 7, 8]).buffer, 0, 4);
+
+      while(received < 8 && (n = await b.recv(buf, received)) > 0) received += n;
+
+      eq(8, await moved);
+      eq('1,2,3,4,5,6,7,8', [...new Uint8Array(buf)].join());
+    } finally {
+      os.close(r);
+      os.close(w);
+      a.close();
+      b.close();
+    }
+  },
+
+  async 'write() batches while corked'() {
+    const [a, b] = asyncPair();
+    const buf = new ArrayBuffer(16);
+
+    a.cork();
+
+    const first = a.write('foo'),
+      second = a.write('bar');
+
+    await sleep(10);
+    eq(6, a.bufferedAmount);
+
+    a.uncork();
+
+    /* both writes went out as one batch */
+    eq(6, await first);
+    eq(6, await second);
+    eq(0, a.bufferedAmount);
+
+    eq(6, await b.recv(buf));
+    eq('foobar', toString(buf, 0, 6));
+
+    /* writes in the same tick coalesce without cork() */
+    const third = a.write('baz');
+    a.write('qux', 1, 2);
+
+    eq(5, await third);
+    eq(5, await b.recv(buf));
+    eq('bazux', toString(buf, 0, 5));
+
+    a.close();
+    b.close();
+  },
+
+  async 'sendFds() and recvFds() pass descriptors'() {
+    const [a, b] = asyncPair();
+
+    if(!a.sendFds) {
+      console.log('sendFds()/recvFds() not available');
+      return;
+    }
+
+    const pair = [],
+      buf = new ArrayBuffer(16);
+
+    eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, pair));
+
+    eq(2, await a.sendFds([pair[0]], 'fd'));
+
+    const msg = await b.recvFds();
+
+    eq('fd', toString(msg.data));
+    eq(1, msg.fds.length);
+    assert(msg.fds[0] != pair[0], 'a new descriptor was allocated');
+
+    /* the received descriptor refers to the same socket */
+    eq(3, os.write(msg.fds[0], new Uint8Array([0x61, 0x62, 0x63]).buffer, 0, 3));
+    eq(3, os.read(pair[1], buf, 0, 16));
+    eq('abc', toString(buf, 0, 3));
+
+    /* without payload a single NUL byte carries the descriptors */
+    eq(1, await a.sendFds([]));
+    eq(0, (await b.recvFds()).fds.length);
+
+    for(const fd of [...pair, msg.fds[0]]) os.close(fd);
+    a.close();
+    b.close();
+  },
+
+  async 'sendZeroCopy() resolves once the buffer is released'() {
+    const [a, b] = asyncPair();
+
+    if(!a.sendZeroCopy) {
+      console.log('sendZeroCopy() not available');
+      return;
+    }
+
+    const data = new Uint8Array(64).fill(0x7a),
+      buf = new ArrayBuffer(64);
+
+    /* AF_UNIX has no SO_ZEROCOPY, the data is copied instead */
+    eq(64, await a.sendZeroCopy(data.buffer));
+    eq(16, await a.sendZeroCopy(data, 8, 16));
+
+    let received = 0,
+      n;
+
+    while(received < 80 && (n = await b.recv(buf)) > 0) received += n;
+
+    eq(80, received);
+
+    let error;
+
+    try {
+      a.sendZeroCopy('text');
+    } catch(e) {
+      error = e;
+    }
+
+    assert(error instanceof TypeError, 'sendZeroCopy() wants a buffer');
+
+    a.close();
+    b.close();
+  },
+
+  async 'close() settles pending recv()'() {
+    const [a, b] = asyncPair();
+    const pending = b.recv(new ArrayBuffer(16));
+
+    await sleep(10);
+    b.close();
+
+    eq(-1, await pending);
+    a.close();
+  }
+});
@@ -0,0 +1,118 @@
+import * as os from 'os';
+import { AF_INET, AF_UNIX, AsyncSocket, IPPROTO_TCP, Listener, SOCK_STREAM, SockAddr, Socket, socketpair } from 'sockets';
+import { assert, eq, tests } from './tinytest.js';
+
+const HIGH_FD = 0x10001;
+const NEEDED = HIGH_FD + 64;
+
+const sleep = ms => new Promise(resolve => os.setTimeout(resolve, ms));
+
+/* runs a command, returns what it wrote to stdout */
+function run(argv) {
+  const [r, w] = os.pipe(),
+    buf = new ArrayBuffer(4096);
+  const pid = os.exec(argv, { block: false, stdout: w });
+  let out = '',
+    n;
+
+  os.close(w);
+
+  while((n = os.read(r, buf, 0, buf.byteLength)) > 0) out += String.fromCharCode(...new Uint8Array(buf, 0, n));
+
+  os.close(r);
+  os.waitpid(pid, 0);
+  return out.trim();
+}
+
+function limit(str) {
+  return str == 'unlimited' ? Infinity : +str;
+}
+
+/* takes up the descriptors below 'fd' with duplicates of /dev/null, so new ones are allocated above */
+function fillTo(fd) {
+  const fill = [os.open('/dev/null', os.O_RDONLY)];
+
+  while(fill[fill.length - 1] < fd - 1) fill.push(os.dup(fill[0]));
+
+  return fill;
+}
+
+const soft = limit(run(['sh', '-c', 'ulimit -n'])),
+  hard = limit(run(['sh', '-c', 'ulimit -Hn']));
+
+if(soft < NEEDED && hard >= NEEDED) {
+  /* the soft limit is raised for a new process running this file */
+  tests({
+    'fds above 0xffff (raised RLIMIT_NOFILE)'() {
+      const [exe] = os.readlink('/proc/self/exe');
+      const out = run(['sh', '-c', `ulimit -n ${NEEDED} && exec "$0" "$1" 2>&1`, exe, scriptArgs[0]]);
+
+      console.log(out);
+      assert(/\d+ tests succeeded/.test(out), 'all tests succeeded with the raised limit');
+    }
+  });
+} else if(soft < NEEDED) {
+  console.log(`hard RLIMIT_NOFILE is ${hard}, fds above 0xffff can not be tested`);
+} else {
+  tests({
+    'Socket on fds above 0xffff'() {
+      const fill = fillTo(HIGH_FD),
+        pair = [];
+
+      try {
+        eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, pair));
+
+        const a = Socket.adopt(pair[0]),
+          b = Socket.adopt(pair[1]),
+          buf = new ArrayBuffer(16);
+
+        assert(a.fd >= HIGH_FD && b.fd >= HIGH_FD, `sockets on #${a.fd} and #${b.fd}`);
+        eq(pair[0], a.fd);
+        assert(a.open, `socket #${a.fd} open`);
+
+        eq(3, a.send('abc'));
+        eq(3, b.recv(buf));
+        eq(3, b.ret);
+        eq('recv', b.syscall);
+      } finally {
+        for(const fd of pair.concat(fill)) os.close(fd);
+      }
+    },
+
+    async 'AsyncSocket and Listener on fds above 0xffff'() {
+      const fill = fillTo(HIGH_FD);
+      const listener = new Listener(new SockAddr(AF_INET, '127.0.0.1', 0));
+      const client = new AsyncSocket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+      let accepted = [];
+
+      try {
+        assert(listener.fd >= HIGH_FD, `Listener on #${listener.fd}`);
+        assert(client.fd >= HIGH_FD, `AsyncSocket on #${client.fd}`);
+
+        listener.start(socks => (accepted = accepted.concat(socks)));
+
+        eq(0, await client.connect(listener.address));
+
+        for(let i = 0; i < 10 && !accepted.length; i++) await sleep(10);
+
+        eq(1, accepted.length);
+
+        const [server] = accepted,
+          buf = new ArrayBuffer(16);
+
+        assert(server instanceof AsyncSocket && server.fd >= HIGH_FD, `accepted AsyncSocket on #${server.fd}`);
+        assert(server.open, `socket #${server.fd} open`);
+
+        eq(3, await client.send('abc'));
+        eq(3, await server.recv(buf));
+        eq(3, await server.send(buf, 0, 3));
+        eq(3, await client.recv(buf));
+      } finally {
+        for(const s of accepted) s.close();
+        client.close();
+        listener.close();
+        for(const fd of fill) os.close(fd);
+      }
+    }
+  });
+}
@@ -0,0 +1,56 @@
+import { SyscallError, EAGAIN, EINVAL } from 'syscallerror';
+import { AF_UNIX, SOCK_STREAM, Socket, socketpair, throwErrors } from 'sockets';
+import { assert, eq, tests } from './tinytest.js';
+
+tests({
+  'constructed error'() {
+    const err = new SyscallError('read', EAGAIN);
+
+    eq('read', err.syscall);
+    eq(EAGAIN, err.errno);
+    eq('EAGAIN', err.name);
+    assert(err.message.startsWith('read() = -1'), err.message);
+    eq('string', typeof err.stack);
+  },
+
+  'throwErrors(false) returns -errno'() {
+    const fds = [];
+
+    eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    const sock = Socket.adopt(fds[0]);
+
+    eq(true, throwErrors(false));
+
+    try {
+      eq(-EINVAL, sock.shutdown(-1));
+      eq(EINVAL, sock.errno);
+    } finally {
+      eq(false, throwErrors(true));
+      sock.close();
+      Socket.adopt(fds[1]).close();
+    }
+  },
+
+  'errors thrown by sockets are SyscallErrors'() {
+    const fds = [];
+
+    eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    const sock = Socket.adopt(fds[0]);
+    let caught;
+
+    try {
+      sock.shutdown(-1);
+    } catch(e) {
+      caught = e;
+    } finally {
+      sock.close();
+      Socket.adopt(fds[1]).close();
+    }
+
+    assert(caught instanceof SyscallError, 'SyscallError thrown');
+    eq('shutdown', caught.syscall);
+    eq('string', typeof caught.stack);
+  }
+});
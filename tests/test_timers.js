@@ -0,0 +1,109 @@
+import { AF_UNIX, AsyncSocket, ETIMEDOUT, SOCK_STREAM, socketpair } from 'sockets';
+import { setTimeout, clearTimeout, setInterval, clearInterval } from '../lib/timers.js';
+import { assert, eq, tests } from './tinytest.js';
+
+const sleep = ms => new Promise(resolve => setTimeout(resolve, ms));
+
+tests({
+  async 'timers fire in order'() {
+    const fired = [];
+
+    setTimeout(() => fired.push(30), 30);
+    setTimeout(() => fired.push(5), 5);
+    setTimeout(() => fired.push(70), 70);
+    clearTimeout(setTimeout(() => fired.push('cleared'), 10));
+
+    await sleep(120);
+    eq('5,30,70', fired.join(','));
+  },
+
+  async 'intervals repeat until cleared'() {
+    let n = 0;
+    const timer = setInterval(() => ++n, 10);
+
+    await sleep(75);
+    clearInterval(timer);
+
+    const count = n;
+    assert(count >= 3, `interval fired ${count} times`);
+
+    await sleep(40);
+    eq(count, n);
+  },
+
+  async 'negative delays fire right away'() {
+    let fired = 0;
+
+    setTimeout(() => ++fired, -1);
+    setTimeout(() => ++fired, -1e9);
+    await sleep(20);
+    eq(2, fired);
+  },
+
+  async 'short timers fire while long ones are pending'() {
+    const fired = [];
+    const long = setTimeout(() => fired.push('long'), 3600000);
+
+    setTimeout(() => fired.push('short'), 100);
+    await sleep(150);
+
+    eq('short', fired.join(','));
+    clearTimeout(long);
+  },
+
+  'clearTimeout ignores non-timers'() {
+    eq(undefined, clearTimeout({}));
+    eq(undefined, clearTimeout(42));
+    eq(undefined, clearInterval('timer'));
+  },
+
+  async 'many timers'() {
+    const timers = [];
+    let n = 0;
+
+    for(let i = 0; i < 100000; i++) timers.push(setTimeout(() => ++n, 60000));
+    for(let i = 0; i < 100000; i += 2) clearTimeout(timers[i]);
+    for(let i = 0; i < 100000; i++) clearTimeout(timers[i]);
+
+    setTimeout(() => ++n, 1);
+    await sleep(20);
+    eq(1, n);
+  },
+
+  async 'AsyncSocket read deadline'() {
+    const fds = [];
+
+    eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    const a = AsyncSocket.adopt(fds[0]),
+      b = AsyncSocket.adopt(fds[1]);
+
+    a.readTimeout = 20;
+    eq(20, a.readTimeout);
+
+    const start = Date.now();
+    eq(-1, await a.recv(new ArrayBuffer(16)));
+    eq(ETIMEDOUT, a.errno);
+    assert(Date.now() - start >= 15, 'deadline too early');
+
+    a.close();
+    b.close();
+  },
+
+  async 'AsyncSocket idle timeout'() {
+    const fds = [];
+
+    eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    const a = AsyncSocket.adopt(fds[0]);
+    let idle = 0;
+
+    a.ontimeout = () => ++idle;
+    a.timeout = 10;
+
+    await sleep(50);
+    eq(1, idle);
+
+    a.close();
+  }
+});